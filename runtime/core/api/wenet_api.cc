@@ -30,6 +30,9 @@
 #include "utils/json.h"
 #include "utils/string.h"
 
+// The compiled graphs of the contexts kept by a recognizer
+const size_t kContextGraphCacheBytes = 16 << 20;
+
 class Recognizer {
  public:
   explicit Recognizer(const std::string& model_dir) {
@@ -65,8 +68,7 @@ class Recognizer {
 
     std::string fst_path = wenet::JoinPath(model_dir, "TLG.fst");
     if (wenet::FileExists(fst_path)) {  // With LM
-      resource_->fst = std::shared_ptr<fst::VectorFst<fst::StdArc>>(
-          fst::VectorFst<fst::StdArc>::Read(fst_path));
+      resource_->fst = wenet::ReadFst(fst_path);
 
       std::string symbol_path = wenet::JoinPath(model_dir, "words.txt");
       CHECK(wenet::FileExists(symbol_path));
@@ -76,8 +78,12 @@ class Recognizer {
       resource_->symbol_table = resource_->unit_table;
     }
 
-    // Context config init
-    context_config_ = std::make_shared<wenet::ContextConfig>();
+    // The contexts are compiled by the unit trie and cached, like the ones
+    // of the server sessions, see SessionResource
+    resource_->unit_trie =
+        std::make_shared<wenet::UnitTrie>(*resource_->unit_table);
+    resource_->context_graph_cache =
+        std::make_shared<wenet::ContextGraphCache>(kContextGraphCacheBytes);
     decode_options_ = std::make_shared<wenet::DecodeOptions>();
 
     // PostProcessor
@@ -114,29 +120,40 @@ class Recognizer {
     }
   }
 
-  void InitDecoder() {
+  // Return false and set `error` if the contexts can't be compiled
+  bool InitDecoder(std::string* error) {
     CHECK(decoder_ == nullptr);
-    // Optional init context graph
+    // Optional, the resource biased to the contexts
+    std::shared_ptr<wenet::DecodeResource> resource = resource_;
     if (context_.size() > 0) {
-      context_config_->context_score = context_score_;
-      auto context_graph =
-          std::make_shared<wenet::ContextGraph>(*context_config_);
-      context_graph->BuildContextGraph(context_, resource_->symbol_table);
-      resource_->context_graph = context_graph;
+      std::string context_key;
+      resource = wenet::SessionResource(resource_, context_, context_score_,
+                                        &context_key, error);
+      if (resource == nullptr) {
+        LOG(ERROR) << "Failed to build the context graph: " << *error;
+        return false;
+      }
     }
 
     // Init decode options
     decode_options_->chunk_size = chunk_size_;
     // Init decoder
-    decoder_ = std::make_shared<wenet::AsrDecoder>(feature_pipeline_, resource_,
+    decoder_ = std::make_shared<wenet::AsrDecoder>(feature_pipeline_, resource,
                                                    *decode_options_);
+    return true;
   }
 
   std::string Decode(const char* data, int len, int last) {
     using wenet::DecodeState;
     // Init decoder when it is called first time
     if (decoder_ == nullptr) {
-      InitDecoder();
+      std::string error;
+      if (!InitDecoder(&error)) {
+        json::JSON obj;
+        obj["type"] = "error";
+        obj["message"] = error;
+        return obj.dump();
+      }
     }
     // Convert to 16 bits PCM data to float
     CHECK_EQ(len % 2, 0);
@@ -207,13 +224,13 @@ class Recognizer {
   std::shared_ptr<wenet::DecodeResource> resource_ = nullptr;
   std::shared_ptr<wenet::DecodeOptions> decode_options_ = nullptr;
   std::shared_ptr<wenet::AsrDecoder> decoder_ = nullptr;
-  std::shared_ptr<wenet::ContextConfig> context_config_ = nullptr;
   std::shared_ptr<wenet::PostProcessOptions> post_process_opts_ = nullptr;
 
   int nbest_ = 1;
   bool enable_timestamp_ = false;
   std::vector<std::string> context_;
-  float context_score_;
+  // <= 0 means the default score of ContextConfig
+  float context_score_ = 0;
   std::string language_ = "chs";
   bool continuous_decoding_ = false;
   int chunk_size_ = 16;
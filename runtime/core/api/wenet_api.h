@@ -57,7 +57,8 @@ void wenet_reset(void* decoder);
       "type" : "final_result"
     }
 
-    "type": final_result/partial_result
+    "type": final_result/partial_result/error
+    "message": the reason of the error, e.g. the contexts can't be compiled
     "nbest": nbest is enabled when n > 1 in final_result
         "sentence": the ASR result
         "word_pieces": optional, output timestamp when enabled
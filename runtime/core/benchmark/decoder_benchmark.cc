@@ -0,0 +1,265 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cmath>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "fst/symbol-table.h"
+#include "fst/vector-fst.h"
+
+#include "decoder/context_graph.h"
+#include "decoder/ctc_prefix_beam_search.h"
+#include "decoder/ctc_wfst_beam_search.h"
+#include "util/object-pool.h"
+
+// All the inputs are synthetic, so no model or graph file is needed, and
+// they are generated by fixed seeds to be reproducible.
+namespace {
+
+const int kChunkSize = 16;
+const int kNumChunks = 20;
+// A CTC frame is 4 subsampled frames of 10ms
+const float kCtcFrameSeconds = 0.04;
+
+// CTC log posteriors of `num_chunks` chunks. Blank dominates 70% of the
+// frames and a random unit dominates the others, like the outputs of a
+// trained model.
+std::vector<std::vector<std::vector<float>>> RandomCtcLogProbs(
+    int vocab_size, int num_chunks) {
+  std::default_random_engine generator(0);
+  std::normal_distribution<float> logit(0, 1);
+  std::uniform_real_distribution<float> uniform(0, 1);
+  std::uniform_int_distribution<int> unit(1, vocab_size - 1);
+  std::vector<std::vector<std::vector<float>>> chunks(num_chunks);
+  for (auto& chunk : chunks) {
+    chunk.resize(kChunkSize);
+    for (auto& frame : chunk) {
+      frame.resize(vocab_size);
+      for (auto& x : frame) x = logit(generator);
+      int peak = uniform(generator) < 0.7 ? 0 : unit(generator);
+      frame[peak] += 10;
+      float sum = 0;
+      for (float x : frame) sum += std::exp(x);
+      float log_sum = std::log(sum);
+      for (auto& x : frame) x -= log_sum;
+    }
+  }
+  return chunks;
+}
+
+std::string EncodeUtf8(int code_point) {
+  std::string utf8(3, 0);
+  utf8[0] = static_cast<char>(0xE0 | (code_point >> 12));
+  utf8[1] = static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+  utf8[2] = static_cast<char>(0x80 | (code_point & 0x3F));
+  return utf8;
+}
+
+// Unit i > 0 is the i-th CJK character, so any unit sequence is a phrase
+std::shared_ptr<fst::SymbolTable> SyntheticUnitTable(int vocab_size) {
+  auto unit_table = std::make_shared<fst::SymbolTable>();
+  unit_table->AddSymbol("<blank>", 0);
+  for (int i = 1; i < vocab_size; ++i) {
+    unit_table->AddSymbol(EncodeUtf8(0x4E00 + i), i);
+  }
+  return unit_table;
+}
+
+// `num_phrases` random phrases of 2 to 6 units
+std::vector<std::string> RandomPhrases(int vocab_size, int num_phrases) {
+  std::default_random_engine generator(0);
+  std::uniform_int_distribution<int> length(2, 6);
+  std::uniform_int_distribution<int> unit(1, vocab_size - 1);
+  std::vector<std::string> phrases(num_phrases);
+  for (auto& phrase : phrases) {
+    int n = length(generator);
+    for (int i = 0; i < n; ++i) phrase += EncodeUtf8(0x4E00 + unit(generator));
+  }
+  return phrases;
+}
+
+std::shared_ptr<wenet::ContextGraph> SyntheticContextGraph(int vocab_size,
+                                                           int num_phrases) {
+  std::vector<std::string> phrases = RandomPhrases(vocab_size, num_phrases);
+  wenet::ContextConfig config;
+  config.max_contexts = num_phrases;
+  auto context_graph = std::make_shared<wenet::ContextGraph>(config);
+  context_graph->BuildContextGraph(phrases, SyntheticUnitTable(vocab_size));
+  return context_graph;
+}
+
+// Streaming search of one utterance of kNumChunks chunks, the arguments are
+// the vocabulary size, the beam size and the number of context phrases
+void BM_CtcPrefixBeamSearch(benchmark::State& state) {
+  const int vocab_size = state.range(0);
+  wenet::CtcPrefixBeamSearchOptions opts;
+  opts.first_beam_size = state.range(1);
+  opts.second_beam_size = state.range(1);
+  std::shared_ptr<wenet::ContextGraph> context_graph = nullptr;
+  if (state.range(2) > 0) {
+    context_graph = SyntheticContextGraph(vocab_size, state.range(2));
+  }
+  auto chunks = RandomCtcLogProbs(vocab_size, kNumChunks);
+  wenet::CtcPrefixBeamSearch searcher(opts, context_graph);
+  for (auto _ : state) {
+    searcher.Reset();
+    for (const auto& chunk : chunks) searcher.Search(chunk);
+    searcher.FinalizeSearch();
+    benchmark::DoNotOptimize(searcher.Outputs().data());
+  }
+  state.counters["frames/s"] = benchmark::Counter(
+      state.iterations() * kNumChunks * kChunkSize,
+      benchmark::Counter::kIsRate);
+}
+
+// Walk the context graph with random units, about half of them continue a
+// phrase. The argument is the number of phrases.
+void BM_ContextGraphGetNextState(benchmark::State& state) {
+  const int vocab_size = 5000;
+  auto context_graph = SyntheticContextGraph(vocab_size, state.range(0));
+  std::default_random_engine generator(1);
+  std::uniform_int_distribution<int> unit(1, vocab_size - 1);
+  std::vector<int> units(4096);
+  for (auto& x : units) x = unit(generator);
+  int cur_state = 0;
+  size_t i = 0;
+  for (auto _ : state) {
+    float score = 0;
+    cur_state = context_graph->GetNextState(cur_state, units[i], &score);
+    i = (i + 1) % units.size();
+    benchmark::DoNotOptimize(score);
+  }
+}
+
+// Compile the hotwords of a request with the unit trie of the resource,
+// the argument is the number of phrases
+void BM_BuildContextGraph(benchmark::State& state) {
+  const int vocab_size = 5000;
+  std::vector<std::string> phrases = RandomPhrases(vocab_size, state.range(0));
+  wenet::UnitTrie unit_trie(*SyntheticUnitTable(vocab_size));
+  wenet::ContextConfig config;
+  config.max_contexts = state.range(0);
+  for (auto _ : state) {
+    wenet::ContextGraph context_graph(config);
+    context_graph.BuildContextGraph(phrases, unit_trie);
+    benchmark::DoNotOptimize(context_graph.NumStates());
+  }
+  state.SetItemsProcessed(state.iterations() * phrases.size());
+}
+
+// Token loop TLG, every unit is a word, so every unit sequence is accepted
+std::unique_ptr<fst::StdVectorFst> SyntheticTlg(int vocab_size) {
+  std::unique_ptr<fst::StdVectorFst> tlg(new fst::StdVectorFst);
+  int state = tlg->AddState();
+  tlg->SetStart(state);
+  tlg->SetFinal(state, fst::StdArc::Weight::One());
+  // The input label is the unit id + 1, 0 is epsilon
+  tlg->AddArc(state, fst::StdArc(1, 0, 0, state));
+  for (int i = 1; i < vocab_size; ++i) {
+    tlg->AddArc(state, fst::StdArc(i + 1, i, 1.0, state));
+  }
+  return tlg;
+}
+
+// Streaming WFST search of one utterance, the argument is the vocabulary
+// size
+void BM_CtcWfstBeamSearch(benchmark::State& state) {
+  const int vocab_size = state.range(0);
+  auto tlg = SyntheticTlg(vocab_size);
+  wenet::CtcWfstBeamSearchOptions opts;
+  opts.max_active = 7000;
+  opts.beam = 16;
+  opts.lattice_beam = 8;
+  opts.nbest = 10;
+  auto chunks = RandomCtcLogProbs(vocab_size, kNumChunks);
+  wenet::CtcWfstBeamSearch searcher(*tlg, opts, nullptr);
+  for (auto _ : state) {
+    searcher.Reset();
+    for (const auto& chunk : chunks) searcher.Search(chunk);
+    searcher.FinalizeSearch();
+    benchmark::DoNotOptimize(searcher.Outputs().data());
+  }
+  state.counters["frames/s"] = benchmark::Counter(
+      state.iterations() * kNumChunks * kChunkSize,
+      benchmark::Counter::kIsRate);
+  // Seconds of search per second of audio
+  state.counters["rtf"] = benchmark::Counter(
+      state.iterations() * kNumChunks * kChunkSize * kCtcFrameSeconds,
+      benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+struct Link {
+  int next_tok;
+  float acoustic_cost;
+  float graph_cost;
+  Link* next;
+};
+
+// The allocation pattern of the lattice decoder: every frame creates
+// max_active links and prunes half of them, and all of them are gone at
+// the end of the utterance. The argument is 1 for kaldi::ObjectPool, which
+// the decoder uses, and 0 for new/delete.
+void BM_LinkAllocation(benchmark::State& state) {
+  const int kLinksPerFrame = 7000;
+  const int kNumFrames = 100;
+  const bool use_pool = state.range(0) != 0;
+  kaldi::ObjectPool<Link> pool;
+  std::vector<Link*> live;
+  for (auto _ : state) {
+    for (int t = 0; t < kNumFrames; ++t) {
+      size_t first = live.size();
+      for (int i = 0; i < kLinksPerFrame; ++i) {
+        live.push_back(use_pool ? pool.New() : new Link());
+        live.back()->next_tok = i;
+      }
+      // Prune every other link of the frame
+      size_t kept = first;
+      for (size_t i = first; i < live.size(); ++i) {
+        if (i % 2 == 0) {
+          live[kept++] = live[i];
+        } else if (use_pool) {
+          pool.Delete(live[i]);
+        } else {
+          delete live[i];
+        }
+      }
+      live.resize(kept);
+    }
+    if (use_pool) {
+      pool.Reset();
+    } else {
+      for (Link* link : live) delete link;
+    }
+    live.clear();
+  }
+  state.SetItemsProcessed(state.iterations() * kNumFrames * kLinksPerFrame);
+}
+
+}  // namespace
+
+BENCHMARK(BM_CtcPrefixBeamSearch)
+    ->ArgNames({"vocab", "beam", "phrases"})
+    ->Args({5000, 10, 0})
+    ->Args({5000, 30, 0})
+    ->Args({10000, 10, 0})
+    ->Args({5000, 10, 1000})
+    ->Args({5000, 30, 1000});
+BENCHMARK(BM_ContextGraphGetNextState)->Arg(10000)->Arg(100000);
+BENCHMARK(BM_BuildContextGraph)->Arg(1000)->Arg(10000);
+BENCHMARK(BM_CtcWfstBeamSearch)->Arg(5000);
+BENCHMARK(BM_LinkAllocation)->ArgName("pool")->Arg(0)->Arg(1);
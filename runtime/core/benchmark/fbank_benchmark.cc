@@ -0,0 +1,147 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "frontend/fbank.h"
+#include "frontend/feature_pipeline.h"
+#include "frontend/fft.h"
+
+namespace {
+
+// Fbank of one chunk, the argument is the chunk length in ms
+void BM_Fbank(benchmark::State& state, wenet::FbankEngine engine) {
+  wenet::FeaturePipelineConfig config(80, 16000);
+  wenet::Fbank fbank(config.num_bins, config.sample_rate, config.frame_length,
+                     config.frame_shift, config.low_freq, config.pre_emphasis,
+                     config.scale_input_to_unit, config.log_floor,
+                     config.log_base, config.window_type, config.mel_type,
+                     config.norm_type);
+  fbank.set_engine(engine);
+  int num_samples = state.range(0) * config.sample_rate / 1000 +
+                    config.frame_length - config.frame_shift;
+  std::default_random_engine generator(0);
+  std::uniform_real_distribution<float> distribution(-10000, 10000);
+  std::vector<float> wave(num_samples);
+  for (auto& x : wave) x = distribution(generator);
+
+  std::vector<std::vector<float>> feats;
+  int64_t num_frames = 0;
+  for (auto _ : state) {
+    num_frames += fbank.Compute(wave, &feats);
+    benchmark::DoNotOptimize(feats.data());
+  }
+  state.counters["frames/s"] =
+      benchmark::Counter(num_frames, benchmark::Counter::kIsRate);
+}
+
+// In place complex FFT, the argument is the number of points
+void BM_Fft(benchmark::State& state) {
+  const int n = state.range(0);
+  std::vector<int> bitrev(n);
+  std::vector<float> sintbl(n + n / 4);
+  wenet::make_sintbl(n, sintbl.data());
+  wenet::make_bitrev(n, bitrev.data());
+  std::default_random_engine generator(0);
+  std::uniform_real_distribution<float> distribution(-1, 1);
+  std::vector<float> input(n);
+  for (auto& x : input) x = distribution(generator);
+
+  std::vector<float> real(n), img(n);
+  for (auto _ : state) {
+    real = input;
+    std::fill(img.begin(), img.end(), 0);
+    wenet::fft(bitrev.data(), sintbl.data(), real.data(), img.data(), n);
+    benchmark::DoNotOptimize(real.data());
+    benchmark::DoNotOptimize(img.data());
+  }
+}
+
+void BM_FbankReference(benchmark::State& state) {
+  BM_Fbank(state, wenet::FbankEngine::kReference);
+}
+
+void BM_FbankOptimized(benchmark::State& state) {
+  BM_Fbank(state, wenet::FbankEngine::kOptimized);
+}
+
+// Streaming feature extraction of the whole audio, the argument is the audio
+// length in ms, and the features are read by 67 frames, the first chunk of
+// chunk_size 16 with subsampling rate 4 and right context 6
+void BM_FeaturePipeline(benchmark::State& state, wenet::FbankEngine engine) {
+  wenet::FeaturePipelineConfig config(80, 16000);
+  config.engine = engine;
+  const int num_samples = state.range(0) * config.sample_rate / 1000;
+  std::vector<int16_t> pcm(num_samples);
+  std::default_random_engine generator(0);
+  std::uniform_int_distribution<int> distribution(-10000, 10000);
+  for (auto& x : pcm) x = distribution(generator);
+
+  std::vector<float> feats;
+  for (auto _ : state) {
+    wenet::FeaturePipeline pipeline(config);
+    pipeline.AcceptWaveform(pcm.data(), num_samples);
+    pipeline.set_input_finished();
+    while (pipeline.Read(67, &feats)) {
+    }
+    benchmark::DoNotOptimize(feats.data());
+  }
+}
+
+void BM_FeaturePipelineReference(benchmark::State& state) {
+  BM_FeaturePipeline(state, wenet::FbankEngine::kReference);
+}
+
+void BM_FeaturePipelineOptimized(benchmark::State& state) {
+  BM_FeaturePipeline(state, wenet::FbankEngine::kOptimized);
+}
+
+// Handoff of the frames between a producer thread and a consumer thread,
+// the argument is the frames of each packet, and the consumer reads the
+// chunks of 67 frames like the decoder
+void BM_FeatureQueueHandoff(benchmark::State& state) {
+  const int dim = 80, num_frames = 100000, packet_frames = state.range(0);
+  std::vector<float> packet(packet_frames * dim, 1.0);
+  std::vector<float> chunk(67 * dim);
+  for (auto _ : state) {
+    wenet::FeatureQueue queue(dim);
+    std::thread producer([&]() {
+      for (int i = 0; i < num_frames; i += packet_frames) {
+        queue.Push(packet.data(), packet_frames);
+      }
+    });
+    int num_read = 0;
+    while (num_read < num_frames) {
+      num_read += queue.Pop(67, chunk.data());
+    }
+    producer.join();
+    benchmark::DoNotOptimize(chunk.data());
+  }
+  state.counters["frames/s"] = benchmark::Counter(
+      state.iterations() * num_frames, benchmark::Counter::kIsRate);
+}
+
+}  // namespace
+
+BENCHMARK(BM_Fft)->Arg(256)->Arg(512);
+BENCHMARK(BM_FbankReference)->Arg(100)->Arg(160)->Arg(640);
+BENCHMARK(BM_FbankOptimized)->Arg(100)->Arg(160)->Arg(640);
+BENCHMARK(BM_FeaturePipelineReference)->Arg(10000);
+BENCHMARK(BM_FeaturePipelineOptimized)->Arg(10000);
+BENCHMARK(BM_FeatureQueueHandoff)->Arg(1)->Arg(10)->UseRealTime();
@@ -0,0 +1,44 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string>
+
+#include "benchmark/benchmark.h"
+
+#include "post_processor/post_processor.h"
+
+namespace {
+
+// A mixed Mandarin and English sentence in the units of the model
+const char kSentence[] =
+    "▁we▁are▁going▁to▁test▁the▁post▁processor"
+    "▁今天天气怎么样▁what▁a▁nice▁day▁我们去▁the▁park▁吧"
+    "▁it▁is▁about▁twenty▁minutes▁away";
+
+// The argument is 1 for the final result, 0 for the partial one
+void BM_PostProcessorProcess(benchmark::State& state) {
+  wenet::PostProcessOptions opts;
+  wenet::PostProcessor post_processor(opts);
+  const std::string sentence(kSentence);
+  bool finish = state.range(0) != 0;
+  for (auto _ : state) {
+    std::string result = post_processor.Process(sentence, finish);
+    benchmark::DoNotOptimize(result.data());
+  }
+  state.SetBytesProcessed(state.iterations() * sentence.size());
+}
+
+}  // namespace
+
+BENCHMARK(BM_PostProcessorProcess)->Arg(0)->Arg(1);
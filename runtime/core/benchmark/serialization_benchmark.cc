@@ -0,0 +1,58 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "decoder/asr_decoder.h"
+#include "websocket/websocket_server.h"
+
+namespace {
+
+// N-best results of a 10s utterance, 50 words each
+std::vector<wenet::DecodeResult> SyntheticResults(int nbest) {
+  std::vector<wenet::DecodeResult> results(nbest);
+  for (int i = 0; i < nbest; ++i) {
+    for (int j = 0; j < 50; ++j) {
+      std::string word = "word" + std::to_string((i + j) % 17);
+      results[i].sentence += word + " ";
+      results[i].word_pieces.emplace_back(word, j * 200, j * 200 + 180);
+    }
+    results[i].stable_sentence = results[i].sentence;
+    results[i].score = -i;
+  }
+  return results;
+}
+
+// The JSON of the websocket protocol, the arguments are the n-best and 1
+// for the final result with the word pieces, 0 for the partial one
+void BM_SerializeDecodeResult(benchmark::State& state) {
+  const int nbest = state.range(0);
+  const bool finish = state.range(1) != 0;
+  std::vector<wenet::DecodeResult> results = SyntheticResults(nbest);
+  for (auto _ : state) {
+    std::string json = wenet::SerializeDecodeResult(results, nbest, finish);
+    benchmark::DoNotOptimize(json.data());
+  }
+}
+
+}  // namespace
+
+BENCHMARK(BM_SerializeDecodeResult)
+    ->ArgNames({"nbest", "final"})
+    ->Args({1, 0})
+    ->Args({1, 1})
+    ->Args({10, 1});
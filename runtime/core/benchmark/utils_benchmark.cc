@@ -0,0 +1,73 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <random>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "utils/utils.h"
+
+namespace {
+
+std::vector<float> RandomData(int size) {
+  std::default_random_engine generator(0);
+  std::normal_distribution<float> distribution(0, 3);
+  std::vector<float> data(size);
+  for (auto& x : data) x = distribution(generator);
+  return data;
+}
+
+// TopK of one frame, the arguments are the vocabulary size and k
+void BM_TopK(benchmark::State& state) {
+  std::vector<float> data = RandomData(state.range(0));
+  std::vector<float> values;
+  std::vector<int32_t> indices;
+  for (auto _ : state) {
+    wenet::TopK(data, state.range(1), &values, &indices);
+    benchmark::DoNotOptimize(values.data());
+  }
+}
+
+// TopK of a chunk of 16 frames in one pass, the arguments are the same
+void BM_BatchTopK(benchmark::State& state) {
+  const int num_rows = 16;
+  const int dim = state.range(0);
+  const int k = state.range(1);
+  std::vector<float> data = RandomData(num_rows * dim);
+  std::vector<float> values(num_rows * k);
+  std::vector<int32_t> indices(num_rows * k);
+  for (auto _ : state) {
+    wenet::BatchTopK(data.data(), num_rows, dim, k, values.data(),
+                     indices.data());
+    benchmark::DoNotOptimize(values.data());
+  }
+  state.SetItemsProcessed(state.iterations() * num_rows);
+}
+
+void BM_LogAdd(benchmark::State& state) {
+  std::vector<float> data = RandomData(1024);
+  for (auto _ : state) {
+    float sum = -wenet::kFloatMax;
+    for (float x : data) sum = wenet::LogAdd(sum, x);
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * data.size());
+}
+
+}  // namespace
+
+BENCHMARK(BM_TopK)->Args({5000, 10})->Args({5000, 30});
+BENCHMARK(BM_BatchTopK)->Args({5000, 10})->Args({5000, 30});
+BENCHMARK(BM_LogAdd);
@@ -0,0 +1,64 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compile the context phrases to the binary context graph, which is memory
+// mapped by --context_graph_path of the decoders, e.g.
+//
+//   compile_context_graph_main --unit_path units.txt \
+//       --context_path contacts.txt --output_path contacts.graph
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "decoder/context_graph.h"
+#include "utils/flags.h"
+#include "utils/log.h"
+#include "utils/string.h"
+#include "utils/timer.h"
+
+DEFINE_string(unit_path, "", "e2e model unit symbol table");
+DEFINE_string(context_path, "", "context phrases, one per line");
+DEFINE_double(context_score, 3.0, "is used to rescore the decoded result");
+DEFINE_double(incremental_context_score, 0.0,
+              "extra score of every matched unit after the first one");
+DEFINE_string(output_path, "", "the compiled context graph");
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+
+  auto unit_table = std::shared_ptr<fst::SymbolTable>(
+      fst::SymbolTable::ReadText(FLAGS_unit_path));
+  CHECK(unit_table != nullptr);
+  std::vector<std::string> contexts;
+  std::ifstream infile(FLAGS_context_path);
+  std::string context;
+  while (getline(infile, context)) {
+    contexts.emplace_back(wenet::Trim(context));
+  }
+
+  wenet::Timer timer;
+  wenet::ContextConfig config;
+  config.context_score = FLAGS_context_score;
+  config.incremental_context_score = FLAGS_incremental_context_score;
+  wenet::ContextGraph context_graph(config);
+  context_graph.BuildContextGraph(contexts, unit_table);
+  LOG(INFO) << "Compiled " << contexts.size() << " contexts to "
+            << context_graph.NumStates() << " states in " << timer.Elapsed()
+            << " ms";
+  CHECK(context_graph.Write(FLAGS_output_path));
+  return 0;
+}
@@ -12,7 +12,9 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <iomanip>
+#include <memory>
 #include <thread>
 #include <utility>
 
@@ -22,6 +24,7 @@
 #include "utils/string.h"
 #include "utils/thread_pool.h"
 #include "utils/timer.h"
+#include "utils/trace.h"
 #include "utils/utils.h"
 
 DEFINE_bool(simulate_streaming, false, "simulate streaming input");
@@ -31,7 +34,14 @@ DEFINE_string(wav_scp, "", "input wav scp");
 DEFINE_string(result, "", "result output file");
 DEFINE_bool(continuous_decoding, false, "continuous decoding mode");
 DEFINE_int32(thread_num, 1, "num of decode thread");
+DEFINE_int32(batch_size, 1,
+             "non streaming mode only, decode this many waves at once by "
+             "the batched ctc prefix beam search in each decode thread");
 DEFINE_int32(warmup, 0, "num of warmup decode, 0 means no warmup");
+DEFINE_bool(benchmark, false,
+            "benchmark mode, report the wall clock throughput of decoding "
+            "the waves by --thread_num concurrent sessions, use it together "
+            "with --simulate_streaming");
 
 std::shared_ptr<wenet::DecodeOptions> g_decode_config;
 std::shared_ptr<wenet::FeaturePipelineConfig> g_feature_config;
@@ -42,6 +52,20 @@ std::mutex g_mutex;
 int g_total_waves_dur = 0;
 int g_total_decode_time = 0;
 
+void WriteResult(const std::string& key, const std::string& final_result,
+                 const std::vector<wenet::DecodeResult>& results) {
+  std::ostream& buffer = FLAGS_result.empty() ? std::cout : g_result;
+  if (!FLAGS_output_nbest) {
+    buffer << key << " " << final_result << std::endl;
+  } else {
+    buffer << "wav " << key << std::endl;
+    for (auto& r : results) {
+      if (r.sentence.empty()) continue;
+      buffer << "candidate " << r.score << " " << r.sentence << std::endl;
+    }
+  }
+}
+
 void Decode(std::pair<std::string, std::string> wav, bool warmup = false) {
   wenet::WavReader wav_reader(wav.second);
   int num_samples = wav_reader.num_samples();
@@ -107,23 +131,56 @@ void Decode(std::pair<std::string, std::string> wav, bool warmup = false) {
 
   if (!warmup) {
     g_mutex.lock();
-    std::ostream& buffer = FLAGS_result.empty() ? std::cout : g_result;
-    if (!FLAGS_output_nbest) {
-      buffer << wav.first << " " << final_result << std::endl;
-    } else {
-      buffer << "wav " << wav.first << std::endl;
-      auto& results = decoder.result();
-      for (auto& r : results) {
-        if (r.sentence.empty()) continue;
-        buffer << "candidate " << r.score << " " << r.sentence << std::endl;
-      }
-    }
+    WriteResult(wav.first, final_result, decoder.result());
     g_total_waves_dur += wave_dur;
     g_total_decode_time += decode_time;
     g_mutex.unlock();
   }
 }
 
+void DecodeBatch(std::vector<std::pair<std::string, std::string>> waves,
+                 bool warmup = false) {
+  std::vector<std::unique_ptr<wenet::AsrDecoder>> decoders;
+  std::vector<wenet::AsrDecoder*> batch;
+  int waves_dur = 0;
+  for (const auto& wav : waves) {
+    wenet::WavReader wav_reader(wav.second);
+    int num_samples = wav_reader.num_samples();
+    CHECK_EQ(wav_reader.sample_rate(), FLAGS_sample_rate);
+    auto feature_pipeline =
+        std::make_shared<wenet::FeaturePipeline>(*g_feature_config);
+    feature_pipeline->AcceptWaveform(wav_reader.data(), num_samples);
+    feature_pipeline->set_input_finished();
+    waves_dur += static_cast<int>(static_cast<float>(num_samples) /
+                                  wav_reader.sample_rate() * 1000);
+    decoders.emplace_back(new wenet::AsrDecoder(
+        feature_pipeline, g_decode_resource, *g_decode_config));
+    batch.push_back(decoders.back().get());
+  }
+
+  wenet::Timer timer;
+  wenet::BatchCtcPrefixBeamSearch batch_search(
+      g_decode_config->ctc_prefix_search_opts);
+  wenet::AsrDecoder::DecodeBatch(batch, &batch_search);
+  for (auto* decoder : batch) decoder->Rescoring();
+  int decode_time = timer.Elapsed();
+  LOG(INFO) << "Decoded " << waves.size() << " waves of " << waves_dur
+            << "ms audio taken " << decode_time << "ms.";
+
+  if (!warmup) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    for (size_t i = 0; i < waves.size(); ++i) {
+      const auto& results = batch[i]->result();
+      std::string final_result;
+      if (batch[i]->DecodedSomething()) final_result = results[0].sentence;
+      LOG(INFO) << waves[i].first << " Final result: " << final_result;
+      WriteResult(waves[i].first, final_result, results);
+    }
+    g_total_waves_dur += waves_dur;
+    g_total_decode_time += decode_time;
+  }
+}
+
 int main(int argc, char* argv[]) {
   gflags::ParseCommandLineFlags(&argc, &argv, false);
   google::InitGoogleLogging(argv[0]);
@@ -157,29 +214,66 @@ int main(int argc, char* argv[]) {
     g_result.open(FLAGS_result, std::ios::out);
   }
 
+  if (FLAGS_batch_size > 1) {
+    CHECK_LE(FLAGS_chunk_size, 0) << "--batch_size is for non streaming only";
+    CHECK(!FLAGS_simulate_streaming && !FLAGS_continuous_decoding);
+    CHECK(g_decode_resource->fst == nullptr)
+        << "--batch_size is for the ctc prefix beam search only";
+  }
+  std::vector<std::vector<std::pair<std::string, std::string>>> batches;
+  if (FLAGS_batch_size > 1) {
+    for (size_t i = 0; i < waves.size(); i += FLAGS_batch_size) {
+      size_t end = std::min(waves.size(), i + FLAGS_batch_size);
+      batches.emplace_back(waves.begin() + i, waves.begin() + end);
+    }
+  }
+
   // Warmup
   if (FLAGS_warmup > 0) {
     LOG(INFO) << "Warming up...";
     {
       ThreadPool pool(FLAGS_thread_num);
-      auto wav = waves[0];
       for (int i = 0; i < FLAGS_warmup; i++) {
-        pool.enqueue(Decode, wav, true);
+        if (FLAGS_batch_size > 1) {
+          pool.enqueue(DecodeBatch, batches[0], true);
+        } else {
+          pool.enqueue(Decode, waves[0], true);
+        }
       }
     }
     LOG(INFO) << "Warmup done.";
   }
 
+  wenet::Timer wall_timer;
   {
     ThreadPool pool(FLAGS_thread_num);
-    for (auto& wav : waves) {
-      pool.enqueue(Decode, wav, false);
+    if (FLAGS_batch_size > 1) {
+      for (auto& batch : batches) {
+        pool.enqueue(DecodeBatch, batch, false);
+      }
+    } else {
+      for (auto& wav : waves) {
+        pool.enqueue(Decode, wav, false);
+      }
     }
   }
+  int wall_time = wall_timer.Elapsed();
 
   LOG(INFO) << "Total: decoded " << g_total_waves_dur << "ms audio taken "
             << g_total_decode_time << "ms.";
   LOG(INFO) << "RTF: " << std::setprecision(4)
             << static_cast<float>(g_total_decode_time) / g_total_waves_dur;
+  if (FLAGS_benchmark) {
+    // With simulated streaming, each session also waits for its audio, so
+    // the wall clock throughput is the meaningful number here.
+    LOG(INFO) << "Benchmark: " << waves.size() << " waves by "
+              << FLAGS_thread_num << " concurrent sessions, wall clock "
+              << wall_time << "ms, throughput " << std::setprecision(4)
+              << static_cast<float>(g_total_waves_dur) / wall_time
+              << "x real time.";
+  }
+  if (!FLAGS_trace_path.empty()) {
+    wenet::DumpTrace(FLAGS_trace_path);
+  }
   return 0;
 }
@@ -19,6 +19,7 @@
 #include "decoder/params.h"
 #include "grpc/grpc_server.h"
 #include "utils/log.h"
+#include "utils/trace.h"
 
 DEFINE_int32(port, 10086, "grpc listening port");
 DEFINE_int32(workers, 4, "grpc num workers");
@@ -29,6 +30,10 @@ using grpc::ServerBuilder;
 int main(int argc, char* argv[]) {
   gflags::ParseCommandLineFlags(&argc, &argv, false);
   google::InitGoogleLogging(argv[0]);
+  // Before any thread is created
+  if (!FLAGS_trace_path.empty()) {
+    wenet::StartTraceDumper(FLAGS_trace_path);
+  }
 
   auto decode_config = wenet::InitDecodeOptionsFromFlags();
   auto feature_config = wenet::InitFeaturePipelineConfigFromFlags();
@@ -0,0 +1,310 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Load generator of the servers, it replays the waves of a wav.scp by many
+// concurrent streaming sessions and reports the latency percentiles, e.g.
+//
+//   load_generator_main --protocol websocket --port 10086 \
+//       --wav_scp wav.scp --concurrency 100 --ramp_up_sec 10
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "frontend/wav.h"
+#include "utils/flags.h"
+#include "utils/string.h"
+#include "utils/timer.h"
+#include "websocket/websocket_client.h"
+#ifdef WITH_GRPC
+#include "grpc/grpc_client.h"
+#endif
+#ifdef WITH_HTTP
+#include "http/http_client.h"
+#endif
+
+DEFINE_string(protocol, "websocket", "websocket, grpc or http");
+DEFINE_string(hostname, "127.0.0.1", "hostname of the server");
+DEFINE_int32(port, 10086, "port of the server");
+DEFINE_string(wav_scp, "", "the waves to replay, they are used in turn");
+DEFINE_int32(concurrency, 10, "number of concurrent sessions");
+DEFINE_int32(num_sessions, 0,
+             "total number of sessions, 0 means one session per wave");
+DEFINE_double(speed, 1.0,
+              "pace the audio at this times real time, 0 means sending it as "
+              "fast as possible, then the RTF is the one of the server under "
+              "this concurrency");
+DEFINE_double(ramp_up_sec, 0,
+              "the concurrent sessions start evenly in this period");
+DEFINE_int32(packet_ms, 100, "audio in each packet in ms");
+DEFINE_int32(nbest, 1, "n-best of decode result");
+DEFINE_bool(continuous_decoding, false, "continuous decoding mode");
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Wave {
+  std::string key;
+  int sample_rate;
+  std::vector<int16_t> pcm;
+};
+
+struct SessionResult {
+  bool error = false;
+  double audio_ms = 0;
+  // From the first packet, -1 if there is no partial result
+  double first_partial_ms = -1;
+  // From the last packet to the last final result, -1 if there is none
+  double final_ms = -1;
+  // From the first packet to the end of the session
+  double session_ms = 0;
+  int num_partials = 0;
+};
+
+double ElapsedMs(Clock::time_point begin, Clock::time_point end) {
+  return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+// Times of the messages of a session, they are received by the read thread
+// of the client
+class SessionTracker {
+ public:
+  void OnMessage(const std::string& type) {
+    int64_t now = Clock::now().time_since_epoch().count();
+    if (type == "partial_result") {
+      if (num_partials_.fetch_add(1) == 0) first_partial_ = now;
+    } else if (type == "final_result") {
+      last_final_ = now;
+    } else if (type == "error") {
+      error_ = true;
+    }
+  }
+
+  void Finish(Clock::time_point first_packet, Clock::time_point last_packet,
+              SessionResult* result) const {
+    auto to_time = [](int64_t t) {
+      return Clock::time_point(Clock::duration(t));
+    };
+    result->error = result->error || error_;
+    result->num_partials = num_partials_;
+    if (num_partials_ > 0) {
+      result->first_partial_ms =
+          ElapsedMs(first_packet, to_time(first_partial_));
+    }
+    if (last_final_ > 0 && to_time(last_final_) >= last_packet) {
+      result->final_ms = ElapsedMs(last_packet, to_time(last_final_));
+    }
+    result->session_ms = ElapsedMs(first_packet, Clock::now());
+  }
+
+ private:
+  std::atomic<int> num_partials_{0};
+  std::atomic<int64_t> first_partial_{0};
+  std::atomic<int64_t> last_final_{0};
+  std::atomic<bool> error_{false};
+};
+
+// Send the wave in packets of FLAGS_packet_ms paced by FLAGS_speed, `send`
+// returns false to stop early. Return the time of the last packet.
+template <typename SendFunc>
+Clock::time_point SendPaced(const Wave& wave, Clock::time_point first_packet,
+                            SendFunc send) {
+  const int packet_samples = FLAGS_packet_ms * wave.sample_rate / 1000;
+  const int num_samples = wave.pcm.size();
+  Clock::time_point last_packet = first_packet;
+  for (int start = 0, i = 0; start < num_samples;
+       start += packet_samples, ++i) {
+    if (FLAGS_speed > 0) {
+      std::this_thread::sleep_until(
+          first_packet + std::chrono::microseconds(static_cast<int64_t>(
+                             i * FLAGS_packet_ms * 1000 / FLAGS_speed)));
+    }
+    int end = std::min(start + packet_samples, num_samples);
+    last_packet = Clock::now();
+    if (!send(wave.pcm.data() + start, end - start)) break;
+  }
+  return last_packet;
+}
+
+SessionResult RunSession(const Wave& wave) {
+  SessionResult result;
+  result.audio_ms = 1000.0 * wave.pcm.size() / wave.sample_rate;
+  SessionTracker tracker;
+  auto on_message = [&tracker](const std::string& type) {
+    tracker.OnMessage(type);
+  };
+  Clock::time_point first_packet = Clock::now();
+  Clock::time_point last_packet = first_packet;
+  try {
+    if (FLAGS_protocol == "websocket") {
+      wenet::WebSocketClient client(FLAGS_hostname, FLAGS_port, on_message);
+      client.set_nbest(FLAGS_nbest);
+      client.set_sr(wave.sample_rate);
+      client.set_continuous_decoding(FLAGS_continuous_decoding);
+      client.SendStartSignal();
+      first_packet = Clock::now();
+      last_packet = SendPaced(wave, first_packet,
+                              [&client](const int16_t* data, int size) {
+                                if (client.done()) return false;
+                                client.SendBinaryData(data,
+                                                      size * sizeof(int16_t));
+                                return true;
+                              });
+      client.SendEndSignal();
+      client.Join();
+#ifdef WITH_GRPC
+    } else if (FLAGS_protocol == "grpc") {
+      wenet::GrpcClient client(FLAGS_hostname, FLAGS_port, FLAGS_nbest,
+                               FLAGS_continuous_decoding, on_message);
+      first_packet = Clock::now();
+      last_packet = SendPaced(wave, first_packet,
+                              [&client](const int16_t* data, int size) {
+                                if (client.done()) return false;
+                                client.SendBinaryData(data,
+                                                      size * sizeof(int16_t));
+                                return true;
+                              });
+      client.Join();
+#endif
+#ifdef WITH_HTTP
+    } else if (FLAGS_protocol == "http") {
+      // Not streaming, the whole wave is sent in one request
+      wenet::HttpClient client(FLAGS_hostname, FLAGS_port, on_message);
+      client.set_nbest(FLAGS_nbest);
+      first_packet = last_packet = Clock::now();
+      client.SendBinaryData(wave.pcm.data(),
+                            wave.pcm.size() * sizeof(int16_t));
+#endif
+    } else {
+      LOG(FATAL) << "Unsupported protocol " << FLAGS_protocol;
+    }
+  } catch (std::exception const& e) {
+    LOG(ERROR) << wave.key << ": " << e.what();
+    result.error = true;
+  }
+  tracker.Finish(first_packet, last_packet, &result);
+  return result;
+}
+
+// Nearest rank percentile
+double Percentile(std::vector<double>* values, double p) {
+  if (values->empty()) return 0;
+  std::sort(values->begin(), values->end());
+  int rank = std::ceil(p / 100 * values->size());
+  return (*values)[std::max(rank, 1) - 1];
+}
+
+void ReportPercentiles(const std::string& name, std::vector<double> values) {
+  std::ostringstream os;
+  os << std::fixed << std::setprecision(1) << name << " (" << values.size()
+     << " samples): p50 " << Percentile(&values, 50) << " p90 "
+     << Percentile(&values, 90) << " p99 " << Percentile(&values, 99)
+     << " max " << Percentile(&values, 100);
+  LOG(INFO) << os.str();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+
+  std::vector<Wave> waves;
+  std::ifstream wav_scp(FLAGS_wav_scp);
+  std::string line;
+  while (getline(wav_scp, line)) {
+    std::vector<std::string> strs;
+    wenet::SplitString(line, &strs);
+    CHECK_GE(strs.size(), 2);
+    wenet::WavReader wav_reader(strs[1]);
+    Wave wave;
+    wave.key = strs[0];
+    wave.sample_rate = wav_reader.sample_rate();
+    wave.pcm.assign(wav_reader.data(),
+                    wav_reader.data() + wav_reader.num_samples());
+    waves.emplace_back(std::move(wave));
+  }
+  if (waves.empty()) {
+    LOG(FATAL) << "Please provide non-empty wav scp.";
+  }
+  const int num_sessions =
+      FLAGS_num_sessions > 0 ? FLAGS_num_sessions : waves.size();
+  const int concurrency = std::min(FLAGS_concurrency, num_sessions);
+  LOG(INFO) << "Running " << num_sessions << " sessions by " << concurrency
+            << " concurrent clients at " << FLAGS_speed << "x real time";
+
+  std::atomic<int> next_session{0};
+  std::mutex mutex;
+  std::vector<SessionResult> results;
+  std::vector<std::thread> clients;
+  wenet::Timer wall_timer;
+  for (int i = 0; i < concurrency; ++i) {
+    clients.emplace_back([&, i]() {
+      // Ramp up, the clients start evenly in FLAGS_ramp_up_sec
+      std::this_thread::sleep_for(std::chrono::microseconds(
+          static_cast<int64_t>(FLAGS_ramp_up_sec * 1e6 * i / concurrency)));
+      for (int n = next_session++; n < num_sessions; n = next_session++) {
+        SessionResult result = RunSession(waves[n % waves.size()]);
+        std::lock_guard<std::mutex> lock(mutex);
+        results.push_back(result);
+      }
+    });
+  }
+  for (auto& client : clients) client.join();
+  double wall_ms = wall_timer.Elapsed();
+
+  int num_errors = 0;
+  double total_audio_ms = 0;
+  int64_t total_partials = 0;
+  std::vector<double> first_partial_ms, final_ms, rtf;
+  for (const auto& result : results) {
+    if (result.error) {
+      ++num_errors;
+      continue;
+    }
+    total_audio_ms += result.audio_ms;
+    total_partials += result.num_partials;
+    if (result.first_partial_ms >= 0) {
+      first_partial_ms.push_back(result.first_partial_ms);
+    }
+    if (result.final_ms >= 0) final_ms.push_back(result.final_ms);
+    if (result.audio_ms > 0) {
+      rtf.push_back(result.session_ms / result.audio_ms);
+    }
+  }
+  LOG(INFO) << "Sessions: " << results.size() << ", errors: " << num_errors;
+  ReportPercentiles("First partial latency in ms", first_partial_ms);
+  ReportPercentiles("Final latency after the last packet in ms", final_ms);
+  LOG(INFO) << "Partial updates per second of audio: " << std::setprecision(4)
+            << total_partials * 1000.0 / std::max(total_audio_ms, 1.0);
+  // Paced sessions can't be faster than the pacing, so the RTF is only
+  // the one of the server when the audio is sent as fast as possible
+  ReportPercentiles("Session time / audio duration", rtf);
+  LOG(INFO) << "Throughput: " << std::setprecision(4)
+            << total_audio_ms / std::max(wall_ms, 1.0) << "x real time, "
+            << "estimated server RTF per stream: "
+            << concurrency * std::max(wall_ms, 1.0) /
+                   std::max(total_audio_ms, 1.0);
+  return 0;
+}
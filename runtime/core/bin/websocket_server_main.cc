@@ -14,21 +14,52 @@
 
 #include "decoder/params.h"
 #include "utils/log.h"
+#include "utils/trace.h"
+#include "websocket/async_websocket_server.h"
 #include "websocket/websocket_server.h"
 
 DEFINE_int32(port, 10086, "websocket listening port");
+DEFINE_bool(async, false,
+            "event driven server with fixed io and decode thread pools, "
+            "instead of two threads per connection");
+DEFINE_int32(io_thread_num, 1, "num of io threads in async mode");
+DEFINE_int32(decode_thread_num, 4, "num of decode threads in async mode");
+DEFINE_bool(pin_decode_threads, false,
+            "pin the decode threads to the cores in async mode, Linux only");
+DEFINE_int32(max_queued_frames, 1000,
+             "stop reading from a connection when it has more feature frames "
+             "than this waiting for decoding, in async mode");
+DEFINE_int32(context_thread_num, 1,
+             "num of threads compiling the session hotwords in async mode");
 
 int main(int argc, char* argv[]) {
   gflags::ParseCommandLineFlags(&argc, &argv, false);
   google::InitGoogleLogging(argv[0]);
+  // Before any thread is created
+  if (!FLAGS_trace_path.empty()) {
+    wenet::StartTraceDumper(FLAGS_trace_path);
+  }
 
   auto decode_config = wenet::InitDecodeOptionsFromFlags();
   auto feature_config = wenet::InitFeaturePipelineConfigFromFlags();
   auto decode_resource = wenet::InitDecodeResourceFromFlags();
 
-  wenet::WebSocketServer server(FLAGS_port, feature_config, decode_config,
-                                decode_resource);
-  LOG(INFO) << "Listening at port " << FLAGS_port;
-  server.Start();
+  if (FLAGS_async) {
+    wenet::AsyncServerOptions opts;
+    opts.num_io_threads = FLAGS_io_thread_num;
+    opts.num_decode_threads = FLAGS_decode_thread_num;
+    opts.pin_decode_threads = FLAGS_pin_decode_threads;
+    opts.max_queued_frames = FLAGS_max_queued_frames;
+    opts.num_context_threads = FLAGS_context_thread_num;
+    wenet::AsyncWebSocketServer server(FLAGS_port, opts, feature_config,
+                                       decode_config, decode_resource);
+    LOG(INFO) << "Listening at port " << FLAGS_port << " in async mode";
+    server.Start();
+  } else {
+    wenet::WebSocketServer server(FLAGS_port, feature_config, decode_config,
+                                  decode_resource);
+    LOG(INFO) << "Listening at port " << FLAGS_port;
+    server.Start();
+  }
   return 0;
 }
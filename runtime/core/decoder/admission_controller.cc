@@ -0,0 +1,181 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/admission_controller.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+#include "utils/log.h"
+#include "utils/metrics.h"
+
+namespace wenet {
+
+namespace {
+
+int64_t NowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+AdmissionController::AdmissionController(const AdmissionOptions& opts,
+                                         const DecodeOptions& decode_options)
+    : opts_(opts),
+      degraded_decode_options_(std::make_shared<DecodeOptions>(
+          DegradeDecodeOptions(decode_options, opts.degrade_chunk_size))) {
+  CHECK_GT(opts_.window_ms, 0);
+  CHECK(opts_.ewma_alpha > 0 && opts_.ewma_alpha <= 1);
+  num_threads_ = opts_.num_threads;
+  if (num_threads_ <= 0) {
+    num_threads_ = std::max(1U, std::thread::hardware_concurrency());
+  }
+  window_start_us_ = NowUs();
+}
+
+std::unique_ptr<AdmissionController::Ticket> AdmissionController::Admit() {
+  Metrics& metrics = Metrics::Global();
+  bool degraded = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    UpdateWindow(NowUs());
+    // The load with one more session of the current RTF
+    float load = load_ + rtf_ / num_threads_;
+    const char* reason = nullptr;
+    if (opts_.max_sessions > 0 && num_sessions_ >= opts_.max_sessions) {
+      reason = "sessions";
+    } else if (opts_.max_load > 0 && load > opts_.max_load) {
+      reason = "load";
+    } else if (opts_.max_backlog_ms > 0 &&
+               backlog_ms_ > opts_.max_backlog_ms) {
+      reason = "backlog";
+    }
+    if (reason != nullptr) {
+      VLOG(1) << "Reject a new session by the " << reason << ", sessions "
+              << num_sessions_ << " load " << load << " backlog "
+              << backlog_ms_ << "ms";
+      metrics.sessions_rejected.Increment();
+      return nullptr;
+    }
+    degraded = opts_.degrade_load > 0 && load > opts_.degrade_load;
+    ++num_sessions_;
+  }
+  if (degraded) metrics.sessions_degraded.Increment();
+  return std::unique_ptr<Ticket>(new Ticket(this, degraded));
+}
+
+void AdmissionController::Release() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  --num_sessions_;
+}
+
+void AdmissionController::ObserveChunk(int64_t compute_us, int audio_ms,
+                                       int backlog_ms) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  UpdateWindow(NowUs());
+  window_compute_us_ += compute_us;
+  window_backlog_ms_ += backlog_ms;
+  ++window_chunks_;
+  if (audio_ms > 0) {
+    float rtf = compute_us / (audio_ms * 1000.0f);
+    rtf_ = rtf_observed_ ? rtf_ + opts_.ewma_alpha * (rtf - rtf_) : rtf;
+    rtf_observed_ = true;
+  }
+}
+
+void AdmissionController::UpdateWindow(int64_t now_us) {
+  int64_t elapsed_us = now_us - window_start_us_;
+  int64_t window_us = opts_.window_ms * 1000LL;
+  if (elapsed_us < window_us) return;
+  float load =
+      static_cast<float>(window_compute_us_) / (elapsed_us * num_threads_);
+  float backlog_ms = 0;
+  if (window_chunks_ > 0) {
+    backlog_ms = static_cast<float>(window_backlog_ms_) / window_chunks_;
+  }
+  // The windows passed without a chunk are idle, so the longer it's been,
+  // the more the new values weigh
+  float weight = 1.0f - std::pow(1.0f - opts_.ewma_alpha,
+                                 static_cast<float>(elapsed_us) / window_us);
+  load_ += weight * (load - load_);
+  backlog_ms_ += weight * (backlog_ms - backlog_ms_);
+  window_start_us_ = now_us;
+  window_compute_us_ = 0;
+  window_backlog_ms_ = 0;
+  window_chunks_ = 0;
+  Metrics& metrics = Metrics::Global();
+  metrics.decode_load_percent.Set(static_cast<int64_t>(load_ * 100));
+  metrics.decode_backlog_ms.Set(static_cast<int64_t>(backlog_ms_));
+}
+
+int AdmissionController::num_sessions() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_sessions_;
+}
+
+float AdmissionController::load() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return load_;
+}
+
+float AdmissionController::backlog_ms() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return backlog_ms_;
+}
+
+float AdmissionController::rtf() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return rtf_;
+}
+
+DecodeOptions DegradeDecodeOptions(const DecodeOptions& opts,
+                                   bool chunk_size) {
+  DecodeOptions degraded = opts;
+  // A full utterance (chunk_size <= 0) is decoded at once anyway
+  if (chunk_size && degraded.chunk_size > 0) {
+    degraded.chunk_size *= 2;
+    // About the same left context in frames
+    if (degraded.num_left_chunks > 0) {
+      degraded.num_left_chunks = (degraded.num_left_chunks + 1) / 2;
+    }
+  }
+  auto& prefix_opts = degraded.ctc_prefix_search_opts;
+  prefix_opts.first_beam_size = std::max(1, prefix_opts.first_beam_size / 2);
+  prefix_opts.second_beam_size = std::max(1, prefix_opts.second_beam_size / 2);
+  auto& wfst_opts = degraded.ctc_wfst_search_opts;
+  wfst_opts.max_active =
+      std::max(wfst_opts.min_active, wfst_opts.max_active / 2);
+  degraded.rescoring_weight = 0.0;
+  return degraded;
+}
+
+bool AdmitSession(const DecodeResource& resource,
+                  std::unique_ptr<AdmissionController::Ticket>* ticket,
+                  std::shared_ptr<DecodeOptions>* opts) {
+  CHECK(ticket != nullptr);
+  CHECK(opts != nullptr);
+  if (resource.admission_controller == nullptr) return true;
+  *ticket = resource.admission_controller->Admit();
+  if (*ticket == nullptr) return false;
+  if ((*ticket)->degraded()) {
+    *opts = resource.admission_controller->degraded_decode_options();
+  }
+  return true;
+}
+
+}  // namespace wenet
@@ -0,0 +1,142 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_ADMISSION_CONTROLLER_H_
+#define DECODER_ADMISSION_CONTROLLER_H_
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "decoder/asr_decoder.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+struct AdmissionOptions {
+  // At most this number of concurrent sessions, 0 means no limit
+  int max_sessions = 0;
+  // The threads decoding the sessions, 0 means the number of cores
+  int num_threads = 0;
+  // Reject a new session if the decode load with it would be over this,
+  // 0 means no limit. The load is the compute time of the chunks per
+  // second of wall time per thread, 1.0 means all the threads are busy.
+  float max_load = 0;
+  // Reject a new session if the audio waiting for decoding is more than
+  // this on average, 0 means no limit
+  int max_backlog_ms = 0;
+  // Admit a new session in the degraded mode if the decode load with it
+  // would be over this, 0 means never
+  float degrade_load = 0;
+  // Whether the degraded mode may use larger chunks, only if the model
+  // takes any chunk size, see AsrModel::dynamic_chunk_size
+  bool degrade_chunk_size = false;
+  // The load and the backlog are measured over windows of window_ms, and
+  // smoothed by ewma_alpha per window
+  int window_ms = 500;
+  float ewma_alpha = 0.3;
+};
+
+// AdmissionController decides whether a server takes a new session by the
+// live decode load, rather than taking every session until all of them miss
+// the real time. AsrDecoder reports the compute time and the backlog of
+// every chunk, and a new session is admitted if the load with one more
+// session of the current RTF stays under the limits. Near the limits, it
+// may be admitted in the degraded mode, whose decode options are cheaper,
+// see DegradeDecodeOptions.
+//
+// It is thread safe.
+class AdmissionController {
+ public:
+  // An admitted session, it's counted until the ticket is destroyed
+  class Ticket {
+   public:
+    Ticket(AdmissionController* controller, bool degraded)
+        : controller_(controller), degraded_(degraded) {}
+    ~Ticket() { controller_->Release(); }
+    bool degraded() const { return degraded_; }
+
+   private:
+    AdmissionController* controller_;
+    const bool degraded_;
+
+   public:
+    WENET_DISALLOW_COPY_AND_ASSIGN(Ticket);
+  };
+
+  // `decode_options` are the options of the normal sessions, the degraded
+  // ones are derived from them
+  AdmissionController(const AdmissionOptions& opts,
+                      const DecodeOptions& decode_options);
+
+  // Return nullptr if the new session is rejected. The controller must
+  // outlive the ticket.
+  std::unique_ptr<Ticket> Admit();
+  // Called after each chunk, `compute_us` is the time decoding the chunk of
+  // `audio_ms`, and `backlog_ms` is the audio still waiting for decoding
+  void ObserveChunk(int64_t compute_us, int audio_ms, int backlog_ms);
+
+  std::shared_ptr<DecodeOptions> degraded_decode_options() const {
+    return degraded_decode_options_;
+  }
+  int num_sessions() const;
+  // The smoothed values the decisions are made on
+  float load() const;
+  float backlog_ms() const;
+  float rtf() const;
+
+ private:
+  void Release();
+  // Close the window if it's over, the lock must be held
+  void UpdateWindow(int64_t now_us);
+
+  const AdmissionOptions opts_;
+  int num_threads_ = 1;
+  std::shared_ptr<DecodeOptions> degraded_decode_options_;
+
+  mutable std::mutex mutex_;
+  int num_sessions_ = 0;
+  float load_ = 0;
+  float backlog_ms_ = 0;
+  // The RTF of one session, compute time over audio time, smoothed per
+  // chunk
+  float rtf_ = 0;
+  bool rtf_observed_ = false;
+  // The current window
+  int64_t window_start_us_ = 0;
+  int64_t window_compute_us_ = 0;
+  int64_t window_backlog_ms_ = 0;
+  int window_chunks_ = 0;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(AdmissionController);
+};
+
+// The options of the sessions admitted in the degraded mode: beams half as
+// wide, no attention rescoring, and if `chunk_size` is true, chunks twice as
+// large, which halves the encoder calls
+DecodeOptions DegradeDecodeOptions(const DecodeOptions& opts,
+                                   bool chunk_size);
+
+// Admit a new session of `resource`, it's always admitted if the resource
+// has no admission controller. Return false if it's rejected, otherwise
+// `ticket` holds the admission, and `opts` is set to the degraded options
+// if the session is degraded.
+bool AdmitSession(const DecodeResource& resource,
+                  std::unique_ptr<AdmissionController::Ticket>* ticket,
+                  std::shared_ptr<DecodeOptions>* opts);
+
+}  // namespace wenet
+
+#endif  // DECODER_ADMISSION_CONTROLLER_H_
@@ -18,13 +18,86 @@
 #include <ctype.h>
 
 #include <algorithm>
+#include <fstream>
 #include <limits>
+#include <map>
 #include <utility>
 
+#include "decoder/admission_controller.h"
+#include "utils/metrics.h"
 #include "utils/timer.h"
+#include "utils/trace.h"
 
 namespace wenet {
 
+std::shared_ptr<fst::Fst<fst::StdArc>> ReadFst(const std::string& path,
+                                               bool mmap) {
+  std::ifstream strm(path, std::ios_base::in | std::ios_base::binary);
+  if (!strm) {
+    LOG(ERROR) << "Failed to open fst " << path;
+    return nullptr;
+  }
+  // The source must be the file path, which is what the ConstFst maps
+  fst::FstReadOptions opts(path);
+  if (mmap) opts.mode = fst::FstReadOptions::MAP;
+  std::shared_ptr<fst::Fst<fst::StdArc>> graph(
+      fst::Fst<fst::StdArc>::Read(strm, opts));
+  if (graph != nullptr) {
+    VLOG(1) << "Read " << graph->Type() << " fst " << path;
+  }
+  return graph;
+}
+
+std::shared_ptr<DecodeResource> SessionResource(
+    const std::shared_ptr<DecodeResource>& resource,
+    const std::vector<std::string>& hotwords, float hotwords_score,
+    std::string* context_key, std::string* error) {
+  std::shared_ptr<const ContextGraph> context_graph = nullptr;
+  if (!hotwords.empty()) {
+    if (resource->unit_trie == nullptr) {
+      *error = "Hotwords are not supported without the unit table";
+      return nullptr;
+    }
+    ContextConfig config;
+    if (resource->context_graph != nullptr) {
+      config = resource->context_graph->config();
+    }
+    // Before the compilation, its cost grows with the hotwords
+    *error = CheckContextLimits(hotwords, config);
+    if (!error->empty()) return nullptr;
+    if (hotwords_score > 0) config.context_score = hotwords_score;
+    if (resource->context_graph_cache != nullptr) {
+      context_graph = resource->context_graph_cache->Get(
+          hotwords, config, *resource->unit_trie, resource->context_graph,
+          context_key);
+    } else {
+      auto graph = std::make_shared<ContextGraph>(config);
+      if (graph->BuildContextGraph(hotwords, *resource->unit_trie,
+                                   resource->context_graph)) {
+        context_graph = graph;
+      }
+      context_key->clear();
+    }
+    if (context_graph == nullptr) {
+      *error = "Too many hotwords over the context graph of the server";
+      return nullptr;
+    }
+  } else if (!context_key->empty()) {
+    if (resource->context_graph_cache != nullptr) {
+      context_graph = resource->context_graph_cache->Find(*context_key);
+    }
+    if (context_graph == nullptr) {
+      *error = "Unknown context key " + *context_key;
+      return nullptr;
+    }
+  } else {
+    return resource;
+  }
+  auto session_resource = std::make_shared<DecodeResource>(*resource);
+  session_resource->context_graph = context_graph;
+  return session_resource;
+}
+
 AsrDecoder::AsrDecoder(std::shared_ptr<FeaturePipeline> feature_pipeline,
                        std::shared_ptr<DecodeResource> resource,
                        const DecodeOptions& opts)
@@ -32,13 +105,16 @@ AsrDecoder::AsrDecoder(std::shared_ptr<FeaturePipeline> feature_pipeline,
       // Make a copy of the model ASR model since we will change the inner
       // status of the model
       model_(resource->model->Copy()),
+      model_pool_(std::make_shared<AsrModelPool>(resource->model)),
       post_processor_(resource->post_processor),
       context_graph_(resource->context_graph),
+      admission_controller_(resource->admission_controller),
       symbol_table_(resource->symbol_table),
       fst_(resource->fst),
       unit_table_(resource->unit_table),
       opts_(opts),
-      ctc_endpointer_(new CtcEndpoint(opts.ctc_endpoint_config)) {
+      ctc_endpointer_(new CtcEndpoint(opts.ctc_endpoint_config)),
+      rescoring_gate_(new RescoringGate(opts.rescoring_gate_opts)) {
   if (opts_.reverse_weight > 0) {
     // Check if model has a right to left decoder
     CHECK(model_->is_bidirectional_decoder());
@@ -51,11 +127,20 @@ AsrDecoder::AsrDecoder(std::shared_ptr<FeaturePipeline> feature_pipeline,
                                           resource->context_graph));
   }
   ctc_endpointer_->frame_shift_in_ms(frame_shift_in_ms());
+  Metrics::Global().active_sessions.Add(1);
+}
+
+AsrDecoder::~AsrDecoder() {
+  Metrics& metrics = Metrics::Global();
+  metrics.active_sessions.Add(-1);
+  metrics.session_memory_bytes.Add(-static_cast<int64_t>(reported_memory_));
 }
 
 void AsrDecoder::Reset() {
   start_ = false;
   result_.clear();
+  session_timer_.Reset();
+  first_partial_observed_ = false;
   num_frames_ = 0;
   global_frame_offset_ = 0;
   model_->Reset();
@@ -73,60 +158,167 @@ void AsrDecoder::ResetContinuousDecoding() {
   ctc_endpointer_->Reset();
 }
 
+size_t AsrDecoder::MemoryUsage() const {
+  size_t bytes = model_->MemoryUsage();
+  bytes += (ctc_summaries_.topk_score.capacity() +
+            ctc_summaries_.blank_score.capacity()) *
+           sizeof(float);
+  bytes += ctc_summaries_.topk_index.capacity() * sizeof(int32_t);
+  return bytes;
+}
+
+void AsrDecoder::ReportMemoryUsage() {
+  size_t bytes = MemoryUsage();
+  Metrics::Global().session_memory_bytes.Add(
+      static_cast<int64_t>(bytes) - static_cast<int64_t>(reported_memory_));
+  reported_memory_ = bytes;
+}
+
 DecodeState AsrDecoder::Decode(bool block) {
   return this->AdvanceDecoding(block);
 }
 
+void AsrDecoder::DecodeBatch(const std::vector<AsrDecoder*>& decoders,
+                             BatchCtcPrefixBeamSearch* batch_search) {
+  WENET_TRACE_SCOPE("AsrDecoder::DecodeBatch");
+  int batch_size = decoders.size();
+  Metrics& metrics = Metrics::Global();
+  std::vector<std::vector<std::vector<float>>> ctc_log_probs(batch_size);
+  std::vector<int> lengths(batch_size, 0);
+  std::vector<CtcPrefixBeamSearch*> searchers(batch_size);
+  int max_len = 0;
+  int vocab_size = 0;
+  for (int b = 0; b < batch_size; ++b) {
+    AsrDecoder* decoder = decoders[b];
+    CHECK(decoder->searcher_->Type() == kPrefixBeamSearch)
+        << "Only the CTC prefix beam search decodes in batches";
+    CHECK_LE(decoder->opts_.chunk_size, 0);
+    CHECK(decoder->feature_pipeline_->input_finished());
+    decoder->chunk_timer_.Reset();
+    auto& model = decoder->model_;
+    model->set_chunk_size(decoder->opts_.chunk_size);
+    model->set_keep_encoder_outs(decoder->opts_.rescoring_weight != 0.0);
+    // All the frames of the utterance
+    const int feature_dim = decoder->feature_pipeline_->feature_dim();
+    std::vector<float>* feats = model->BeginChunk(feature_dim);
+    size_t num_cached = feats->size();
+    decoder->feature_pipeline_->ReadAppend(model->num_frames_for_chunk(false),
+                                           feats);
+    decoder->num_frames_ += (feats->size() - num_cached) / feature_dim;
+    {
+      ScopedLatency latency(&metrics.encoder_forward);
+      model->ForwardEncoder(feature_dim, &ctc_log_probs[b]);
+    }
+    lengths[b] = ctc_log_probs[b].size();
+    max_len = std::max(max_len, lengths[b]);
+    if (lengths[b] > 0) vocab_size = ctc_log_probs[b][0].size();
+    searchers[b] = static_cast<CtcPrefixBeamSearch*>(decoder->searcher_.get());
+  }
+
+  if (max_len > 0) {
+    // (batch_size x max_len x vocab_size) row major, the padding is skipped
+    // by the search
+    std::vector<float> logp(static_cast<size_t>(batch_size) * max_len *
+                            vocab_size);
+    for (int b = 0; b < batch_size; ++b) {
+      float* row = logp.data() + static_cast<size_t>(b) * max_len * vocab_size;
+      for (const auto& frame : ctc_log_probs[b]) {
+        std::copy(frame.begin(), frame.end(), row);
+        row += vocab_size;
+      }
+    }
+    ScopedLatency latency(&metrics.ctc_search);
+    batch_search->Search(logp.data(), batch_size, max_len, vocab_size,
+                         lengths, searchers);
+  }
+  for (AsrDecoder* decoder : decoders) {
+    decoder->UpdateResult();
+    decoder->ReportMemoryUsage();
+    decoder->start_ = true;
+  }
+}
+
 void AsrDecoder::Rescoring() {
+  WENET_TRACE_SCOPE("AsrDecoder::Rescoring");
   // Do attention rescoring
   Timer timer;
   AttentionRescoring();
   VLOG(2) << "Rescoring cost latency: " << timer.Elapsed() << "ms.";
+  Metrics::Global().final_latency.Observe(chunk_timer_.ElapsedUs());
 }
 
 DecodeState AsrDecoder::AdvanceDecoding(bool block) {
   DecodeState state = DecodeState::kEndBatch;
+  chunk_timer_.Reset();
   model_->set_chunk_size(opts_.chunk_size);
   model_->set_num_left_chunks(opts_.num_left_chunks);
+  model_->set_max_cache_frames(opts_.max_cache_frames);
+  // The encoder outputs are only needed by the attention rescoring
+  model_->set_keep_encoder_outs(opts_.rescoring_weight != 0.0);
   int num_required_frames = model_->num_frames_for_chunk(start_);
-  std::vector<std::vector<float>> chunk_feats;
   // Return immediately if we do not want to block
-  if (!block && !feature_pipeline_->input_finished() &&
-      feature_pipeline_->NumQueuedFrames() < num_required_frames) {
+  if (!block && !feature_pipeline_->Ready(num_required_frames)) {
     return DecodeState::kWaitFeats;
   }
+  // The features are read behind the cached frames in the encoder input
+  const int feature_dim = feature_pipeline_->feature_dim();
+  std::vector<float>* feats = model_->BeginChunk(feature_dim);
+  size_t num_cached = feats->size();
   // If not okay, that means we reach the end of the input
-  if (!feature_pipeline_->Read(num_required_frames, &chunk_feats)) {
+  if (!feature_pipeline_->ReadAppend(num_required_frames, feats)) {
     state = DecodeState::kEndFeats;
   }
 
-  num_frames_ += chunk_feats.size();
+  int num_chunk_frames = (feats->size() - num_cached) / feature_dim;
+  num_frames_ += num_chunk_frames;
   VLOG(2) << "Required " << num_required_frames << " get "
-          << chunk_feats.size();
+          << num_chunk_frames;
+  // The cost of the chunk, without the time waiting for the features
+  Timer compute_timer;
   Timer timer;
   std::vector<std::vector<float>> ctc_log_probs;
-  model_->ForwardEncoder(chunk_feats, &ctc_log_probs);
-  int forward_time = timer.Elapsed();
+  model_->ForwardEncoder(feature_dim, &ctc_log_probs);
+  Metrics& metrics = Metrics::Global();
+  int64_t forward_us = timer.ElapsedUs();
+  metrics.encoder_forward.Observe(forward_us);
+  timer.Reset();
+  // One pass over the CTC outputs for the blank scale, the top k and the
+  // blank scores, which the searcher and the endpointer share
+  float blank_bias = 0;
   if (opts_.ctc_wfst_search_opts.blank_scale != 1.0) {
-    for (int i = 0; i < ctc_log_probs.size(); i++) {
-      ctc_log_probs[i][0] = ctc_log_probs[i][0] +
-                            std::log(opts_.ctc_wfst_search_opts.blank_scale);
-    }
+    blank_bias = std::log(opts_.ctc_wfst_search_opts.blank_scale);
   }
-  timer.Reset();
-  searcher_->Search(ctc_log_probs);
-  int search_time = timer.Elapsed();
-  VLOG(3) << "forward takes " << forward_time << " ms, search takes "
-          << search_time << " ms";
+  int k = opts_.ctc_prefix_search_opts.first_beam_size;
+  SummarizeCtcFrames(0, blank_bias, k, &ctc_log_probs, &ctc_summaries_);
+  {
+    WENET_TRACE_SCOPE("SearchInterface::Search");
+    searcher_->Search(ctc_log_probs, ctc_summaries_);
+  }
+  int64_t search_us = timer.ElapsedUs();
+  metrics.ctc_search.Observe(search_us);
+  VLOG(3) << "forward takes " << forward_us << " us, search takes "
+          << search_us << " us";
   UpdateResult();
+  if (!first_partial_observed_ && DecodedSomething()) {
+    metrics.first_partial_latency.Observe(session_timer_.ElapsedUs());
+    first_partial_observed_ = true;
+  }
 
   if (state != DecodeState::kEndFeats) {
-    if (ctc_endpointer_->IsEndpoint(ctc_log_probs, DecodedSomething())) {
+    ScopedLatency latency(&metrics.endpointing);
+    if (ctc_endpointer_->IsEndpoint(ctc_summaries_, DecodedSomething())) {
       VLOG(1) << "Endpoint is detected at " << num_frames_;
       state = DecodeState::kEndpoint;
     }
   }
 
+  if (admission_controller_ != nullptr && num_chunk_frames > 0) {
+    int frame_shift = feature_frame_shift_in_ms();
+    admission_controller_->ObserveChunk(
+        compute_timer.ElapsedUs(), num_chunk_frames * frame_shift,
+        feature_pipeline_->NumQueuedFrames() * frame_shift);
+  }
+  ReportMemoryUsage();
   start_ = true;
   return state;
 }
@@ -145,7 +337,14 @@ void AsrDecoder::UpdateResult(bool finish) {
     DecodeResult path;
     path.score = likelihood[i];
     int offset = global_frame_offset_ * feature_frame_shift_in_ms();
+    // The stable outputs are a prefix shared by all the partial hypotheses
+    size_t num_stable = hypothesis.size();
+    if (!finish) {
+      num_stable = std::min(
+          num_stable, static_cast<size_t>(searcher_->NumStableOutputs()));
+    }
     for (size_t j = 0; j < hypothesis.size(); j++) {
+      if (j == num_stable) path.stable_sentence = path.sentence;
       std::string word = symbol_table_->Find(hypothesis[j]);
       // A detailed explanation of this if-else branch can be found in
       // https://github.com/wenet-e2e/wenet/issues/583#issuecomment-907994058
@@ -155,6 +354,7 @@ void AsrDecoder::UpdateResult(bool finish) {
         path.sentence += (word);
       }
     }
+    if (num_stable == hypothesis.size()) path.stable_sentence = path.sentence;
 
     // TimeStamp is only supported in final result
     // TimeStamp of the output of CtcWfstBeamSearch may be inaccurate due to
@@ -191,7 +391,10 @@ void AsrDecoder::UpdateResult(bool finish) {
     }
 
     if (post_processor_ != nullptr) {
+      ScopedLatency latency(&Metrics::Global().post_processing);
       path.sentence = post_processor_->Process(path.sentence, finish);
+      path.stable_sentence =
+          post_processor_->Process(path.stable_sentence, finish);
     }
     result_.emplace_back(path);
   }
@@ -215,31 +418,108 @@ void AsrDecoder::UpdateResult(bool finish) {
 }
 
 void AsrDecoder::AttentionRescoring() {
+  std::shared_ptr<RescoringTask> task = FinishSegment();
+  task->Run();
+  result_ = std::move(task->result_);
+}
+
+std::shared_ptr<RescoringTask> AsrDecoder::DetachRescoring() {
+  std::shared_ptr<RescoringTask> task = FinishSegment();
+  Metrics::Global().final_latency.Observe(chunk_timer_.ElapsedUs());
+  if (task->model_ != nullptr) {
+    // The task keeps the model with the encoder outputs of the segment, and
+    // the decoder continues with a spare one, the task returns its model
+    // to the pool when it's done
+    task->model_pool_ = model_pool_;
+    model_ = model_pool_->Take();
+  }
+  return task;
+}
+
+std::shared_ptr<RescoringTask> AsrDecoder::FinishSegment() {
   searcher_->FinalizeSearch();
   UpdateResult(true);
+  auto task = std::make_shared<RescoringTask>();
+  task->result_ = result_;
+  task->opts_ = &opts_;
   // No need to do rescoring
   if (0.0 == opts_.rescoring_weight) {
-    return;
+    return task;
   }
   // Inputs() returns N-best input ids, which is the basic unit for rescoring
   // In CtcPrefixBeamSearch, inputs are the same to outputs
-  const auto& hypotheses = searcher_->Inputs();
+  task->hypotheses_ = searcher_->Inputs();
+  task->model_ = model_;
+  task->rescoring_gate_ = rescoring_gate_;
+  task->utterance_ms_ =
+      (num_frames_ - global_frame_offset_) * feature_frame_shift_in_ms();
+  return task;
+}
+
+RescoringTask::~RescoringTask() {
+  if (model_pool_ != nullptr) {
+    model_pool_->Return(std::move(model_));
+  }
+}
+
+void RescoringTask::Run() {
+  const auto& hypotheses = hypotheses_;
   int num_hyps = hypotheses.size();
-  if (num_hyps <= 0) {
+  if (model_ == nullptr || num_hyps <= 0) {
     return;
   }
+  ScopedLatency latency(&Metrics::Global().rescoring);
+  WENET_TRACE_SCOPE("RescoringTask::Run");
+
+  // The n-best of CtcWfstBeamSearch may have identical inputs, which only
+  // differ in the words, they are rescored once
+  std::vector<std::vector<int>> unique_hyps;
+  std::vector<int> unique_index(num_hyps);
+  std::map<std::vector<int>, int> hyp_to_index;
+  for (int i = 0; i < num_hyps; ++i) {
+    auto it = hyp_to_index.emplace(hypotheses[i], unique_hyps.size());
+    if (it.second) unique_hyps.push_back(hypotheses[i]);
+    unique_index[i] = it.first->second;
+  }
+
+  // Skip the rescoring if the gate says the CTC 1-best is good enough
+  std::vector<float> ctc_scores(num_hyps);
+  for (int i = 0; i < num_hyps; ++i) ctc_scores[i] = result_[i].score;
+  RescoringDecision decision = rescoring_gate_->Decide(
+      ctc_scores, unique_hyps.size(), utterance_ms_);
+  if (decision != RescoringDecision::kRescore) {
+    VLOG(2) << "Skip rescoring of " << num_hyps << " hyps, decision "
+            << static_cast<int>(decision);
+    return;
+  }
+  // Or only rescore the top hypotheses, the unique ones are in the order of
+  // their first occurrences. The others keep their CTC scores and rank
+  // after the rescored ones, the scores are not comparable.
+  int num_rescored = rescoring_gate_->NumHypsToRescore(num_hyps);
+  if (num_rescored < num_hyps) {
+    num_hyps = num_rescored;
+    unique_index.resize(num_hyps);
+    unique_hyps.resize(
+        *std::max_element(unique_index.begin(), unique_index.end()) + 1);
+  }
+  if (static_cast<int>(unique_hyps.size()) < num_hyps) {
+    VLOG(2) << "Rescoring " << unique_hyps.size() << " unique hyps of "
+            << num_hyps;
+  }
 
   // TODO(zhendong.peng): Do we need rescoring while context matching?
   std::vector<float> rescoring_score;
-  model_->AttentionRescoring(hypotheses, opts_.reverse_weight,
+  model_->AttentionRescoring(unique_hyps, opts_->reverse_weight,
                              &rescoring_score);
 
   // Combine ctc score and rescoring score
   for (size_t i = 0; i < num_hyps; ++i) {
-    result_[i].score = opts_.rescoring_weight * rescoring_score[i] +
-                       opts_.ctc_weight * result_[i].score;
+    result_[i].score =
+        opts_->rescoring_weight * rescoring_score[unique_index[i]] +
+        opts_->ctc_weight * result_[i].score;
   }
-  std::sort(result_.begin(), result_.end(), DecodeResult::CompareFunc);
+  std::sort(result_.begin(), result_.begin() + num_hyps,
+            DecodeResult::CompareFunc);
 }
 
 }  // namespace wenet
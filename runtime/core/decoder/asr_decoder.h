@@ -16,6 +16,7 @@
 #ifndef DECODER_ASR_DECODER_H_
 #define DECODER_ASR_DECODER_H_
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <unordered_set>
@@ -26,23 +27,35 @@
 #include "fst/symbol-table.h"
 
 #include "decoder/asr_model.h"
+#include "decoder/batch_ctc_prefix_beam_search.h"
 #include "decoder/context_graph.h"
+#include "decoder/context_graph_cache.h"
 #include "decoder/ctc_endpoint.h"
+#include "decoder/ctc_frame_summary.h"
 #include "decoder/ctc_prefix_beam_search.h"
 #include "decoder/ctc_wfst_beam_search.h"
+#include "decoder/rescoring_gate.h"
 #include "decoder/search_interface.h"
 #include "frontend/feature_pipeline.h"
 #include "post_processor/post_processor.h"
+#include "utils/thread_pool.h"
+#include "utils/timer.h"
 #include "utils/utils.h"
 
 namespace wenet {
 
+class AdmissionController;
+
 struct DecodeOptions {
   // chunk_size is the frame number of one chunk after subsampling.
   // e.g. if subsample rate is 4 and chunk_size = 16, the frames in
   // one chunk are 64 = 16*4
   int chunk_size = 16;
   int num_left_chunks = -1;
+  // If num_left_chunks < 0, bound the attention cache to the last
+  // max_cache_frames frames (after subsampling), -1 means unbounded. It
+  // keeps the memory and the attention cost flat in long streams.
+  int max_cache_frames = -1;
 
   // final_score = rescoring_weight * rescoring_score + ctc_weight * ctc_score;
   // rescoring_score = left_to_right_score * (1 - reverse_weight) +
@@ -58,6 +71,7 @@ struct DecodeOptions {
   CtcEndpointConfig ctc_endpoint_config;
   CtcPrefixBeamSearchOptions ctc_prefix_search_opts;
   CtcWfstBeamSearchOptions ctc_wfst_search_opts;
+  RescoringGateOptions rescoring_gate_opts;
 };
 
 struct WordPiece {
@@ -72,6 +86,9 @@ struct WordPiece {
 struct DecodeResult {
   float score = -kFloatMax;
   std::string sentence;
+  // The prefix of the sentence which won't change in the later partial
+  // results, it's the whole sentence in the final result
+  std::string stable_sentence;
   std::unordered_set<std::string> contexts;
   std::vector<WordPiece> word_pieces;
 
@@ -87,15 +104,69 @@ enum DecodeState {
   kWaitFeats = 0x03  // Feat is not enough for one chunk inference, wait
 };
 
+// Read the decoding graph of any registered type, e.g. vector or const. If
+// `mmap` is true and the graph is a ConstFst written aligned (see
+// fstmakeconst), it is memory mapped rather than read, so the loading is
+// instant and the pages are shared by all the processes using the file.
+std::shared_ptr<fst::Fst<fst::StdArc>> ReadFst(const std::string& path,
+                                               bool mmap = true);
+
 // DecodeResource is thread safe, which can be shared for multiple
 // decoding threads
 struct DecodeResource {
   std::shared_ptr<AsrModel> model = nullptr;
   std::shared_ptr<fst::SymbolTable> symbol_table = nullptr;
-  std::shared_ptr<fst::VectorFst<fst::StdArc>> fst = nullptr;
+  // VectorFst or ConstFst, the latter may be memory mapped, see ReadFst
+  std::shared_ptr<fst::Fst<fst::StdArc>> fst = nullptr;
   std::shared_ptr<fst::SymbolTable> unit_table = nullptr;
-  std::shared_ptr<ContextGraph> context_graph = nullptr;
+  // Segments the context phrases into the units of unit_table
+  std::shared_ptr<UnitTrie> unit_trie = nullptr;
+  std::shared_ptr<const ContextGraph> context_graph = nullptr;
   std::shared_ptr<PostProcessor> post_processor = nullptr;
+  // Optional, the servers run the rescoring of the segments of continuous
+  // decoding here, see AsrDecoder::DetachRescoring
+  std::shared_ptr<ThreadPool> rescoring_pool = nullptr;
+  // Optional, the compiled graphs of the session hotwords
+  std::shared_ptr<ContextGraphCache> context_graph_cache = nullptr;
+  // Optional, admit the new sessions by the decode load, the decoders
+  // report the cost of their chunks to it
+  std::shared_ptr<AdmissionController> admission_controller = nullptr;
+};
+
+// The resource of a session biased to its own hotwords, or to the cached
+// hotwords of `context_key` if `hotwords` is empty. It shares everything
+// with `resource` but the context graph, whose hotwords overlay the ones of
+// `resource`. `context_key` is set to the key of the hotwords if they are
+// cached. Return nullptr and set `error` if the key is not cached, the
+// hotwords exceed the limits of ContextConfig, or they can't be compiled
+// without the unit table or over the context graph of `resource`.
+std::shared_ptr<DecodeResource> SessionResource(
+    const std::shared_ptr<DecodeResource>& resource,
+    const std::vector<std::string>& hotwords, float hotwords_score,
+    std::string* context_key, std::string* error);
+
+// The attention rescoring of a finished segment, it owns everything it
+// needs, so it can run in any thread while the decoder goes on.
+class RescoringTask {
+ public:
+  // The model of a detached segment goes back to its pool
+  ~RescoringTask();
+  // Rescore and rerank result()
+  void Run();
+  const std::vector<DecodeResult>& result() const { return result_; }
+
+ private:
+  friend class AsrDecoder;
+
+  std::vector<DecodeResult> result_;
+  std::vector<std::vector<int>> hypotheses_;
+  // nullptr if there is nothing to rescore
+  std::shared_ptr<AsrModel> model_ = nullptr;
+  // Set if model_ is detached from the decoder, see DetachRescoring
+  std::shared_ptr<AsrModelPool> model_pool_ = nullptr;
+  std::shared_ptr<RescoringGate> rescoring_gate_ = nullptr;
+  const DecodeOptions* opts_ = nullptr;
+  int utterance_ms_ = 0;
 };
 
 // Torch ASR decoder
@@ -104,10 +175,27 @@ class AsrDecoder {
   AsrDecoder(std::shared_ptr<FeaturePipeline> feature_pipeline,
              std::shared_ptr<DecodeResource> resource,
              const DecodeOptions& opts);
+  ~AsrDecoder();
   // @param block: if true, block when feature is not enough for one chunk
   //               inference. Otherwise, return kWaitFeats.
   DecodeState Decode(bool block = true);
+  // Decode a batch of complete utterances at once, the offline counterpart
+  // of Decode. The encoder runs per utterance, then the CTC prefix beam
+  // searches of all of them run in `batch_search`. Every decoder must have
+  // all its features and search by CtcPrefixBeamSearch in the non streaming
+  // mode. Rescoring() gives the final results after it.
+  static void DecodeBatch(const std::vector<AsrDecoder*>& decoders,
+                          BatchCtcPrefixBeamSearch* batch_search);
+  // Whether Decode(false) would decode rather than return kWaitFeats, it
+  // can be called by any thread, see DecodeScheduler
+  bool ReadyToDecode() const {
+    return feature_pipeline_->Ready(model_->num_frames_for_chunk(start_));
+  }
   void Rescoring();
+  // Finish the search of the segment, so result() is the CTC final result,
+  // and return its rescoring as a task instead of running it. The decoder
+  // can ResetContinuousDecoding and go on with the next segment at once.
+  std::shared_ptr<RescoringTask> DetachRescoring();
   void Reset();
   void ResetContinuousDecoding();
   bool DecodedSomething() const {
@@ -128,26 +216,35 @@ class AsrDecoder {
            feature_pipeline_->config().sample_rate;
   }
   const std::vector<DecodeResult>& result() const { return result_; }
+  // Bytes held by the decoding states of this session, see
+  // AsrModel::MemoryUsage. It's also in Metrics after every chunk.
+  size_t MemoryUsage() const;
 
  private:
   DecodeState AdvanceDecoding(bool block = true);
   void AttentionRescoring();
+  std::shared_ptr<RescoringTask> FinishSegment();
 
   void UpdateResult(bool finish = false);
+  // Update the memory of this session in Metrics
+  void ReportMemoryUsage();
 
   std::shared_ptr<FeaturePipeline> feature_pipeline_;
   std::shared_ptr<AsrModel> model_;
+  // The models of the detached segments, see DetachRescoring
+  std::shared_ptr<AsrModelPool> model_pool_;
   std::shared_ptr<PostProcessor> post_processor_;
-  std::shared_ptr<ContextGraph> context_graph_;
+  std::shared_ptr<const ContextGraph> context_graph_;
+  std::shared_ptr<AdmissionController> admission_controller_;
 
-  std::shared_ptr<fst::VectorFst<fst::StdArc>> fst_ = nullptr;
+  std::shared_ptr<fst::Fst<fst::StdArc>> fst_ = nullptr;
   // output symbol table
   std::shared_ptr<fst::SymbolTable> symbol_table_;
   // e2e unit symbol table
   std::shared_ptr<fst::SymbolTable> unit_table_ = nullptr;
   const DecodeOptions& opts_;
   // cache feature
-  bool start_ = false;
+  std::atomic<bool> start_{false};
   // For continuous decoding
   int num_frames_ = 0;
   int global_frame_offset_ = 0;
@@ -155,9 +252,19 @@ class AsrDecoder {
 
   std::unique_ptr<SearchInterface> searcher_;
   std::unique_ptr<CtcEndpoint> ctc_endpointer_;
+  std::shared_ptr<RescoringGate> rescoring_gate_;
 
   int num_frames_in_current_chunk_ = 0;
   std::vector<DecodeResult> result_;
+  // Top k and blank scores of the CTC outputs of the current chunk
+  CtcFrameSummaries ctc_summaries_;
+  // For the session latencies in Metrics, the final latency is measured
+  // from the start of the last chunk of the segment
+  Timer session_timer_;
+  Timer chunk_timer_;
+  bool first_partial_observed_ = false;
+  // The memory of this session in Metrics
+  size_t reported_memory_ = 0;
 
  public:
   WENET_DISALLOW_COPY_AND_ASSIGN(AsrDecoder);
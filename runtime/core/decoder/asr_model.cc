@@ -2,9 +2,13 @@
 
 #include "decoder/asr_model.h"
 
+#include <cstring>
 #include <memory>
 #include <utility>
 
+#include "utils/log.h"
+#include "utils/trace.h"
+
 namespace wenet {
 
 int AsrModel::num_frames_for_chunk(bool start) const {
@@ -22,6 +26,22 @@ int AsrModel::num_frames_for_chunk(bool start) const {
   return num_required_frames;
 }
 
+int AsrModel::required_cache_size() const {
+  if (num_left_chunks_ < 0 && max_cache_frames_ > 0) {
+    return max_cache_frames_;
+  }
+  return chunk_size_ * num_left_chunks_;
+}
+
+size_t AsrModel::MemoryUsage() const {
+  size_t bytes = 0;
+  for (const auto& feat : cached_feature_) {
+    bytes += feat.capacity() * sizeof(float);
+  }
+  bytes += feats_.capacity() * sizeof(float);
+  return bytes;
+}
+
 void AsrModel::CacheFeature(
     const std::vector<std::vector<float>>& chunk_feats) {
   // Cache feature for next chunk
@@ -39,9 +59,73 @@ void AsrModel::CacheFeature(
   }
 }
 
+void AsrModel::CacheFeature(const float* chunk_feats, int num_frames,
+                            int feature_dim) {
+  // Cache feature for next chunk, the same as the above
+  const int cached_feature_size = 1 + right_context_ - subsampling_rate_;
+  if (num_frames >= cached_feature_size) {
+    cached_feature_.resize(cached_feature_size);
+    const float* start =
+        chunk_feats + (num_frames - cached_feature_size) * feature_dim;
+    for (int i = 0; i < cached_feature_size; ++i) {
+      cached_feature_[i].assign(start + i * feature_dim,
+                                start + (i + 1) * feature_dim);
+    }
+  }
+}
+
+std::vector<float>* AsrModel::BeginChunk(int feature_dim) {
+  int num_cached = cached_feature_.size();
+  feats_.resize(static_cast<size_t>(num_cached) * feature_dim);
+  float* data = feats_.data();
+  for (int i = 0; i < num_cached; ++i) {
+    CHECK_EQ(static_cast<int>(cached_feature_[i].size()), feature_dim);
+    memcpy(data, cached_feature_[i].data(), sizeof(float) * feature_dim);
+    data += feature_dim;
+  }
+  return &feats_;
+}
+
+void AsrModel::ForwardEncoderFunc(const float* feats, int num_frames,
+                                  int feature_dim,
+                                  std::vector<std::vector<float>>* ctc_prob) {
+  // The rows version splices cached_feature_ itself
+  int num_cached = cached_feature_.size();
+  chunk_rows_.resize(num_frames - num_cached);
+  for (int i = num_cached; i < num_frames; ++i) {
+    chunk_rows_[i - num_cached].assign(feats + i * feature_dim,
+                                       feats + (i + 1) * feature_dim);
+  }
+  this->ForwardEncoderFunc(chunk_rows_, ctc_prob);
+}
+
+void AsrModel::ForwardEncoder(const float* chunk_feats, int num_frames,
+                              int feature_dim,
+                              std::vector<std::vector<float>>* ctc_prob) {
+  std::vector<float>* feats = BeginChunk(feature_dim);
+  feats->insert(feats->end(), chunk_feats,
+                chunk_feats + static_cast<size_t>(num_frames) * feature_dim);
+  ForwardEncoder(feature_dim, ctc_prob);
+}
+
+void AsrModel::ForwardEncoder(int feature_dim,
+                              std::vector<std::vector<float>>* ctc_prob) {
+  WENET_TRACE_SCOPE("AsrModel::ForwardEncoder");
+  ctc_prob->clear();
+  int num_cached = cached_feature_.size();
+  int total_frames = feats_.size() / feature_dim;
+  if (total_frames >= right_context_ + 1) {
+    this->ForwardEncoderFunc(feats_.data(), total_frames, feature_dim,
+                             ctc_prob);
+    this->CacheFeature(feats_.data() + num_cached * feature_dim,
+                       total_frames - num_cached, feature_dim);
+  }
+}
+
 void AsrModel::ForwardEncoder(
     const std::vector<std::vector<float>>& chunk_feats,
     std::vector<std::vector<float>>* ctc_prob) {
+  WENET_TRACE_SCOPE("AsrModel::ForwardEncoder");
   ctc_prob->clear();
   int num_frames = cached_feature_.size() + chunk_feats.size();
   if (num_frames >= right_context_ + 1) {
@@ -50,4 +134,22 @@ void AsrModel::ForwardEncoder(
   }
 }
 
+std::shared_ptr<AsrModel> AsrModelPool::Take() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!spare_models_.empty()) {
+      std::shared_ptr<AsrModel> model = std::move(spare_models_.back());
+      spare_models_.pop_back();
+      return model;
+    }
+  }
+  return model_->Copy();
+}
+
+void AsrModelPool::Return(std::shared_ptr<AsrModel> model) {
+  model->Reset();
+  std::lock_guard<std::mutex> lock(mutex_);
+  spare_models_.push_back(std::move(model));
+}
+
 }  // namespace wenet
@@ -5,6 +5,7 @@
 
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -24,11 +25,28 @@ class AsrModel {
   }
   virtual int offset() const { return offset_; }
 
+  // Whether the chunk size can change at runtime, the exported ONNX and the
+  // other fixed shape models take the chunk shapes of their export
+  virtual bool dynamic_chunk_size() const { return false; }
   // If chunk_size > 0, streaming case. Otherwise, none streaming case
   virtual void set_chunk_size(int chunk_size) { chunk_size_ = chunk_size; }
   virtual void set_num_left_chunks(int num_left_chunks) {
     num_left_chunks_ = num_left_chunks;
   }
+  // If num_left_chunks < 0, the attention cache keeps all the left frames,
+  // and it's bounded to the last `max_cache_frames` ones if it's > 0
+  virtual void set_max_cache_frames(int max_cache_frames) {
+    max_cache_frames_ = max_cache_frames;
+  }
+  // The encoder outputs are only kept for AttentionRescoring, otherwise only
+  // the one of the current chunk is kept. The kept ones grow with the
+  // segment until Reset, they are bounded by the endpoint of the segment
+  // length, see CtcEndpointConfig::rule3.
+  virtual void set_keep_encoder_outs(bool keep_encoder_outs) {
+    keep_encoder_outs_ = keep_encoder_outs;
+  }
+  // Frames of the attention cache kept for the next chunk, < 0 means all
+  int required_cache_size() const;
   // start: if it is the start chunk of one sentence
   virtual int num_frames_for_chunk(bool start) const;
 
@@ -37,6 +55,18 @@ class AsrModel {
   virtual void ForwardEncoder(
       const std::vector<std::vector<float>>& chunk_feats,
       std::vector<std::vector<float>>* ctc_prob);
+  // Same as the above, `chunk_feats` is (num_frames x feature_dim) row major
+  // in one contiguous buffer, it is copied once to the encoder input.
+  virtual void ForwardEncoder(const float* chunk_feats, int num_frames,
+                              int feature_dim,
+                              std::vector<std::vector<float>>* ctc_prob);
+  // The zero copy version of the above. BeginChunk returns the encoder input
+  // holding the cached frames of the last chunk, the caller appends the
+  // frames of the chunk behind them, e.g. by FeaturePipeline::ReadAppend,
+  // and then calls ForwardEncoder(feature_dim, ...) on them.
+  std::vector<float>* BeginChunk(int feature_dim);
+  void ForwardEncoder(int feature_dim,
+                      std::vector<std::vector<float>>* ctc_prob);
 
   virtual void AttentionRescoring(const std::vector<std::vector<int>>& hyps,
                                   float reverse_weight,
@@ -44,11 +74,23 @@ class AsrModel {
 
   virtual std::shared_ptr<AsrModel> Copy() const = 0;
 
+  // Bytes held by the decoding states of the session, e.g. the caches and
+  // the encoder outputs, the weights shared by the sessions are excluded
+  virtual size_t MemoryUsage() const;
+
  protected:
   virtual void ForwardEncoderFunc(
       const std::vector<std::vector<float>>& chunk_feats,
       std::vector<std::vector<float>>* ctc_prob) = 0;
+  // `feats` is the encoder input of (num_frames x feature_dim), the cached
+  // frames followed by the chunk. The default implementation converts the
+  // chunk to rows and calls the above one, backends taking a contiguous
+  // input should override it.
+  virtual void ForwardEncoderFunc(const float* feats, int num_frames,
+                                  int feature_dim,
+                                  std::vector<std::vector<float>>* ctc_prob);
   virtual void CacheFeature(const std::vector<std::vector<float>>& chunk_feats);
+  void CacheFeature(const float* chunk_feats, int num_frames, int feature_dim);
 
   int right_context_ = 1;
   int subsampling_rate_ = 1;
@@ -57,9 +99,39 @@ class AsrModel {
   bool is_bidirectional_decoder_ = false;
   int chunk_size_ = 16;
   int num_left_chunks_ = -1;  // -1 means all left chunks
+  int max_cache_frames_ = -1;  // -1 means unbounded
+  bool keep_encoder_outs_ = true;
   int offset_ = 0;
 
   std::vector<std::vector<float>> cached_feature_;
+  // Contiguous encoder input of the chunk, see BeginChunk, it's reused
+  // across the chunks
+  std::vector<float> feats_;
+  // Reused buffer of the default contiguous ForwardEncoderFunc
+  std::vector<std::vector<float>> chunk_rows_;
+};
+
+// Spare session models of a decoder. The model of a detached segment goes
+// with its rescoring, and comes back here when the rescoring is done, so
+// the next segments reuse its encoder memory and the preallocated buffers
+// of the backend instead of a new Copy() per segment. The models may come
+// back from any thread.
+class AsrModelPool {
+ public:
+  explicit AsrModelPool(std::shared_ptr<AsrModel> model)
+      : model_(std::move(model)) {}
+  // A spare model, or a new Copy() of the model if there is none
+  std::shared_ptr<AsrModel> Take();
+  // Reset `model` and keep it for Take
+  void Return(std::shared_ptr<AsrModel> model);
+
+ private:
+  std::shared_ptr<AsrModel> model_;
+  std::mutex mutex_;
+  std::vector<std::shared_ptr<AsrModel>> spare_models_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(AsrModelPool);
 };
 
 }  // namespace wenet
@@ -0,0 +1,85 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/batch_ctc_prefix_beam_search.h"
+
+#include <algorithm>
+#include <future>
+#include <utility>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+BatchCtcPrefixBeamSearch::BatchCtcPrefixBeamSearch(
+    const CtcPrefixBeamSearchOptions& opts, ThreadPool* pool)
+    : opts_(opts), pool_(pool) {}
+
+void BatchCtcPrefixBeamSearch::Search(const float* logp, int batch_size,
+                                      int max_len, int vocab_size,
+                                      const std::vector<int>& lengths) {
+  batch_size_ = batch_size;
+  while (static_cast<int>(searchers_.size()) < batch_size_) {
+    searchers_.emplace_back(new CtcPrefixBeamSearch(opts_));
+  }
+  std::vector<CtcPrefixBeamSearch*> searchers(batch_size);
+  for (int b = 0; b < batch_size; ++b) {
+    searchers_[b]->Reset();
+    searchers[b] = searchers_[b].get();
+  }
+  Search(logp, batch_size, max_len, vocab_size, lengths, searchers);
+  for (int b = 0; b < batch_size; ++b) searchers_[b]->FinalizeSearch();
+}
+
+void BatchCtcPrefixBeamSearch::Search(
+    const float* logp, int batch_size, int max_len, int vocab_size,
+    const std::vector<int>& lengths,
+    const std::vector<CtcPrefixBeamSearch*>& searchers) {
+  CHECK_EQ(static_cast<int>(lengths.size()), batch_size);
+  CHECK_EQ(static_cast<int>(searchers.size()), batch_size);
+  int k = std::min(vocab_size, opts_.first_beam_size);
+  size_t num_rows = static_cast<size_t>(batch_size) * max_len;
+  topk_score_.resize(num_rows * k);
+  topk_index_.resize(num_rows * k);
+
+  // The top k of utterance b are written to its own rows of the shared
+  // buffers, so the utterances don't depend on each other. Only the valid
+  // frames are computed, the padding is skipped.
+  auto search = [&](int b) {
+    CHECK_LE(lengths[b], max_len);
+    size_t row = static_cast<size_t>(b) * max_len;
+    BatchTopK(logp + row * vocab_size, lengths[b], vocab_size, k,
+              topk_score_.data() + row * k, topk_index_.data() + row * k);
+    searchers[b]->Search(topk_score_.data() + row * k,
+                         topk_index_.data() + row * k, lengths[b], k);
+  };
+  if (pool_ == nullptr || batch_size <= 1) {
+    for (int b = 0; b < batch_size; ++b) search(b);
+  } else {
+    std::vector<std::future<void>> futures;
+    futures.reserve(batch_size);
+    for (int b = 0; b < batch_size; ++b) {
+      futures.emplace_back(pool_->enqueue(search, b));
+    }
+    for (auto& future : futures) future.get();
+  }
+}
+
+const CtcPrefixBeamSearch& BatchCtcPrefixBeamSearch::Result(int b) const {
+  CHECK_GE(b, 0);
+  CHECK_LT(b, batch_size_);
+  return *searchers_[b];
+}
+
+}  // namespace wenet
@@ -0,0 +1,73 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_BATCH_CTC_PREFIX_BEAM_SEARCH_H_
+#define DECODER_BATCH_CTC_PREFIX_BEAM_SEARCH_H_
+
+#include <memory>
+#include <vector>
+
+#include "decoder/ctc_prefix_beam_search.h"
+#include "utils/thread_pool.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// CTC prefix beam search of a batch of utterances, e.g. the CTC output of
+// a batched offline encoder forward, see AsrDecoder::DecodeBatch. Every
+// utterance is one task, which does the first beam prune (BatchTopK) of its
+// valid frames into the shared buffers and then searches them, so the
+// utterances run in parallel if a thread pool is given. The buffers and
+// the searchers are reused across the batches.
+class BatchCtcPrefixBeamSearch {
+ public:
+  // `pool` is optional and not owned, it must outlive the search
+  explicit BatchCtcPrefixBeamSearch(const CtcPrefixBeamSearchOptions& opts,
+                                    ThreadPool* pool = nullptr);
+
+  // Search `batch_size` complete utterances, `logp` is the
+  // (batch_size x max_len x vocab_size) row major CTC log probs, and
+  // utterance b has lengths[b] <= max_len valid frames. The previous
+  // results are reset.
+  void Search(const float* logp, int batch_size, int max_len, int vocab_size,
+              const std::vector<int>& lengths);
+  // Same as the above, but utterance b is searched by searchers[b], e.g.
+  // the one of its decoder. They are neither reset nor finalized, like the
+  // searchers of the streaming decoding.
+  void Search(const float* logp, int batch_size, int max_len, int vocab_size,
+              const std::vector<int>& lengths,
+              const std::vector<CtcPrefixBeamSearch*>& searchers);
+
+  int batch_size() const { return batch_size_; }
+  // The search result of utterance `b`, see CtcPrefixBeamSearch
+  const CtcPrefixBeamSearch& Result(int b) const;
+
+ private:
+
+  CtcPrefixBeamSearchOptions opts_;
+  ThreadPool* pool_;
+  int batch_size_ = 0;
+  // One searcher per utterance, they are reused across the batches
+  std::vector<std::unique_ptr<CtcPrefixBeamSearch>> searchers_;
+  // (batch_size x max_len x k) row major top k of all the frames
+  std::vector<float> topk_score_;
+  std::vector<int32_t> topk_index_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(BatchCtcPrefixBeamSearch);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_BATCH_CTC_PREFIX_BEAM_SEARCH_H_
@@ -14,239 +14,576 @@
 
 #include "decoder/context_graph.h"
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
 #include <fstream>
-#include <queue>
+#include <functional>
+#include <iterator>
+#include <limits>
 #include <utility>
 
-#include "fst/determinize.h"
-
+#include "utils/log.h"
 #include "utils/string.h"
 #include "utils/utils.h"
 
 namespace wenet {
 
-// Split the UTF-8 string into unit ids according to unit_table
-bool SplitContextToUnits(const std::string& context,
-                         const std::shared_ptr<fst::SymbolTable>& unit_table,
-                         std::vector<int>* units) {
-  std::vector<std::string> chars;
-  SplitUTF8StringToChars(context, &chars);
+namespace {
 
-  bool no_oov = true;
-  bool beginning = true;
-  for (size_t start = 0; start < chars.size();) {
-    for (size_t end = chars.size(); end > start; --end) {
-      std::string unit;
-      for (size_t i = start; i < end; i++) {
-        unit += chars[i];
-      }
-      // Add '▁' at the beginning of English word.
-      // TODO(zhendong.peng): Support bpe model
-      if (IsAlpha(unit) && beginning) {
-        unit = kSpaceSymbol + unit;
-      }
+const char kContextGraphMagic[4] = {'W', 'C', 'T', 'X'};
+const int32_t kContextGraphVersion = 1;
 
-      int unit_id = unit_table->Find(unit);
-      if (unit_id != -1) {
-        units->emplace_back(unit_id);
-        start = end;
-        beginning = false;
-        continue;
+// The image is the header, then the arrays of ContextGraph in the order of
+// the members, they are all 4 bytes, and the phrase data at last
+struct ContextGraphHeader {
+  char magic[4];
+  int32_t version;
+  int32_t num_states;
+  int32_t root_size;
+  int32_t num_phrases;
+  int32_t phrase_bytes;
+  float context_score;
+  float incremental_context_score;
+};
+
+size_t ImageSize(const ContextGraphHeader& header) {
+  int64_t num_states = header.num_states;
+  int64_t num_words = (num_states + 1) + (num_states - 1) + header.root_size +
+                      5 * num_states + (header.num_phrases + 1);
+  return sizeof(header) + num_words * 4 + header.phrase_bytes;
+}
+
+template <typename T>
+void AppendTo(const std::vector<T>& data, std::vector<char>* image) {
+  const char* bytes = reinterpret_cast<const char*>(data.data());
+  image->insert(image->end(), bytes, bytes + data.size() * sizeof(T));
+}
+
+int FindChildIn(const int32_t* arc_begin, const int32_t* arc_units,
+                const int32_t* root_next, int root_size, int state,
+                int unit_id) {
+  if (state == 0) {
+    return unit_id >= 0 && unit_id < root_size ? root_next[unit_id] : -1;
+  }
+  const int32_t* begin = arc_units + arc_begin[state];
+  const int32_t* end = arc_units + arc_begin[state + 1];
+  const int32_t* it = std::lower_bound(begin, end, unit_id);
+  return it != end && *it == unit_id ? it - arc_units + 1 : -1;
+}
+
+}  // namespace
+
+UnitTrie::UnitTrie(const fst::SymbolTable& unit_table) : nodes_(1) {
+  bool has_upper = false;
+  bool has_lower = false;
+  for (int i = 0; i < unit_table.NumSymbols(); ++i) {
+    int unit_id = unit_table.GetNthKey(i);
+    std::string unit = unit_table.Find(unit_id);
+    // The case of the symbols like <blank> doesn't matter
+    bool is_symbol = unit.size() > 2 && unit.front() == '<' &&
+                     unit.back() == '>';
+    int node = 0;
+    for (unsigned char byte : unit) {
+      int child = FindChild(node, byte);
+      if (child < 0) {
+        child = nodes_.size();
+        auto& children = nodes_[node].children;
+        children.insert(
+            std::lower_bound(children.begin(), children.end(),
+                             std::make_pair(byte, 0)),
+            std::make_pair(byte, child));
+        nodes_.emplace_back();
       }
+      node = child;
+      has_upper = has_upper || (!is_symbol && isupper(byte));
+      has_lower = has_lower || (!is_symbol && islower(byte));
+    }
+    if (node > 0) nodes_[node].unit_id = unit_id;
+    fingerprint_ = fingerprint_ * 31 + (std::hash<std::string>()(unit) ^
+                                        static_cast<size_t>(unit_id));
+  }
+  space_node_ = 0;
+  for (unsigned char byte : std::string(kSpaceSymbol)) {
+    space_node_ = FindChild(space_node_, byte);
+    if (space_node_ < 0) break;
+  }
+  upper_case_ = has_upper && !has_lower;
+  lower_case_ = has_lower && !has_upper;
+}
+
+int UnitTrie::FindChild(int node, unsigned char byte) const {
+  const auto& children = nodes_[node].children;
+  auto it = std::lower_bound(children.begin(), children.end(),
+                             std::make_pair(byte, 0));
+  return it != children.end() && it->first == byte ? it->second : -1;
+}
 
-      if (end == start + 1) {
+int UnitTrie::LongestMatch(int node, const std::string& text, size_t pos,
+                           int* unit_id) const {
+  int length = 0;
+  for (size_t i = pos; i < text.size() && text[i] != ' '; ++i) {
+    node = FindChild(node, text[i]);
+    if (node < 0) break;
+    if (nodes_[node].unit_id >= 0) {
+      length = i + 1 - pos;
+      *unit_id = nodes_[node].unit_id;
+    }
+  }
+  return length;
+}
+
+bool UnitTrie::Split(const std::string& context,
+                     std::vector<int>* units) const {
+  std::string text = context;
+  if (upper_case_ || lower_case_) {
+    for (auto& c : text) {
+      unsigned char byte = c;
+      c = upper_case_ ? toupper(byte) : tolower(byte);
+    }
+  }
+
+  bool no_oov = true;
+  bool beginning = true;
+  for (size_t pos = 0; pos < text.size();) {
+    if (text[pos] == ' ') {
+      beginning = true;
+      ++pos;
+      continue;
+    }
+    int unit_id = -1;
+    int length = 0;
+    // Add '▁' at the beginning of English word.
+    if (beginning && space_node_ >= 0 &&
+        isalpha(static_cast<unsigned char>(text[pos]))) {
+      length = LongestMatch(space_node_, text, pos, &unit_id);
+      if (length == 0 && nodes_[space_node_].unit_id >= 0) {
         // Matching using '▁' separately for English
-        if (unit[0] == kSpaceSymbol[0]) {
-          units->emplace_back(unit_table->Find(kSpaceSymbol));
-          beginning = false;
-          break;
-        }
-        ++start;
-        if (unit == " ") {
-          beginning = true;
-          continue;
-        }
-        no_oov = false;
-        LOG(WARNING) << unit << " is oov.";
+        units->emplace_back(nodes_[space_node_].unit_id);
+        beginning = false;
+        continue;
       }
     }
+    if (length == 0) {
+      length = LongestMatch(0, text, pos, &unit_id);
+    }
+    if (length > 0) {
+      units->emplace_back(unit_id);
+      pos += length;
+      beginning = false;
+      continue;
+    }
+    // Skip the oov char
+    size_t end = pos + 1;
+    while (end < text.size() && (text[end] & 0xC0) == 0x80) ++end;
+    no_oov = false;
+    LOG(WARNING) << context.substr(pos, end - pos) << " is oov.";
+    pos = end;
   }
   return no_oov;
 }
 
-ContextGraph::ContextGraph(ContextConfig config) : config_(config) {}
+bool SplitContextToUnits(const std::string& context,
+                         const std::shared_ptr<fst::SymbolTable>& unit_table,
+                         std::vector<int>* units) {
+  return UnitTrie(*unit_table).Split(context, units);
+}
 
-int ContextGraph::TraceContext(int cur_state, int unit_id, int* final_state) {
-  CHECK_GE(cur_state, 0);
-  int next_state = 0;
-  Matcher matcher(*graph_, fst::MATCH_INPUT);
-  matcher.SetState(cur_state);
-  if (matcher.Find(unit_id)) {
-    next_state = matcher.Value().nextstate;
-    if (graph_->Final(next_state) != Weight::Zero()) {
-      *final_state = next_state;
+std::string CheckContextLimits(const std::vector<std::string>& contexts,
+                               const ContextConfig& config) {
+  if (contexts.size() > static_cast<size_t>(config.max_contexts)) {
+    return "Too many hotwords, at most " +
+           std::to_string(config.max_contexts) + " are allowed";
+  }
+  for (const auto& context : contexts) {
+    if (UTF8StringLength(context) > config.max_context_length) {
+      return "Hotword is too long, at most " +
+             std::to_string(config.max_context_length) +
+             " characters are allowed";
     }
-    return next_state;
   }
-  LOG(FATAL) << "Trace context failed.";
+  return "";
 }
 
-void ContextGraph::BuildContextGraph(
+ContextGraph::ContextGraph(ContextConfig config) : config_(config) {}
+
+bool ContextGraph::BuildContextGraph(
     const std::vector<std::string>& contexts,
-    const std::shared_ptr<fst::SymbolTable>& unit_table) {
-  // Split context phrase into unit ids according to the `unit_table`
-  std::unordered_map<std::string, std::vector<int>> context_units;
-  for (const auto& context : contexts) {
+    const std::shared_ptr<fst::SymbolTable>& unit_table,
+    std::shared_ptr<const ContextGraph> base) {
+  return BuildContextGraph(contexts, UnitTrie(*unit_table), std::move(base));
+}
+
+bool ContextGraph::BuildContextGraph(
+    const std::vector<std::string>& contexts, const UnitTrie& unit_trie,
+    std::shared_ptr<const ContextGraph> base) {
+  CHECK(base == nullptr || base->base_ == nullptr)
+      << "The base of an overlay must not be an overlay.";
+  base_ = std::move(base);
+  // The state of an overlay is the pair of the states, it must fit in int
+  int64_t max_states = std::numeric_limits<int32_t>::max();
+  if (base_ != nullptr) max_states /= base_->NumStates();
+
+  // Split context phrase into unit ids according to the `unit_trie`, the
+  // phrases are the units and the index of the context
+  std::vector<std::pair<std::vector<int>, int>> phrases;
+  int64_t num_trie_states = 1;
+  for (size_t i = 0; i < contexts.size(); ++i) {
     std::vector<int> units;
-    bool no_oov = SplitContextToUnits(context, unit_table, &units);
-    if (!no_oov) {
+    bool no_oov = unit_trie.Split(contexts[i], &units);
+    if (!no_oov || std::any_of(units.begin(), units.end(),
+                               [](int unit) { return unit <= 0; })) {
       LOG(WARNING) << "Ignore unknown unit found during compilation.";
       continue;
     }
-    context_units[context] = units;
+    if (units.empty()) continue;
+    if (base_ != nullptr && base_->HasPhrase(units)) continue;
+    num_trie_states += units.size();
+    if (num_trie_states > max_states) {
+      LOG(WARNING) << "Too many contexts, " << contexts.size()
+                   << " contexts over a base graph of "
+                   << (base_ != nullptr ? base_->NumStates() : 1)
+                   << " states";
+      return false;
+    }
+    phrases.emplace_back(std::move(units), i);
   }
+  // After sorting, the children of every trie node are added in order. It's
+  // stable, so the first of the contexts of the same units is kept.
+  std::stable_sort(phrases.begin(), phrases.end(),
+                   [](const std::pair<std::vector<int>, int>& a,
+                      const std::pair<std::vector<int>, int>& b) {
+                     return a.first < b.first;
+                   });
 
-  // Build the context graph
-  std::unique_ptr<fst::StdVectorFst> ofst(new fst::StdVectorFst());
-  int start_state = ofst->AddState();
-  ofst->SetStart(start_state);
-  for (const auto& context : contexts) {
-    if (context_units.count(context) == 0) continue;
-    std::vector<int> units = context_units[context];
-    int state = start_state;
-    int next_state = state;
-    for (size_t i = 0; i < units.size(); ++i) {
-      next_state = ofst->AddState();
-      if (i == units.size() - 1) {
-        ofst->SetFinal(next_state, Weight::One());
+  // Build the trie, the children of a node are a linked list
+  struct TrieNode {
+    int unit = 0;
+    int first_child = -1;
+    int last_child = -1;
+    int next_sibling = -1;
+    int phrase_id = -1;
+  };
+  std::vector<TrieNode> trie(1);
+  std::vector<int> phrase_contexts;  // Phrase id to the index of contexts
+  for (const auto& phrase : phrases) {
+    int node = 0;
+    for (int unit : phrase.first) {
+      int child = trie[node].last_child;
+      if (child < 0 || trie[child].unit != unit) {
+        int new_child = trie.size();
+        trie.emplace_back();
+        trie[new_child].unit = unit;
+        if (child < 0) {
+          trie[node].first_child = new_child;
+        } else {
+          trie[child].next_sibling = new_child;
+        }
+        trie[node].last_child = new_child;
+        child = new_child;
       }
-      float score =
-          i * config_.incremental_context_score + config_.context_score;
-      ofst->AddArc(state, fst::StdArc(units[i], units[i], score, next_state));
-      state = next_state;
+      node = child;
+    }
+    if (trie[node].phrase_id < 0) {
+      trie[node].phrase_id = phrase_contexts.size();
+      phrase_contexts.push_back(phrase.second);
     }
   }
-  graph_ = std::unique_ptr<fst::StdVectorFst>(new fst::StdVectorFst());
-  // input/output label are sorted after Determinize
-  fst::Determinize(*ofst, graph_.get());
 
-  // Determinize will change the final state id
-  for (const auto& context : contexts) {
-    if (context_units.count(context) == 0) continue;
-    std::vector<int> units = context_units[context];
-    int final_state = -1;
-    int cur_state = 0;
-    for (int unit : units) {
-      cur_state = TraceContext(cur_state, unit, &final_state);
+  // Number the states in BFS order, then the arc i goes to the state i + 1
+  const int num_states = trie.size();
+  std::vector<int> order(1, 0);  // Trie nodes in BFS order
+  std::vector<int32_t> arc_begin(num_states + 1);
+  std::vector<int32_t> arc_units;
+  std::vector<int32_t> depths(num_states, 0);
+  std::vector<float> arc_scores(num_states, 0);
+  std::vector<float> total_scores(num_states, 0);
+  std::vector<int32_t> phrase_ids(num_states, -1);
+  for (int state = 0; state < num_states; ++state) {
+    arc_begin[state] = arc_units.size();
+    phrase_ids[state] = trie[order[state]].phrase_id;
+    for (int child = trie[order[state]].first_child; child >= 0;
+         child = trie[child].next_sibling) {
+      int next_state = order.size();
+      order.push_back(child);
+      arc_units.push_back(trie[child].unit);
+      depths[next_state] = depths[state] + 1;
+      arc_scores[next_state] = depths[state] *
+                                   config_.incremental_context_score +
+                               config_.context_score;
+      total_scores[next_state] = total_scores[state] + arc_scores[next_state];
     }
-    CHECK_GT(final_state, 0);
-    context_table_[final_state] = context;
   }
-
-  // Convert context graph to AC automaton
-  ConvertToAC();
-}
-
-void ContextGraph::ConvertToAC() {
-  CHECK(graph_ != nullptr) << "Context graph should not be nullptr!";
-  int num_states = graph_->NumStates();
-  std::vector<int> fail_states(num_states, 0);
-  std::vector<float> total_weights(num_states, 0);
-  Matcher matcher(*graph_, fst::MATCH_INPUT);
-  // start state
-  fail_states[0] = -1;
-  total_weights[0] = 0;
+  arc_begin[num_states] = arc_units.size();
+  int root_size = 0;
+  for (int i = arc_begin[0]; i < arc_begin[1]; ++i) {
+    root_size = std::max(root_size, arc_units[i] + 1);
+  }
+  std::vector<int32_t> root_next(root_size, -1);
+  for (int i = arc_begin[0]; i < arc_begin[1]; ++i) {
+    root_next[arc_units[i]] = i + 1;
+  }
+  auto find_child = [&](int state, int unit_id) {
+    return FindChildIn(arc_begin.data(), arc_units.data(), root_next.data(),
+                       root_size, state, unit_id);
+  };
 
   // Please see:
   // https://web.stanford.edu/group/cslipublications/cslipublications/koskenniemi-festschrift/9-mohri.pdf
-  std::queue<int> states_queue;
-  states_queue.push(0);
-  while (!states_queue.empty()) {
-    int state = states_queue.front();
-    states_queue.pop();
-
-    for (ArcIterator aiter(*graph_, state); !aiter.Done(); aiter.Next()) {
-      const fst::StdArc& arc = aiter.Value();
-      int next_state = arc.nextstate;
-      total_weights[next_state] = total_weights[state] + arc.weight.Value();
-      // Backtracking the failure state for next_state
-      for (int fail_state = fail_states[state]; fail_state != -1;
-           fail_state = fail_states[fail_state]) {
-        matcher.SetState(fail_state);
-        if (matcher.Find(arc.ilabel)) {
-          fail_states[next_state] = matcher.Value().nextstate;
+  // The failure state of a state is the longest proper suffix of it in the
+  // graph, all the states before it in BFS order are done.
+  std::vector<int32_t> ac_fail_states(num_states, 0);
+  std::vector<int32_t> output_links(num_states, -1);
+  ac_fail_states[0] = -1;
+  for (int state = 0; state < num_states; ++state) {
+    for (int i = arc_begin[state]; i < arc_begin[state + 1]; ++i) {
+      int next_state = i + 1;
+      int fail_state = 0;
+      for (int s = ac_fail_states[state]; s >= 0; s = ac_fail_states[s]) {
+        int child = find_child(s, arc_units[i]);
+        if (child >= 0) {
+          fail_state = child;
           break;
         }
       }
-      states_queue.push(next_state);
+      ac_fail_states[next_state] = fail_state;
+      output_links[next_state] = phrase_ids[fail_state] >= 0
+                                     ? fail_state
+                                     : output_links[fail_state];
     }
   }
 
-  // Compute fail weight, add fail arc
-  for (int state = 0; state < num_states; state++) {
-    int fail_state = fail_states[state];
-    if (fail_state < 0) continue;
-    if (graph_->Final(fail_state) != Weight::Zero()) {
-      fallback_finals_[state] = fail_state;
-      if (graph_->NumArcs(fail_state) == 0) continue;
+  // The fail weight backs off the score of the partial match, the score of
+  // a full match is kept. There is no failure transition if the suffix is a
+  // full match which can't be extended, or the state is a full match
+  // without a matched suffix, the search goes back to the start state.
+  std::vector<int32_t> fail_states(num_states, -1);
+  std::vector<float> fail_scores(num_states, 0);
+  for (int state = 1; state < num_states; ++state) {
+    int fail_state = ac_fail_states[state];
+    bool is_final = phrase_ids[state] >= 0;
+    if (phrase_ids[fail_state] >= 0 &&
+        arc_begin[fail_state] == arc_begin[fail_state + 1]) {
+      continue;
     }
-    if (graph_->Final(state) != Weight::Zero() && fail_state == 0) continue;
+    if (is_final && fail_state == 0) continue;
+    fail_states[state] = fail_state;
+    fail_scores[state] =
+        is_final ? 0 : total_scores[fail_state] - total_scores[state];
+  }
 
-    float fail_weight = total_weights[fail_state] - total_weights[state];
-    if (graph_->Final(state) != Weight::Zero()) {
-      fail_weight = 0;
-    }
-    graph_->AddArc(state, fst::StdArc(0, 0, fail_weight, fail_state));
+  std::vector<int32_t> phrase_offsets(1, 0);
+  std::string phrase_data;
+  for (int context : phrase_contexts) {
+    phrase_data += contexts[context];
+    phrase_offsets.push_back(phrase_data.size());
   }
-  // Sort arcs by ilabel, means move the fallback arc from last to first for the
-  // matcher
-  fst::ArcSort(graph_.get(), fst::ILabelCompare<fst::StdArc>());
+
+  // Serialize to the image
+  ContextGraphHeader header;
+  memcpy(header.magic, kContextGraphMagic, sizeof(header.magic));
+  header.version = kContextGraphVersion;
+  header.num_states = num_states;
+  header.root_size = root_size;
+  header.num_phrases = phrase_contexts.size();
+  header.phrase_bytes = phrase_data.size();
+  header.context_score = config_.context_score;
+  header.incremental_context_score = config_.incremental_context_score;
+  auto image = std::make_shared<std::vector<char>>();
+  image->reserve(ImageSize(header));
+  const char* header_data = reinterpret_cast<const char*>(&header);
+  image->insert(image->end(), header_data, header_data + sizeof(header));
+  AppendTo(arc_begin, image.get());
+  AppendTo(arc_units, image.get());
+  AppendTo(root_next, image.get());
+  AppendTo(arc_scores, image.get());
+  AppendTo(fail_states, image.get());
+  AppendTo(fail_scores, image.get());
+  AppendTo(phrase_ids, image.get());
+  AppendTo(output_links, image.get());
+  AppendTo(phrase_offsets, image.get());
+  image->insert(image->end(), phrase_data.begin(), phrase_data.end());
+  size_t size = image->size();
+  CHECK(Attach(std::shared_ptr<const char>(image, image->data()), size));
+  VLOG(1) << "Context graph of " << phrase_contexts.size() << " phrases, "
+          << num_states << " states";
+  return true;
 }
 
-int ContextGraph::GetNextState(int cur_state, int unit_id, float* score,
-                               std::unordered_set<std::string>* contexts) {
-  CHECK_GE(cur_state, 0);
-  // Find(0) matches any epsilons on the underlying FST explicitly
-  CHECK_NE(unit_id, 0);
-  int next_state = 0;
-
-  Matcher matcher(*graph_, fst::MATCH_INPUT);
-  matcher.SetState(cur_state);
-  if (matcher.Find(unit_id)) {
-    const fst::StdArc& arc = matcher.Value();
-    next_state = arc.nextstate;
-    *score += arc.weight.Value();
-    // Collect all contexts in the decode result
-    if (contexts != nullptr) {
-      if (graph_->Final(next_state) != Weight::Zero()) {
-        contexts->insert(context_table_[next_state]);
-      }
-      int fallback_final = next_state;
-      while (fallback_finals_.count(fallback_final) > 0) {
-        fallback_final = fallback_finals_[fallback_final];
-        contexts->insert(context_table_[fallback_final]);
-      }
-    }
+bool ContextGraph::Attach(std::shared_ptr<const char> image, size_t size) {
+  ContextGraphHeader header;
+  if (size < sizeof(header)) return false;
+  memcpy(&header, image.get(), sizeof(header));
+  if (memcmp(header.magic, kContextGraphMagic, sizeof(header.magic)) != 0 ||
+      header.version != kContextGraphVersion || header.num_states < 1 ||
+      header.root_size < 0 || header.num_phrases < 0 ||
+      header.phrase_bytes < 0 || size != ImageSize(header)) {
+    return false;
+  }
+  const int num_states = header.num_states;
+  const char* data = image.get() + sizeof(header);
+  auto next_ints = [&data](int count) {
+    const int32_t* ints = reinterpret_cast<const int32_t*>(data);
+    data += count * sizeof(int32_t);
+    return ints;
+  };
+  auto next_floats = [&data](int count) {
+    const float* floats = reinterpret_cast<const float*>(data);
+    data += count * sizeof(float);
+    return floats;
+  };
+  arc_begin_ = next_ints(num_states + 1);
+  arc_units_ = next_ints(num_states - 1);
+  root_next_ = next_ints(header.root_size);
+  arc_scores_ = next_floats(num_states);
+  fail_states_ = next_ints(num_states);
+  fail_scores_ = next_floats(num_states);
+  phrase_ids_ = next_ints(num_states);
+  output_links_ = next_ints(num_states);
+  phrase_offsets_ = next_ints(header.num_phrases + 1);
+  phrase_data_ = data;
+  num_states_ = num_states;
+  root_size_ = header.root_size;
+  config_.context_score = header.context_score;
+  config_.incremental_context_score = header.incremental_context_score;
+  image_ = std::move(image);
+  image_size_ = size;
+  return true;
+}
 
-    // Leaves go back to the start state
-    if (graph_->NumArcs(next_state) == 0) {
-      return 0;
+bool ContextGraph::Write(const std::string& path) const {
+  CHECK(image_ != nullptr) << "Context graph is not built!";
+  std::ofstream os(path, std::ios::binary);
+  if (!os) {
+    LOG(ERROR) << "Failed to open " << path;
+    return false;
+  }
+  os.write(image_.get(), image_size_);
+  return static_cast<bool>(os);
+}
+
+std::shared_ptr<ContextGraph> ContextGraph::Read(const std::string& path,
+                                                 bool mmap) {
+  std::shared_ptr<const char> image = nullptr;
+  size_t size = 0;
+#ifndef _WIN32
+  if (mmap) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      LOG(ERROR) << "Failed to open " << path;
+      return nullptr;
+    }
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      size = st.st_size;
+      data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) {
+      LOG(ERROR) << "Failed to map " << path;
+      return nullptr;
     }
-    return next_state;
+    image = std::shared_ptr<const char>(
+        static_cast<const char*>(data),
+        [size](const char* p) { munmap(const_cast<char*>(p), size); });
+  }
+#endif
+  if (image == nullptr) {
+    std::ifstream is(path, std::ios::binary);
+    if (!is) {
+      LOG(ERROR) << "Failed to open " << path;
+      return nullptr;
+    }
+    auto buffer = std::make_shared<std::vector<char>>(
+        std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+    size = buffer->size();
+    image = std::shared_ptr<const char>(buffer, buffer->data());
+  }
+  auto graph = std::make_shared<ContextGraph>(ContextConfig());
+  if (!graph->Attach(std::move(image), size)) {
+    LOG(ERROR) << path << " is not a valid context graph";
+    return nullptr;
+  }
+  VLOG(1) << "Read context graph of " << graph->num_states_ << " states";
+  return graph;
+}
+
+int ContextGraph::FindChild(int state, int unit_id) const {
+  return FindChildIn(arc_begin_, arc_units_, root_next_, root_size_, state,
+                     unit_id);
+}
+
+bool ContextGraph::HasPhrase(const std::vector<int>& units) const {
+  int state = 0;
+  for (int unit : units) {
+    state = FindChild(state, unit);
+    if (state < 0) return false;
   }
+  return phrase_ids_[state] >= 0;
+}
+
+int ContextGraph::NumStates() const {
+  return base_ == nullptr ? num_states_ : num_states_ * base_->num_states_;
+}
+
+bool ContextGraph::IsFinalState(int state) const {
+  if (base_ == nullptr) return phrase_ids_[state] >= 0;
+  int num_base_states = base_->num_states_;
+  return phrase_ids_[state / num_base_states] >= 0 ||
+         base_->phrase_ids_[state % num_base_states] >= 0;
+}
 
-  // Check whether the first arc is fallback arc
-  ArcIterator aiter(*graph_, cur_state);
-  const fst::StdArc& arc = aiter.Value();
-  // The start state has no fallback arc
-  if (arc.ilabel == 0) {
-    next_state = arc.nextstate;
-    *score += arc.weight.Value();
-    // fallback
-    return GetNextState(next_state, unit_id, score);
+int ContextGraph::GetNextState(
+    int cur_state, int unit_id, float* score,
+    std::unordered_set<std::string>* contexts) const {
+  CHECK_GE(cur_state, 0);
+  // 0 is the blank
+  CHECK_NE(unit_id, 0);
+  if (base_ == nullptr) {
+    return NextState(cur_state, unit_id, score, contexts);
   }
+  int num_base_states = base_->num_states_;
+  int base_state = base_->NextState(cur_state % num_base_states, unit_id,
+                                    score, contexts);
+  int state =
+      NextState(cur_state / num_base_states, unit_id, score, contexts);
+  return state * num_base_states + base_state;
+}
 
-  return 0;
+int ContextGraph::NextState(int cur_state, int unit_id, float* score,
+                            std::unordered_set<std::string>* contexts) const {
+  int state = cur_state;
+  int next_state = FindChild(state, unit_id);
+  while (next_state < 0) {
+    // Fallback, the start state has no failure transition
+    if (fail_states_[state] < 0) return 0;
+    *score += fail_scores_[state];
+    state = fail_states_[state];
+    next_state = FindChild(state, unit_id);
+  }
+  *score += arc_scores_[next_state];
+  // Collect all contexts in the decode result
+  if (contexts != nullptr) {
+    int final_state = phrase_ids_[next_state] >= 0 ? next_state
+                                                   : output_links_[next_state];
+    for (; final_state >= 0; final_state = output_links_[final_state]) {
+      int phrase_id = phrase_ids_[final_state];
+      contexts->emplace(phrase_data_ + phrase_offsets_[phrase_id],
+                        phrase_offsets_[phrase_id + 1] -
+                            phrase_offsets_[phrase_id]);
+    }
+  }
+  // Leaves go back to the start state
+  if (arc_begin_[next_state] == arc_begin_[next_state + 1]) return 0;
+  return next_state;
 }
 
 }  // namespace wenet
@@ -15,23 +15,58 @@
 #ifndef DECODER_CONTEXT_GRAPH_H_
 #define DECODER_CONTEXT_GRAPH_H_
 
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <string>
-#include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
-#include "fst/compose.h"
-#include "fst/fst.h"
-#include "fst/matcher.h"
-#include "fst/vector-fst.h"
+#include "fst/symbol-table.h"
+
+#include "utils/utils.h"
 
 namespace wenet {
 
-using ArcIterator = fst::ArcIterator<fst::StdFst>;
-using Matcher = fst::SortedMatcher<fst::StdFst>;
-using Weight = fst::StdArc::Weight;
+// Prefix trie of the units over their UTF-8 bytes, it's built once for the
+// unit table and segments the phrases by one left to right pass.
+class UnitTrie {
+ public:
+  explicit UnitTrie(const fst::SymbolTable& unit_table);
+  // Split the UTF-8 phrase into unit ids by the longest match. A word
+  // starting with a letter prefers the units with the leading '▁' of the
+  // BPE/sentencepiece models, and the letters are converted to the case of
+  // the units if all of them are upper (or lower) case. Return whether
+  // there is no oov, the oov chars are skipped.
+  bool Split(const std::string& context, std::vector<int>* units) const;
+  // Hash of the units and their ids
+  size_t fingerprint() const { return fingerprint_; }
+
+ private:
+  struct Node {
+    int unit_id = -1;
+    // Sorted by the byte
+    std::vector<std::pair<unsigned char, int>> children;
+  };
+  int FindChild(int node, unsigned char byte) const;
+  // The length in bytes of the longest unit of `text` at `pos` from `node`,
+  // 0 if there is none
+  int LongestMatch(int node, const std::string& text, size_t pos,
+                   int* unit_id) const;
+
+  std::vector<Node> nodes_;
+  int space_node_ = -1;  // The node of '▁'
+  bool upper_case_ = false;
+  bool lower_case_ = false;
+  size_t fingerprint_ = 0;
 
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(UnitTrie);
+};
+
+// Split the UTF-8 string into unit ids according to unit_table. It builds
+// the UnitTrie of unit_table every time, use UnitTrie for many phrases.
 bool SplitContextToUnits(const std::string& context,
                          const std::shared_ptr<fst::SymbolTable>& unit_table,
                          std::vector<int>* units);
@@ -43,25 +78,87 @@ struct ContextConfig {
   float incremental_context_score = 0.0;
 };
 
+// Check the hotwords of a session against the limits of `config`, the
+// count and the length in characters of every hotword. Return the error if
+// any of them is exceeded, otherwise an empty string.
+std::string CheckContextLimits(const std::vector<std::string>& contexts,
+                               const ContextConfig& config);
+
+// Aho-Corasick automaton of the context phrases compiled to flat arrays.
+// The states are numbered in BFS order, so the arcs of every state are a
+// block sorted by unit and the arc i goes to the state i + 1. The arcs of
+// the start state are a dense table indexed by unit. The failure
+// transitions and the phrases matched at every state are precomputed, so a
+// lookup is a binary search plus a walk along the failure chain.
+//
+// The arrays live in one binary image, which is written by Write and memory
+// mapped by Read, so a large graph (e.g. all the contacts of the users)
+// loads instantly and its pages are shared by the processes. The image
+// only has the unit ids, it must be used with the same unit table.
+//
+// A small graph (e.g. the hotwords of one session) can overlay a large
+// shared base graph without copying it. Both automatons run side by side
+// and the state is the pair of their states.
 class ContextGraph {
  public:
   explicit ContextGraph(ContextConfig config);
-  int TraceContext(int cur_state, int unit_id, int* final_state);
-  void BuildContextGraph(const std::vector<std::string>& context,
-                         const std::shared_ptr<fst::SymbolTable>& unit_table);
-  void ConvertToAC();
+  // The phrases of `base` are not added again, so they are not boosted
+  // twice. `base` must not be an overlay itself. Return false if the states
+  // of the graph, times the ones of `base` for an overlay, don't fit in int,
+  // the graph must not be used then.
+  bool BuildContextGraph(const std::vector<std::string>& contexts,
+                         const UnitTrie& unit_trie,
+                         std::shared_ptr<const ContextGraph> base = nullptr);
+  bool BuildContextGraph(const std::vector<std::string>& contexts,
+                         const std::shared_ptr<fst::SymbolTable>& unit_table,
+                         std::shared_ptr<const ContextGraph> base = nullptr);
+  // Write the image of the graph, the base of an overlay is not included
+  bool Write(const std::string& path) const;
+  // Read the image written by Write, nullptr if it's invalid
+  static std::shared_ptr<ContextGraph> Read(const std::string& path,
+                                            bool mmap = true);
+
   int GetNextState(int cur_state, int unit_id, float* score,
-                   std::unordered_set<std::string>* contexts = nullptr);
+                   std::unordered_set<std::string>* contexts = nullptr) const;
   // check context state is the final state
-  bool IsFinalState(int state) {
-    return graph_->Final(state) != Weight::Zero();
-  }
+  bool IsFinalState(int state) const;
+  int NumStates() const;
+  // Memory of the graph in bytes, the base of an overlay is not included
+  size_t image_size() const { return image_size_; }
+  const ContextConfig& config() const { return config_; }
 
  private:
+  // Point the arrays into `image`, false if it's not a valid image
+  bool Attach(std::shared_ptr<const char> image, size_t size);
+  // The child of `state` by `unit_id`, -1 if there is none
+  int FindChild(int state, int unit_id) const;
+  // GetNextState of this graph without the base
+  int NextState(int cur_state, int unit_id, float* score,
+                std::unordered_set<std::string>* contexts) const;
+  // Whether `units` is a phrase of this graph
+  bool HasPhrase(const std::vector<int>& units) const;
+
   ContextConfig config_;
-  std::unique_ptr<fst::StdVectorFst> graph_;
-  std::unordered_map<int, int> fallback_finals_;  // States fallback to final
-  std::unordered_map<int, std::string> context_table_;  // Finals to context
+  std::shared_ptr<const ContextGraph> base_ = nullptr;
+  std::shared_ptr<const char> image_ = nullptr;
+  size_t image_size_ = 0;
+
+  int num_states_ = 0;
+  int root_size_ = 0;
+  const int32_t* arc_begin_ = nullptr;  // num_states + 1
+  const int32_t* arc_units_ = nullptr;  // num_states - 1 arcs
+  const int32_t* root_next_ = nullptr;  // root_size, -1 for no arc
+  const float* arc_scores_ = nullptr;   // Score of the arc into the state
+  const int32_t* fail_states_ = nullptr;  // -1 goes back to the start state
+  const float* fail_scores_ = nullptr;
+  const int32_t* phrase_ids_ = nullptr;  // Phrase ending at the state or -1
+  // The next final state along the failure chain, -1 if there is none
+  const int32_t* output_links_ = nullptr;
+  const int32_t* phrase_offsets_ = nullptr;  // num_phrases + 1
+  const char* phrase_data_ = nullptr;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(ContextGraph);
 };
 
 }  // namespace wenet
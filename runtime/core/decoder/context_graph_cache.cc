@@ -0,0 +1,174 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/context_graph_cache.h"
+
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+
+#include "utils/log.h"
+#include "utils/metrics.h"
+
+namespace wenet {
+
+namespace {
+
+// 64-bit FNV-1a
+class Fnv1a {
+ public:
+  void Update(const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+      hash_ = (hash_ ^ bytes[i]) * 0x100000001b3ULL;
+    }
+  }
+  template <typename T>
+  void Update(const T& value) {
+    Update(&value, sizeof(value));
+  }
+  uint64_t hash() const { return hash_; }
+
+ private:
+  uint64_t hash_ = 0xcbf29ce484222325ULL;
+};
+
+}  // namespace
+
+std::string ContextGraphCache::Key(const std::vector<std::string>& contexts,
+                                   const ContextConfig& config,
+                                   const UnitTrie& unit_trie,
+                                   const ContextGraph* base) {
+  Fnv1a fnv;
+  fnv.Update(unit_trie.fingerprint());
+  // The cached overlays hold their bases, so the address is not reused
+  fnv.Update(reinterpret_cast<uintptr_t>(base));
+  fnv.Update(config.context_score);
+  fnv.Update(config.incremental_context_score);
+  for (const auto& context : contexts) {
+    // With the length, so that {"ab", "c"} differs from {"a", "bc"}
+    fnv.Update(context.size());
+    fnv.Update(context.data(), context.size());
+  }
+  std::ostringstream key;
+  key << std::hex << std::setw(16) << std::setfill('0') << fnv.hash();
+  return key.str();
+}
+
+bool ContextGraphCache::Entry::Matches(
+    const std::vector<std::string>& contexts, const ContextConfig& config,
+    const UnitTrie& unit_trie, const ContextGraph* base) const {
+  return this->base == base &&
+         unit_trie_fingerprint == unit_trie.fingerprint() &&
+         context_score == config.context_score &&
+         incremental_context_score == config.incremental_context_score &&
+         this->contexts == contexts;
+}
+
+std::shared_ptr<const ContextGraph> ContextGraphCache::Get(
+    const std::vector<std::string>& contexts, const ContextConfig& config,
+    const UnitTrie& unit_trie, std::shared_ptr<const ContextGraph> base,
+    std::string* key) {
+  Metrics& metrics = Metrics::Global();
+  std::string cache_key = Key(contexts, config, unit_trie, base.get());
+  bool collided = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(cache_key);
+    if (it != index_.end()) {
+      if (it->second->Matches(contexts, config, unit_trie, base.get())) {
+        metrics.context_graph_cache_hits.Increment();
+        entries_.splice(entries_.begin(), entries_, it->second);
+        if (key != nullptr) *key = cache_key;
+        return it->second->graph;
+      }
+      collided = true;
+    }
+  }
+  metrics.context_graph_cache_misses.Increment();
+  if (key != nullptr) key->clear();
+
+  // Compile without the lock, the sessions of other hotwords go on
+  auto graph = std::make_shared<ContextGraph>(config);
+  if (!graph->BuildContextGraph(contexts, unit_trie, base)) return nullptr;
+  size_t graph_bytes = graph->image_size();
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(cache_key);
+  if (it != index_.end()) {
+    if (it->second->Matches(contexts, config, unit_trie, base.get())) {
+      // Compiled by another session at the same time
+      if (key != nullptr) *key = cache_key;
+      return it->second->graph;
+    }
+    collided = true;
+  }
+  if (collided) {
+    LOG(WARNING) << "Hotwords collide with the cached ones of key "
+                 << cache_key << ", the graph is not cached";
+    return graph;
+  }
+  if (graph_bytes > max_bytes_) {
+    LOG(WARNING) << "The context graph of " << graph_bytes
+                 << " bytes is too large to cache";
+    return graph;
+  }
+  Entry entry;
+  entry.key = cache_key;
+  entry.contexts = contexts;
+  entry.context_score = config.context_score;
+  entry.incremental_context_score = config.incremental_context_score;
+  entry.unit_trie_fingerprint = unit_trie.fingerprint();
+  entry.base = base.get();
+  entry.graph = graph;
+  entries_.push_front(std::move(entry));
+  index_[cache_key] = entries_.begin();
+  bytes_ += graph_bytes;
+  metrics.context_graph_cache_bytes.Add(graph_bytes);
+  // The evicted graphs live on in their sessions
+  while (bytes_ > max_bytes_) {
+    size_t evicted_bytes = entries_.back().graph->image_size();
+    bytes_ -= evicted_bytes;
+    metrics.context_graph_cache_bytes.Add(
+        -static_cast<int64_t>(evicted_bytes));
+    index_.erase(entries_.back().key);
+    entries_.pop_back();
+  }
+  if (key != nullptr) *key = cache_key;
+  return graph;
+}
+
+std::shared_ptr<const ContextGraph> ContextGraphCache::Find(
+    const std::string& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    Metrics::Global().context_graph_cache_misses.Increment();
+    return nullptr;
+  }
+  Metrics::Global().context_graph_cache_hits.Increment();
+  entries_.splice(entries_.begin(), entries_, it->second);
+  return it->second->graph;
+}
+
+int ContextGraphCache::Size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+size_t ContextGraphCache::Bytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return bytes_;
+}
+
+}  // namespace wenet
@@ -0,0 +1,91 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_CONTEXT_GRAPH_CACHE_H_
+#define DECODER_CONTEXT_GRAPH_CACHE_H_
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "decoder/context_graph.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// LRU cache of the compiled context graphs of the hotword lists, bounded by
+// the memory of the graphs. It's thread safe, and the graphs are immutable,
+// so one graph is shared by all the sessions of the same hotwords.
+//
+// The key is the content hash of the hotwords, the scores, the unit table
+// and the base graph, so one cache can serve several models. The content is
+// kept with the graph and compared on a hit, so a collision of the hashes,
+// accidental or crafted, never serves the graph of other hotwords.
+class ContextGraphCache {
+ public:
+  explicit ContextGraphCache(size_t max_bytes) : max_bytes_(max_bytes) {}
+
+  static std::string Key(const std::vector<std::string>& contexts,
+                         const ContextConfig& config,
+                         const UnitTrie& unit_trie,
+                         const ContextGraph* base = nullptr);
+
+  // The graph of `contexts` overlaying `base`, it's compiled on a miss. The
+  // key is returned in `key` if it's not nullptr, by which Find returns the
+  // same graph later. `key` is empty if the graph is not cached. Return
+  // nullptr if the graph can't be built, see BuildContextGraph.
+  std::shared_ptr<const ContextGraph> Get(
+      const std::vector<std::string>& contexts, const ContextConfig& config,
+      const UnitTrie& unit_trie,
+      std::shared_ptr<const ContextGraph> base = nullptr,
+      std::string* key = nullptr);
+  // nullptr if `key` is not cached, or evicted
+  std::shared_ptr<const ContextGraph> Find(const std::string& key);
+
+  int Size() const;
+  size_t Bytes() const;
+
+ private:
+  struct Entry {
+    std::string key;
+    std::vector<std::string> contexts;
+    float context_score = 0;
+    float incremental_context_score = 0;
+    size_t unit_trie_fingerprint = 0;
+    const ContextGraph* base = nullptr;
+    std::shared_ptr<const ContextGraph> graph;
+
+    bool Matches(const std::vector<std::string>& contexts,
+                 const ContextConfig& config, const UnitTrie& unit_trie,
+                 const ContextGraph* base) const;
+  };
+
+  const size_t max_bytes_;
+  mutable std::mutex mutex_;
+  // The most recently used first
+  std::list<Entry> entries_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+  size_t bytes_ = 0;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(ContextGraphCache);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_CONTEXT_GRAPH_CACHE_H_
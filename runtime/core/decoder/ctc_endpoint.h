@@ -17,6 +17,8 @@
 
 #include <vector>
 
+#include "decoder/ctc_frame_summary.h"
+
 namespace wenet {
 
 struct CtcEndpointRule {
@@ -62,12 +64,17 @@ class CtcEndpoint {
   /// should terminate decoding.
   bool IsEndpoint(const std::vector<std::vector<float>>& ctc_log_probs,
                   bool decoded_something);
+  /// The same as above, but only reads the blank scores of the summaries.
+  bool IsEndpoint(const CtcFrameSummaries& summaries, bool decoded_something);
 
   void frame_shift_in_ms(int frame_shift_in_ms) {
     frame_shift_in_ms_ = frame_shift_in_ms;
   }
 
  private:
+  void AcceptBlankScore(float blank_logp);
+  bool CheckRules(bool decoded_something);
+
   CtcEndpointConfig config_;
   int frame_shift_in_ms_ = -1;
   int num_frames_decoded_ = 0;
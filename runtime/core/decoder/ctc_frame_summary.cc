@@ -0,0 +1,48 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/ctc_frame_summary.h"
+
+#include <algorithm>
+
+#include "utils/log.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+void SummarizeCtcFrames(int blank, float blank_bias, int k,
+                        std::vector<std::vector<float>>* logp,
+                        CtcFrameSummaries* summaries) {
+  int num_frames = logp->size();
+  summaries->num_frames = num_frames;
+  if (num_frames == 0) return;
+  int vocab_size = (*logp)[0].size();
+  CHECK_GT(vocab_size, blank);
+  k = std::max(1, std::min(k, vocab_size));
+  summaries->k = k;
+  summaries->topk_score.resize(num_frames * k);
+  summaries->topk_index.resize(num_frames * k);
+  summaries->blank_score.resize(num_frames);
+  for (int t = 0; t < num_frames; ++t) {
+    std::vector<float>& row = (*logp)[t];
+    CHECK_EQ(static_cast<int>(row.size()), vocab_size);
+    row[blank] += blank_bias;
+    summaries->blank_score[t] = row[blank];
+    BatchTopK(row.data(), 1, vocab_size, k,
+              summaries->topk_score.data() + t * k,
+              summaries->topk_index.data() + t * k);
+  }
+}
+
+}  // namespace wenet
@@ -0,0 +1,50 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_CTC_FRAME_SUMMARY_H_
+#define DECODER_CTC_FRAME_SUMMARY_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace wenet {
+
+// Compact summary of the CTC log probs of a chunk: the top k (score, index)
+// and the blank score of each frame. It's all that the prefix beam search,
+// the blank skipping of the WFST search and the endpointer need, so the
+// full rows, which have 5k-10k units for BPE models, are walked only once.
+struct CtcFrameSummaries {
+  int num_frames = 0;
+  int k = 0;
+  // (num_frames x k) row major, sorted in descending order
+  std::vector<float> topk_score;
+  std::vector<int32_t> topk_index;
+  // Log prob of blank of each frame
+  std::vector<float> blank_score;
+
+  const float* TopKScore(int t) const { return topk_score.data() + t * k; }
+  const int32_t* TopKIndex(int t) const { return topk_index.data() + t * k; }
+  int Argmax(int t) const { return topk_index[t * k]; }
+};
+
+// Summarize `logp` by one SIMD pass per frame, see BatchTopK. `blank_bias`,
+// e.g. log(blank_scale), is added to the blank column of `logp` in place
+// beforehand. k is clamped to [1, vocab size].
+void SummarizeCtcFrames(int blank, float blank_bias, int k,
+                        std::vector<std::vector<float>>* logp,
+                        CtcFrameSummaries* summaries);
+
+}  // namespace wenet
+
+#endif  // DECODER_CTC_FRAME_SUMMARY_H_
@@ -15,8 +15,6 @@
 #include "decoder/ctc_prefix_beam_search.h"
 
 #include <algorithm>
-#include <tuple>
-#include <unordered_map>
 #include <utility>
 
 #include "utils/log.h"
@@ -24,9 +22,21 @@
 
 namespace wenet {
 
+// Minimal arena size which triggers the garbage collection
+static const size_t kMinGcSize = 4096;
+
+static inline uint64_t ChildKey(int parent, int token) {
+  return (static_cast<uint64_t>(parent) << 32) | static_cast<uint32_t>(token);
+}
+
+// The token is never 0xffffffff, so it doesn't collide with the ChildKey
+static inline uint64_t NodeKey(int node) {
+  return (static_cast<uint64_t>(node) << 32) | 0xffffffffu;
+}
+
 CtcPrefixBeamSearch::CtcPrefixBeamSearch(
     const CtcPrefixBeamSearchOptions& opts,
-    const std::shared_ptr<ContextGraph>& context_graph)
+    const std::shared_ptr<const ContextGraph>& context_graph)
     : opts_(opts), context_graph_(context_graph) {
   Reset();
 }
@@ -38,44 +48,50 @@ void CtcPrefixBeamSearch::Reset() {
   viterbi_likelihood_.clear();
   times_.clear();
   outputs_.clear();
+  nodes_.clear();
+  time_nodes_.clear();
+  children_.Clear();
+  gc_nodes_ = kMinGcSize;
+  gc_time_nodes_ = kMinGcSize;
 
   abs_time_step_ = 0;
+  num_stable_outputs_ = 0;
   PrefixScore prefix_score;
   prefix_score.s = 0.0;
   prefix_score.ns = -kFloatMax;
   prefix_score.v_s = 0.0;
   prefix_score.v_ns = 0.0;
 
+  // The root of the trie is the empty prefix
+  nodes_.push_back({-1, -1});
+  cur_hyps_.emplace_back(0, prefix_score);
   std::vector<int> empty;
-  cur_hyps_[empty] = prefix_score;
   outputs_.emplace_back(empty);
   hypotheses_.emplace_back(empty);
   likelihood_.emplace_back(prefix_score.total_score());
   times_.emplace_back(empty);
 }
 
-static bool PrefixScoreCompare(
-    const std::pair<std::vector<int>, PrefixScore>& a,
-    const std::pair<std::vector<int>, PrefixScore>& b) {
-  return a.second.total_score() > b.second.total_score();
-}
-
-void CtcPrefixBeamSearch::UpdateHypotheses(
-    const std::vector<std::pair<std::vector<int>, PrefixScore>>& hpys) {
-  cur_hyps_.clear();
-  outputs_.clear();
-  hypotheses_.clear();
-  likelihood_.clear();
-  viterbi_likelihood_.clear();
-  times_.clear();
-  for (auto& item : hpys) {
-    cur_hyps_[item.first] = item.second;
-    hypotheses_.emplace_back(item.first);
-    outputs_.emplace_back(std::move(item.first));
-    likelihood_.emplace_back(item.second.total_score());
-    viterbi_likelihood_.emplace_back(item.second.viterbi_score());
-    times_.emplace_back(item.second.times());
+CtcPrefixBeamSearch::Candidate& CtcPrefixBeamSearch::GetCandidate(int node,
+                                                                  int token) {
+  int child = node;
+  if (token >= 0) {
+    child = children_.Find(ChildKey(node, token));
   }
+  uint64_t key = child >= 0 ? NodeKey(child) : ChildKey(node, token);
+  int size = candidates_.size();
+  int index = candidate_index_.FindOrInsert(key, size);
+  if (index == size) {
+    // A new candidate has PrefixScore(-inf, -inf) by default
+    candidates_.emplace_back();
+    Candidate& candidate = candidates_.back();
+    candidate.node = child;
+    if (child < 0) {
+      candidate.parent = node;
+      candidate.token = token;
+    }
+  }
+  return candidates_[index];
 }
 
 // Please refer https://robin1001.github.io/2020/12/11/ctc-search
@@ -83,105 +99,263 @@ void CtcPrefixBeamSearch::UpdateHypotheses(
 // it.
 void CtcPrefixBeamSearch::Search(const std::vector<std::vector<float>>& logp) {
   if (logp.size() == 0) return;
-  int first_beam_size =
-      std::min(static_cast<int>(logp[0].size()), opts_.first_beam_size);
   for (int t = 0; t < logp.size(); ++t, ++abs_time_step_) {
-    const std::vector<float>& logp_t = logp[t];
-    std::unordered_map<std::vector<int>, PrefixScore, PrefixHash> next_hyps;
+    int first_beam_size =
+        std::min(static_cast<int>(logp[t].size()), opts_.first_beam_size);
     // 1. First beam prune, only select topk candidates
-    std::vector<float> topk_score;
-    std::vector<int32_t> topk_index;
-    TopK(logp_t, first_beam_size, &topk_score, &topk_index);
-
-    // 2. Token passing
-    for (int i = 0; i < topk_index.size(); ++i) {
-      int id = topk_index[i];
-      auto prob = topk_score[i];
-      for (const auto& it : cur_hyps_) {
-        const std::vector<int>& prefix = it.first;
-        const PrefixScore& prefix_score = it.second;
-        // If prefix doesn't exist in next_hyps, next_hyps[prefix] will insert
-        // PrefixScore(-inf, -inf) by default, since the default constructor
-        // of PrefixScore will set fields s(blank ending score) and
-        // ns(none blank ending score) to -inf, respectively.
-        if (id == opts_.blank) {
-          // Case 0: *a + ε => *a
-          PrefixScore& next_score = next_hyps[prefix];
-          next_score.s = LogAdd(next_score.s, prefix_score.score() + prob);
-          next_score.v_s = prefix_score.viterbi_score() + prob;
-          next_score.times_s = prefix_score.times();
-          // Prefix not changed, copy the context from prefix.
-          if (context_graph_ && !next_score.has_context) {
-            next_score.CopyContext(prefix_score);
-            next_score.has_context = true;
-          }
-        } else if (!prefix.empty() && id == prefix.back()) {
-          // Case 1: *a + a => *a
-          PrefixScore& next_score1 = next_hyps[prefix];
-          next_score1.ns = LogAdd(next_score1.ns, prefix_score.ns + prob);
-          if (next_score1.v_ns < prefix_score.v_ns + prob) {
-            next_score1.v_ns = prefix_score.v_ns + prob;
-            if (next_score1.cur_token_prob < prob) {
-              next_score1.cur_token_prob = prob;
-              next_score1.times_ns = prefix_score.times_ns;
-              CHECK_GT(next_score1.times_ns.size(), 0);
-              next_score1.times_ns.back() = abs_time_step_;
-            }
-          }
-          if (context_graph_ && !next_score1.has_context) {
-            next_score1.CopyContext(prefix_score);
-            next_score1.has_context = true;
-          }
+    TopK(logp[t], first_beam_size, &topk_score_, &topk_index_);
+    SearchStep(topk_score_.data(), topk_index_.data(), first_beam_size);
+  }
+  UpdateOutputs();
+}
 
-          // Case 2: *aε + a => *aa
-          std::vector<int> new_prefix(prefix);
-          new_prefix.emplace_back(id);
-          PrefixScore& next_score2 = next_hyps[new_prefix];
-          next_score2.ns = LogAdd(next_score2.ns, prefix_score.s + prob);
-          if (next_score2.v_ns < prefix_score.v_s + prob) {
-            next_score2.v_ns = prefix_score.v_s + prob;
-            next_score2.cur_token_prob = prob;
-            next_score2.times_ns = prefix_score.times_s;
-            next_score2.times_ns.emplace_back(abs_time_step_);
-          }
-          if (context_graph_ && !next_score2.has_context) {
-            // Prefix changed, calculate the context score.
-            next_score2.UpdateContext(context_graph_, prefix_score, id);
-            next_score2.has_context = true;
-          }
-        } else {
-          // Case 3: *a + b => *ab, *aε + b => *ab
-          std::vector<int> new_prefix(prefix);
-          new_prefix.emplace_back(id);
-          PrefixScore& next_score = next_hyps[new_prefix];
-          next_score.ns = LogAdd(next_score.ns, prefix_score.score() + prob);
-          if (next_score.v_ns < prefix_score.viterbi_score() + prob) {
-            next_score.v_ns = prefix_score.viterbi_score() + prob;
-            next_score.cur_token_prob = prob;
-            next_score.times_ns = prefix_score.times();
-            next_score.times_ns.emplace_back(abs_time_step_);
-          }
-          if (context_graph_ && !next_score.has_context) {
-            // Calculate the context score.
-            next_score.UpdateContext(context_graph_, prefix_score, id);
-            next_score.has_context = true;
+void CtcPrefixBeamSearch::Search(const std::vector<std::vector<float>>& logp,
+                                 const CtcFrameSummaries& summaries) {
+  if (logp.size() == 0) return;
+  CHECK_EQ(summaries.num_frames, static_cast<int>(logp.size()));
+  int first_beam_size =
+      std::min(static_cast<int>(logp[0].size()), opts_.first_beam_size);
+  if (summaries.k < first_beam_size) {
+    Search(logp);
+    return;
+  }
+  // The first beam prune is the head of the summarized top k
+  if (summaries.k == first_beam_size) {
+    Search(summaries.topk_score.data(), summaries.topk_index.data(),
+           summaries.num_frames, first_beam_size);
+    return;
+  }
+  for (int t = 0; t < summaries.num_frames; ++t, ++abs_time_step_) {
+    SearchStep(summaries.TopKScore(t), summaries.TopKIndex(t),
+               first_beam_size);
+  }
+  UpdateOutputs();
+}
+
+void CtcPrefixBeamSearch::Search(const float* topk_score,
+                                 const int32_t* topk_index, int num_frames,
+                                 int k) {
+  if (num_frames == 0) return;
+  for (int t = 0; t < num_frames; ++t, ++abs_time_step_) {
+    SearchStep(topk_score + static_cast<size_t>(t) * k,
+               topk_index + static_cast<size_t>(t) * k, k);
+  }
+  UpdateOutputs();
+}
+
+void CtcPrefixBeamSearch::SearchStep(const float* topk_score,
+                                     const int32_t* topk_index, int k) {
+  // 2. Token passing
+  candidate_index_.Clear();
+  candidates_.clear();
+  // At most 2 candidates for each (hyp, token), so the references returned
+  // by GetCandidate() are stable
+  candidates_.reserve(2 * cur_hyps_.size() * k);
+  for (int i = 0; i < k; ++i) {
+    int id = topk_index[i];
+    auto prob = topk_score[i];
+    for (const auto& it : cur_hyps_) {
+      const int node = it.first;
+      const PrefixScore& prefix_score = it.second;
+      if (id == opts_.blank) {
+        // Case 0: *a + ε => *a
+        PrefixScore& next_score = GetCandidate(node, -1).score;
+        next_score.s = LogAdd(next_score.s, prefix_score.score() + prob);
+        next_score.v_s = prefix_score.viterbi_score() + prob;
+        next_score.times_s = prefix_score.times();
+        // Prefix not changed, copy the context from prefix.
+        if (context_graph_ && !next_score.has_context) {
+          next_score.CopyContext(prefix_score);
+          next_score.has_context = true;
+        }
+      } else if (node != 0 && id == nodes_[node].token) {
+        // Case 1: *a + a => *a
+        Candidate& candidate1 = GetCandidate(node, -1);
+        PrefixScore& next_score1 = candidate1.score;
+        next_score1.ns = LogAdd(next_score1.ns, prefix_score.ns + prob);
+        if (next_score1.v_ns < prefix_score.v_ns + prob) {
+          next_score1.v_ns = prefix_score.v_ns + prob;
+          if (next_score1.cur_token_prob < prob) {
+            next_score1.cur_token_prob = prob;
+            // Replace the last time of the none blank path
+            CHECK_GE(prefix_score.times_ns, 0);
+            next_score1.times_ns = time_nodes_[prefix_score.times_ns].parent;
+            candidate1.ns_time = abs_time_step_;
           }
         }
+        if (context_graph_ && !next_score1.has_context) {
+          next_score1.CopyContext(prefix_score);
+          next_score1.has_context = true;
+        }
+
+        // Case 2: *aε + a => *aa
+        Candidate& candidate2 = GetCandidate(node, id);
+        PrefixScore& next_score2 = candidate2.score;
+        next_score2.ns = LogAdd(next_score2.ns, prefix_score.s + prob);
+        if (next_score2.v_ns < prefix_score.v_s + prob) {
+          next_score2.v_ns = prefix_score.v_s + prob;
+          next_score2.cur_token_prob = prob;
+          next_score2.times_ns = prefix_score.times_s;
+          candidate2.ns_time = abs_time_step_;
+        }
+        if (context_graph_ && !next_score2.has_context) {
+          // Prefix changed, calculate the context score.
+          next_score2.UpdateContext(context_graph_, prefix_score, id);
+          next_score2.has_context = true;
+        }
+      } else {
+        // Case 3: *a + b => *ab, *aε + b => *ab
+        Candidate& candidate = GetCandidate(node, id);
+        PrefixScore& next_score = candidate.score;
+        next_score.ns = LogAdd(next_score.ns, prefix_score.score() + prob);
+        if (next_score.v_ns < prefix_score.viterbi_score() + prob) {
+          next_score.v_ns = prefix_score.viterbi_score() + prob;
+          next_score.cur_token_prob = prob;
+          next_score.times_ns = prefix_score.times();
+          candidate.ns_time = abs_time_step_;
+        }
+        if (context_graph_ && !next_score.has_context) {
+          // Calculate the context score.
+          next_score.UpdateContext(context_graph_, prefix_score, id);
+          next_score.has_context = true;
+        }
       }
     }
+  }
+
+  // 3. Second beam prune, only keep top n best paths
+  PruneCandidates();
+  if (nodes_.size() > gc_nodes_ || time_nodes_.size() > gc_time_nodes_) {
+    CollectGarbage();
+  }
+}
 
-    // 3. Second beam prune, only keep top n best paths
-    std::vector<std::pair<std::vector<int>, PrefixScore>> arr(next_hyps.begin(),
-                                                              next_hyps.end());
-    int second_beam_size =
-        std::min(static_cast<int>(arr.size()), opts_.second_beam_size);
-    std::nth_element(arr.begin(), arr.begin() + second_beam_size, arr.end(),
-                     PrefixScoreCompare);
-    arr.resize(second_beam_size);
-    std::sort(arr.begin(), arr.end(), PrefixScoreCompare);
+void CtcPrefixBeamSearch::PruneCandidates() {
+  order_.resize(candidates_.size());
+  for (int i = 0; i < order_.size(); ++i) order_[i] = i;
+  int second_beam_size =
+      std::min(static_cast<int>(order_.size()), opts_.second_beam_size);
+  auto compare = [this](int a, int b) {
+    return candidates_[a].score.total_score() >
+           candidates_[b].score.total_score();
+  };
+  std::nth_element(order_.begin(), order_.begin() + second_beam_size,
+                   order_.end(), compare);
+  std::sort(order_.begin(), order_.begin() + second_beam_size, compare);
 
-    // 4. Update cur_hyps_ and get new result
-    UpdateHypotheses(arr);
+  // Only the survivors are added to the arenas
+  cur_hyps_.clear();
+  for (int i = 0; i < second_beam_size; ++i) {
+    Candidate& candidate = candidates_[order_[i]];
+    int node = candidate.node;
+    if (node < 0) {
+      node = nodes_.size();
+      nodes_.push_back({candidate.parent, candidate.token});
+      children_.FindOrInsert(ChildKey(candidate.parent, candidate.token),
+                             node);
+    }
+    PrefixScore& score = candidate.score;
+    if (candidate.ns_time >= 0) {
+      time_nodes_.push_back({score.times_ns, candidate.ns_time});
+      score.times_ns = time_nodes_.size() - 1;
+    }
+    cur_hyps_.emplace_back(node, score);
+  }
+}
+
+void CtcPrefixBeamSearch::CollectGarbage() {
+  // The parent of a node is always added before it, so the arenas are
+  // compacted in one forward pass after marking the live nodes.
+  // 1. Prefix nodes
+  remap_.assign(nodes_.size(), -1);
+  remap_[0] = 0;
+  for (const auto& it : cur_hyps_) {
+    for (int n = it.first; n >= 0 && remap_[n] < 0; n = nodes_[n].parent) {
+      remap_[n] = 0;
+    }
+  }
+  int size = 0;
+  children_.Clear();
+  for (int i = 0; i < nodes_.size(); ++i) {
+    if (remap_[i] < 0) continue;
+    PrefixNode node = nodes_[i];
+    if (node.parent >= 0) {
+      node.parent = remap_[node.parent];
+      children_.FindOrInsert(ChildKey(node.parent, node.token), size);
+    }
+    nodes_[size] = node;
+    remap_[i] = size++;
+  }
+  nodes_.resize(size);
+  for (auto& it : cur_hyps_) it.first = remap_[it.first];
+
+  // 2. Time nodes
+  remap_.assign(time_nodes_.size(), -1);
+  for (const auto& it : cur_hyps_) {
+    for (int times : {it.second.times_s, it.second.times_ns}) {
+      for (int n = times; n >= 0 && remap_[n] < 0;
+           n = time_nodes_[n].parent) {
+        remap_[n] = 0;
+      }
+    }
+  }
+  size = 0;
+  for (int i = 0; i < time_nodes_.size(); ++i) {
+    if (remap_[i] < 0) continue;
+    TimeNode node = time_nodes_[i];
+    if (node.parent >= 0) node.parent = remap_[node.parent];
+    time_nodes_[size] = node;
+    remap_[i] = size++;
+  }
+  time_nodes_.resize(size);
+  for (auto& it : cur_hyps_) {
+    PrefixScore& score = it.second;
+    if (score.times_s >= 0) score.times_s = remap_[score.times_s];
+    if (score.times_ns >= 0) score.times_ns = remap_[score.times_ns];
+  }
+
+  gc_nodes_ = std::max(2 * nodes_.size(), kMinGcSize);
+  gc_time_nodes_ = std::max(2 * time_nodes_.size(), kMinGcSize);
+}
+
+void CtcPrefixBeamSearch::UpdateOutputs() {
+  int num_hyps = cur_hyps_.size();
+  hypotheses_.resize(num_hyps);
+  likelihood_.resize(num_hyps);
+  viterbi_likelihood_.resize(num_hyps);
+  times_.resize(num_hyps);
+  for (int i = 0; i < num_hyps; ++i) {
+    const PrefixScore& score = cur_hyps_[i].second;
+    // Walk the chains from the end to the start
+    std::vector<int>& hyp = hypotheses_[i];
+    hyp.clear();
+    for (int n = cur_hyps_[i].first; n > 0; n = nodes_[n].parent) {
+      hyp.push_back(nodes_[n].token);
+    }
+    std::reverse(hyp.begin(), hyp.end());
+    std::vector<int>& times = times_[i];
+    times.clear();
+    for (int n = score.times(); n >= 0; n = time_nodes_[n].parent) {
+      times.push_back(time_nodes_[n].time);
+    }
+    std::reverse(times.begin(), times.end());
+    likelihood_[i] = score.total_score();
+    viterbi_likelihood_[i] = score.viterbi_score();
+  }
+  outputs_ = hypotheses_;
+
+  // All the later hypotheses extend the current ones, so the common prefix
+  // of the current ones never changes
+  const std::vector<int>& best = hypotheses_[0];
+  for (; num_stable_outputs_ < best.size(); ++num_stable_outputs_) {
+    int token = best[num_stable_outputs_];
+    bool common = true;
+    for (int i = 1; i < num_hyps && common; ++i) {
+      const std::vector<int>& hyp = hypotheses_[i];
+      common = num_stable_outputs_ < hyp.size() &&
+               hyp[num_stable_outputs_] == token;
+    }
+    if (!common) break;
   }
 }
 
@@ -191,18 +365,20 @@ void CtcPrefixBeamSearch::FinalizeSearch() {
   CHECK_EQ(hypotheses_.size(), likelihood_.size());
   // We should backoff the context score/state when the context is
   // not fully matched at the last time.
-  for (const auto& prefix : hypotheses_) {
-    PrefixScore& prefix_score = cur_hyps_[prefix];
+  for (auto& it : cur_hyps_) {
+    PrefixScore& prefix_score = it.second;
     if (prefix_score.context_state != 0) {
       prefix_score.UpdateContext(context_graph_, prefix_score, -1);
     }
   }
-  std::vector<std::pair<std::vector<int>, PrefixScore>> arr(cur_hyps_.begin(),
-                                                            cur_hyps_.end());
-  std::sort(arr.begin(), arr.end(), PrefixScoreCompare);
+  std::sort(cur_hyps_.begin(), cur_hyps_.end(),
+            [](const std::pair<int, PrefixScore>& a,
+               const std::pair<int, PrefixScore>& b) {
+              return a.second.total_score() > b.second.total_score();
+            });
 
-  // Update cur_hyps_ and get new result
-  UpdateHypotheses(arr);
+  // Update outputs with the new order
+  UpdateOutputs();
 }
 
 }  // namespace wenet
@@ -16,12 +16,12 @@
 #define DECODER_CTC_PREFIX_BEAM_SEARCH_H_
 
 #include <memory>
-#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include "decoder/context_graph.h"
 #include "decoder/search_interface.h"
+#include "utils/flat_hash_table.h"
 #include "utils/utils.h"
 
 namespace wenet {
@@ -32,20 +32,32 @@ struct CtcPrefixBeamSearchOptions {
   int second_beam_size = 10;
 };
 
+// The prefixes are kept in a trie, a prefix is the id of its last node, and
+// the timestamps are kept in a parent pointer arena in the same way, so
+// extending a prefix, comparing two prefixes or copying the timestamps are
+// O(1) no matter how long the hypothesis is. See CtcPrefixBeamSearch.
+struct PrefixNode {
+  int parent;  // -1 for the root, the empty prefix
+  int token;
+};
+
+struct TimeNode {
+  int parent;  // -1 for the first time of a prefix
+  int time;
+};
+
 struct PrefixScore {
   float s = -kFloatMax;               // blank ending score
   float ns = -kFloatMax;              // none blank ending score
   float v_s = -kFloatMax;             // viterbi blank ending score
   float v_ns = -kFloatMax;            // viterbi none blank ending score
   float cur_token_prob = -kFloatMax;  // prob of current token
-  std::vector<int> times_s;           // times of viterbi blank path
-  std::vector<int> times_ns;          // times of viterbi none blank path
+  int times_s = -1;                   // last TimeNode of viterbi blank path
+  int times_ns = -1;  // last TimeNode of viterbi none blank path
 
   float score() const { return LogAdd(s, ns); }
   float viterbi_score() const { return v_s > v_ns ? v_s : v_ns; }
-  const std::vector<int>& times() const {
-    return v_s > v_ns ? times_s : times_ns;
-  }
+  int times() const { return v_s > v_ns ? times_s : times_ns; }
 
   bool has_context = false;
   int context_state = 0;
@@ -56,7 +68,7 @@ struct PrefixScore {
     context_score = prefix_score.context_score;
   }
 
-  void UpdateContext(const std::shared_ptr<ContextGraph>& context_graph,
+  void UpdateContext(const std::shared_ptr<const ContextGraph>& context_graph,
                      const PrefixScore& prefix_score, int word_id) {
     this->CopyContext(prefix_score);
 
@@ -69,29 +81,23 @@ struct PrefixScore {
   float total_score() const { return score() + context_score; }
 };
 
-struct PrefixHash {
-  size_t operator()(const std::vector<int>& prefix) const {
-    size_t hash_code = 0;
-    // here we use KB&DR hash code
-    for (int id : prefix) {
-      hash_code = id + 31 * hash_code;
-    }
-    return hash_code;
-  }
-};
-
 class CtcPrefixBeamSearch : public SearchInterface {
  public:
   explicit CtcPrefixBeamSearch(
       const CtcPrefixBeamSearchOptions& opts,
-      const std::shared_ptr<ContextGraph>& context_graph = nullptr);
+      const std::shared_ptr<const ContextGraph>& context_graph = nullptr);
 
   void Search(const std::vector<std::vector<float>>& logp) override;
+  void Search(const std::vector<std::vector<float>>& logp,
+              const CtcFrameSummaries& summaries) override;
+  // Search `num_frames` frames whose first beam prune is already done,
+  // `topk_score` and `topk_index` are (num_frames x k) row major and sorted
+  // in descending order, see BatchCtcPrefixBeamSearch.
+  void Search(const float* topk_score, const int32_t* topk_index,
+              int num_frames, int k);
   void Reset() override;
   void FinalizeSearch() override;
   SearchType Type() const override { return SearchType::kPrefixBeamSearch; }
-  void UpdateHypotheses(
-      const std::vector<std::pair<std::vector<int>, PrefixScore>>& hpys);
 
   const std::vector<float>& viterbi_likelihood() const {
     return viterbi_likelihood_;
@@ -104,9 +110,34 @@ class CtcPrefixBeamSearch : public SearchInterface {
   }
   const std::vector<float>& Likelihood() const override { return likelihood_; }
   const std::vector<std::vector<int>>& Times() const override { return times_; }
+  int NumStableOutputs() const override { return num_stable_outputs_; }
 
  private:
+  // A hypothesis of the next frame. The prefix is either an existing trie
+  // node, or `token` appended to the node `parent`, which is only added to
+  // the trie if it survives the beam pruning. Likewise, `ns_time` >= 0 means
+  // a new TimeNode (score.times_ns, ns_time) for the none blank path.
+  struct Candidate {
+    PrefixScore score;
+    int node = -1;
+    int parent = -1;
+    int token = -1;
+    int ns_time = -1;
+  };
+
+  // Step the search by one frame with its top k tokens
+  void SearchStep(const float* topk_score, const int32_t* topk_index, int k);
+  // The candidate of `node`, or of `token` appended to `node` if token >= 0
+  Candidate& GetCandidate(int node, int token);
+  // Move the best candidates to cur_hyps_
+  void PruneCandidates();
+  // Remove the nodes unreachable from cur_hyps_ from the arenas
+  void CollectGarbage();
+  // Build hypotheses_, likelihood_, etc. from cur_hyps_
+  void UpdateOutputs();
+
   int abs_time_step_ = 0;
+  int num_stable_outputs_ = 0;
 
   // N-best list and corresponding likelihood_, in sorted order
   std::vector<std::vector<int>> hypotheses_;
@@ -114,8 +145,26 @@ class CtcPrefixBeamSearch : public SearchInterface {
   std::vector<float> viterbi_likelihood_;
   std::vector<std::vector<int>> times_;
 
-  std::unordered_map<std::vector<int>, PrefixScore, PrefixHash> cur_hyps_;
-  std::shared_ptr<ContextGraph> context_graph_ = nullptr;
+  // Arenas of prefixes and timestamps
+  std::vector<PrefixNode> nodes_;
+  std::vector<TimeNode> time_nodes_;
+  // (parent, token) -> child in nodes_
+  FlatHashTable children_;
+  // Arena sizes which trigger the next CollectGarbage()
+  size_t gc_nodes_ = 0;
+  size_t gc_time_nodes_ = 0;
+
+  // Current hypotheses in sorted order, PrefixScore and its prefix node
+  std::vector<std::pair<int, PrefixScore>> cur_hyps_;
+  // Per frame buffers, they are reused across the frames
+  FlatHashTable candidate_index_;
+  std::vector<Candidate> candidates_;
+  std::vector<int> order_;
+  std::vector<float> topk_score_;
+  std::vector<int32_t> topk_index_;
+  std::vector<int> remap_;
+
+  std::shared_ptr<const ContextGraph> context_graph_ = nullptr;
   // Outputs contain the hypotheses_ and tags like: <context> and </context>
   std::vector<std::vector<int>> outputs_;
   const CtcPrefixBeamSearchOptions& opts_;
@@ -50,7 +50,7 @@ int32 DecodableTensorScaled::NumIndices() const {
 
 CtcWfstBeamSearch::CtcWfstBeamSearch(
     const fst::Fst<fst::StdArc>& fst, const CtcWfstBeamSearchOptions& opts,
-    const std::shared_ptr<ContextGraph>& context_graph)
+    const std::shared_ptr<const ContextGraph>& context_graph)
     : decodable_(opts.acoustic_scale),
       decoder_(fst, opts, context_graph),
       context_graph_(context_graph),
@@ -62,11 +62,17 @@ void CtcWfstBeamSearch::Reset() {
   num_frames_ = 0;
   decoded_frames_mapping_.clear();
   is_last_frame_blank_ = false;
+  last_blank_frame_ = -1;
   last_best_ = 0;
   inputs_.clear();
   outputs_.clear();
   likelihood_.clear();
   times_.clear();
+  num_stable_outputs_ = 0;
+  stable_alignment_.clear();
+  stable_outputs_.clear();
+  stable_inputs_.clear();
+  stable_cost_ = 0;
   decodable_.Reset();
   decoder_.InitDecoding();
 }
@@ -77,55 +83,123 @@ void CtcWfstBeamSearch::Search(const std::vector<std::vector<float>>& logp) {
   }
   // Every time we get the log posterior, we decode it all before return
   for (int i = 0; i < logp.size(); i++) {
-    float blank_score = std::exp(logp[i][opts_.blank]);
-    if (blank_score > opts_.blank_skip_thresh * opts_.blank_scale) {
-      VLOG(3) << "skipping frame " << num_frames_ << " score " << blank_score;
-      is_last_frame_blank_ = true;
-      last_frame_prob_ = logp[i];
-    } else {
+    if (!SkipBlankFrame(i, logp[i][opts_.blank])) {
       // Get the best symbol
       int cur_best =
           std::max_element(logp[i].begin(), logp[i].end()) - logp[i].begin();
-      // Optional, adding one blank frame if we has skipped it in two same
-      // symbols
-      if (cur_best != opts_.blank && is_last_frame_blank_ &&
-          cur_best == last_best_) {
-        decodable_.AcceptLoglikes(last_frame_prob_);
-        decoder_.AdvanceDecoding(&decodable_, 1);
-        decoded_frames_mapping_.push_back(num_frames_ - 1);
-        VLOG(2) << "Adding blank frame at symbol " << cur_best;
-      }
-      last_best_ = cur_best;
-
-      decodable_.AcceptLoglikes(logp[i]);
-      decoder_.AdvanceDecoding(&decodable_, 1);
-      decoded_frames_mapping_.push_back(num_frames_);
-      is_last_frame_blank_ = false;
+      DecodeFrame(logp, i, cur_best);
+    }
+    num_frames_++;
+  }
+  FinishChunk(logp);
+}
+
+void CtcWfstBeamSearch::Search(const std::vector<std::vector<float>>& logp,
+                               const CtcFrameSummaries& summaries) {
+  if (0 == logp.size()) {
+    return;
+  }
+  CHECK_EQ(summaries.num_frames, static_cast<int>(logp.size()));
+  // The blank score and the best symbol come from the summaries, only the
+  // decoded frames are read by the decoder
+  for (int i = 0; i < logp.size(); i++) {
+    if (!SkipBlankFrame(i, summaries.blank_score[i])) {
+      DecodeFrame(logp, i, summaries.Argmax(i));
     }
     num_frames_++;
   }
+  FinishChunk(logp);
+}
+
+bool CtcWfstBeamSearch::SkipBlankFrame(int t, float blank_logp) {
+  float blank_score = std::exp(blank_logp);
+  if (blank_score > opts_.blank_skip_thresh * opts_.blank_scale) {
+    VLOG(3) << "skipping frame " << num_frames_ << " score " << blank_score;
+    is_last_frame_blank_ = true;
+    last_blank_frame_ = t;
+    return true;
+  }
+  return false;
+}
+
+void CtcWfstBeamSearch::DecodeFrame(
+    const std::vector<std::vector<float>>& logp, int t, int cur_best) {
+  // Optional, adding one blank frame if we has skipped it in two same
+  // symbols
+  if (cur_best != opts_.blank && is_last_frame_blank_ &&
+      cur_best == last_best_) {
+    // The skipped frame is in this chunk, or it's the last frame of the
+    // previous chunk which is kept in last_frame_prob_
+    decodable_.AcceptLoglikes(last_blank_frame_ >= 0 ? logp[last_blank_frame_]
+                                                     : last_frame_prob_);
+    decoder_.AdvanceDecoding(&decodable_, 1);
+    decoded_frames_mapping_.push_back(num_frames_ - 1);
+    VLOG(2) << "Adding blank frame at symbol " << cur_best;
+  }
+  last_best_ = cur_best;
+
+  decodable_.AcceptLoglikes(logp[t]);
+  decoder_.AdvanceDecoding(&decodable_, 1);
+  decoded_frames_mapping_.push_back(num_frames_);
+  is_last_frame_blank_ = false;
+}
+
+void CtcWfstBeamSearch::FinishChunk(
+    const std::vector<std::vector<float>>& logp) {
+  // Only copy the skipped frame which the next chunk may need
+  if (is_last_frame_blank_ && last_blank_frame_ >= 0) {
+    last_frame_prob_ = logp[last_blank_frame_];
+  }
+  last_blank_frame_ = -1;
   // Get the best path
-  inputs_.clear();
-  outputs_.clear();
-  likelihood_.clear();
   if (decoded_frames_mapping_.size() > 0) {
-    inputs_.resize(1);
-    outputs_.resize(1);
-    likelihood_.resize(1);
-    kaldi::Lattice lat;
-    decoder_.GetBestPath(&lat, true);
-    std::vector<int> alignment;
-    kaldi::LatticeWeight weight;
-    fst::GetLinearSymbolSequence(lat, &alignment, &outputs_[0], &weight);
-    ConvertToInputs(alignment, &inputs_[0]);
-    VLOG(3) << weight.Value1() << " " << weight.Value2();
-    likelihood_[0] = -(weight.Value1() + weight.Value2());
+    UpdateBestPath();
   }
 }
 
+// Only the part of the best path after the stable point is traced back, the
+// part before it is kept in stable_*, so the cost per chunk doesn't grow with
+// the length of the utterance.
+void CtcWfstBeamSearch::UpdateBestPath() {
+  float final_cost = 0;
+  decoder_.TraceBackStable(&stable_arcs_, &tail_arcs_, &final_cost);
+  int num_stable_frames = stable_alignment_.size();
+  for (const auto& arc : stable_arcs_) {
+    if (arc.ilabel != 0) stable_alignment_.push_back(arc.ilabel);
+    if (arc.olabel != 0) stable_outputs_.push_back(arc.olabel);
+    stable_cost_ += arc.weight.Value1() + arc.weight.Value2();
+  }
+  AppendInputs(stable_alignment_, num_stable_frames, &stable_inputs_);
+
+  inputs_.resize(1);
+  outputs_.resize(1);
+  likelihood_.resize(1);
+  alignment_ = stable_alignment_;
+  outputs_[0] = stable_outputs_;
+  float cost = stable_cost_ + final_cost;
+  for (const auto& arc : tail_arcs_) {
+    if (arc.ilabel != 0) alignment_.push_back(arc.ilabel);
+    if (arc.olabel != 0) outputs_[0].push_back(arc.olabel);
+    cost += arc.weight.Value1() + arc.weight.Value2();
+  }
+  inputs_[0] = stable_inputs_;
+  AppendInputs(alignment_, stable_alignment_.size(), &inputs_[0]);
+  likelihood_[0] = -cost;
+  num_stable_outputs_ = stable_outputs_.size();
+  VLOG(3) << "Stable frames " << stable_alignment_.size() << " tail frames "
+          << alignment_.size() - stable_alignment_.size();
+}
+
 void CtcWfstBeamSearch::FinalizeSearch() {
   decodable_.SetFinish();
   decoder_.FinalizeDecoding();
+  num_stable_outputs_ = 0;
+  const kaldi::ObjectPoolStats& tokens = decoder_.TokenPoolStats();
+  const kaldi::ObjectPoolStats& links = decoder_.LinkPoolStats();
+  VLOG(2) << "Token pool: live " << tokens.num_live << " peak "
+          << tokens.peak_live << " bytes " << tokens.bytes
+          << ", link pool: live " << links.num_live << " peak "
+          << links.peak_live << " bytes " << links.bytes;
   inputs_.clear();
   outputs_.clear();
   likelihood_.clear();
@@ -167,7 +241,13 @@ void CtcWfstBeamSearch::ConvertToInputs(const std::vector<int>& alignment,
                                         std::vector<int>* time) {
   input->clear();
   if (time != nullptr) time->clear();
-  for (int cur = 0; cur < alignment.size(); ++cur) {
+  AppendInputs(alignment, 0, input, time);
+}
+
+void CtcWfstBeamSearch::AppendInputs(const std::vector<int>& alignment,
+                                     int begin, std::vector<int>* input,
+                                     std::vector<int>* time) {
+  for (int cur = begin; cur < alignment.size(); ++cur) {
     // ignore blank
     if (alignment[cur] - 1 == opts_.blank) continue;
     // merge continuous same label
@@ -62,8 +62,10 @@ class CtcWfstBeamSearch : public SearchInterface {
  public:
   explicit CtcWfstBeamSearch(
       const fst::Fst<fst::StdArc>& fst, const CtcWfstBeamSearchOptions& opts,
-      const std::shared_ptr<ContextGraph>& context_graph);
+      const std::shared_ptr<const ContextGraph>& context_graph);
   void Search(const std::vector<std::vector<float>>& logp) override;
+  void Search(const std::vector<std::vector<float>>& logp,
+              const CtcFrameSummaries& summaries) override;
   void Reset() override;
   void FinalizeSearch() override;
   SearchType Type() const override { return SearchType::kWfstBeamSearch; }
@@ -76,25 +78,50 @@ class CtcWfstBeamSearch : public SearchInterface {
   }
   const std::vector<float>& Likelihood() const override { return likelihood_; }
   const std::vector<std::vector<int>>& Times() const override { return times_; }
+  int NumStableOutputs() const override { return num_stable_outputs_; }
 
  private:
+  // Return true if frame `t` is skipped for its blank log prob
+  bool SkipBlankFrame(int t, float blank_logp);
+  // Decode frame `t` of `logp` whose best symbol is `cur_best`
+  void DecodeFrame(const std::vector<std::vector<float>>& logp, int t,
+                   int cur_best);
+  // Keep the state for the next chunk and update the best path
+  void FinishChunk(const std::vector<std::vector<float>>& logp);
+  // Update the partial best path by the incremental traceback
+  void UpdateBestPath();
   // Sub one and remove <blank>
   void ConvertToInputs(const std::vector<int>& alignment,
                        std::vector<int>* input,
                        std::vector<int>* time = nullptr);
+  // Convert alignment[begin:] and append it to `input`
+  void AppendInputs(const std::vector<int>& alignment, int begin,
+                    std::vector<int>* input, std::vector<int>* time = nullptr);
 
   int num_frames_ = 0;
   std::vector<int> decoded_frames_mapping_;
 
   int last_best_ = 0;  // last none blank best id
   std::vector<float> last_frame_prob_;
+  // The last skipped frame in the current chunk, -1 for none
+  int last_blank_frame_ = -1;
   bool is_last_frame_blank_ = false;
   std::vector<std::vector<int>> inputs_, outputs_;
   std::vector<float> likelihood_;
   std::vector<std::vector<int>> times_;
+  int num_stable_outputs_ = 0;
+  // The best path up to the stable point of the decoder, which never changes
+  std::vector<int> stable_alignment_;
+  std::vector<int> stable_outputs_;
+  std::vector<int> stable_inputs_;
+  float stable_cost_ = 0;
+  // Buffers of UpdateBestPath(), they are reused across the chunks
+  std::vector<kaldi::LatticeArc> stable_arcs_;
+  std::vector<kaldi::LatticeArc> tail_arcs_;
+  std::vector<int> alignment_;
   DecodableTensorScaled decodable_;
   kaldi::LatticeFasterOnlineDecoder decoder_;
-  std::shared_ptr<ContextGraph> context_graph_;
+  std::shared_ptr<const ContextGraph> context_graph_;
   const CtcWfstBeamSearchOptions& opts_;
 };
 
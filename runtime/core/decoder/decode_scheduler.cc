@@ -0,0 +1,218 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/decode_scheduler.h"
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <utility>
+
+#include "utils/log.h"
+#include "utils/metrics.h"
+#include "utils/trace.h"
+
+namespace wenet {
+
+namespace {
+
+int64_t Now() {
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+void PinToCore(int core) {
+#ifdef __linux__
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(core, &cpus);
+  if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+    LOG(WARNING) << "Failed to pin the decode worker to core " << core;
+  }
+#else
+  LOG(WARNING) << "Pinning the decode workers is only supported on Linux";
+#endif
+}
+
+}  // namespace
+
+class DecodeScheduler::Session {
+ public:
+  enum State {
+    kIdle = 0,  // Waiting for the input
+    kQueued,
+    kRunning,
+    kNotified,  // Running, and notified during the step
+    kDone,
+  };
+
+  Session(StepFunc step, ReadyFunc ready, int home)
+      : step(std::move(step)), ready(std::move(ready)), home(home) {}
+
+  const StepFunc step;
+  const ReadyFunc ready;
+  // The worker whose queue it goes to when it's notified
+  const int home;
+  std::atomic<int> state{kIdle};
+  // The priority in the queues, it's only written by the thread which
+  // queues the session
+  int64_t ready_time = 0;
+};
+
+struct DecodeScheduler::Worker {
+  struct Later {
+    bool operator()(const std::shared_ptr<Session>& a,
+                    const std::shared_ptr<Session>& b) const {
+      return a->ready_time > b->ready_time;
+    }
+  };
+
+  std::mutex mutex;
+  // The earliest ready session on the top
+  std::priority_queue<std::shared_ptr<Session>,
+                      std::vector<std::shared_ptr<Session>>, Later>
+      queue;
+  std::thread thread;
+};
+
+DecodeScheduler::DecodeScheduler(const DecodeSchedulerOptions& opts)
+    : opts_(opts) {
+  CHECK_GT(opts_.num_workers, 0);
+  for (int i = 0; i < opts_.num_workers; ++i) {
+    workers_.emplace_back(new Worker);
+  }
+  // All the queues are there before any worker steals from them
+  for (int i = 0; i < opts_.num_workers; ++i) {
+    workers_[i]->thread = std::thread(&DecodeScheduler::Loop, this, i);
+  }
+}
+
+DecodeScheduler::~DecodeScheduler() {
+  stop_.store(true);
+  work_ready_.NotifyAll();
+  for (auto& worker : workers_) {
+    worker->thread.join();
+  }
+}
+
+std::shared_ptr<DecodeScheduler::Session> DecodeScheduler::AddSession(
+    StepFunc step, ReadyFunc ready) {
+  int home = next_home_.fetch_add(1) % num_workers();
+  return std::make_shared<Session>(std::move(step), std::move(ready), home);
+}
+
+void DecodeScheduler::Notify(const std::shared_ptr<Session>& session) {
+  int state = session->state.load();
+  while (true) {
+    if (state == Session::kIdle) {
+      if (!session->ready()) return;
+      if (session->state.compare_exchange_weak(state, Session::kQueued)) {
+        session->ready_time = Now();
+        Push(session->home, session);
+        return;
+      }
+    } else if (state == Session::kRunning) {
+      if (session->state.compare_exchange_weak(state, Session::kNotified)) {
+        return;
+      }
+    } else {
+      // It's queued, notified or done
+      return;
+    }
+  }
+}
+
+void DecodeScheduler::Push(int index, std::shared_ptr<Session> session) {
+  Metrics::Global().decode_queue_depth.Add(1);
+  {
+    Worker* worker = workers_[index].get();
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    worker->queue.push(std::move(session));
+  }
+  work_ready_.NotifyOne();
+}
+
+std::shared_ptr<DecodeScheduler::Session> DecodeScheduler::Pop(int index) {
+  const int n = num_workers();
+  for (int i = 0; i < n; ++i) {
+    Worker* worker = workers_[(index + i) % n].get();
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    if (worker->queue.empty()) continue;
+    std::shared_ptr<Session> session = worker->queue.top();
+    worker->queue.pop();
+    Metrics::Global().decode_queue_depth.Add(-1);
+    return session;
+  }
+  return nullptr;
+}
+
+void DecodeScheduler::Loop(int index) {
+  if (opts_.pin_workers) {
+    PinToCore(index % std::max(1U, std::thread::hardware_concurrency()));
+  }
+  while (!stop_.load()) {
+    std::shared_ptr<Session> session = Pop(index);
+    if (session == nullptr) {
+      uint32_t key = work_ready_.PrepareWait();
+      session = Pop(index);
+      if (session == nullptr && !stop_.load()) {
+        work_ready_.Wait(key);
+        continue;
+      }
+      work_ready_.CancelWait();
+      if (session == nullptr) break;
+    }
+    Run(index, std::move(session));
+  }
+}
+
+void DecodeScheduler::Run(int index, std::shared_ptr<Session> session) {
+  session->state.store(Session::kRunning);
+  StepState result = StepState::kDone;
+  {
+    WENET_TRACE_SCOPE("DecodeScheduler::Step");
+    result = session->step();
+  }
+  if (result == StepState::kDone) {
+    session->state.store(Session::kDone);
+    return;
+  }
+  if (result == StepState::kMore) {
+    // Still ready since ready_time, so it keeps its priority
+    session->state.store(Session::kQueued);
+    Push(index, std::move(session));
+    return;
+  }
+  while (true) {
+    int state = Session::kRunning;
+    if (session->state.compare_exchange_strong(state, Session::kIdle)) {
+      return;
+    }
+    // Notified during the step, the input may be ready now
+    session->state.store(Session::kRunning);
+    if (session->ready()) {
+      session->state.store(Session::kQueued);
+      session->ready_time = Now();
+      Push(index, std::move(session));
+      return;
+    }
+  }
+}
+
+}  // namespace wenet
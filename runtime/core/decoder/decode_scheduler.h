@@ -0,0 +1,98 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_DECODE_SCHEDULER_H_
+#define DECODER_DECODE_SCHEDULER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "utils/event_count.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+struct DecodeSchedulerOptions {
+  int num_workers = 4;
+  // Pin the worker i to the core i, it only works on Linux
+  bool pin_workers = false;
+};
+
+// DecodeScheduler multiplexes the decoding of many streaming sessions onto
+// a fixed pool of workers, so a server needs as many decoding threads as
+// cores rather than one blocking thread per session.
+//
+// A session is queued when its input is ready, e.g. there are enough frames
+// for the next chunk, and a worker runs one step of it, typically one
+// AsrDecoder::Decode(false), then queues it again if there is more to do,
+// so a session with a long backlog can't hold a worker. The queued sessions
+// run in the order of the time they became ready, which is about the time
+// their oldest undecoded audio arrived, so the latency of every session is
+// bounded under load. Each worker has its own queue and steals from the
+// others when it runs out of work.
+//
+// It is thread safe.
+class DecodeScheduler {
+ public:
+  enum class StepState {
+    kMore,  // There may be more to decode, run it again
+    kWait,  // Wait for more input, until the next Notify()
+    kDone,  // The session is finished
+  };
+  // Step of a session, it's never run concurrently for one session
+  using StepFunc = std::function<StepState()>;
+  // Whether a step could make progress, it must be thread safe
+  using ReadyFunc = std::function<bool()>;
+  class Session;
+
+  explicit DecodeScheduler(const DecodeSchedulerOptions& opts);
+  // The queued sessions are dropped
+  ~DecodeScheduler();
+
+  // The functions should not hold the owner of the session, or they never
+  // go away, see AsyncConnectionHandler
+  std::shared_ptr<Session> AddSession(StepFunc step, ReadyFunc ready);
+  // Called when the input of `session` is updated, it is queued if it is
+  // ready and not running. If it is running, it's checked again after the
+  // step.
+  void Notify(const std::shared_ptr<Session>& session);
+
+  int num_workers() const { return static_cast<int>(workers_.size()); }
+
+ private:
+  struct Worker;
+
+  void Loop(int index);
+  // Pop from the queue of the worker `index`, or steal from the others
+  std::shared_ptr<Session> Pop(int index);
+  void Push(int index, std::shared_ptr<Session> session);
+  void Run(int index, std::shared_ptr<Session> session);
+
+  const DecodeSchedulerOptions opts_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<int> next_home_{0};
+  std::atomic<bool> stop_{false};
+  // Notified when a session is queued
+  EventCount work_ready_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(DecodeScheduler);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_DECODE_SCHEDULER_H_
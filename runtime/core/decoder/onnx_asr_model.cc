@@ -18,6 +18,7 @@
 #include "decoder/onnx_asr_model.h"
 
 #include <algorithm>
+#include <cstring>
 #include <memory>
 #include <utility>
 
@@ -25,6 +26,12 @@
 
 namespace wenet {
 
+static int64_t ShapeSize(const std::vector<int64_t>& shape) {
+  int64_t size = 1;
+  for (int64_t dim : shape) size *= dim;
+  return size;
+}
+
 Ort::Env OnnxAsrModel::env_ = Ort::Env(ORT_LOGGING_LEVEL_WARNING, "");
 Ort::SessionOptions OnnxAsrModel::session_options_ = Ort::SessionOptions();
 
@@ -143,6 +150,10 @@ void OnnxAsrModel::Read(const std::string& model_dir) {
   GetInputOutputInfo(encoder_session_, &encoder_in_names_, &encoder_out_names_);
   LOG(INFO) << "Onnx CTC:";
   GetInputOutputInfo(ctc_session_, &ctc_in_names_, &ctc_out_names_);
+  // (1, T, vocab_size), it's -1 if the vocabulary axis is dynamic
+  vocab_size_ = ctc_session_->GetOutputTypeInfo(0)
+                    .GetTensorTypeAndShapeInfo()
+                    .GetShape()[2];
   LOG(INFO) << "Onnx Rescore:";
   GetInputOutputInfo(rescore_session_, &rescore_in_names_, &rescore_out_names_);
 }
@@ -153,6 +164,7 @@ OnnxAsrModel::OnnxAsrModel(const OnnxAsrModel& other) {
   num_blocks_ = other.num_blocks_;
   head_ = other.head_;
   cnn_module_kernel_ = other.cnn_module_kernel_;
+  vocab_size_ = other.vocab_size_;
   right_context_ = other.right_context_;
   subsampling_rate_ = other.subsampling_rate_;
   sos_ = other.sos_;
@@ -160,6 +172,8 @@ OnnxAsrModel::OnnxAsrModel(const OnnxAsrModel& other) {
   is_bidirectional_decoder_ = other.is_bidirectional_decoder_;
   chunk_size_ = other.chunk_size_;
   num_left_chunks_ = other.num_left_chunks_;
+  max_cache_frames_ = other.max_cache_frames_;
+  keep_encoder_outs_ = other.keep_encoder_outs_;
   offset_ = other.offset_;
 
   // sessions
@@ -183,132 +197,256 @@ std::shared_ptr<AsrModel> OnnxAsrModel::Copy() const {
   return asr_model;
 }
 
+const Ort::MemoryInfo& OnnxAsrModel::CpuMemoryInfo() {
+  static Ort::MemoryInfo memory_info =
+      Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
+  return memory_info;
+}
+
 void OnnxAsrModel::Reset() {
   offset_ = 0;
-  encoder_outs_.clear();
+  num_encoder_frames_ = 0;
+  num_chunk_frames_ = 0;
   cached_feature_.clear();
+  const Ort::MemoryInfo& memory_info = CpuMemoryInfo();
   // Reset att_cache
-  Ort::MemoryInfo memory_info =
-      Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
   if (num_left_chunks_ > 0) {
     int required_cache_size = chunk_size_ * num_left_chunks_;
     offset_ = required_cache_size;
-    att_cache_.resize(num_blocks_ * head_ * required_cache_size *
-                          encoder_output_size_ / head_ * 2,
-                      0.0);
-    const int64_t att_cache_shape[] = {num_blocks_, head_, required_cache_size,
-                                       encoder_output_size_ / head_ * 2};
-    att_cache_ort_ = Ort::Value::CreateTensor<float>(
-        memory_info, att_cache_.data(), att_cache_.size(), att_cache_shape, 4);
+    att_cache_shape_ = {num_blocks_, head_, required_cache_size,
+                        encoder_output_size_ / head_ * 2};
   } else {
-    att_cache_.resize(0, 0.0);
-    const int64_t att_cache_shape[] = {num_blocks_, head_, 0,
-                                       encoder_output_size_ / head_ * 2};
-    att_cache_ort_ = Ort::Value::CreateTensor<float>(
-        memory_info, att_cache_.data(), att_cache_.size(), att_cache_shape, 4);
+    att_cache_shape_ = {num_blocks_, head_, 0,
+                        encoder_output_size_ / head_ * 2};
   }
+  att_cache_.assign(ShapeSize(att_cache_shape_), 0.0);
+  att_cache_ort_ = Ort::Value::CreateTensor<float>(
+      memory_info, att_cache_.data(), att_cache_.size(),
+      att_cache_shape_.data(), att_cache_shape_.size());
 
   // Reset cnn_cache
-  cnn_cache_.resize(
-      num_blocks_ * encoder_output_size_ * (cnn_module_kernel_ - 1), 0.0);
-  const int64_t cnn_cache_shape[] = {num_blocks_, 1, encoder_output_size_,
-                                     cnn_module_kernel_ - 1};
+  cnn_cache_shape_ = {num_blocks_, 1, encoder_output_size_,
+                      cnn_module_kernel_ - 1};
+  cnn_cache_.assign(ShapeSize(cnn_cache_shape_), 0.0);
   cnn_cache_ort_ = Ort::Value::CreateTensor<float>(
-      memory_info, cnn_cache_.data(), cnn_cache_.size(), cnn_cache_shape, 4);
+      memory_info, cnn_cache_.data(), cnn_cache_.size(),
+      cnn_cache_shape_.data(), cnn_cache_shape_.size());
 }
 
-void OnnxAsrModel::ForwardEncoderFunc(
-    const std::vector<std::vector<float>>& chunk_feats,
-    std::vector<std::vector<float>>* out_prob) {
-  Ort::MemoryInfo memory_info =
-      Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
-  // 1. Prepare onnx required data, splice cached_feature_ and chunk_feats
-  // chunk
-  int num_frames = cached_feature_.size() + chunk_feats.size();
-  const int feature_dim = chunk_feats[0].size();
-  std::vector<float> feats;
-  for (size_t i = 0; i < cached_feature_.size(); ++i) {
-    feats.insert(feats.end(), cached_feature_[i].begin(),
-                 cached_feature_[i].end());
-  }
-  for (size_t i = 0; i < chunk_feats.size(); ++i) {
-    feats.insert(feats.end(), chunk_feats[i].begin(), chunk_feats[i].end());
+int OnnxAsrModel::NumEncoderOutputs(int num_input_frames) const {
+  // The convolution subsampling outputs one frame for the first
+  // right_context_ + 1 frames, and one more for every subsampling_rate_
+  // frames after them
+  return (num_input_frames - right_context_ - 1) / subsampling_rate_ + 1;
+}
+
+void OnnxAsrModel::ForwardEncoderChunk(const float* feats, int num_frames,
+                                       int feature_dim) {
+  const Ort::MemoryInfo& memory_info = CpuMemoryInfo();
+  if (encoder_binding_ == nullptr) {
+    encoder_binding_ = std::make_unique<Ort::IoBinding>(*encoder_session_);
   }
-  const int64_t feats_shape[3] = {1, num_frames, feature_dim};
+  // 1. Prepare onnx required data, the chunk is a view of the spliced input
+  int num_input_frames = num_frames;
+  const int64_t feats_shape[3] = {1, num_input_frames, feature_dim};
   Ort::Value feats_ort = Ort::Value::CreateTensor<float>(
-      memory_info, feats.data(), feats.size(), feats_shape, 3);
+      memory_info, const_cast<float*>(feats),
+      static_cast<size_t>(num_frames) * feature_dim, feats_shape, 3);
   // offset
-  int64_t offset_int64 = static_cast<int64_t>(offset_);
+  offset_int64_ = offset_;
   Ort::Value offset_ort = Ort::Value::CreateTensor<int64_t>(
-      memory_info, &offset_int64, 1, std::vector<int64_t>{}.data(), 0);
+      memory_info, &offset_int64_, 1, nullptr, 0);
   // required_cache_size
-  int64_t required_cache_size = chunk_size_ * num_left_chunks_;
+  required_cache_size_ = chunk_size_ * num_left_chunks_;
+  if (num_left_chunks_ < 0) {
+    required_cache_size_ = AsrModel::required_cache_size();
+  }
   Ort::Value required_cache_size_ort = Ort::Value::CreateTensor<int64_t>(
-      memory_info, &required_cache_size, 1, std::vector<int64_t>{}.data(), 0);
+      memory_info, &required_cache_size_, 1, nullptr, 0);
   // att_mask
   Ort::Value att_mask_ort{nullptr};
-  std::vector<uint8_t> att_mask(required_cache_size + chunk_size_, 1);
   if (num_left_chunks_ > 0) {
+    att_mask_.assign(required_cache_size_ + chunk_size_, 1);
     int chunk_idx = offset_ / chunk_size_ - num_left_chunks_;
     if (chunk_idx < num_left_chunks_) {
       for (int i = 0; i < (num_left_chunks_ - chunk_idx) * chunk_size_; ++i) {
-        att_mask[i] = 0;
+        att_mask_[i] = 0;
       }
     }
-    const int64_t att_mask_shape[] = {1, 1, required_cache_size + chunk_size_};
+    const int64_t att_mask_shape[] = {1, 1, required_cache_size_ + chunk_size_};
     att_mask_ort = Ort::Value::CreateTensor<bool>(
-        memory_info, reinterpret_cast<bool*>(att_mask.data()), att_mask.size(),
-        att_mask_shape, 3);
+        memory_info, reinterpret_cast<bool*>(att_mask_.data()),
+        att_mask_.size(), att_mask_shape, 3);
   }
-
-  // 2. Encoder chunk forward
-  std::vector<Ort::Value> inputs;
   for (auto name : encoder_in_names_) {
     if (!strcmp(name, "chunk")) {
-      inputs.emplace_back(std::move(feats_ort));
+      encoder_binding_->BindInput(name, feats_ort);
     } else if (!strcmp(name, "offset")) {
-      inputs.emplace_back(std::move(offset_ort));
+      encoder_binding_->BindInput(name, offset_ort);
     } else if (!strcmp(name, "required_cache_size")) {
-      inputs.emplace_back(std::move(required_cache_size_ort));
+      encoder_binding_->BindInput(name, required_cache_size_ort);
     } else if (!strcmp(name, "att_cache")) {
-      inputs.emplace_back(std::move(att_cache_ort_));
+      encoder_binding_->BindInput(name, att_cache_ort_);
     } else if (!strcmp(name, "cnn_cache")) {
-      inputs.emplace_back(std::move(cnn_cache_ort_));
-    } else if (!strcmp(name, "att_mask")) {
-      inputs.emplace_back(std::move(att_mask_ort));
+      encoder_binding_->BindInput(name, cnn_cache_ort_);
+    } else if (!strcmp(name, "att_mask") && num_left_chunks_ > 0) {
+      encoder_binding_->BindInput(name, att_mask_ort);
     }
   }
 
-  std::vector<Ort::Value> ort_outputs = encoder_session_->Run(
-      Ort::RunOptions{nullptr}, encoder_in_names_.data(), inputs.data(),
-      inputs.size(), encoder_out_names_.data(), encoder_out_names_.size());
-
-  offset_ += static_cast<int>(
-      ort_outputs[0].GetTensorTypeAndShapeInfo().GetShape()[1]);
-  att_cache_ort_ = std::move(ort_outputs[1]);
-  cnn_cache_ort_ = std::move(ort_outputs[2]);
+  // 2. Bind the outputs in place, the encoder output goes to the end of
+  // encoder_out_, and the caches go to the spare buffers
+  int num_outputs = NumEncoderOutputs(num_input_frames);
+  int begin = keep_encoder_outs_ ? num_encoder_frames_ : 0;
+  encoder_out_.resize(static_cast<size_t>(begin + num_outputs) *
+                      encoder_output_size_);
+  const int64_t out_shape[] = {1, num_outputs, encoder_output_size_};
+  float* out_data = encoder_out_.data() + begin * encoder_output_size_;
+  Ort::Value out_ort = Ort::Value::CreateTensor<float>(
+      memory_info, out_data, num_outputs * encoder_output_size_, out_shape, 3);
+  encoder_binding_->BindOutput(encoder_out_names_[0], out_ort);
+  // The attention cache only has a fixed shape with num_left_chunks > 0,
+  // otherwise onnxruntime allocates it
+  bool fixed_att_cache = num_left_chunks_ > 0;
+  Ort::Value next_att_cache_ort{nullptr};
+  if (fixed_att_cache) {
+    next_att_cache_.resize(att_cache_.size());
+    next_att_cache_ort = Ort::Value::CreateTensor<float>(
+        memory_info, next_att_cache_.data(), next_att_cache_.size(),
+        att_cache_shape_.data(), att_cache_shape_.size());
+    encoder_binding_->BindOutput(encoder_out_names_[1], next_att_cache_ort);
+  } else {
+    encoder_binding_->BindOutput(encoder_out_names_[1], memory_info);
+  }
+  next_cnn_cache_.resize(cnn_cache_.size());
+  Ort::Value next_cnn_cache_ort = Ort::Value::CreateTensor<float>(
+      memory_info, next_cnn_cache_.data(), next_cnn_cache_.size(),
+      cnn_cache_shape_.data(), cnn_cache_shape_.size());
+  encoder_binding_->BindOutput(encoder_out_names_[2], next_cnn_cache_ort);
+
+  // 3. Encoder chunk forward
+  encoder_session_->Run(Ort::RunOptions{nullptr}, *encoder_binding_);
+
+  offset_ += num_outputs;
+  num_encoder_frames_ = begin + num_outputs;
+  num_chunk_frames_ = num_outputs;
+  if (fixed_att_cache) {
+    att_cache_.swap(next_att_cache_);
+    att_cache_ort_ = std::move(next_att_cache_ort);
+  } else {
+    std::vector<Ort::Value> outputs = encoder_binding_->GetOutputValues();
+    att_cache_ort_ = std::move(outputs[1]);
+    if (max_cache_frames_ > 0) TrimAttentionCache();
+  }
+  cnn_cache_.swap(next_cnn_cache_);
+  cnn_cache_ort_ = std::move(next_cnn_cache_ort);
+}
 
-  std::vector<Ort::Value> ctc_inputs;
-  ctc_inputs.emplace_back(std::move(ort_outputs[0]));
+void OnnxAsrModel::TrimAttentionCache() {
+  // att_cache is (num_blocks, head, cache_t, d_k * 2)
+  std::vector<int64_t> shape =
+      att_cache_ort_.GetTensorTypeAndShapeInfo().GetShape();
+  CHECK_EQ(shape.size(), 4);
+  int64_t cache_t = shape[2];
+  if (cache_t <= max_cache_frames_) return;
+  int64_t num_rows = shape[0] * shape[1];
+  int64_t row_size = shape[3];
+  const float* src = att_cache_ort_.GetTensorData<float>();
+  // The exported model may ignore required_cache_size, copy the tail of each
+  // (block, head) to att_cache_, whose size doesn't grow any more
+  att_cache_.resize(num_rows * max_cache_frames_ * row_size);
+  float* dst = att_cache_.data();
+  for (int64_t i = 0; i < num_rows; ++i) {
+    const float* row = src + (i * cache_t + cache_t - max_cache_frames_) *
+                                 row_size;
+    memcpy(dst, row, sizeof(float) * max_cache_frames_ * row_size);
+    dst += max_cache_frames_ * row_size;
+  }
+  shape[2] = max_cache_frames_;
+  att_cache_ort_ = Ort::Value::CreateTensor<float>(
+      CpuMemoryInfo(), att_cache_.data(), att_cache_.size(), shape.data(), 4);
+}
 
-  std::vector<Ort::Value> ctc_ort_outputs = ctc_session_->Run(
-      Ort::RunOptions{nullptr}, ctc_in_names_.data(), ctc_inputs.data(),
-      ctc_inputs.size(), ctc_out_names_.data(), ctc_out_names_.size());
-  encoder_outs_.push_back(std::move(ctc_inputs[0]));
+size_t OnnxAsrModel::MemoryUsage() const {
+  size_t bytes = AsrModel::MemoryUsage();
+  // The caches bound in place are views of the buffers below, only the
+  // attention cache allocated by onnxruntime is counted on its own
+  if (num_left_chunks_ <= 0 &&
+      static_cast<const OrtValue*>(att_cache_ort_) != nullptr &&
+      att_cache_ort_.GetTensorData<float>() != att_cache_.data()) {
+    bytes += att_cache_ort_.GetTensorTypeAndShapeInfo().GetElementCount() *
+             sizeof(float);
+  }
+  bytes += (att_cache_.capacity() + next_att_cache_.capacity() +
+            cnn_cache_.capacity() + next_cnn_cache_.capacity()) *
+           sizeof(float);
+  bytes += (encoder_out_.capacity() + ctc_out_.capacity()) * sizeof(float);
+  return bytes;
+}
 
-  float* logp_data = ctc_ort_outputs[0].GetTensorMutableData<float>();
-  auto type_info = ctc_ort_outputs[0].GetTensorTypeAndShapeInfo();
+void OnnxAsrModel::CtcActivation(
+    const Ort::Value& hidden, std::vector<std::vector<float>>* out_prob) {
+  if (ctc_binding_ == nullptr) {
+    ctc_binding_ = std::make_unique<Ort::IoBinding>(*ctc_session_);
+  }
+  ctc_binding_->BindInput(ctc_in_names_[0], hidden);
+  // The log probs go to ctc_out_ in place if the vocabulary size is static
+  int num_frames = hidden.GetTensorTypeAndShapeInfo().GetShape()[1];
+  Ort::Value out_ort{nullptr};
+  if (vocab_size_ > 0) {
+    ctc_out_.resize(static_cast<size_t>(num_frames) * vocab_size_);
+    const int64_t out_shape[] = {1, num_frames, vocab_size_};
+    out_ort = Ort::Value::CreateTensor<float>(
+        CpuMemoryInfo(), ctc_out_.data(), ctc_out_.size(), out_shape, 3);
+    ctc_binding_->BindOutput(ctc_out_names_[0], out_ort);
+  } else {
+    ctc_binding_->BindOutput(ctc_out_names_[0], CpuMemoryInfo());
+  }
+  ctc_session_->Run(Ort::RunOptions{nullptr}, *ctc_binding_);
+  if (vocab_size_ <= 0) {
+    out_ort = std::move(ctc_binding_->GetOutputValues()[0]);
+  }
 
-  int num_outputs = type_info.GetShape()[1];
-  int output_dim = type_info.GetShape()[2];
-  out_prob->resize(num_outputs);
-  for (int i = 0; i < num_outputs; i++) {
+  const float* logp_data = out_ort.GetTensorData<float>();
+  int output_dim = out_ort.GetTensorTypeAndShapeInfo().GetShape()[2];
+  out_prob->resize(num_frames);
+  for (int i = 0; i < num_frames; i++) {
     (*out_prob)[i].resize(output_dim);
     memcpy((*out_prob)[i].data(), logp_data + i * output_dim,
            sizeof(float) * output_dim);
   }
 }
 
+const float* OnnxAsrModel::ChunkEncoderOut() const {
+  return encoder_out_.data() +
+         static_cast<size_t>(num_encoder_frames_ - num_chunk_frames_) *
+             encoder_output_size_;
+}
+
+void OnnxAsrModel::ForwardEncoderFunc(
+    const std::vector<std::vector<float>>& chunk_feats,
+    std::vector<std::vector<float>>* out_prob) {
+  const int feature_dim = chunk_feats[0].size();
+  std::vector<float>* feats = BeginChunk(feature_dim);
+  for (const auto& feat : chunk_feats) {
+    feats->insert(feats->end(), feat.begin(), feat.end());
+  }
+  ForwardEncoderFunc(feats->data(), feats->size() / feature_dim, feature_dim,
+                     out_prob);
+}
+
+void OnnxAsrModel::ForwardEncoderFunc(
+    const float* feats, int num_frames, int feature_dim,
+    std::vector<std::vector<float>>* out_prob) {
+  ForwardEncoderChunk(feats, num_frames, feature_dim);
+  // The CTC session reads the encoder output of the chunk in place
+  const int64_t hidden_shape[] = {1, num_chunk_frames_, encoder_output_size_};
+  Ort::Value hidden = Ort::Value::CreateTensor<float>(
+      CpuMemoryInfo(), const_cast<float*>(ChunkEncoderOut()),
+      num_chunk_frames_ * encoder_output_size_, hidden_shape, 3);
+  CtcActivation(hidden, out_prob);
+}
+
 float OnnxAsrModel::ComputeAttentionScore(const float* prob,
                                           const std::vector<int>& hyp, int eos,
                                           int decode_out_len) {
@@ -323,8 +461,7 @@ float OnnxAsrModel::ComputeAttentionScore(const float* prob,
 void OnnxAsrModel::AttentionRescoring(const std::vector<std::vector<int>>& hyps,
                                       float reverse_weight,
                                       std::vector<float>* rescoring_score) {
-  Ort::MemoryInfo memory_info =
-      Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
+  const Ort::MemoryInfo& memory_info = CpuMemoryInfo();
   CHECK(rescoring_score != nullptr);
   int num_hyps = hyps.size();
   rescoring_score->resize(num_hyps, 0.0f);
@@ -333,7 +470,7 @@ void OnnxAsrModel::AttentionRescoring(const std::vector<std::vector<int>>& hyps,
     return;
   }
   // No encoder output
-  if (encoder_outs_.size() == 0) {
+  if (num_encoder_frames_ == 0) {
     return;
   }
 
@@ -345,18 +482,9 @@ void OnnxAsrModel::AttentionRescoring(const std::vector<std::vector<int>>& hyps,
     hyps_lens.emplace_back(static_cast<int64_t>(length));
   }
 
-  std::vector<float> rescore_input;
-  int encoder_len = 0;
-  for (int i = 0; i < encoder_outs_.size(); i++) {
-    float* encoder_outs_data = encoder_outs_[i].GetTensorMutableData<float>();
-    auto type_info = encoder_outs_[i].GetTensorTypeAndShapeInfo();
-    for (int j = 0; j < type_info.GetElementCount(); j++) {
-      rescore_input.emplace_back(encoder_outs_data[j]);
-    }
-    encoder_len += type_info.GetShape()[1];
-  }
-
-  const int64_t decode_input_shape[] = {1, encoder_len, encoder_output_size_};
+  // The decoder reads the encoder outputs of the segment in place
+  const int64_t decode_input_shape[] = {1, num_encoder_frames_,
+                                        encoder_output_size_};
 
   std::vector<int64_t> hyps_pad;
 
@@ -380,7 +508,8 @@ void OnnxAsrModel::AttentionRescoring(const std::vector<std::vector<int>>& hyps,
   const int64_t hyps_lens_shape[] = {num_hyps};
 
   Ort::Value decode_input_tensor_ = Ort::Value::CreateTensor<float>(
-      memory_info, rescore_input.data(), rescore_input.size(),
+      memory_info, encoder_out_.data(),
+      static_cast<size_t>(num_encoder_frames_) * encoder_output_size_,
       decode_input_shape, 3);
   Ort::Value hyps_pad_tensor_ = Ort::Value::CreateTensor<int64_t>(
       memory_info, hyps_pad.data(), hyps_pad.size(), hyps_pad_shape, 2);
@@ -43,6 +43,7 @@ class OnnxAsrModel : public AsrModel {
                           float reverse_weight,
                           std::vector<float>* rescoring_score) override;
   std::shared_ptr<AsrModel> Copy() const override;
+  size_t MemoryUsage() const override;
   void GetInputOutputInfo(const std::shared_ptr<Ort::Session>& session,
                           std::vector<const char*>* in_names,
                           std::vector<const char*>* out_names);
@@ -50,6 +51,25 @@ class OnnxAsrModel : public AsrModel {
  protected:
   void ForwardEncoderFunc(const std::vector<std::vector<float>>& chunk_feats,
                           std::vector<std::vector<float>>* ctc_prob) override;
+  void ForwardEncoderFunc(const float* feats, int num_frames,
+                          int feature_dim,
+                          std::vector<std::vector<float>>* ctc_prob) override;
+  // Encoder forward of one chunk, updates the caches and appends the encoder
+  // output of the chunk to encoder_out_. The inputs and the outputs are
+  // bound in place by encoder_binding_, so there is no allocation for the
+  // caches and the encoder outputs once the buffers are grown.
+  void ForwardEncoderChunk(const float* feats, int num_frames,
+                           int feature_dim);
+  // Number of encoder outputs of `num_input_frames` spliced input frames
+  int NumEncoderOutputs(int num_input_frames) const;
+  // Encoder output of the last chunk, (num_chunk_frames_ x output_size)
+  const float* ChunkEncoderOut() const;
+  // Keep the last max_cache_frames_ frames of att_cache_ort_ in att_cache_
+  void TrimAttentionCache();
+  // Runs the CTC session on `hidden` (1, T, D) and copies the (T, V) log
+  // probs to `ctc_prob`
+  void CtcActivation(const Ort::Value& hidden,
+                     std::vector<std::vector<float>>* ctc_prob);
 
   float ComputeAttentionScore(const float* prob, const std::vector<int>& hyp,
                               int eos, int decode_out_len);
@@ -74,10 +94,18 @@ class OnnxAsrModel : public AsrModel {
   std::vector<const char*> ctc_in_names_, ctc_out_names_;
   std::vector<const char*> rescore_in_names_, rescore_out_names_;
 
+  static const Ort::MemoryInfo& CpuMemoryInfo();
+
+  int64_t vocab_size_ = -1;
+  // Per session bindings of the shared sessions, created on first use
+  std::unique_ptr<Ort::IoBinding> encoder_binding_;
+  std::unique_ptr<Ort::IoBinding> ctc_binding_;
+
   // caches
   Ort::Value att_cache_ort_{nullptr};
   Ort::Value cnn_cache_ort_{nullptr};
-  std::vector<Ort::Value> encoder_outs_;
+  std::vector<int64_t> att_cache_shape_;
+  std::vector<int64_t> cnn_cache_shape_;
   // NOTE: Instead of making a copy of the xx_cache, ONNX only maintains
   //  its data pointer when initializing xx_cache_ort (see https://github.com/
   //  microsoft/onnxruntime/blob/master/onnxruntime/core/framework
@@ -85,6 +113,21 @@ class OnnxAsrModel : public AsrModel {
   //  our data "alive" during the lifetime of decoder.
   std::vector<float> att_cache_;
   std::vector<float> cnn_cache_;
+  // The caches of the next chunk are written here, and swapped with the
+  // above after the forward
+  std::vector<float> next_att_cache_;
+  std::vector<float> next_cnn_cache_;
+  // Scalar inputs and att_mask, the tensors are views of them
+  int64_t offset_int64_ = 0;
+  int64_t required_cache_size_ = 0;
+  std::vector<uint8_t> att_mask_;
+  // Encoder outputs of the segment, (num_encoder_frames_ x output_size)
+  // contiguously, the rescoring session reads it in place
+  std::vector<float> encoder_out_;
+  int num_encoder_frames_ = 0;
+  int num_chunk_frames_ = 0;
+  // CTC log probs of the last CtcActivation
+  std::vector<float> ctc_out_;
 };
 
 }  // namespace wenet
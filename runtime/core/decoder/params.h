@@ -21,6 +21,7 @@
 #include <utility>
 #include <vector>
 
+#include "decoder/admission_controller.h"
 #include "decoder/asr_decoder.h"
 #ifdef USE_ONNX
 #include "decoder/onnx_asr_model.h"
@@ -59,13 +60,43 @@ DEFINE_string(bpu_model_dir, "",
 DEFINE_string(openvino_dir, "", "directory where the OV model is saved");
 DEFINE_int32(core_number, 1, "Core number of process");
 
+DEFINE_string(trace_path, "",
+              "dump the chrome trace here, at exit or on SIGUSR1 for the "
+              "servers, it requires building with TRACE");
+DEFINE_int32(rescoring_threads, 0,
+             "if > 0, the servers send the ctc final result of a segment of "
+             "continuous decoding at once, and send the rescored one later "
+             "from a pool of this many threads, 0 means rescoring inline");
+
+// AdmissionController flags, the servers reject the new sessions over them
+DEFINE_int32(max_sessions, 0, "max concurrent sessions, 0 means no limit");
+DEFINE_double(max_decode_load, 0.0,
+              "max decode load with a new session, the load is the compute "
+              "time of the chunks per second per decode thread, 0 means no "
+              "limit");
+DEFINE_int32(max_backlog_ms, 0,
+             "max average audio in ms waiting for decoding, 0 means no limit");
+DEFINE_double(degrade_decode_load, 0.0,
+              "admit a new session with larger chunks, narrower beams and "
+              "no rescoring if the decode load with it is over this, 0 means "
+              "never");
+DEFINE_int32(admission_threads, 0,
+             "decode threads the load is measured against, 0 means the "
+             "number of cores");
+
 // FeaturePipelineConfig flags
 DEFINE_int32(num_bins, 80, "num mel bins for fbank feature");
 DEFINE_int32(sample_rate, 16000, "sample rate for audio");
 DEFINE_string(feat_type, "kaldi", "Type of feature extraction: kaldi, whisper");
+DEFINE_bool(fast_fbank, false,
+            "use the SIMD optimized fbank engine, the features match the "
+            "default engine within float rounding");
 
 // TLG fst
 DEFINE_string(fst_path, "", "TLG fst path");
+DEFINE_bool(fst_mmap, true,
+            "memory map the TLG fst if it is an aligned const fst, "
+            "see fstmakeconst");
 
 // ITN fst
 DEFINE_string(itn_model_dir, "",
@@ -75,6 +106,12 @@ DEFINE_string(itn_model_dir, "",
 // DecodeOptions flags
 DEFINE_int32(chunk_size, 16, "decoding chunk size");
 DEFINE_int32(num_left_chunks, -1, "left chunks in decoding");
+DEFINE_int32(max_cache_frames, -1,
+             "if num_left_chunks < 0, max frames of the attention cache, "
+             "-1 means unbounded");
+DEFINE_int32(max_segment_ms, 20000,
+             "endpoint a segment at this length, it bounds the encoder "
+             "outputs kept for the rescoring of the segment");
 DEFINE_double(ctc_weight, 0.5,
               "ctc weight when combining ctc score and rescoring score");
 DEFINE_double(rescoring_weight, 1.0,
@@ -83,6 +120,16 @@ DEFINE_double(reverse_weight, 0.0,
               "used for bitransformer rescoring. it must be 0.0 if decoder is"
               "conventional transformer decoder, and only reverse_weight > 0.0"
               "dose the right to left decoder will be calculated and used");
+DEFINE_double(rescoring_skip_margin, 0.0,
+              "skip the rescoring if the ctc score of the 1-best beats all "
+              "the others by this margin, <= 0 means never");
+DEFINE_bool(rescoring_skip_single_hyp, false,
+            "skip the rescoring if there is only one distinct hypothesis");
+DEFINE_int32(rescoring_gate_max_ms, 0,
+             "the above rescoring skip rules only apply to the utterances "
+             "not longer than it, <= 0 means any length");
+DEFINE_int32(rescoring_max_hyps, 0,
+             "only rescore the top hypotheses, <= 0 means all");
 DEFINE_int32(max_active, 7000, "max active states in ctc wfst search");
 DEFINE_int32(min_active, 200, "min active states in ctc wfst search");
 DEFINE_double(beam, 16.0, "beam in ctc wfst search");
@@ -108,6 +155,12 @@ DEFINE_string(unit_path, "",
 
 // Context flags
 DEFINE_string(context_path, "", "context path, is used to build context graph");
+DEFINE_int32(context_graph_cache_mb, 256,
+             "memory of the LRU cache of the compiled session hotwords, "
+             "0 to compile them for every session");
+DEFINE_string(context_graph_path, "",
+              "context graph compiled by compile_context_graph_main, it is "
+              "memory mapped, the contexts of --context_path overlay it");
 DEFINE_double(context_score, 3.0, "is used to rescore the decoded result");
 
 // PostProcessOptions flags
@@ -132,6 +185,9 @@ std::shared_ptr<FeaturePipelineConfig> InitFeaturePipelineConfigFromFlags() {
   FeatureType feat_type = StringToFeatureType(FLAGS_feat_type);
   auto feature_config = std::make_shared<FeaturePipelineConfig>(
       FLAGS_num_bins, FLAGS_sample_rate, feat_type);
+  if (FLAGS_fast_fbank) {
+    feature_config->engine = FbankEngine::kOptimized;
+  }
   return feature_config;
 }
 
@@ -139,8 +195,15 @@ std::shared_ptr<DecodeOptions> InitDecodeOptionsFromFlags() {
   auto decode_config = std::make_shared<DecodeOptions>();
   decode_config->chunk_size = FLAGS_chunk_size;
   decode_config->num_left_chunks = FLAGS_num_left_chunks;
+  decode_config->max_cache_frames = FLAGS_max_cache_frames;
   decode_config->ctc_weight = FLAGS_ctc_weight;
   decode_config->reverse_weight = FLAGS_reverse_weight;
+  decode_config->rescoring_gate_opts.score_margin = FLAGS_rescoring_skip_margin;
+  decode_config->rescoring_gate_opts.skip_single_hyp =
+      FLAGS_rescoring_skip_single_hyp;
+  decode_config->rescoring_gate_opts.max_utterance_ms =
+      FLAGS_rescoring_gate_max_ms;
+  decode_config->rescoring_gate_opts.max_hyps = FLAGS_rescoring_max_hyps;
   decode_config->rescoring_weight = FLAGS_rescoring_weight;
   decode_config->ctc_wfst_search_opts.max_active = FLAGS_max_active;
   decode_config->ctc_wfst_search_opts.min_active = FLAGS_min_active;
@@ -158,6 +221,8 @@ std::shared_ptr<DecodeOptions> InitDecodeOptionsFromFlags() {
   decode_config->ctc_prefix_search_opts.blank = FLAGS_blank_id;
   decode_config->ctc_endpoint_config.blank = FLAGS_blank_id;
   decode_config->ctc_endpoint_config.blank_scale = FLAGS_blank_scale;
+  decode_config->ctc_endpoint_config.rule3.min_utterance_length =
+      FLAGS_max_segment_ms;
   return decode_config;
 }
 
@@ -218,17 +283,24 @@ std::shared_ptr<DecodeResource> InitDecodeResourceFromFlags() {
     LOG(FATAL) << "Please set ONNX, TORCH, XPU, BPU or OpenVINO model path!!!";
   }
 
+  if (FLAGS_rescoring_threads > 0) {
+    LOG(INFO) << "Rescore the segments asynchronously by "
+              << FLAGS_rescoring_threads << " threads";
+    resource->rescoring_pool =
+        std::make_shared<ThreadPool>(FLAGS_rescoring_threads);
+  }
+
   LOG(INFO) << "Reading unit table " << FLAGS_unit_path;
   auto unit_table = std::shared_ptr<fst::SymbolTable>(
       fst::SymbolTable::ReadText(FLAGS_unit_path));
   CHECK(unit_table != nullptr);
   resource->unit_table = unit_table;
+  resource->unit_trie = std::make_shared<UnitTrie>(*unit_table);
 
   if (!FLAGS_fst_path.empty()) {  // With LM
     CHECK(!FLAGS_dict_path.empty());
     LOG(INFO) << "Reading fst " << FLAGS_fst_path;
-    auto fst = std::shared_ptr<fst::VectorFst<fst::StdArc>>(
-        fst::VectorFst<fst::StdArc>::Read(FLAGS_fst_path));
+    auto fst = ReadFst(FLAGS_fst_path, FLAGS_fst_mmap);
     CHECK(fst != nullptr);
     resource->fst = fst;
 
@@ -241,6 +313,11 @@ std::shared_ptr<DecodeResource> InitDecodeResourceFromFlags() {
     resource->symbol_table = unit_table;
   }
 
+  if (!FLAGS_context_graph_path.empty()) {
+    LOG(INFO) << "Reading context graph " << FLAGS_context_graph_path;
+    resource->context_graph = ContextGraph::Read(FLAGS_context_graph_path);
+    CHECK(resource->context_graph != nullptr);
+  }
   if (!FLAGS_context_path.empty()) {
     LOG(INFO) << "Reading context " << FLAGS_context_path;
     std::vector<std::string> contexts;
@@ -251,8 +328,16 @@ std::shared_ptr<DecodeResource> InitDecodeResourceFromFlags() {
     }
     ContextConfig config;
     config.context_score = FLAGS_context_score;
-    resource->context_graph = std::make_shared<ContextGraph>(config);
-    resource->context_graph->BuildContextGraph(contexts, unit_table);
+    auto context_graph = std::make_shared<ContextGraph>(config);
+    CHECK(context_graph->BuildContextGraph(contexts, *resource->unit_trie,
+                                           resource->context_graph))
+        << "Too many contexts over the context graph";
+    resource->context_graph = context_graph;
+  }
+
+  if (FLAGS_context_graph_cache_mb > 0) {
+    resource->context_graph_cache = std::make_shared<ContextGraphCache>(
+        static_cast<size_t>(FLAGS_context_graph_cache_mb) << 20);
   }
 
   PostProcessOptions post_process_opts;
@@ -278,6 +363,19 @@ std::shared_ptr<DecodeResource> InitDecodeResourceFromFlags() {
     }
   }
 
+  if (FLAGS_max_sessions > 0 || FLAGS_max_decode_load > 0 ||
+      FLAGS_max_backlog_ms > 0 || FLAGS_degrade_decode_load > 0) {
+    AdmissionOptions admission_opts;
+    admission_opts.max_sessions = FLAGS_max_sessions;
+    admission_opts.num_threads = FLAGS_admission_threads;
+    admission_opts.max_load = FLAGS_max_decode_load;
+    admission_opts.max_backlog_ms = FLAGS_max_backlog_ms;
+    admission_opts.degrade_load = FLAGS_degrade_decode_load;
+    admission_opts.degrade_chunk_size = resource->model->dynamic_chunk_size();
+    resource->admission_controller = std::make_shared<AdmissionController>(
+        admission_opts, *InitDecodeOptionsFromFlags());
+  }
+
   return resource;
 }
 
@@ -0,0 +1,68 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/rescoring_gate.h"
+
+#include <algorithm>
+
+#include "utils/metrics.h"
+
+namespace wenet {
+
+RescoringDecision RescoringGate::Decide(const std::vector<float>& ctc_scores,
+                                        int num_unique_hyps,
+                                        int utterance_ms) {
+  Metrics& metrics = Metrics::Global();
+  metrics.rescoring_requests.Increment();
+  if (opts_.max_utterance_ms > 0 && utterance_ms > opts_.max_utterance_ms) {
+    return RescoringDecision::kRescore;
+  }
+  if (opts_.skip_single_hyp && num_unique_hyps <= 1) {
+    metrics.rescoring_skipped_single_hyp.Increment();
+    return RescoringDecision::kSkipSingleHyp;
+  }
+  if (opts_.score_margin > 0 && ctc_scores.size() > 1) {
+    auto best = std::max_element(ctc_scores.begin(), ctc_scores.end());
+    float second = -kFloatMax;
+    for (auto it = ctc_scores.begin(); it != ctc_scores.end(); ++it) {
+      if (it != best) second = std::max(second, *it);
+    }
+    if (*best - second >= opts_.score_margin) {
+      metrics.rescoring_skipped_score_margin.Increment();
+      return RescoringDecision::kSkipScoreMargin;
+    }
+  }
+  return RescoringDecision::kRescore;
+}
+
+int RescoringGate::NumHypsToRescore(int num_hyps) {
+  if (opts_.max_hyps > 0 && num_hyps > opts_.max_hyps) {
+    Metrics::Global().rescoring_shortened.Increment();
+    return opts_.max_hyps;
+  }
+  return num_hyps;
+}
+
+RescoringGateStats RescoringGate::GlobalStats() {
+  const Metrics& metrics = Metrics::Global();
+  RescoringGateStats stats;
+  stats.num_requests = metrics.rescoring_requests.Value();
+  stats.num_skipped_score_margin =
+      metrics.rescoring_skipped_score_margin.Value();
+  stats.num_skipped_single_hyp = metrics.rescoring_skipped_single_hyp.Value();
+  stats.num_shortened = metrics.rescoring_shortened.Value();
+  return stats;
+}
+
+}  // namespace wenet
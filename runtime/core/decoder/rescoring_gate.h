@@ -0,0 +1,83 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_RESCORING_GATE_H_
+#define DECODER_RESCORING_GATE_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+struct RescoringGateOptions {
+  // Skip the rescoring if the CTC score of the 1-best is higher than the
+  // ones of all the other hypotheses by at least score_margin, <= 0 means
+  // never
+  float score_margin = 0.0;
+  // Skip the rescoring if there is only one distinct hypothesis, it can't
+  // change the 1-best but the final score is the CTC score then
+  bool skip_single_hyp = false;
+  // The two rules above only apply to the utterances of at most
+  // max_utterance_ms, <= 0 means any length
+  int max_utterance_ms = 0;
+  // Only rescore the top max_hyps hypotheses, the others keep their CTC
+  // scores and rank after them, <= 0 means all
+  int max_hyps = 0;
+};
+
+enum class RescoringDecision {
+  kRescore = 0x00,
+  kSkipScoreMargin = 0x01,
+  kSkipSingleHyp = 0x02,
+};
+
+// Counters of the rescoring requests of all the gates in the process, they
+// are exported by Metrics too
+struct RescoringGateStats {
+  int64_t num_requests = 0;
+  int64_t num_skipped_score_margin = 0;
+  int64_t num_skipped_single_hyp = 0;
+  // The rescored ones which dropped some hypotheses by max_hyps
+  int64_t num_shortened = 0;
+};
+
+// Decides whether the attention rescoring of an utterance is worth running,
+// most endpoints are short confident commands, whose 1-best the second pass
+// hardly changes.
+class RescoringGate {
+ public:
+  explicit RescoringGate(RescoringGateOptions opts) : opts_(opts) {}
+
+  // `ctc_scores` are the CTC scores of the n-best, `num_unique_hyps` is the
+  // number of distinct hypotheses in them, and `utterance_ms` is the length
+  // of the utterance. It updates the counters.
+  RescoringDecision Decide(const std::vector<float>& ctc_scores,
+                           int num_unique_hyps, int utterance_ms);
+  // Number of the top hypotheses to rescore out of `num_hyps`
+  int NumHypsToRescore(int num_hyps);
+
+  static RescoringGateStats GlobalStats();
+
+ private:
+  const RescoringGateOptions opts_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(RescoringGate);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_RESCORING_GATE_H_
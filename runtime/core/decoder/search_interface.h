@@ -15,10 +15,12 @@
 #ifndef DECODER_SEARCH_INTERFACE_H_
 #define DECODER_SEARCH_INTERFACE_H_
 
-namespace wenet {
-
 #include <vector>
 
+#include "decoder/ctc_frame_summary.h"
+
+namespace wenet {
+
 enum SearchType {
   kPrefixBeamSearch = 0x00,
   kWfstBeamSearch = 0x01,
@@ -28,6 +30,13 @@ class SearchInterface {
  public:
   virtual ~SearchInterface() {}
   virtual void Search(const std::vector<std::vector<float>>& logp) = 0;
+  // Search with the summaries of the frames of `logp`, see
+  // CtcFrameSummaries, so the searches which can work on the summaries
+  // don't walk the full rows again
+  virtual void Search(const std::vector<std::vector<float>>& logp,
+                      const CtcFrameSummaries& summaries) {
+    Search(logp);
+  }
   virtual void Reset() = 0;
   virtual void FinalizeSearch() = 0;
 
@@ -40,6 +49,10 @@ class SearchInterface {
   virtual const std::vector<float>& Likelihood() const = 0;
   // N-best timestamp
   virtual const std::vector<std::vector<int>>& Times() const = 0;
+  // The number of leading outputs of the best hypothesis which are final,
+  // they never change in the later search, so the partial result can show
+  // them without flickering
+  virtual int NumStableOutputs() const { return 0; }
 };
 
 }  // namespace wenet
@@ -92,6 +92,8 @@ TorchAsrModel::TorchAsrModel(const TorchAsrModel& other) {
   is_bidirectional_decoder_ = other.is_bidirectional_decoder_;
   chunk_size_ = other.chunk_size_;
   num_left_chunks_ = other.num_left_chunks_;
+  max_cache_frames_ = other.max_cache_frames_;
+  keep_encoder_outs_ = other.keep_encoder_outs_;
   offset_ = other.offset_;
   // 2. Model copy, just copy the model ptr since:
   // PyTorch allows using multiple CPU threads during TorchScript model
@@ -114,33 +116,19 @@ void TorchAsrModel::Reset() {
   offset_ = 0;
   att_cache_ = std::move(torch::zeros({0, 0, 0, 0}));
   cnn_cache_ = std::move(torch::zeros({0, 0, 0, 0}));
-  encoder_outs_.clear();
+  // encoder_memory_ is kept for the next segment
+  num_encoder_frames_ = 0;
   cached_feature_.clear();
 }
 
-void TorchAsrModel::ForwardEncoderFunc(
-    const std::vector<std::vector<float>>& chunk_feats,
-    std::vector<std::vector<float>>* out_prob) {
-  // 1. Prepare libtorch required data, splice cached_feature_ and chunk_feats
-  // The first dimension is for batchsize, which is 1.
-  int num_frames = cached_feature_.size() + chunk_feats.size();
-  const int feature_dim = chunk_feats[0].size();
+torch::Tensor TorchAsrModel::ForwardEncoderChunk(const float* feats_data,
+                                                int num_frames,
+                                                int feature_dim) {
+  // 1. Prepare libtorch required data, the tensor shares the memory of the
+  // spliced input. The first dimension is for batchsize, which is 1.
   torch::Tensor feats =
-      torch::zeros({1, num_frames, feature_dim}, torch::kFloat);
-  for (size_t i = 0; i < cached_feature_.size(); ++i) {
-    torch::Tensor row =
-        torch::from_blob(const_cast<float*>(cached_feature_[i].data()),
-                         {feature_dim}, torch::kFloat)
-            .clone();
-    feats[0][i] = std::move(row);
-  }
-  for (size_t i = 0; i < chunk_feats.size(); ++i) {
-    torch::Tensor row =
-        torch::from_blob(const_cast<float*>(chunk_feats[i].data()),
-                         {feature_dim}, torch::kFloat)
-            .clone();
-    feats[0][cached_feature_.size() + i] = std::move(row);
-  }
+      torch::from_blob(const_cast<float*>(feats_data),
+                       {1, num_frames, feature_dim}, torch::kFloat);
 
   // 2. Encoder chunk forward
 #ifdef USE_GPU
@@ -148,10 +136,9 @@ void TorchAsrModel::ForwardEncoderFunc(
   att_cache_ = att_cache_.to(at::kCUDA);
   cnn_cache_ = cnn_cache_.to(at::kCUDA);
 #endif
-  int required_cache_size = chunk_size_ * num_left_chunks_;
   torch::NoGradGuard no_grad;
-  std::vector<torch::jit::IValue> inputs = {feats, offset_, required_cache_size,
-                                            att_cache_, cnn_cache_};
+  std::vector<torch::jit::IValue> inputs = {
+      feats, offset_, required_cache_size(), att_cache_, cnn_cache_};
 
   // Refer interfaces in wenet/transformer/asr_model.py
   auto outputs =
@@ -167,31 +154,87 @@ void TorchAsrModel::ForwardEncoderFunc(
   cnn_cache_ = outputs[2].toTensor();
 #endif
   offset_ += chunk_out.size(1);
+  if (keep_encoder_outs_) {
+    AppendEncoderOut(chunk_out);
+  }
+  return chunk_out;
+}
 
+void TorchAsrModel::AppendEncoderOut(const torch::Tensor& chunk_out) {
+  int num_frames = chunk_out.size(1);
+  int capacity = encoder_memory_.defined() ? encoder_memory_.size(1) : 0;
+  if (num_encoder_frames_ + num_frames > capacity) {
+    // Grow by doubling, so the copies are amortized O(1) per frame
+    int new_capacity = std::max(2 * capacity, num_encoder_frames_ + num_frames);
+    torch::Tensor memory = torch::empty(
+        {1, new_capacity, chunk_out.size(2)}, chunk_out.options());
+    if (num_encoder_frames_ > 0) {
+      memory.narrow(1, 0, num_encoder_frames_)
+          .copy_(encoder_memory_.narrow(1, 0, num_encoder_frames_));
+    }
+    encoder_memory_ = memory;
+  }
+  encoder_memory_.narrow(1, num_encoder_frames_, num_frames).copy_(chunk_out);
+  num_encoder_frames_ += num_frames;
+}
+
+size_t TorchAsrModel::MemoryUsage() const {
+  size_t bytes = AsrModel::MemoryUsage();
+  bytes += att_cache_.nbytes() + cnn_cache_.nbytes();
+  if (encoder_memory_.defined()) {
+    bytes += encoder_memory_.nbytes();
+  }
+  bytes += (hyps_pad_.capacity() + hyps_length_.capacity()) * sizeof(int64_t);
+  return bytes;
+}
+
+torch::Tensor TorchAsrModel::CtcActivation(const torch::Tensor& encoder_out) {
+  torch::NoGradGuard no_grad;
   // The first dimension of returned value is for batchsize, which is 1
 #ifdef USE_GPU
-  chunk_out = chunk_out.to(at::kCUDA);
   torch::Tensor ctc_log_probs =
-      model_->run_method("ctc_activation", chunk_out).toTensor();
-  ctc_log_probs = ctc_log_probs.to(at::kCPU)[0];
-  encoder_outs_.push_back(std::move(chunk_out.to(at::kCPU)));
+      model_->run_method("ctc_activation", encoder_out.to(at::kCUDA))
+          .toTensor();
+  return ctc_log_probs.to(at::kCPU)[0];
 #else
-  torch::Tensor ctc_log_probs =
-      model_->run_method("ctc_activation", chunk_out).toTensor()[0];
-  encoder_outs_.push_back(std::move(chunk_out));
+  return model_->run_method("ctc_activation", encoder_out).toTensor()[0];
 #endif
+}
 
-  // Copy to output
-  int num_outputs = ctc_log_probs.size(0);
-  int output_dim = ctc_log_probs.size(1);
+void TorchAsrModel::CopyCtcProb(const torch::Tensor& ctc_log_probs,
+                                std::vector<std::vector<float>>* out_prob) {
+  torch::Tensor log_probs = ctc_log_probs.contiguous();
+  int num_outputs = log_probs.size(0);
+  int output_dim = log_probs.size(1);
+  const float* data = log_probs.data_ptr<float>();
   out_prob->resize(num_outputs);
   for (int i = 0; i < num_outputs; i++) {
     (*out_prob)[i].resize(output_dim);
-    memcpy((*out_prob)[i].data(), ctc_log_probs[i].data_ptr(),
+    memcpy((*out_prob)[i].data(), data + i * output_dim,
            sizeof(float) * output_dim);
   }
 }
 
+void TorchAsrModel::ForwardEncoderFunc(
+    const std::vector<std::vector<float>>& chunk_feats,
+    std::vector<std::vector<float>>* out_prob) {
+  const int feature_dim = chunk_feats[0].size();
+  std::vector<float>* feats = BeginChunk(feature_dim);
+  for (const auto& feat : chunk_feats) {
+    feats->insert(feats->end(), feat.begin(), feat.end());
+  }
+  ForwardEncoderFunc(feats->data(), feats->size() / feature_dim, feature_dim,
+                     out_prob);
+}
+
+void TorchAsrModel::ForwardEncoderFunc(
+    const float* feats, int num_frames, int feature_dim,
+    std::vector<std::vector<float>>* out_prob) {
+  torch::Tensor chunk_out =
+      ForwardEncoderChunk(feats, num_frames, feature_dim);
+  CopyCtcProb(CtcActivation(chunk_out), out_prob);
+}
+
 float TorchAsrModel::ComputeAttentionScore(const torch::Tensor& prob,
                                            const std::vector<int>& hyp,
                                            int eos) {
@@ -215,31 +258,34 @@ void TorchAsrModel::AttentionRescoring(
     return;
   }
   // No encoder output
-  if (encoder_outs_.size() == 0) {
+  if (num_encoder_frames_ == 0) {
     return;
   }
 
   torch::NoGradGuard no_grad;
-  // Step 1: Prepare input for libtorch
-  torch::Tensor hyps_length = torch::zeros({num_hyps}, torch::kLong);
+  // Step 1: Prepare input for libtorch, the hyps are padded in contiguous
+  // buffers, which the tensors share
   int max_hyps_len = 0;
+  hyps_length_.resize(num_hyps);
   for (size_t i = 0; i < num_hyps; ++i) {
     int length = hyps[i].size() + 1;
     max_hyps_len = std::max(length, max_hyps_len);
-    hyps_length[i] = static_cast<int64_t>(length);
+    hyps_length_[i] = length;
   }
-  torch::Tensor hyps_tensor =
-      torch::zeros({num_hyps, max_hyps_len}, torch::kLong);
+  hyps_pad_.assign(num_hyps * max_hyps_len, 0);
   for (size_t i = 0; i < num_hyps; ++i) {
-    const std::vector<int>& hyp = hyps[i];
-    hyps_tensor[i][0] = sos_;
-    for (size_t j = 0; j < hyp.size(); ++j) {
-      hyps_tensor[i][j + 1] = hyp[j];
-    }
+    int64_t* row = hyps_pad_.data() + i * max_hyps_len;
+    row[0] = sos_;
+    std::copy(hyps[i].begin(), hyps[i].end(), row + 1);
   }
+  torch::Tensor hyps_length =
+      torch::from_blob(hyps_length_.data(), {num_hyps}, torch::kLong);
+  torch::Tensor hyps_tensor = torch::from_blob(
+      hyps_pad_.data(), {num_hyps, max_hyps_len}, torch::kLong);
 
-  // Step 2: Forward attention decoder by hyps and corresponding encoder_outs_
-  torch::Tensor encoder_out = torch::cat(encoder_outs_, 1);
+  // Step 2: Forward attention decoder by hyps and the encoder outputs of the
+  // segment, which is a view of encoder_memory_
+  torch::Tensor encoder_out = encoder_memory_.narrow(1, 0, num_encoder_frames_);
 #ifdef USE_GPU
   hyps_tensor = hyps_tensor.to(at::kCUDA);
   hyps_length = hyps_length.to(at::kCUDA);
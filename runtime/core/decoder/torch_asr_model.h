@@ -47,17 +47,38 @@ class TorchAsrModel : public AsrModel {
                           float reverse_weight,
                           std::vector<float>* rescoring_score) override;
   std::shared_ptr<AsrModel> Copy() const override;
+  size_t MemoryUsage() const override;
+  bool dynamic_chunk_size() const override { return true; }
 
  protected:
   void ForwardEncoderFunc(const std::vector<std::vector<float>>& chunk_feats,
                           std::vector<std::vector<float>>* ctc_prob) override;
+  void ForwardEncoderFunc(const float* feats, int num_frames,
+                          int feature_dim,
+                          std::vector<std::vector<float>>* ctc_prob) override;
+  // Encoder forward of the spliced input `feats` of one chunk, updates the
+  // caches and returns the encoder output of the chunk, which is on CPU.
+  torch::Tensor ForwardEncoderChunk(const float* feats, int num_frames,
+                                    int feature_dim);
+  // Append the encoder output of a chunk to encoder_memory_
+  void AppendEncoderOut(const torch::Tensor& chunk_out);
+  // CTC log probs of the encoder output (1, T, D), returns (T, V) on CPU
+  torch::Tensor CtcActivation(const torch::Tensor& encoder_out);
+  void CopyCtcProb(const torch::Tensor& ctc_log_probs,
+                   std::vector<std::vector<float>>* ctc_prob);
 
   float ComputeAttentionScore(const torch::Tensor& prob,
                               const std::vector<int>& hyp, int eos);
 
  private:
   std::shared_ptr<TorchModule> model_ = nullptr;
-  std::vector<torch::Tensor> encoder_outs_;
+  // Encoder outputs of the segment are encoder_memory_[:, :num_frames], the
+  // tensor grows by doubling and is reused across the segments
+  torch::Tensor encoder_memory_;
+  int num_encoder_frames_ = 0;
+  // Padded hyps and their lengths of AttentionRescoring
+  std::vector<int64_t> hyps_pad_;
+  std::vector<int64_t> hyps_length_;
   // transformer/conformer attention cache
   torch::Tensor att_cache_ = torch::zeros({0, 0, 0, 0});
   // conformer-only conv_module cache
@@ -17,10 +17,12 @@
 
 #include <cstring>
 #include <limits>
+#include <memory>
 #include <random>
 #include <utility>
 #include <vector>
 
+#include "frontend/fbank_kernels.h"
 #include "frontend/fft.h"
 #include "utils/log.h"
 
@@ -51,6 +53,14 @@ enum class LogBase {
   kBase10,
 };
 
+// kReference is the straightforward implementation below, kOptimized runs a
+// half size real FFT and the SIMD kernels in fbank_kernels.h, its output
+// matches kReference within float rounding.
+enum class FbankEngine {
+  kReference = 0,
+  kOptimized,
+};
+
 class Fbank {
  public:
   Fbank(int num_bins, int sample_rate, int frame_length, int frame_shift,
@@ -170,6 +180,14 @@ class Fbank {
 
   void set_dither(float dither) { dither_ = dither; }
 
+  void set_engine(FbankEngine engine) {
+    engine_ = engine;
+    if (engine_ == FbankEngine::kOptimized && real_fft_ == nullptr) {
+      InitOptimizedEngine();
+    }
+  }
+  FbankEngine engine() const { return engine_; }
+
   int num_bins() const { return num_bins_; }
 
   static inline float InverseMelScale(float mel_freq,
@@ -246,9 +264,84 @@ class Fbank {
     }
   }
 
+  // Flatten the mel filters and prepare the buffers of kOptimized
+  void InitOptimizedEngine() {
+    kernels_ = &GetFbankKernels();
+    real_fft_ = std::make_unique<RealFft>(fft_points_);
+    mel_banks_.start.resize(num_bins_);
+    mel_banks_.size.resize(num_bins_);
+    mel_banks_.offset.resize(num_bins_);
+    mel_banks_.weights.clear();
+    for (int j = 0; j < num_bins_; ++j) {
+      mel_banks_.start[j] = bins_[j].first;
+      mel_banks_.size[j] = bins_[j].second.size();
+      mel_banks_.offset[j] = mel_banks_.weights.size();
+      mel_banks_.weights.insert(mel_banks_.weights.end(),
+                                bins_[j].second.begin(),
+                                bins_[j].second.end());
+    }
+    frame_.resize(fft_points_);
+    fft_re_.resize(fft_points_ / 2);
+    fft_im_.resize(fft_points_ / 2);
+    power_.resize(fft_points_ / 2);
+    noise_.resize(frame_length_);
+    VLOG(1) << "Optimized fbank engine with " << kernels_->name << " kernels";
+  }
+
+  // Same as Compute() below, but by the kOptimized engine
+  int ComputeOptimized(const std::vector<float>& wave,
+                       std::vector<std::vector<float>>* feat) {
+    int num_samples = wave.size();
+    if (num_samples < frame_length_) return 0;
+    int num_frames = 1 + ((num_samples - frame_length_) / frame_shift_);
+    feat->resize(num_frames);
+    const FbankKernels& k = *kernels_;
+    float* data = frame_.data();
+    float log_scale = log_base_ == LogBase::kBase10 ? 1.0 / log(10.0) : 1.0;
+    float max_mel_engery = std::numeric_limits<float>::min();
+
+    for (int i = 0; i < num_frames; ++i) {
+      memcpy(data, wave.data() + i * frame_shift_,
+             sizeof(float) * frame_length_);
+      if (scale_input_to_unit_) {
+        k.scale(1.0f / kS16AbsMax, frame_length_, data);
+      }
+      if (dither_ != 0.0) {
+        for (int j = 0; j < frame_length_; ++j) {
+          noise_[j] = distribution_(generator_);
+        }
+        k.add_scaled(noise_.data(), dither_, frame_length_, data);
+      }
+      if (remove_dc_offset_) k.remove_dc_offset(frame_length_, data);
+      if (pre_emphasis_) k.pre_emphasis(0.97, frame_length_, data);
+      k.apply_window(window_.data(), frame_length_, data);
+      memset(data + frame_length_, 0,
+             sizeof(float) * (fft_points_ - frame_length_));
+      real_fft_->Compute(data, fft_re_.data(), fft_im_.data());
+
+      (*feat)[i].resize(num_bins_);
+      float* out = (*feat)[i].data();
+      k.mel_energies(fft_re_.data(), fft_im_.data(), fft_points_ / 2,
+                     mel_banks_, power_.data(), out);
+      if (use_log_) k.log(log_floor_, log_scale, num_bins_, out);
+      if (norm_type_ == NormalizationType::kWhisper) {
+        for (int j = 0; j < num_bins_; ++j) {
+          max_mel_engery = std::max(max_mel_engery, out[j]);
+        }
+      }
+    }
+    if (norm_type_ == NormalizationType::kWhisper)
+      WhisperNorm(feat, max_mel_engery);
+
+    return num_frames;
+  }
+
   // Compute fbank feat, return num frames
   int Compute(const std::vector<float>& wave,
               std::vector<std::vector<float>>* feat) {
+    if (engine_ == FbankEngine::kOptimized) {
+      return ComputeOptimized(wave, feat);
+    }
     int num_samples = wave.size();
 
     if (num_samples < frame_length_) return 0;
@@ -352,6 +445,17 @@ class Fbank {
   std::vector<int> bitrev_;
   // trigonometric function table
   std::vector<float> sintbl_;
+
+  // kOptimized engine
+  FbankEngine engine_ = FbankEngine::kReference;
+  const FbankKernels* kernels_ = nullptr;
+  std::unique_ptr<RealFft> real_fft_;
+  SparseMelBanks mel_banks_;
+  std::vector<float> frame_;
+  std::vector<float> fft_re_;
+  std::vector<float> fft_im_;
+  std::vector<float> power_;
+  std::vector<float> noise_;
 };
 
 }  // namespace wenet
@@ -0,0 +1,457 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "frontend/fbank_kernels.h"
+
+#include <math.h>
+
+#include <algorithm>
+
+#include "frontend/fft.h"
+#include "utils/log.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WENET_FBANK_AVX2
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define WENET_FBANK_NEON
+#include <arm_neon.h>
+#endif
+
+namespace wenet {
+
+// Plain C++ kernels, they are also the tails of the SIMD kernels
+namespace {
+
+void ScaleScalar(float scale, int n, float* data) {
+  for (int i = 0; i < n; ++i) data[i] *= scale;
+}
+
+void AddScaledScalar(const float* noise, float scale, int n, float* data) {
+  for (int i = 0; i < n; ++i) data[i] += scale * noise[i];
+}
+
+void RemoveDcOffsetScalar(int n, float* data) {
+  float mean = 0.0;
+  for (int i = 0; i < n; ++i) mean += data[i];
+  mean /= n;
+  for (int i = 0; i < n; ++i) data[i] -= mean;
+}
+
+void PreEmphasisScalar(float coeff, int n, float* data) {
+  for (int i = n - 1; i > 0; --i) data[i] -= coeff * data[i - 1];
+  data[0] -= coeff * data[0];
+}
+
+void ApplyWindowScalar(const float* window, int n, float* data) {
+  for (int i = 0; i < n; ++i) data[i] *= window[i];
+}
+
+void MelEnergiesScalar(const float* re, const float* im, int num_fft_bins,
+                       const SparseMelBanks& banks, float* power, float* out) {
+  for (int i = 0; i < num_fft_bins; ++i) {
+    power[i] = re[i] * re[i] + im[i] * im[i];
+  }
+  for (int j = 0; j < banks.num_bins(); ++j) {
+    const float* w = banks.weights.data() + banks.offset[j];
+    const float* p = power + banks.start[j];
+    float energy = 0.0;
+    for (int k = 0; k < banks.size[j]; ++k) energy += w[k] * p[k];
+    out[j] = energy;
+  }
+}
+
+void LogScalar(float floor, float scale, int n, float* data) {
+  for (int i = 0; i < n; ++i) {
+    data[i] = logf(std::max(data[i], floor)) * scale;
+  }
+}
+
+const FbankKernels kScalarKernels = {
+    "scalar",
+    ScaleScalar,
+    AddScaledScalar,
+    RemoveDcOffsetScalar,
+    PreEmphasisScalar,
+    ApplyWindowScalar,
+    MelEnergiesScalar,
+    LogScalar,
+};
+
+// Coefficients of the logf polynomial approximation from Cephes, the error
+// is about 1 ulp in the normal range
+const float kLogP[] = {7.0376836292E-2f,  -1.1514610310E-1f, 1.1676998740E-1f,
+                       -1.2420140846E-1f, 1.4249322787E-1f,  -1.6668057665E-1f,
+                       2.0000714765E-1f,  -2.4999993993E-1f, 3.3333331174E-1f};
+const float kLogQ1 = -2.12194440e-4f;
+const float kLogQ2 = 0.693359375f;
+const float kSqrtHalf = 0.707106781186547524f;
+
+#ifdef WENET_FBANK_AVX2
+
+#define WENET_AVX2 __attribute__((target("avx2,fma")))
+
+WENET_AVX2 inline float HorizontalSum(__m256 v) {
+  __m128 lo = _mm256_castps256_ps128(v);
+  __m128 hi = _mm256_extractf128_ps(v, 1);
+  lo = _mm_add_ps(lo, hi);
+  lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+  lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+  return _mm_cvtss_f32(lo);
+}
+
+WENET_AVX2 inline __m256 Log256(__m256 x) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  // Extract the exponent, and keep the mantissa in [0.5, 1)
+  __m256i e_int = _mm256_srli_epi32(_mm256_castps_si256(x), 23);
+  x = _mm256_and_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(~0x7f800000)));
+  x = _mm256_or_ps(x, _mm256_set1_ps(0.5f));
+  e_int = _mm256_sub_epi32(e_int, _mm256_set1_epi32(0x7f));
+  __m256 e = _mm256_add_ps(_mm256_cvtepi32_ps(e_int), one);
+  // x < sqrt(0.5) ? (e - 1, 2x - 1) : (e, x - 1)
+  __m256 mask = _mm256_cmp_ps(x, _mm256_set1_ps(kSqrtHalf), _CMP_LT_OS);
+  __m256 tmp = _mm256_and_ps(x, mask);
+  x = _mm256_sub_ps(x, one);
+  e = _mm256_sub_ps(e, _mm256_and_ps(one, mask));
+  x = _mm256_add_ps(x, tmp);
+  __m256 z = _mm256_mul_ps(x, x);
+  __m256 y = _mm256_set1_ps(kLogP[0]);
+  for (int i = 1; i < 9; ++i) {
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(kLogP[i]));
+  }
+  y = _mm256_mul_ps(_mm256_mul_ps(y, x), z);
+  y = _mm256_fmadd_ps(e, _mm256_set1_ps(kLogQ1), y);
+  y = _mm256_fnmadd_ps(z, _mm256_set1_ps(0.5f), y);
+  x = _mm256_add_ps(x, y);
+  return _mm256_fmadd_ps(e, _mm256_set1_ps(kLogQ2), x);
+}
+
+WENET_AVX2 void ScaleAvx2(float scale, int n, float* data) {
+  __m256 s = _mm256_set1_ps(scale);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(data + i, _mm256_mul_ps(_mm256_loadu_ps(data + i), s));
+  }
+  ScaleScalar(scale, n - i, data + i);
+}
+
+WENET_AVX2 void AddScaledAvx2(const float* noise, float scale, int n,
+                              float* data) {
+  __m256 s = _mm256_set1_ps(scale);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 v = _mm256_fmadd_ps(s, _mm256_loadu_ps(noise + i),
+                               _mm256_loadu_ps(data + i));
+    _mm256_storeu_ps(data + i, v);
+  }
+  AddScaledScalar(noise + i, scale, n - i, data + i);
+}
+
+WENET_AVX2 void RemoveDcOffsetAvx2(int n, float* data) {
+  __m256 acc = _mm256_setzero_ps();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    acc = _mm256_add_ps(acc, _mm256_loadu_ps(data + i));
+  }
+  float sum = HorizontalSum(acc);
+  for (; i < n; ++i) sum += data[i];
+  float mean = sum / n;
+  __m256 m = _mm256_set1_ps(mean);
+  for (i = 0; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(data + i, _mm256_sub_ps(_mm256_loadu_ps(data + i), m));
+  }
+  for (; i < n; ++i) data[i] -= mean;
+}
+
+WENET_AVX2 void PreEmphasisAvx2(float coeff, int n, float* data) {
+  // From the end to the start, data[i - 1] is still the input when data[i]
+  // is updated
+  __m256 c = _mm256_set1_ps(coeff);
+  int i = n;
+  for (; i - 8 >= 1; i -= 8) {
+    __m256 cur = _mm256_loadu_ps(data + i - 8);
+    __m256 prev = _mm256_loadu_ps(data + i - 9);
+    _mm256_storeu_ps(data + i - 8, _mm256_fnmadd_ps(c, prev, cur));
+  }
+  PreEmphasisScalar(coeff, i, data);
+}
+
+WENET_AVX2 void ApplyWindowAvx2(const float* window, int n, float* data) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 v =
+        _mm256_mul_ps(_mm256_loadu_ps(data + i), _mm256_loadu_ps(window + i));
+    _mm256_storeu_ps(data + i, v);
+  }
+  ApplyWindowScalar(window + i, n - i, data + i);
+}
+
+WENET_AVX2 void MelEnergiesAvx2(const float* re, const float* im,
+                                int num_fft_bins, const SparseMelBanks& banks,
+                                float* power, float* out) {
+  int i = 0;
+  for (; i + 8 <= num_fft_bins; i += 8) {
+    __m256 r = _mm256_loadu_ps(re + i);
+    __m256 m = _mm256_loadu_ps(im + i);
+    _mm256_storeu_ps(power + i, _mm256_fmadd_ps(r, r, _mm256_mul_ps(m, m)));
+  }
+  for (; i < num_fft_bins; ++i) power[i] = re[i] * re[i] + im[i] * im[i];
+  // The power spectrum is in L1 cache here
+  for (int j = 0; j < banks.num_bins(); ++j) {
+    const float* w = banks.weights.data() + banks.offset[j];
+    const float* p = power + banks.start[j];
+    int size = banks.size[j];
+    __m256 acc = _mm256_setzero_ps();
+    int k = 0;
+    for (; k + 8 <= size; k += 8) {
+      acc = _mm256_fmadd_ps(_mm256_loadu_ps(w + k), _mm256_loadu_ps(p + k),
+                            acc);
+    }
+    float energy = HorizontalSum(acc);
+    for (; k < size; ++k) energy += w[k] * p[k];
+    out[j] = energy;
+  }
+}
+
+WENET_AVX2 void LogAvx2(float floor, float scale, int n, float* data) {
+  __m256 f = _mm256_set1_ps(floor);
+  __m256 s = _mm256_set1_ps(scale);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 v = _mm256_max_ps(_mm256_loadu_ps(data + i), f);
+    _mm256_storeu_ps(data + i, _mm256_mul_ps(Log256(v), s));
+  }
+  LogScalar(floor, scale, n - i, data + i);
+}
+
+const FbankKernels kAvx2Kernels = {
+    "avx2",
+    ScaleAvx2,
+    AddScaledAvx2,
+    RemoveDcOffsetAvx2,
+    PreEmphasisAvx2,
+    ApplyWindowAvx2,
+    MelEnergiesAvx2,
+    LogAvx2,
+};
+
+#endif  // WENET_FBANK_AVX2
+
+#ifdef WENET_FBANK_NEON
+
+inline float HorizontalSum(float32x4_t v) {
+  float32x2_t s = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+  return vget_lane_f32(vpadd_f32(s, s), 0);
+}
+
+inline float32x4_t Log128(float32x4_t x) {
+  const float32x4_t one = vdupq_n_f32(1.0f);
+  // Extract the exponent, and keep the mantissa in [0.5, 1)
+  int32x4_t e_int = vreinterpretq_s32_u32(
+      vshrq_n_u32(vreinterpretq_u32_f32(x), 23));
+  x = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(x),
+                                      vdupq_n_u32(~0x7f800000u)));
+  const uint32x4_t half = vreinterpretq_u32_f32(vdupq_n_f32(0.5f));
+  x = vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(x), half));
+  e_int = vsubq_s32(e_int, vdupq_n_s32(0x7f));
+  float32x4_t e = vaddq_f32(vcvtq_f32_s32(e_int), one);
+  // x < sqrt(0.5) ? (e - 1, 2x - 1) : (e, x - 1)
+  uint32x4_t mask = vcltq_f32(x, vdupq_n_f32(kSqrtHalf));
+  float32x4_t tmp =
+      vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(x), mask));
+  x = vsubq_f32(x, one);
+  e = vsubq_f32(
+      e, vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(one), mask)));
+  x = vaddq_f32(x, tmp);
+  float32x4_t z = vmulq_f32(x, x);
+  float32x4_t y = vdupq_n_f32(kLogP[0]);
+  for (int i = 1; i < 9; ++i) {
+    y = vmlaq_f32(vdupq_n_f32(kLogP[i]), y, x);
+  }
+  y = vmulq_f32(vmulq_f32(y, x), z);
+  y = vmlaq_f32(y, e, vdupq_n_f32(kLogQ1));
+  y = vmlsq_f32(y, z, vdupq_n_f32(0.5f));
+  x = vaddq_f32(x, y);
+  return vmlaq_f32(x, e, vdupq_n_f32(kLogQ2));
+}
+
+void ScaleNeon(float scale, int n, float* data) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    vst1q_f32(data + i, vmulq_n_f32(vld1q_f32(data + i), scale));
+  }
+  ScaleScalar(scale, n - i, data + i);
+}
+
+void AddScaledNeon(const float* noise, float scale, int n, float* data) {
+  float32x4_t s = vdupq_n_f32(scale);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    float32x4_t v = vmlaq_f32(vld1q_f32(data + i), s, vld1q_f32(noise + i));
+    vst1q_f32(data + i, v);
+  }
+  AddScaledScalar(noise + i, scale, n - i, data + i);
+}
+
+void RemoveDcOffsetNeon(int n, float* data) {
+  float32x4_t acc = vdupq_n_f32(0.0f);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) acc = vaddq_f32(acc, vld1q_f32(data + i));
+  float sum = HorizontalSum(acc);
+  for (; i < n; ++i) sum += data[i];
+  float mean = sum / n;
+  float32x4_t m = vdupq_n_f32(mean);
+  for (i = 0; i + 4 <= n; i += 4) {
+    vst1q_f32(data + i, vsubq_f32(vld1q_f32(data + i), m));
+  }
+  for (; i < n; ++i) data[i] -= mean;
+}
+
+void PreEmphasisNeon(float coeff, int n, float* data) {
+  // From the end to the start, data[i - 1] is still the input when data[i]
+  // is updated
+  float32x4_t c = vdupq_n_f32(coeff);
+  int i = n;
+  for (; i - 4 >= 1; i -= 4) {
+    float32x4_t cur = vld1q_f32(data + i - 4);
+    float32x4_t prev = vld1q_f32(data + i - 5);
+    vst1q_f32(data + i - 4, vmlsq_f32(cur, c, prev));
+  }
+  PreEmphasisScalar(coeff, i, data);
+}
+
+void ApplyWindowNeon(const float* window, int n, float* data) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    vst1q_f32(data + i, vmulq_f32(vld1q_f32(data + i), vld1q_f32(window + i)));
+  }
+  ApplyWindowScalar(window + i, n - i, data + i);
+}
+
+void MelEnergiesNeon(const float* re, const float* im, int num_fft_bins,
+                     const SparseMelBanks& banks, float* power, float* out) {
+  int i = 0;
+  for (; i + 4 <= num_fft_bins; i += 4) {
+    float32x4_t r = vld1q_f32(re + i);
+    float32x4_t m = vld1q_f32(im + i);
+    vst1q_f32(power + i, vmlaq_f32(vmulq_f32(m, m), r, r));
+  }
+  for (; i < num_fft_bins; ++i) power[i] = re[i] * re[i] + im[i] * im[i];
+  // The power spectrum is in L1 cache here
+  for (int j = 0; j < banks.num_bins(); ++j) {
+    const float* w = banks.weights.data() + banks.offset[j];
+    const float* p = power + banks.start[j];
+    int size = banks.size[j];
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    int k = 0;
+    for (; k + 4 <= size; k += 4) {
+      acc = vmlaq_f32(acc, vld1q_f32(w + k), vld1q_f32(p + k));
+    }
+    float energy = HorizontalSum(acc);
+    for (; k < size; ++k) energy += w[k] * p[k];
+    out[j] = energy;
+  }
+}
+
+void LogNeon(float floor, float scale, int n, float* data) {
+  float32x4_t f = vdupq_n_f32(floor);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    float32x4_t v = vmaxq_f32(vld1q_f32(data + i), f);
+    vst1q_f32(data + i, vmulq_n_f32(Log128(v), scale));
+  }
+  LogScalar(floor, scale, n - i, data + i);
+}
+
+const FbankKernels kNeonKernels = {
+    "neon",
+    ScaleNeon,
+    AddScaledNeon,
+    RemoveDcOffsetNeon,
+    PreEmphasisNeon,
+    ApplyWindowNeon,
+    MelEnergiesNeon,
+    LogNeon,
+};
+
+#endif  // WENET_FBANK_NEON
+
+const FbankKernels& SelectFbankKernels() {
+#ifdef WENET_FBANK_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return kAvx2Kernels;
+  }
+#endif
+#ifdef WENET_FBANK_NEON
+  return kNeonKernels;
+#endif
+  return kScalarKernels;
+}
+
+}  // namespace
+
+const FbankKernels& GetFbankKernels() {
+  static const FbankKernels& kernels = SelectFbankKernels();
+  return kernels;
+}
+
+const FbankKernels& GetScalarFbankKernels() { return kScalarKernels; }
+
+RealFft::RealFft(int n) : n_(n) {
+  // n must be a power of two, and the sin table needs n / 2 >= 4
+  CHECK_GE(n_, 8);
+  CHECK_EQ(n_ & (n_ - 1), 0);
+  const int half = n_ / 2;
+  bitrev_.resize(half);
+  sintbl_.resize(half + half / 4);
+  make_sintbl(half, sintbl_.data());
+  make_bitrev(half, bitrev_.data());
+  cos_.resize(half);
+  sin_.resize(half);
+  for (int k = 0; k < half; ++k) {
+    double theta = M_2PI * k / n_;
+    cos_[k] = cos(theta);
+    sin_[k] = sin(theta);
+  }
+  z_re_.resize(half);
+  z_im_.resize(half);
+}
+
+void RealFft::Compute(float* data, float* re, float* im) {
+  const int half = n_ / 2;
+  // Pack the even points to the real part and the odd ones to the
+  // imaginary part, z[j] = x[2j] + i * x[2j + 1]
+  for (int j = 0; j < half; ++j) {
+    z_re_[j] = data[2 * j];
+    z_im_[j] = data[2 * j + 1];
+  }
+  fft(bitrev_.data(), sintbl_.data(), z_re_.data(), z_im_.data(), half);
+  // Split Z to the spectrums of the even and odd points,
+  //   E[k] = (Z[k] + conj(Z[half - k])) / 2
+  //   O[k] = (Z[k] - conj(Z[half - k])) / 2i
+  // then X[k] = E[k] + exp(-2i * pi * k / n) * O[k]
+  for (int k = 0; k < half; ++k) {
+    int mk = (half - k) & (half - 1);
+    float ar = z_re_[k], ai = z_im_[k];
+    float br = z_re_[mk], bi = -z_im_[mk];
+    float er = 0.5f * (ar + br), ei = 0.5f * (ai + bi);
+    float or_ = 0.5f * (ai - bi), oi = -0.5f * (ar - br);
+    float c = cos_[k], s = sin_[k];
+    re[k] = er + c * or_ + s * oi;
+    im[k] = ei + c * oi - s * or_;
+  }
+}
+
+}  // namespace wenet
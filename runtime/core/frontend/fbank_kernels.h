@@ -0,0 +1,92 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FRONTEND_FBANK_KERNELS_H_
+#define FRONTEND_FBANK_KERNELS_H_
+
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// Sparse mel filter banks, bin j has weights[offset[j], offset[j] + size[j])
+// for the power spectrum bins [start[j], start[j] + size[j]).
+struct SparseMelBanks {
+  std::vector<int> start;
+  std::vector<int> size;
+  std::vector<int> offset;
+  std::vector<float> weights;
+
+  int num_bins() const { return start.size(); }
+};
+
+// Vectorized kernels of the optimized fbank engine, see Fbank::Compute.
+// The implementation is chosen once at runtime by the CPU features, AVX2 +
+// FMA on x86, NEON on ARM, and plain C++ otherwise.
+struct FbankKernels {
+  const char* name;
+  // data[i] *= scale
+  void (*scale)(float scale, int n, float* data);
+  // data[i] += scale * noise[i]
+  void (*add_scaled)(const float* noise, float scale, int n, float* data);
+  // data[i] -= mean(data)
+  void (*remove_dc_offset)(int n, float* data);
+  // data[i] -= coeff * data[i - 1], data[0] -= coeff * data[0]
+  void (*pre_emphasis)(float coeff, int n, float* data);
+  // data[i] *= window[i]
+  void (*apply_window)(const float* window, int n, float* data);
+  // Power spectrum of (re, im) followed by the mel filter banks, `power`
+  // is a scratch of `num_fft_bins` floats, and `out` gets the mel energies.
+  void (*mel_energies)(const float* re, const float* im, int num_fft_bins,
+                       const SparseMelBanks& banks, float* power, float* out);
+  // data[i] = log(max(data[i], floor)) * scale, `floor` must be positive
+  void (*log)(float floor, float scale, int n, float* data);
+};
+
+// The best kernels for the running CPU
+const FbankKernels& GetFbankKernels();
+// The plain C++ kernels, it's used as the reference in the tests
+const FbankKernels& GetScalarFbankKernels();
+
+// FFT of `n` real points by one complex FFT of n / 2 points, `n` must be a
+// power of two. Only the first n / 2 bins are computed, which is all that
+// the power spectrum of fbank needs.
+class RealFft {
+ public:
+  explicit RealFft(int n);
+
+  int n() const { return n_; }
+
+  // `data` has n points and is overwritten, `re` and `im` have n / 2 points
+  void Compute(float* data, float* re, float* im);
+
+ private:
+  int n_;
+  // tables of the n / 2 points complex FFT, see fft.h
+  std::vector<int> bitrev_;
+  std::vector<float> sintbl_;
+  // cos and sin of 2 * pi * k / n, k in [0, n / 2)
+  std::vector<float> cos_;
+  std::vector<float> sin_;
+  std::vector<float> z_re_;
+  std::vector<float> z_im_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(RealFft);
+};
+
+}  // namespace wenet
+
+#endif  // FRONTEND_FBANK_KERNELS_H_
@@ -17,6 +17,9 @@
 #include <algorithm>
 #include <utility>
 
+#include "utils/metrics.h"
+#include "utils/trace.h"
+
 namespace wenet {
 
 FeaturePipeline::FeaturePipeline(const FeaturePipelineConfig& config)
@@ -26,102 +29,100 @@ FeaturePipeline::FeaturePipeline(const FeaturePipelineConfig& config)
              config.frame_shift, config.low_freq, config.pre_emphasis,
              config.scale_input_to_unit, config.log_floor, config.log_base,
              config.window_type, config.mel_type, config.norm_type),
+      feature_queue_(config.num_bins),
       num_frames_(0),
-      input_finished_(false) {}
+      input_finished_(false) {
+  fbank_.set_engine(config.engine);
+}
 
 void FeaturePipeline::AcceptWaveform(const float* pcm, const int size) {
-  std::vector<std::vector<float>> feats;
-  std::vector<float> waves;
-  waves.insert(waves.end(), remained_wav_.begin(), remained_wav_.end());
-  waves.insert(waves.end(), pcm, pcm + size);
-  int num_frames = fbank_.Compute(waves, &feats);
-  feature_queue_.Push(std::move(feats));
-  num_frames_ += num_frames;
-
-  int left_samples = waves.size() - config_.frame_shift * num_frames;
+  WENET_TRACE_SCOPE("FeaturePipeline::AcceptWaveform");
+  waves_.clear();
+  waves_.insert(waves_.end(), remained_wav_.begin(), remained_wav_.end());
+  waves_.insert(waves_.end(), pcm, pcm + size);
+  int num_frames = 0;
+  {
+    ScopedLatency latency(&Metrics::Global().feature_extraction);
+    num_frames = fbank_.Compute(waves_, &feats_);
+  }
+  for (int i = 0; i < num_frames; ++i) {
+    feature_queue_.Append(feats_[i].data(), 1);
+  }
+
+  int left_samples = waves_.size() - config_.frame_shift * num_frames;
   remained_wav_.resize(left_samples);
-  std::copy(waves.begin() + config_.frame_shift * num_frames, waves.end(),
+  std::copy(waves_.begin() + config_.frame_shift * num_frames, waves_.end(),
             remained_wav_.begin());
-  // We are still adding wave, notify input is not finished
-  finish_condition_.notify_one();
+  if (num_frames > 0) {
+    num_frames_.fetch_add(num_frames);
+    feature_queue_.Publish();
+    frames_ready_.NotifyAll();
+  }
 }
 
 void FeaturePipeline::AcceptWaveform(const int16_t* pcm, const int size) {
-  auto* float_pcm = new float[size];
+  float_pcm_.resize(size);
   for (size_t i = 0; i < size; i++) {
-    float_pcm[i] = static_cast<float>(pcm[i]);
+    float_pcm_[i] = static_cast<float>(pcm[i]);
   }
-  this->AcceptWaveform(float_pcm, size);
-  delete[] float_pcm;
+  this->AcceptWaveform(float_pcm_.data(), size);
 }
 
 void FeaturePipeline::set_input_finished() {
-  CHECK(!input_finished_);
-  {
-    std::lock_guard<std::mutex> lock(mutex_);
-    input_finished_ = true;
-  }
-  finish_condition_.notify_one();
+  CHECK(!input_finished());
+  input_finished_.store(true, std::memory_order_release);
+  frames_ready_.NotifyAll();
 }
 
-bool FeaturePipeline::ReadOne(std::vector<float>* feat) {
-  if (!feature_queue_.Empty()) {
-    *feat = std::move(feature_queue_.Pop());
-    return true;
-  } else {
-    std::unique_lock<std::mutex> lock(mutex_);
-    while (!input_finished_) {
-      // This will release the lock and wait for notify_one()
-      // from AcceptWaveform() or set_input_finished()
-      finish_condition_.wait(lock);
-      if (!feature_queue_.Empty()) {
-        *feat = std::move(feature_queue_.Pop());
-        return true;
-      }
-    }
-    CHECK(input_finished_);
-    // Double check queue.empty, see issue#893 for detailed discussions.
-    if (!feature_queue_.Empty()) {
-      *feat = std::move(feature_queue_.Pop());
-      return true;
-    } else {
-      return false;
+int FeaturePipeline::WaitFrames(int num_frames) {
+  while (!Ready(num_frames)) {
+    uint32_t key = frames_ready_.PrepareWait();
+    if (Ready(num_frames)) {
+      frames_ready_.CancelWait();
+      break;
     }
+    WENET_TRACE_SCOPE("FeaturePipeline::WaitFrames");
+    frames_ready_.Wait(key);
   }
+  // The queue is checked again after input_finished_, see issue#893 for
+  // detailed discussions.
+  return std::min(num_frames, feature_queue_.Size());
+}
+
+bool FeaturePipeline::ReadOne(std::vector<float>* feat) {
+  if (WaitFrames(1) == 0) return false;
+  feat->resize(feature_dim_);
+  feature_queue_.Pop(1, feat->data());
+  return true;
 }
 
 bool FeaturePipeline::Read(int num_frames,
                            std::vector<std::vector<float>>* feats) {
-  feats->clear();
-  if (feature_queue_.Size() >= num_frames) {
-    *feats = std::move(feature_queue_.Pop(num_frames));
-    return true;
-  } else {
-    std::unique_lock<std::mutex> lock(mutex_);
-    while (!input_finished_) {
-      // This will release the lock and wait for notify_one()
-      // from AcceptWaveform() or set_input_finished()
-      finish_condition_.wait(lock);
-      if (feature_queue_.Size() >= num_frames) {
-        *feats = std::move(feature_queue_.Pop(num_frames));
-        return true;
-      }
-    }
-    CHECK(input_finished_);
-    // Double check queue.empty, see issue#893 for detailed discussions.
-    if (feature_queue_.Size() >= num_frames) {
-      *feats = std::move(feature_queue_.Pop(num_frames));
-      return true;
-    } else {
-      *feats = std::move(feature_queue_.Pop(feature_queue_.Size()));
-      return false;
-    }
+  int n = WaitFrames(num_frames);
+  feats->resize(n);
+  for (int i = 0; i < n; ++i) {
+    (*feats)[i].resize(feature_dim_);
+    feature_queue_.Pop(1, (*feats)[i].data());
   }
+  return n == num_frames;
+}
+
+bool FeaturePipeline::Read(int num_frames, std::vector<float>* feats) {
+  feats->clear();
+  return ReadAppend(num_frames, feats);
+}
+
+bool FeaturePipeline::ReadAppend(int num_frames, std::vector<float>* feats) {
+  int n = WaitFrames(num_frames);
+  size_t offset = feats->size();
+  feats->resize(offset + static_cast<size_t>(n) * feature_dim_);
+  feature_queue_.Pop(n, feats->data() + offset);
+  return n == num_frames;
 }
 
 void FeaturePipeline::Reset() {
-  input_finished_ = false;
-  num_frames_ = 0;
+  input_finished_.store(false);
+  num_frames_.store(0);
   remained_wav_.clear();
   feature_queue_.Clear();
 }
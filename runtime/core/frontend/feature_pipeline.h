@@ -15,14 +15,14 @@
 #ifndef FRONTEND_FEATURE_PIPELINE_H_
 #define FRONTEND_FEATURE_PIPELINE_H_
 
+#include <atomic>
 #include <limits>
-#include <mutex>
-#include <queue>
 #include <string>
 #include <vector>
 
 #include "frontend/fbank.h"
-#include "utils/blocking_queue.h"
+#include "frontend/feature_queue.h"
+#include "utils/event_count.h"
 #include "utils/log.h"
 
 namespace wenet {
@@ -45,6 +45,7 @@ struct FeaturePipelineConfig {
   WindowType window_type;
   MelType mel_type;
   NormalizationType norm_type;
+  FbankEngine engine = FbankEngine::kReference;
 
   FeaturePipelineConfig(int num_bins, int sample_rate,
                         FeatureType feat_type = FeatureType::kKaldi)
@@ -80,17 +81,22 @@ struct FeaturePipelineConfig {
               << " preemphasis " << pre_emphasis << " log_floor " << log_floor
               << " log_base " << int(log_base) << " window_type "
               << int(window_type) << " mel_type " << int(mel_type)
-              << " norm_type " << int(norm_type);
+              << " norm_type " << int(norm_type) << " engine "
+              << int(engine);
   }
 };
 
 // Typically, FeaturePipeline is used in two threads: one thread A calls
 // AcceptWaveform() to add raw wav data and set_input_finished() to notice
 // the end of input wav, another thread B (decoder thread) calls Read() to
-// consume features.So a BlockingQueue is used to make this class thread safe.
+// consume features. The features are kept in a single producer single
+// consumer FeatureQueue, so there is no lock between the two threads, and
+// the frames of one AcceptWaveform() are published at once.
 
 // The Read() is designed as a blocking method when there is no feature
-// in feature_queue_ and the input is not finished.
+// in feature_queue_ and the input is not finished, the thread sleeps on an
+// EventCount which AcceptWaveform() and set_input_finished() notify. An
+// event loop can poll Ready() instead.
 
 // See bin/decoder_main.cc, websocket/websocket_server.cc and
 // decoder/torch_asr_decoder.cc for usage
@@ -104,14 +110,16 @@ class FeaturePipeline {
   void AcceptWaveform(const int16_t* pcm, const int size);
 
   // Current extracted frames number.
-  int num_frames() const { return num_frames_; }
+  int num_frames() const { return num_frames_.load(); }
   int feature_dim() const { return feature_dim_; }
   const FeaturePipelineConfig& config() const { return config_; }
 
   // The caller should call this method when speech input is end.
   // Never call AcceptWaveform() after calling set_input_finished() !
   void set_input_finished();
-  bool input_finished() const { return input_finished_; }
+  bool input_finished() const {
+    return input_finished_.load(std::memory_order_acquire);
+  }
 
   // Return False if input is finished and no feature could be read.
   // Return True if a feature is read.
@@ -127,32 +135,55 @@ class FeaturePipeline {
   // in feature_queue_ and the input is not finished.
   bool Read(int num_frames, std::vector<std::vector<float>>* feats);
 
+  // Same as the above, but the features are returned row major in one
+  // contiguous buffer of (#frames x feature_dim), the capacity of `feats`
+  // is reused so there is no allocation in the steady state.
+  bool Read(int num_frames, std::vector<float>* feats);
+  // Same as the above, but the features are appended to `feats`, so they are
+  // popped from the queue straight to the encoder input, see
+  // AsrModel::BeginChunk.
+  bool ReadAppend(int num_frames, std::vector<float>* feats);
+
+  // Neither AcceptWaveform() nor Read() should be running
   void Reset();
   bool IsLastFrame(int frame) const {
-    return input_finished_ && (frame == num_frames_ - 1);
+    return input_finished() && (frame == num_frames() - 1);
   }
 
+  // Non-blocking, they can be called by any thread
   int NumQueuedFrames() const { return feature_queue_.Size(); }
+  // Whether Read(num_frames) returns without blocking
+  bool Ready(int num_frames) const {
+    // The frames are published before input_finished_
+    return input_finished() || feature_queue_.Size() >= num_frames;
+  }
 
  private:
+  // Wait until there are #num_frames frames in feature_queue_ or the input
+  // is finished, return the number of frames which could be read.
+  int WaitFrames(int num_frames);
+
   const FeaturePipelineConfig& config_;
   int feature_dim_;
   Fbank fbank_;
 
-  BlockingQueue<std::vector<float>> feature_queue_;
-  int num_frames_;
-  bool input_finished_;
+  FeatureQueue feature_queue_;
+  std::atomic<int> num_frames_;
+  std::atomic<bool> input_finished_;
 
   // The feature extraction is done in AcceptWaveform().
   // This waveform sample points are consumed by frame size.
   // The residual waveform sample points after framing are
   // kept to be used in next AcceptWaveform() calling.
   std::vector<float> remained_wav_;
+  // Reused buffers of AcceptWaveform()
+  std::vector<float> waves_;
+  std::vector<float> float_pcm_;
+  std::vector<std::vector<float>> feats_;
 
   // Used to block the Read when there is no feature in feature_queue_
   // and the input is not finished.
-  mutable std::mutex mutex_;
-  std::condition_variable finish_condition_;
+  EventCount frames_ready_;
 };
 
 }  // namespace wenet
@@ -0,0 +1,92 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "frontend/feature_queue.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+FeatureQueue::FeatureQueue(int dim, int block_size)
+    : dim_(dim), block_size_(block_size) {
+  CHECK_GT(dim_, 0);
+  CHECK_GT(block_size_, 0);
+  blocks_.emplace_back(new Block(static_cast<size_t>(block_size_) * dim_));
+  first_ = tail_ = head_ = blocks_.back().get();
+}
+
+FeatureQueue::Block* FeatureQueue::NewBlock() {
+  Block* block = nullptr;
+  if (first_ != tail_ &&
+      first_->start < released_.load(std::memory_order_acquire)) {
+    // The consumer has moved past the oldest block, reuse it
+    block = first_;
+    first_ = first_->next.load(std::memory_order_relaxed);
+    block->next.store(nullptr, std::memory_order_relaxed);
+  } else {
+    blocks_.emplace_back(new Block(static_cast<size_t>(block_size_) * dim_));
+    block = blocks_.back().get();
+  }
+  block->start = pushed_;
+  // Linked before its frames are published, see Pop()
+  tail_->next.store(block, std::memory_order_release);
+  return block;
+}
+
+void FeatureQueue::Append(const float* frames, int num_frames) {
+  while (num_frames > 0) {
+    int offset = static_cast<int>(pushed_ - tail_->start);
+    if (offset == block_size_) {
+      tail_ = NewBlock();
+      offset = 0;
+    }
+    int n = std::min(num_frames, block_size_ - offset);
+    memcpy(tail_->data.get() + static_cast<size_t>(offset) * dim_, frames,
+           sizeof(float) * n * dim_);
+    frames += static_cast<size_t>(n) * dim_;
+    num_frames -= n;
+    pushed_ += n;
+  }
+}
+
+int FeatureQueue::Pop(int num_frames, float* frames) {
+  int64_t written = written_.load(std::memory_order_acquire);
+  num_frames = static_cast<int>(std::min<int64_t>(num_frames,
+                                                  written - popped_));
+  if (num_frames <= 0) return 0;
+  int left = num_frames;
+  while (left > 0) {
+    int offset = static_cast<int>(popped_ - head_->start);
+    if (offset == block_size_) {
+      head_ = head_->next.load(std::memory_order_acquire);
+      offset = 0;
+      released_.store(head_->start, std::memory_order_release);
+    }
+    int n = std::min(left, block_size_ - offset);
+    if (frames != nullptr) {
+      memcpy(frames, head_->data.get() + static_cast<size_t>(offset) * dim_,
+             sizeof(float) * n * dim_);
+      frames += static_cast<size_t>(n) * dim_;
+    }
+    left -= n;
+    popped_ += n;
+  }
+  read_.store(popped_, std::memory_order_release);
+  return num_frames;
+}
+
+}  // namespace wenet
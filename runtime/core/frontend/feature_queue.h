@@ -0,0 +1,94 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FRONTEND_FEATURE_QUEUE_H_
+#define FRONTEND_FEATURE_QUEUE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// FeatureQueue is a FIFO of feature frames between one producer thread and
+// one consumer thread, it's wait free for both of them. The frames are
+// stored row major in a list of fixed size blocks, the producer appends a
+// block when the last one is full, and reuses the blocks which the consumer
+// is done with, so there is no allocation in the steady state and the queue
+// is never bounded. See FeaturePipeline for the blocking wrapper.
+class FeatureQueue {
+ public:
+  explicit FeatureQueue(int dim, int block_size = 256);
+
+  int dim() const { return dim_; }
+  // The published frames not popped yet, it can be called by any thread
+  int Size() const {
+    return static_cast<int>(written_.load(std::memory_order_acquire) -
+                            read_.load(std::memory_order_acquire));
+  }
+  bool Empty() const { return Size() == 0; }
+
+  // Producer. Append `num_frames` frames, `frames` is (num_frames x dim) row
+  // major, they are not visible to the consumer until Publish(), so a batch
+  // of frames costs one atomic store.
+  void Append(const float* frames, int num_frames);
+  void Publish() { written_.store(pushed_, std::memory_order_release); }
+  void Push(const float* frames, int num_frames) {
+    Append(frames, num_frames);
+    Publish();
+  }
+
+  // Consumer. Pop at most `num_frames` frames to `frames`, which must have
+  // room for (num_frames x dim) floats, return the number of popped frames.
+  // The frames are dropped if `frames` is nullptr.
+  int Pop(int num_frames, float* frames);
+  void Clear() { Pop(Size(), nullptr); }
+
+ private:
+  struct Block {
+    explicit Block(size_t size) : data(new float[size]) {}
+    std::unique_ptr<float[]> data;
+    // Index of the first frame of the block in the stream
+    int64_t start = 0;
+    std::atomic<Block*> next{nullptr};
+  };
+
+  Block* NewBlock();
+
+  const int dim_;
+  const int block_size_;  // in frames
+  // Owned by the producer, blocks_ are linked from first_ to tail_
+  std::vector<std::unique_ptr<Block>> blocks_;
+  Block* first_;
+  Block* tail_;
+  int64_t pushed_ = 0;
+  // Owned by the consumer
+  Block* head_;
+  int64_t popped_ = 0;
+  // Shared, on separate cache lines for the two threads
+  alignas(64) std::atomic<int64_t> written_{0};
+  alignas(64) std::atomic<int64_t> read_{0};
+  // Start of head_, the blocks before it can be reused
+  std::atomic<int64_t> released_{0};
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(FeatureQueue);
+};
+
+}  // namespace wenet
+
+#endif  // FRONTEND_FEATURE_QUEUE_H_
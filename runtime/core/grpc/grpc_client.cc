@@ -14,6 +14,8 @@
 
 #include "grpc/grpc_client.h"
 
+#include <utility>
+
 #include "utils/log.h"
 
 namespace wenet {
@@ -25,11 +27,12 @@ using wenet::Request;
 using wenet::Response;
 
 GrpcClient::GrpcClient(const std::string& host, int port, int nbest,
-                       bool continuous_decoding)
+                       bool continuous_decoding, MessageCallback on_message)
     : host_(host),
       port_(port),
       nbest_(nbest),
-      continuous_decoding_(continuous_decoding) {
+      continuous_decoding_(continuous_decoding),
+      on_message_(std::move(on_message)) {
   Connect();
   t_.reset(new std::thread(&GrpcClient::ReadLoopFunc, this));
 }
@@ -57,13 +60,18 @@ void GrpcClient::SendBinaryData(const void* data, size_t size) {
 void GrpcClient::ReadLoopFunc() {
   try {
     while (stream_->Read(response_.get())) {
-      for (int i = 0; i < response_->nbest_size(); i++) {
+      for (int i = 0; on_message_ == nullptr && i < response_->nbest_size();
+           i++) {
         // you can also traverse wordpieces like demonstrated above
         LOG(INFO) << i + 1 << "best " << response_->nbest(i).sentence();
       }
       if (response_->status() != Response_Status_ok) {
+        if (on_message_ != nullptr) on_message_("error");
         break;
       }
+      if (on_message_ != nullptr) {
+        on_message_(Response::Type_Name(response_->type()));
+      }
       if (response_->type() == Response_Type_speech_end) {
         done_ = true;
         break;
@@ -71,6 +79,7 @@ void GrpcClient::ReadLoopFunc() {
     }
   } catch (std::exception const& e) {
     LOG(ERROR) << e.what();
+    if (on_message_ != nullptr) on_message_("error");
   }
 }
 
@@ -80,6 +89,7 @@ void GrpcClient::Join() {
   Status status = stream_->Finish();
   if (!status.ok()) {
     LOG(INFO) << "Recognize rpc failed.";
+    if (on_message_ != nullptr) on_message_("error");
   }
 }
 }  // namespace wenet
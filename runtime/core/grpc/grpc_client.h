@@ -20,6 +20,7 @@
 #include <grpcpp/client_context.h>
 #include <grpcpp/create_channel.h>
 
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -39,8 +40,13 @@ using wenet::Response;
 
 class GrpcClient {
  public:
+  // Called from the read thread with the type of every response received,
+  // e.g. "partial_result", or "error" for a failure
+  using MessageCallback = std::function<void(const std::string& type)>;
+  // If `on_message` is set, the responses are passed to it instead of being
+  // logged
   GrpcClient(const std::string& host, int port, int nbest,
-             bool continuous_decoding);
+             bool continuous_decoding, MessageCallback on_message = nullptr);
 
   void SendBinaryData(const void* data, size_t size);
   void ReadLoopFunc();
@@ -60,6 +66,7 @@ class GrpcClient {
   int nbest_ = 1;
   bool continuous_decoding_ = false;
   bool done_ = false;
+  MessageCallback on_message_;
   std::unique_ptr<std::thread> t_{nullptr};
 
   WENET_DISALLOW_COPY_AND_ASSIGN(GrpcClient);
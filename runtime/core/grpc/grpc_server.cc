@@ -14,6 +14,11 @@
 
 #include "grpc/grpc_server.h"
 
+#include <chrono>
+
+#include "utils/metrics.h"
+#include "utils/trace.h"
+
 namespace wenet {
 
 using grpc::ServerReaderWriter;
@@ -31,20 +36,43 @@ GrpcConnectionHandler::GrpcConnectionHandler(
       response_(std::move(response)),
       feature_config_(std::move(feature_config)),
       decode_config_(std::move(decode_config)),
-      decode_resource_(std::move(decode_resource)) {}
+      decode_resource_(std::move(decode_resource)),
+      write_mutex_(new std::mutex) {}
 
-void GrpcConnectionHandler::OnSpeechStart() {
+void GrpcConnectionHandler::Write(const Response& response) {
+  // The decoding thread and the rescoring pool may write at the same time
+  std::lock_guard<std::mutex> lock(*write_mutex_);
+  WENET_TRACE_SCOPE("Grpc::Write");
+  stream_->Write(response);
+}
+
+bool GrpcConnectionHandler::OnSpeechStart() {
   LOG(INFO) << "Received speech start signal, start reading speech";
+  std::string error;
+  auto resource = SessionResource(decode_resource_, hotwords_,
+                                  hotwords_score_, &context_key_, &error);
+  if (resource == nullptr) {
+    LOG(WARNING) << error;
+    response_->set_status(Response::failed);
+    response_->set_type(Response::server_ready);
+    Write(*response_);
+    return false;
+  }
   got_start_tag_ = true;
   response_->set_status(Response::ok);
   response_->set_type(Response::server_ready);
-  stream_->Write(*response_);
+  response_->set_context_key(context_key_);
+  Write(*response_);
+  response_->clear_context_key();
+  async_rescoring_ =
+      continuous_decoding_ && resource->rescoring_pool != nullptr;
   feature_pipeline_ = std::make_shared<FeaturePipeline>(*feature_config_);
-  decoder_ = std::make_shared<AsrDecoder>(feature_pipeline_, decode_resource_,
+  decoder_ = std::make_shared<AsrDecoder>(feature_pipeline_, resource,
                                           *decode_config_);
   // Start decoder thread
   decode_thread_ = std::make_shared<std::thread>(
       &GrpcConnectionHandler::DecodeThreadFunc, this);
+  return true;
 }
 
 void GrpcConnectionHandler::OnSpeechEnd() {
@@ -58,21 +86,63 @@ void GrpcConnectionHandler::OnPartialResult() {
   LOG(INFO) << "Partial result";
   response_->set_status(Response::ok);
   response_->set_type(Response::partial_result);
-  stream_->Write(*response_);
+  Write(*response_);
 }
 
-void GrpcConnectionHandler::OnFinalResult() {
+void GrpcConnectionHandler::OnFinalResult(int segment) {
   LOG(INFO) << "Final result";
+  VLOG(1) << "Session memory usage: " << decoder_->MemoryUsage() << " bytes";
   response_->set_status(Response::ok);
   response_->set_type(Response::final_result);
-  stream_->Write(*response_);
+  response_->set_segment(segment);
+  Write(*response_);
 }
 
 void GrpcConnectionHandler::OnFinish() {
   // Send finish tag
   response_->set_status(Response::ok);
   response_->set_type(Response::speech_end);
-  stream_->Write(*response_);
+  Write(*response_);
+}
+
+void GrpcConnectionHandler::RescoreAsync() {
+  // Send the CTC final result at once, and the rescored one when it's done
+  std::shared_ptr<RescoringTask> task = decoder_->DetachRescoring();
+  int segment = num_segments_++;
+  // A long stream has many segments, drop the finished ones
+  WaitRescoring(false);
+  Metrics::Global().rescoring_queue_depth.Add(1);
+  SerializeResult(true);
+  OnFinalResult(segment);
+  pending_rescoring_.push_back(decode_resource_->rescoring_pool->enqueue(
+      [this, task, segment]() {
+        Metrics::Global().rescoring_queue_depth.Add(-1);
+        task->Run();
+        Response response;
+        SerializeResult(task->result(), true, &response);
+        response.set_status(Response::ok);
+        response.set_type(Response::rescored_final_result);
+        response.set_segment(segment);
+        LOG(INFO) << "Rescored final result of segment " << segment;
+        Write(response);
+      }));
+}
+
+void GrpcConnectionHandler::WaitRescoring(bool block) {
+  for (auto it = pending_rescoring_.begin();
+       it != pending_rescoring_.end();) {
+    if (!block &&
+        it->wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+      ++it;
+      continue;
+    }
+    try {
+      it->get();
+    } catch (std::exception const& e) {
+      LOG(ERROR) << e.what();
+    }
+    it = pending_rescoring_.erase(it);
+  }
 }
 
 void GrpcConnectionHandler::OnSpeechData() {
@@ -87,8 +157,14 @@ void GrpcConnectionHandler::OnSpeechData() {
 }
 
 void GrpcConnectionHandler::SerializeResult(bool finish) {
-  for (const DecodeResult& path : decoder_->result()) {
-    Response_OneBest* one_best_ = response_->add_nbest();
+  SerializeResult(decoder_->result(), finish, response_.get());
+}
+
+void GrpcConnectionHandler::SerializeResult(
+    const std::vector<DecodeResult>& results, bool finish,
+    Response* response) {
+  for (const DecodeResult& path : results) {
+    Response_OneBest* one_best_ = response->add_nbest();
     one_best_->set_sentence(path.sentence);
     if (finish) {
       for (const WordPiece& word_piece : path.word_pieces) {
@@ -98,7 +174,7 @@ void GrpcConnectionHandler::SerializeResult(bool finish) {
         one_piece_->set_end(word_piece.end);
       }
     }
-    if (response_->nbest_size() == nbest_) {
+    if (response->nbest_size() == nbest_) {
       break;
     }
   }
@@ -111,17 +187,27 @@ void GrpcConnectionHandler::DecodeThreadFunc() {
     response_->clear_status();
     response_->clear_type();
     response_->clear_nbest();
+    response_->clear_segment();
     if (state == DecodeState::kEndFeats) {
-      decoder_->Rescoring();
-      SerializeResult(true);
-      OnFinalResult();
+      if (async_rescoring_) {
+        RescoreAsync();
+        WaitRescoring();
+      } else {
+        decoder_->Rescoring();
+        SerializeResult(true);
+        OnFinalResult();
+      }
       OnFinish();
       stop_recognition_ = true;
       break;
     } else if (state == DecodeState::kEndpoint) {
-      decoder_->Rescoring();
-      SerializeResult(true);
-      OnFinalResult();
+      if (async_rescoring_) {
+        RescoreAsync();
+      } else {
+        decoder_->Rescoring();
+        SerializeResult(true);
+        OnFinalResult();
+      }
       // If it's not continuous decoding, continue to do next recognition
       // otherwise stop the recognition
       if (continuous_decoding_) {
@@ -138,16 +224,27 @@ void GrpcConnectionHandler::DecodeThreadFunc() {
       }
     }
   }
+  // The pending rescoring tasks refer to this handler
+  WaitRescoring();
 }
 
 void GrpcConnectionHandler::operator()() {
   try {
-    while (stream_->Read(request_.get())) {
+    while (true) {
+      {
+        WENET_TRACE_SCOPE("Grpc::Read");
+        if (!stream_->Read(request_.get())) break;
+      }
       if (!got_start_tag_) {
-        nbest_ = request_->decode_config().nbest_config();
-        continuous_decoding_ =
-            request_->decode_config().continuous_decoding_config();
-        OnSpeechStart();
+        const auto& decode_config = request_->decode_config();
+        nbest_ = decode_config.nbest_config();
+        continuous_decoding_ = decode_config.continuous_decoding_config();
+        hotwords_.assign(decode_config.hotwords().begin(),
+                         decode_config.hotwords().end());
+        hotwords_score_ = decode_config.hotwords_score();
+        context_key_ = decode_config.context_key();
+        // Rejected hotwords or unknown context key
+        if (!OnSpeechStart()) return;
       } else {
         OnSpeechData();
       }
@@ -165,10 +262,19 @@ void GrpcConnectionHandler::operator()() {
 Status GrpcServer::Recognize(ServerContext* context,
                              ServerReaderWriter<Response, Request>* stream) {
   LOG(INFO) << "Get Recognize request" << std::endl;
+  // Admitted before reading the stream, so an overloaded server fails the
+  // call at once and the client can retry another one
+  std::unique_ptr<AdmissionController::Ticket> admission;
+  std::shared_ptr<DecodeOptions> decode_config = decode_config_;
+  if (!AdmitSession(*decode_resource_, &admission, &decode_config)) {
+    LOG(WARNING) << "Reject the request, the server is overloaded";
+    return Status(grpc::StatusCode::RESOURCE_EXHAUSTED,
+                  "Server is overloaded, please retry later");
+  }
   auto request = std::make_shared<Request>();
   auto response = std::make_shared<Response>();
   GrpcConnectionHandler handler(stream, request, response, feature_config_,
-                                decode_config_, decode_resource_);
+                                decode_config, decode_resource_);
   std::thread t(std::move(handler));
   t.join();
   return Status::OK;
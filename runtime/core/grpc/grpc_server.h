@@ -15,13 +15,16 @@
 #ifndef GRPC_GRPC_SERVER_H_
 #define GRPC_GRPC_SERVER_H_
 
+#include <future>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <utility>
 #include <vector>
 
+#include "decoder/admission_controller.h"
 #include "decoder/asr_decoder.h"
 #include "frontend/feature_pipeline.h"
 #include "utils/log.h"
@@ -48,17 +51,34 @@ class GrpcConnectionHandler {
   void operator()();
 
  private:
-  void OnSpeechStart();
+  // False if the session can't start, e.g. with an unknown context key
+  bool OnSpeechStart();
   void OnSpeechEnd();
   void OnFinish();
   void OnSpeechData();
   void OnPartialResult();
-  void OnFinalResult();
+  // `segment` is the index of the segment in the asynchronous rescoring
+  // mode, or -1
+  void OnFinalResult(int segment = -1);
   void DecodeThreadFunc();
   void SerializeResult(bool finish);
+  void SerializeResult(const std::vector<DecodeResult>& results, bool finish,
+                       Response* response);
+  void Write(const Response& response);
+  // Send the CTC final result of the segment, and its rescoring runs in the
+  // rescoring pool of the resource, which sends the rescored final result
+  void RescoreAsync();
+  // Wait for the pending rescoring tasks, or only collect the finished ones
+  // if `block` is false
+  void WaitRescoring(bool block = true);
 
   bool continuous_decoding_ = false;
   int nbest_ = 1;
+  // Hotwords of the session, or the cache key of the hotwords of a previous
+  // session, see SessionResource
+  std::vector<std::string> hotwords_;
+  float hotwords_score_ = 0;
+  std::string context_key_;
   ServerReaderWriter<Response, Request>* stream_;
   std::shared_ptr<Request> request_;
   std::shared_ptr<Response> response_;
@@ -73,6 +93,11 @@ class GrpcConnectionHandler {
   std::shared_ptr<FeaturePipeline> feature_pipeline_ = nullptr;
   std::shared_ptr<AsrDecoder> decoder_ = nullptr;
   std::shared_ptr<std::thread> decode_thread_ = nullptr;
+  // The handler is moved into its thread, so the mutex is held by pointer
+  std::unique_ptr<std::mutex> write_mutex_;
+  bool async_rescoring_ = false;
+  int num_segments_ = 0;
+  std::vector<std::future<void>> pending_rescoring_;
 };
 
 class GrpcServer final : public ASR::Service {
@@ -14,6 +14,8 @@
 
 #include "http/http_client.h"
 
+#include <utility>
+
 #include "boost/json/src.hpp"
 
 #include "utils/log.h"
@@ -26,8 +28,9 @@ namespace net = boost::asio;     // from <boost/asio.hpp>
 using tcp = net::ip::tcp;        // from <boost/asio/ip/tcp.hpp>
 namespace json = boost::json;
 
-HttpClient::HttpClient(const std::string& hostname, int port)
-    : hostname_(hostname), port_(port) {
+HttpClient::HttpClient(const std::string& hostname, int port,
+                       MessageCallback on_message)
+    : hostname_(hostname), port_(port), on_message_(std::move(on_message)) {
   Connect();
 }
 
@@ -54,9 +57,16 @@ void HttpClient::SendBinaryData(const void* data, size_t size) {
     http::read(stream_, buffer_, res_);
     std::string message = res_.body();
     json::object obj = json::parse(message).as_object();
-    LOG(INFO) << message;
+    if (on_message_ == nullptr) {
+      LOG(INFO) << message;
+    } else if (obj["status"] != "ok") {
+      on_message_("error");
+    } else {
+      on_message_(std::string(obj["type"].as_string().c_str()));
+    }
   } catch (std::exception const& e) {
     LOG(ERROR) << e.what();
+    if (on_message_ != nullptr) on_message_("error");
   }
   stream_.socket().shutdown(tcp::socket::shutdown_both, ec_);
 }
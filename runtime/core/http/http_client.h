@@ -15,6 +15,7 @@
 #ifndef HTTP_HTTP_CLIENT_H_
 #define HTTP_HTTP_CLIENT_H_
 
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -38,7 +39,13 @@ using tcp = net::ip::tcp;        // from <boost/asio/ip/tcp.hpp>
 
 class HttpClient {
  public:
-  HttpClient(const std::string& host, int port);
+  // Called with the type of the response, i.e. "final_result", or "error"
+  // for a failure
+  using MessageCallback = std::function<void(const std::string& type)>;
+  // If `on_message` is set, the response is passed to it instead of being
+  // logged
+  HttpClient(const std::string& host, int port,
+             MessageCallback on_message = nullptr);
 
   void SendBinaryData(const void* data, size_t size);
   void set_nbest(int nbest) { nbest_ = nbest; }
@@ -51,6 +58,7 @@ class HttpClient {
   int version_ = 11;
   int nbest_ = 1;
   const bool continuous_decoding_ = false;
+  MessageCallback on_message_;
   net::io_context ioc_;
   beast::tcp_stream stream_{ioc_};
   beast::flat_buffer buffer_;
@@ -20,6 +20,8 @@
 
 #include "boost/json/src.hpp"
 #include "utils/log.h"
+#include "utils/metrics.h"
+#include "utils/trace.h"
 
 namespace wenet {
 
@@ -42,13 +44,19 @@ ConnectionHandler::ConnectionHandler(
       res_(std::make_shared<http::response<http::string_body>>(http::status::ok,
                                                                version_)) {}
 
-void ConnectionHandler::OnSpeechStart() {
+bool ConnectionHandler::OnSpeechStart() {
+  if (!AdmitSession(*decode_resource_, &admission_, &decode_config_)) {
+    res_->result(http::status::service_unavailable);
+    OnError("Server is overloaded, please retry later");
+    return false;
+  }
   feature_pipeline_ = std::make_shared<FeaturePipeline>(*feature_config_);
   decoder_ = std::make_shared<AsrDecoder>(feature_pipeline_, decode_resource_,
                                           *decode_config_);
   // Start decoder thread
   decode_thread_ =
       std::make_shared<std::thread>(&ConnectionHandler::DecodeThreadFunc, this);
+  return true;
 }
 
 void ConnectionHandler::OnSpeechEnd() {
@@ -63,6 +71,7 @@ void ConnectionHandler::OnFinalResult(const std::string& result) {
       {"status", "ok"}, {"type", "final_result"}, {"nbest", result}};
   std::string message = json::serialize(rv);
   res_.get()->body() = message;
+  WENET_TRACE_SCOPE("Http::Write");
   http::write(socket_, *res_.get(), ec_);
 }
 
@@ -146,14 +155,25 @@ void ConnectionHandler::OnText(const std::string& message) {
 
 void ConnectionHandler::operator()() {
   try {
-    http::read(socket_, buffer_, *req_.get(), ec_);
+    {
+      WENET_TRACE_SCOPE("Http::Read");
+      http::read(socket_, buffer_, *req_.get(), ec_);
+    }
     if (ec_) {
       LOG(ERROR) << ec_;
+    } else if (req_->method() == http::verb::get &&
+               req_->target() == "/metrics") {
+      // The metrics of the process in the Prometheus text format
+      res_->set(http::field::content_type, "text/plain; version=0.0.4");
+      res_->body() = Metrics::Global().Export();
+      res_->prepare_payload();
+      http::write(socket_, *res_, ec_);
     } else {
       OnText(req_.get()->base()["config"].to_string());
-      OnSpeechStart();
-      OnSpeechData(req_.get()->body());
-      OnSpeechEnd();
+      if (OnSpeechStart()) {
+        OnSpeechData(req_.get()->body());
+        OnSpeechEnd();
+      }
     }
     LOG(INFO) << "Read all pcm data, wait for decoding thread";
     if (decode_thread_ != nullptr) {
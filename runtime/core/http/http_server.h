@@ -28,6 +28,7 @@
 #include <boost/beast/version.hpp>
 #include <boost/config.hpp>
 
+#include "decoder/admission_controller.h"
 #include "decoder/asr_decoder.h"
 #include "frontend/feature_pipeline.h"
 #include "utils/log.h"
@@ -48,7 +49,8 @@ class ConnectionHandler {
   void operator()();
 
  private:
-  void OnSpeechStart();
+  // False if the session is rejected by the admission control
+  bool OnSpeechStart();
   void OnSpeechEnd();
   void OnText(const std::string& message);
   void OnSpeechData(const std::string& message);
@@ -70,6 +72,9 @@ class ConnectionHandler {
   std::shared_ptr<DecodeOptions> decode_config_;
   std::shared_ptr<DecodeResource> decode_resource_;
 
+  // Counts the session in the admission control until it is destroyed,
+  // after the decoder
+  std::unique_ptr<AdmissionController::Ticket> admission_;
   std::shared_ptr<FeaturePipeline> feature_pipeline_ = nullptr;
   std::shared_ptr<AsrDecoder> decoder_ = nullptr;
   std::shared_ptr<std::thread> decode_thread_ = nullptr;
@@ -33,7 +33,7 @@ namespace kaldi {
 template <typename FST, typename Token>
 LatticeFasterDecoderTpl<FST, Token>::LatticeFasterDecoderTpl(
     const FST& fst, const LatticeFasterDecoderConfig& config,
-    const std::shared_ptr<wenet::ContextGraph>& context_graph)
+    const std::shared_ptr<const wenet::ContextGraph>& context_graph)
     : fst_(&fst),
       delete_fst_(false),
       config_(config),
@@ -73,7 +73,7 @@ void LatticeFasterDecoderTpl<FST, Token>::InitDecoding() {
   StateId start_state = fst_->Start();
   KALDI_ASSERT(start_state != fst::kNoStateId);
   active_toks_.resize(1);
-  Token* start_tok = new Token(0.0, 0.0, NULL, NULL, NULL);
+  Token* start_tok = token_pool_.New(0.0, 0.0, NULL, NULL, NULL);
   active_toks_[0].toks = start_tok;
   toks_.Insert(start_state, start_tok);
   num_toks_++;
@@ -268,7 +268,8 @@ LatticeFasterDecoderTpl<FST, Token>::FindOrAddToken(StateId state,
     // tokens on the currently final frame have zero extra_cost
     // as any of them could end up
     // on the winning path.
-    Token* new_tok = new Token(tot_cost, extra_cost, NULL, toks, backpointer);
+    Token* new_tok =
+        token_pool_.New(tot_cost, extra_cost, NULL, toks, backpointer);
     // NULL: no forward links yet
     toks = new_tok;
     num_toks_++;
@@ -354,7 +355,7 @@ void LatticeFasterDecoderTpl<FST, Token>::PruneForwardLinks(
             prev_link->next = next_link;
           else
             tok->links = next_link;
-          delete link;
+          link_pool_.Delete(link);
           link = next_link;  // advance link but leave prev_link the same.
           *links_pruned = true;
         } else {  // keep the link and update the tok_extra_cost if needed.
@@ -446,7 +447,7 @@ void LatticeFasterDecoderTpl<FST, Token>::PruneForwardLinksFinal() {
             prev_link->next = next_link;
           else
             tok->links = next_link;
-          delete link;
+          link_pool_.Delete(link);
           link = next_link;  // advance link but leave prev_link the same.
         } else {  // keep the link and update the tok_extra_cost if needed.
           if (link_extra_cost < 0.0) {  // this is just a precaution.
@@ -508,7 +509,7 @@ void LatticeFasterDecoderTpl<FST, Token>::PruneTokensForFrame(
         prev_tok->next = tok->next;
       else
         toks = tok->next;
-      delete tok;
+      token_pool_.Delete(tok);
       num_toks_--;
     } else {  // fetch next Token
       prev_tok = tok;
@@ -840,8 +841,8 @@ BaseFloat LatticeFasterDecoderTpl<FST, Token>::ProcessEmitting(
 
           // Add ForwardLink from tok to next_tok (put on head of list
           // tok->links)
-          tok->links = new ForwardLinkT(e_next->val, arc.ilabel, arc.olabel,
-                                        graph_cost, ac_cost, tok->links);
+          tok->links = link_pool_.New(e_next->val, arc.ilabel, arc.olabel,
+                                      graph_cost, ac_cost, tok->links);
           if (context_graph_ != nullptr) {
             tok->links->context_score = context_score;
           }
@@ -854,13 +855,12 @@ BaseFloat LatticeFasterDecoderTpl<FST, Token>::ProcessEmitting(
   return next_cutoff;
 }
 
-// static inline
 template <typename FST, typename Token>
 void LatticeFasterDecoderTpl<FST, Token>::DeleteForwardLinks(Token* tok) {
   ForwardLinkT *l = tok->links, *m;
   while (l != NULL) {
     m = l->next;
-    delete l;
+    link_pool_.Delete(l);
     l = m;
   }
   tok->links = NULL;
@@ -928,8 +928,8 @@ void LatticeFasterDecoderTpl<FST, Token>::ProcessNonemitting(BaseFloat cutoff) {
             e_new->val->context_state = tok->context_state;
           }
 
-          tok->links = new ForwardLinkT(e_new->val, 0, arc.olabel, graph_cost,
-                                        0, tok->links);
+          tok->links = link_pool_.New(e_new->val, 0, arc.olabel, graph_cost, 0,
+                                      tok->links);
 
           // "changed" tells us whether the new token has a different
           // cost from before, or is new [if so, add into queue].
@@ -953,19 +953,13 @@ void LatticeFasterDecoderTpl<FST, Token>::DeleteElems(Elem* list) {
 template <typename FST, typename Token>
 void LatticeFasterDecoderTpl<
     FST, Token>::ClearActiveTokens() {  // a cleanup routine, at utt end/begin
-  for (size_t i = 0; i < active_toks_.size(); i++) {
-    // Delete all tokens alive on this frame, and any forward
-    // links they may have.
-    for (Token* tok = active_toks_[i].toks; tok != NULL;) {
-      DeleteForwardLinks(tok);
-      Token* next_tok = tok->next;
-      delete tok;
-      num_toks_--;
-      tok = next_tok;
-    }
-  }
+  // All the tokens and forward links alive are reclaimed at once by the
+  // pools, there is no need to visit them one by one.
+  KALDI_ASSERT(num_toks_ == token_pool_.Stats().num_live);
   active_toks_.clear();
-  KALDI_ASSERT(num_toks_ == 0);
+  token_pool_.Reset();
+  link_pool_.Reset();
+  num_toks_ = 0;
 }
 
 template <typename FST, typename Token>
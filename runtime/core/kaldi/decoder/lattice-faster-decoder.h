@@ -37,6 +37,7 @@
 #include "lat/determinize-lattice-pruned.h"
 #include "lat/kaldi-lattice.h"
 #include "util/hash-list.h"
+#include "util/object-pool.h"
 
 namespace kaldi {
 
@@ -274,7 +275,8 @@ class LatticeFasterDecoderTpl {
   // 'fst'.
   LatticeFasterDecoderTpl(
       const FST& fst, const LatticeFasterDecoderConfig& config,
-      const std::shared_ptr<wenet::ContextGraph>& context_graph = nullptr);
+      const std::shared_ptr<const wenet::ContextGraph>& context_graph =
+          nullptr);
 
   // This version of the constructor takes ownership of the fst, and will delete
   // it when this object is destroyed.
@@ -366,13 +368,19 @@ class LatticeFasterDecoderTpl {
   // whenever we call ProcessEmitting().
   inline int32 NumFramesDecoded() const { return active_toks_.size() - 1; }
 
+  /// Allocation statistics of the Token and ForwardLink pools.  Tokens and
+  /// links are allocated from per-decoder slabs which are reclaimed at once
+  /// by InitDecoding(), so the slabs are reused across utterances.
+  const ObjectPoolStats& TokenPoolStats() const { return token_pool_.Stats(); }
+  const ObjectPoolStats& LinkPoolStats() const { return link_pool_.Stats(); }
+
  protected:
   // we make things protected instead of private, as code in
   // LatticeFasterOnlineDecoderTpl, which inherits from this, also uses the
   // internals.
 
   // Deletes the elements of the singly linked list tok->links.
-  inline static void DeleteForwardLinks(Token* tok);
+  inline void DeleteForwardLinks(Token* tok);
 
   // head of per-frame list of Tokens (list is in topological order),
   // and something saying whether we ever pruned it using PruneForwardLinks.
@@ -503,6 +511,10 @@ class LatticeFasterDecoderTpl {
   int32 num_toks_;  // current total #toks allocated...
   bool warned_;
 
+  // All the Tokens and ForwardLinks are allocated from these pools
+  ObjectPool<Token> token_pool_;
+  ObjectPool<ForwardLinkT> link_pool_;
+
   /// decoding_finalized_ is true if someone called FinalizeDecoding().  [note,
   /// calling this is optional].  If true, it's forbidden to decode more.  Also,
   /// if this is set, then the output of ComputeFinalCosts() is in the next
@@ -517,7 +529,7 @@ class LatticeFasterDecoderTpl {
   BaseFloat final_relative_cost_;
   BaseFloat final_best_cost_;
 
-  std::shared_ptr<wenet::ContextGraph> context_graph_ = nullptr;
+  std::shared_ptr<const wenet::ContextGraph> context_graph_ = nullptr;
 
   // There are various cleanup tasks... the toks_ structure contains
   // singly linked lists of Token pointers, where Elem is the list type.
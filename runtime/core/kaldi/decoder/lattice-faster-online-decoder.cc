@@ -24,10 +24,12 @@
 // see note at the top of lattice-faster-decoder.cc, about how to maintain this
 // file in sync with lattice-faster-decoder.cc
 
+#include <algorithm>
 #include <limits>
 #include <queue>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "decoder/lattice-faster-online-decoder.h"
 
@@ -176,6 +178,62 @@ LatticeFasterOnlineDecoderTpl<FST>::TraceBackBestPath(BestPathIterator iter,
   return BestPathIterator(tok->backpointer, cur_t + step_t);
 }
 
+template <typename FST>
+void LatticeFasterOnlineDecoderTpl<FST>::TraceBackStable(
+    std::vector<LatticeArc>* stable_arcs, std::vector<LatticeArc>* tail_arcs,
+    BaseFloat* final_cost) {
+  stable_arcs->clear();
+  tail_arcs->clear();
+  BestPathIterator iter = BestPathEnd(true, final_cost);
+  // 1. Trace the best path back to the stable point, path_[0] is the best
+  // token and path_arcs_[i] is the arc into path_[i].  All the tokens on the
+  // last frame descend from the stable token, so does the best one.
+  path_.clear();
+  path_arcs_.clear();
+  while (!iter.Done() && iter.tok != stable_tok_) {
+    path_.push_back(static_cast<Token*>(iter.tok));
+    path_arcs_.emplace_back();
+    iter = TraceBackBestPath(iter, &path_arcs_.back());
+  }
+  int32 num_path = path_.size();
+  if (num_path == 0) return;
+
+  // 2. Walk back from every token on the last frame until meeting the best
+  // path, the oldest meeting point is the common ancestor of all of them.
+  // The tokens walked through are memorized with their meeting points, so
+  // each token after the stable point is visited at most once.
+  meet_.clear();
+  for (int32 i = 0; i < num_path; ++i) meet_[path_[i]] = i;
+  int32 stable_pos = 0;
+  for (Token* tok = this->active_toks_.back().toks; tok != NULL;
+       tok = tok->next) {
+    chain_.clear();
+    Token* t = tok;
+    int32 pos = num_path;  // the previous stable token
+    while (t != stable_tok_ && t != NULL) {
+      typename unordered_map<Token*, int32>::const_iterator it = meet_.find(t);
+      if (it != meet_.end()) {
+        pos = it->second;
+        break;
+      }
+      chain_.push_back(t);
+      t = t->backpointer;
+    }
+    for (size_t i = 0; i < chain_.size(); ++i) meet_[chain_[i]] = pos;
+    stable_pos = std::max(stable_pos, pos);
+    if (stable_pos == num_path) break;  // nothing new is stable
+  }
+
+  // 3. Output the arcs in time order and move the stable point
+  for (int32 i = num_path - 1; i >= stable_pos; --i) {
+    stable_arcs->push_back(path_arcs_[i]);
+  }
+  for (int32 i = stable_pos - 1; i >= 0; --i) {
+    tail_arcs->push_back(path_arcs_[i]);
+  }
+  if (stable_pos < num_path) stable_tok_ = path_[stable_pos];
+}
+
 template <typename FST>
 bool LatticeFasterOnlineDecoderTpl<FST>::GetRawLatticePruned(
     Lattice* ofst, bool use_final_probs, BaseFloat beam) const {
@@ -58,7 +58,7 @@ class LatticeFasterOnlineDecoderTpl
   // 'fst'.
   LatticeFasterOnlineDecoderTpl(
       const FST& fst, const LatticeFasterDecoderConfig& config,
-      const std::shared_ptr<wenet::ContextGraph>& context_graph)
+      const std::shared_ptr<const wenet::ContextGraph>& context_graph)
       : LatticeFasterDecoderTpl<FST, Token>(fst, config, context_graph) {}
 
   // This version of the initializer takes ownership of 'fst', and will delete
@@ -67,6 +67,13 @@ class LatticeFasterOnlineDecoderTpl
                                 FST* fst)
       : LatticeFasterDecoderTpl<FST, Token>(config, fst) {}
 
+  /// InitDecoding() of the base class which also resets the stable point of
+  /// TraceBackStable().
+  void InitDecoding() {
+    LatticeFasterDecoderTpl<FST, Token>::InitDecoding();
+    stable_tok_ = NULL;
+  }
+
   struct BestPathIterator {
     void* tok;
     int32 frame;
@@ -113,6 +120,21 @@ class LatticeFasterOnlineDecoderTpl
   BestPathIterator TraceBackBestPath(BestPathIterator iter,
                                      LatticeArc* arc) const;
 
+  /// Incremental version of GetBestPath() for the partial results.  The
+  /// stable point is the latest token which is an ancestor (through the
+  /// backpointers) of all the tokens on the last frame, every path that can
+  /// still win goes through it, so the best path up to it never changes.
+  /// The arcs of the best path from the previous stable point to the new one
+  /// are output to "stable_arcs", and the arcs from the new stable point to
+  /// the best token (using the final-probs) to "tail_arcs", both in time
+  /// order.  Only the tokens after the previous stable point are visited, so
+  /// the cost doesn't grow with the length of the utterance.  The final cost
+  /// of the best token is output to "final_cost" (if non-NULL).  The stable
+  /// point is reset by InitDecoding().
+  void TraceBackStable(std::vector<LatticeArc>* stable_arcs,
+                       std::vector<LatticeArc>* tail_arcs,
+                       BaseFloat* final_cost = NULL);
+
   /// Behaves the same as GetRawLattice but only processes tokens whose
   /// extra_cost is smaller than the best-cost plus the specified beam.
   /// It is only worthwhile to call this function if beam is less than
@@ -122,6 +144,15 @@ class LatticeFasterOnlineDecoderTpl
                            BaseFloat beam) const;
 
   KALDI_DISALLOW_COPY_AND_ASSIGN(LatticeFasterOnlineDecoderTpl);
+
+ private:
+  // The stable point of TraceBackStable(), NULL is before the start token
+  Token* stable_tok_ = NULL;
+  // Buffers of TraceBackStable(), they are reused across the calls
+  std::vector<Token*> path_;
+  std::vector<LatticeArc> path_arcs_;
+  std::vector<Token*> chain_;
+  unordered_map<Token*, int32> meet_;
 };
 
 typedef LatticeFasterOnlineDecoderTpl<fst::StdFst> LatticeFasterOnlineDecoder;
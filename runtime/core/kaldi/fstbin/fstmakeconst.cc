@@ -0,0 +1,74 @@
+// fstbin/fstmakeconst.cc
+
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#include "base/kaldi-common.h"
+#include "fst/fstlib.h"
+#include "fstext/kaldi-fst-io.h"
+#include "util/kaldi-io.h"
+#include "util/parse-options.h"
+
+// e.g.:
+// fstmakeconst TLG.fst TLG.const.fst
+// The output is a ConstFst whose states and arcs are aligned in the file, so
+// the decoder can mmap it instead of reading it, see --fst_mmap.
+
+int main(int argc, char* argv[]) {
+  try {
+    using namespace kaldi;  // NOLINT
+    using namespace fst;    // NOLINT
+
+    const char* usage =
+        "Converts an FST to an aligned ConstFst, which is immutable and can\n"
+        "be memory mapped by the decoder, so the graph is loaded instantly\n"
+        "and its pages are shared by all the processes on the host.\n"
+        "\n"
+        "Usage:  fstmakeconst [ in.fst [ out.fst ] ]\n"
+        "E.g:  fstmakeconst TLG.fst TLG.const.fst\n";
+
+    ParseOptions po(usage);
+    po.Read(argc, argv);
+
+    if (po.NumArgs() > 2) {
+      po.PrintUsage();
+      exit(1);
+    }
+
+    std::string fst_in_filename = po.GetOptArg(1),
+                fst_out_filename = po.GetOptArg(2);
+
+    Fst<StdArc>* fst = ReadFstKaldiGeneric(fst_in_filename);
+    ConstFst<StdArc> const_fst(*fst);
+    delete fst;
+
+    if (fst_out_filename == "") fst_out_filename = "-";
+    bool write_binary = true, write_header = false;
+    kaldi::Output ko(fst_out_filename, write_binary, write_header);
+    FstWriteOptions wopts(kaldi::PrintableWxfilename(fst_out_filename));
+    // The arrays must be aligned to be mapped
+    wopts.align = true;
+    if (!const_fst.Write(ko.Stream(), wopts)) {
+      KALDI_ERR << "Could not write fst to "
+                << kaldi::PrintableWxfilename(fst_out_filename);
+    }
+    return 0;
+  } catch (const std::exception& e) {
+    std::cerr << e.what();
+    return -1;
+  }
+}
@@ -0,0 +1,142 @@
+// util/object-pool.h
+
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+
+// See ../../COPYING for clarification regarding multiple authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+// THIS CODE IS PROVIDED *AS IS* BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, EITHER EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION ANY IMPLIED
+// WARRANTIES OR CONDITIONS OF TITLE, FITNESS FOR A PARTICULAR PURPOSE,
+// MERCHANTABLITY OR NON-INFRINGEMENT.
+// See the Apache 2 License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KALDI_UTIL_OBJECT_POOL_H_
+#define KALDI_UTIL_OBJECT_POOL_H_
+
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "base/kaldi-common.h"
+
+namespace kaldi {
+
+/// Allocation statistics of an ObjectPool.
+struct ObjectPoolStats {
+  size_t num_live = 0;         // objects currently allocated
+  size_t peak_live = 0;        // maximum of num_live since construction
+  size_t num_allocations = 0;  // calls of New() since construction
+  size_t num_slabs = 0;        // slabs owned by the pool
+  size_t bytes = 0;            // memory owned by the pool
+
+  ObjectPoolStats& operator+=(const ObjectPoolStats& other) {
+    num_live += other.num_live;
+    peak_live += other.peak_live;
+    num_allocations += other.num_allocations;
+    num_slabs += other.num_slabs;
+    bytes += other.bytes;
+    return *this;
+  }
+};
+
+/* ObjectPool is a slab allocator of objects of one type, used by the decoders
+   for their Tokens and ForwardLinks, which are created and destroyed millions
+   of times per utterance.  Objects are carved out of slabs of
+   'objects_per_slab' objects, and deleted objects go to an intrusive free list
+   and are reused first.  Reset() reclaims all the objects at once without
+   visiting them, and keeps the slabs for the next utterance, so a long-lived
+   decoder stops calling the general purpose allocator entirely.
+
+   T must be trivially destructible, since Reset() doesn't call destructors.
+   The pool is not thread safe; each decoder owns its own pools.
+*/
+template <class T>
+class ObjectPool {
+ public:
+  static_assert(std::is_trivially_destructible<T>::value,
+                "ObjectPool requires trivially destructible objects");
+
+  explicit ObjectPool(size_t objects_per_slab = 1024)
+      : objects_per_slab_(objects_per_slab) {
+    KALDI_ASSERT(objects_per_slab_ > 0);
+  }
+
+  template <class... Args>
+  inline T* New(Args&&... args) {
+    void* storage;
+    if (free_list_ != NULL) {
+      storage = free_list_;
+      free_list_ = free_list_->next;
+    } else {
+      if (slab_pos_ == objects_per_slab_) NextSlab();
+      storage = slabs_[cur_slab_].get() + slab_pos_++;
+    }
+    ++stats_.num_allocations;
+    if (++stats_.num_live > stats_.peak_live) {
+      stats_.peak_live = stats_.num_live;
+    }
+    return new (storage) T(std::forward<Args>(args)...);
+  }
+
+  inline void Delete(T* object) {
+    // T is trivially destructible, so there is no destructor to call
+    Slot* slot = reinterpret_cast<Slot*>(object);
+    slot->next = free_list_;
+    free_list_ = slot;
+    --stats_.num_live;
+  }
+
+  /// Reclaims all the objects, the pointers returned by New() are invalid
+  /// after this.  The memory is kept for reuse.
+  void Reset() {
+    free_list_ = NULL;
+    cur_slab_ = 0;
+    slab_pos_ = slabs_.empty() ? objects_per_slab_ : 0;
+    stats_.num_live = 0;
+  }
+
+  const ObjectPoolStats& Stats() const { return stats_; }
+
+ private:
+  union Slot {
+    Slot* next;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+
+  void NextSlab() {
+    if (!slabs_.empty() && cur_slab_ + 1 < slabs_.size()) {
+      // Reuse a slab kept by Reset()
+      ++cur_slab_;
+    } else {
+      slabs_.emplace_back(new Slot[objects_per_slab_]);
+      cur_slab_ = slabs_.size() - 1;
+      stats_.num_slabs = slabs_.size();
+      stats_.bytes = slabs_.size() * objects_per_slab_ * sizeof(Slot);
+    }
+    slab_pos_ = 0;
+  }
+
+  size_t objects_per_slab_;
+  std::vector<std::unique_ptr<Slot[]> > slabs_;
+  // The next object is slabs_[cur_slab_][slab_pos_] when free_list_ is empty
+  size_t cur_slab_ = 0;
+  size_t slab_pos_ = objects_per_slab_;
+  Slot* free_list_ = NULL;
+  ObjectPoolStats stats_;
+
+  KALDI_DISALLOW_COPY_AND_ASSIGN(ObjectPool);
+};
+
+}  // namespace kaldi
+
+#endif  // KALDI_UTIL_OBJECT_POOL_H_
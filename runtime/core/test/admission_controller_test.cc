@@ -0,0 +1,137 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/admission_controller.h"
+
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using Ticket = wenet::AdmissionController::Ticket;
+
+// Let the current window end
+void WaitWindow(const wenet::AdmissionOptions& opts) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(2 * opts.window_ms));
+}
+
+}  // namespace
+
+TEST(AdmissionControllerTest, MaxSessionsTest) {
+  wenet::AdmissionOptions opts;
+  opts.max_sessions = 2;
+  wenet::AdmissionController controller(opts, wenet::DecodeOptions());
+  std::unique_ptr<Ticket> first = controller.Admit();
+  std::unique_ptr<Ticket> second = controller.Admit();
+  ASSERT_NE(first, nullptr);
+  ASSERT_NE(second, nullptr);
+  EXPECT_FALSE(first->degraded());
+  EXPECT_EQ(controller.num_sessions(), 2);
+  EXPECT_EQ(controller.Admit(), nullptr);
+  // The slot is back when a session goes away
+  second.reset();
+  EXPECT_EQ(controller.num_sessions(), 1);
+  EXPECT_NE(controller.Admit(), nullptr);
+}
+
+TEST(AdmissionControllerTest, LoadTest) {
+  wenet::AdmissionOptions opts;
+  opts.num_threads = 1;
+  opts.window_ms = 10;
+  opts.ewma_alpha = 1.0;
+  opts.max_load = 1.0;
+  wenet::AdmissionController controller(opts, wenet::DecodeOptions());
+  // 400ms of compute for 4s of audio, in a window of about 20ms
+  controller.ObserveChunk(400000, 4000, 0);
+  WaitWindow(opts);
+  EXPECT_EQ(controller.Admit(), nullptr);
+  EXPECT_GT(controller.load(), 1.0);
+  EXPECT_NEAR(controller.rtf(), 0.1, 1e-6);
+  // The load decays when nothing is decoded
+  WaitWindow(opts);
+  EXPECT_NE(controller.Admit(), nullptr);
+  EXPECT_EQ(controller.load(), 0.0);
+}
+
+TEST(AdmissionControllerTest, BacklogTest) {
+  wenet::AdmissionOptions opts;
+  opts.window_ms = 10;
+  opts.ewma_alpha = 1.0;
+  opts.max_backlog_ms = 100;
+  wenet::AdmissionController controller(opts, wenet::DecodeOptions());
+  controller.ObserveChunk(0, 100, 400);
+  controller.ObserveChunk(0, 100, 200);
+  WaitWindow(opts);
+  EXPECT_EQ(controller.Admit(), nullptr);
+  EXPECT_EQ(controller.backlog_ms(), 300);
+}
+
+TEST(AdmissionControllerTest, DegradeTest) {
+  wenet::AdmissionOptions opts;
+  opts.num_threads = 1;
+  opts.window_ms = 10;
+  opts.ewma_alpha = 1.0;
+  opts.degrade_load = 0.5;
+  opts.degrade_chunk_size = true;
+  wenet::DecodeOptions decode_opts;
+  decode_opts.chunk_size = 16;
+  decode_opts.num_left_chunks = 4;
+  auto resource = std::make_shared<wenet::DecodeResource>();
+  resource->admission_controller =
+      std::make_shared<wenet::AdmissionController>(opts, decode_opts);
+  auto normal_opts = std::make_shared<wenet::DecodeOptions>(decode_opts);
+  std::unique_ptr<Ticket> ticket;
+  std::shared_ptr<wenet::DecodeOptions> session_opts = normal_opts;
+  ASSERT_TRUE(wenet::AdmitSession(*resource, &ticket, &session_opts));
+  EXPECT_FALSE(ticket->degraded());
+  EXPECT_EQ(session_opts, normal_opts);
+
+  resource->admission_controller->ObserveChunk(400000, 4000, 0);
+  WaitWindow(opts);
+  std::unique_ptr<Ticket> degraded_ticket;
+  ASSERT_TRUE(wenet::AdmitSession(*resource, &degraded_ticket, &session_opts));
+  EXPECT_TRUE(degraded_ticket->degraded());
+  EXPECT_EQ(session_opts->chunk_size, 32);
+  EXPECT_EQ(session_opts->num_left_chunks, 2);
+  EXPECT_EQ(session_opts->ctc_prefix_search_opts.first_beam_size,
+            decode_opts.ctc_prefix_search_opts.first_beam_size / 2);
+  EXPECT_EQ(session_opts->rescoring_weight, 0.0);
+}
+
+TEST(AdmissionControllerTest, FixedChunkSizeTest) {
+  wenet::DecodeOptions decode_opts;
+  decode_opts.chunk_size = 16;
+  decode_opts.num_left_chunks = 4;
+  // The chunk shapes of e.g. an ONNX model are fixed at export
+  wenet::DecodeOptions degraded =
+      wenet::DegradeDecodeOptions(decode_opts, false);
+  EXPECT_EQ(degraded.chunk_size, 16);
+  EXPECT_EQ(degraded.num_left_chunks, 4);
+  EXPECT_EQ(degraded.ctc_prefix_search_opts.first_beam_size,
+            decode_opts.ctc_prefix_search_opts.first_beam_size / 2);
+  EXPECT_EQ(degraded.rescoring_weight, 0.0);
+}
+
+TEST(AdmissionControllerTest, NoControllerTest) {
+  wenet::DecodeResource resource;
+  std::unique_ptr<Ticket> ticket;
+  auto opts = std::make_shared<wenet::DecodeOptions>();
+  auto session_opts = opts;
+  EXPECT_TRUE(wenet::AdmitSession(resource, &ticket, &session_opts));
+  EXPECT_EQ(ticket, nullptr);
+  EXPECT_EQ(session_opts, opts);
+}
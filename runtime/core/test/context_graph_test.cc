@@ -0,0 +1,239 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/context_graph.h"
+
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "decoder/context_graph_cache.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+// Units 1 to 5 are the characters of "一二三四五"
+std::shared_ptr<fst::SymbolTable> UnitTable() {
+  auto unit_table = std::make_shared<fst::SymbolTable>();
+  unit_table->AddSymbol("<blank>", 0);
+  std::vector<std::string> units = {"一", "二", "三", "四", "五"};
+  for (size_t i = 0; i < units.size(); ++i) {
+    unit_table->AddSymbol(units[i], i + 1);
+  }
+  return unit_table;
+}
+
+std::shared_ptr<wenet::ContextGraph> BuildGraph(
+    const std::vector<std::string>& contexts,
+    std::shared_ptr<const wenet::ContextGraph> base = nullptr) {
+  wenet::ContextConfig config;
+  config.context_score = 3.0;
+  auto graph = std::make_shared<wenet::ContextGraph>(config);
+  graph->BuildContextGraph(contexts, UnitTable(), base);
+  return graph;
+}
+
+// Walk the units from the start state, return the final state
+int Walk(const wenet::ContextGraph& graph, const std::vector<int>& units,
+         float* score, std::unordered_set<std::string>* contexts = nullptr) {
+  int state = 0;
+  for (int unit : units) {
+    state = graph.GetNextState(state, unit, score, contexts);
+  }
+  return state;
+}
+
+}  // namespace
+
+TEST(ContextGraphTest, MatchTest) {
+  auto graph = BuildGraph({"一二三", "二四"});
+  float score = 0;
+  std::unordered_set<std::string> contexts;
+  // A full match goes back to the start state and keeps the score
+  EXPECT_EQ(Walk(*graph, {1, 2, 3}, &score, &contexts), 0);
+  EXPECT_FLOAT_EQ(score, 9);
+  EXPECT_EQ(contexts, std::unordered_set<std::string>({"一二三"}));
+
+  // "一二" falls back to its suffix "二", the score of "一" is backed off
+  score = 0;
+  contexts.clear();
+  EXPECT_EQ(Walk(*graph, {1, 2, 4}, &score, &contexts), 0);
+  EXPECT_FLOAT_EQ(score, 6);
+  EXPECT_EQ(contexts, std::unordered_set<std::string>({"二四"}));
+
+  // Units out of the graph
+  score = 0;
+  EXPECT_EQ(Walk(*graph, {5, 4}, &score), 0);
+  EXPECT_FLOAT_EQ(score, 0);
+
+  // The partial match is backed off at the end
+  score = 0;
+  int state = Walk(*graph, {1, 2}, &score);
+  EXPECT_GT(state, 0);
+  EXPECT_FALSE(graph->IsFinalState(state));
+  EXPECT_FLOAT_EQ(score, 6);
+  EXPECT_EQ(graph->GetNextState(state, -1, &score), 0);
+  EXPECT_FLOAT_EQ(score, 0);
+}
+
+TEST(ContextGraphTest, OutputTest) {
+  // "二" is a suffix of "一二" and a prefix of "二三"
+  auto graph = BuildGraph({"一二", "二", "二三"});
+  float score = 0;
+  std::unordered_set<std::string> contexts;
+  EXPECT_EQ(Walk(*graph, {1, 2}, &score, &contexts), 0);
+  EXPECT_EQ(contexts, std::unordered_set<std::string>({"一二", "二"}));
+  // A full match which can be extended stays
+  int state = Walk(*graph, {2}, &score);
+  EXPECT_TRUE(graph->IsFinalState(state));
+  EXPECT_GT(graph->NumStates(), state);
+}
+
+TEST(ContextGraphTest, ReadWriteTest) {
+  auto graph = BuildGraph({"一二三", "二四", "三三五"});
+  std::string path = testing::TempDir() + "context_graph_test.bin";
+  ASSERT_TRUE(graph->Write(path));
+  for (bool mmap : {true, false}) {
+    auto read_graph = wenet::ContextGraph::Read(path, mmap);
+    ASSERT_NE(read_graph, nullptr);
+    EXPECT_EQ(read_graph->NumStates(), graph->NumStates());
+    EXPECT_FLOAT_EQ(read_graph->config().context_score, 3.0);
+    std::vector<int> units = {3, 3, 5, 1, 2, 4, 1, 2, 3, 3};
+    float score = 0, read_score = 0;
+    std::unordered_set<std::string> contexts, read_contexts;
+    EXPECT_EQ(Walk(*read_graph, units, &read_score, &read_contexts),
+              Walk(*graph, units, &score, &contexts));
+    EXPECT_FLOAT_EQ(read_score, score);
+    EXPECT_EQ(read_contexts, contexts);
+  }
+}
+
+TEST(ContextGraphTest, OverlayTest) {
+  auto base = BuildGraph({"一二三", "二四"});
+  // "一二三" is in the base, it is not boosted twice
+  auto overlay = BuildGraph({"四五", "一二三"}, base);
+  EXPECT_EQ(overlay->NumStates(), base->NumStates() * 3);
+
+  float score = 0;
+  std::unordered_set<std::string> contexts;
+  EXPECT_EQ(Walk(*overlay, {1, 2, 3}, &score, &contexts), 0);
+  EXPECT_FLOAT_EQ(score, 9);
+  EXPECT_EQ(Walk(*overlay, {4, 5}, &score, &contexts), 0);
+  EXPECT_FLOAT_EQ(score, 15);
+  EXPECT_EQ(contexts, std::unordered_set<std::string>({"一二三", "四五"}));
+
+  // Partial matches of both graphs
+  score = 0;
+  int state = Walk(*overlay, {2, 4, 1, 2}, &score);
+  EXPECT_FLOAT_EQ(score, 12);
+  EXPECT_FALSE(overlay->IsFinalState(state));
+  overlay->GetNextState(state, -1, &score);
+  EXPECT_FLOAT_EQ(score, 6);
+}
+
+TEST(ContextGraphTest, OverlayOverflowTest) {
+  // All the 5^7 phrases of 7 units, about 10^5 states
+  std::vector<std::string> units = {"一", "二", "三", "四", "五"};
+  std::vector<std::string> phrases(1);
+  for (int i = 0; i < 7; ++i) {
+    std::vector<std::string> longer;
+    for (const auto& phrase : phrases) {
+      for (const auto& unit : units) longer.push_back(phrase + unit);
+    }
+    phrases.swap(longer);
+  }
+  auto base = BuildGraph(phrases);
+  // The pairs of the states must fit in int, the hotwords are not dropped
+  std::vector<std::string> hotwords;
+  for (int i = 0; i < 3000; ++i) hotwords.push_back(phrases[i] + "五");
+  wenet::ContextGraph overlay(wenet::ContextConfig{});
+  EXPECT_FALSE(overlay.BuildContextGraph(hotwords, UnitTable(), base));
+  hotwords.resize(100);
+  EXPECT_TRUE(overlay.BuildContextGraph(hotwords, UnitTable(), base));
+}
+
+TEST(UnitTrieTest, LongestMatchTest) {
+  fst::SymbolTable unit_table;
+  std::vector<std::string> units = {"<blank>", "一", "二", "一二", "三",
+                                    "一二三四"};
+  for (size_t i = 0; i < units.size(); ++i) {
+    unit_table.AddSymbol(units[i], i);
+  }
+  wenet::UnitTrie unit_trie(unit_table);
+  std::vector<int> ids;
+  EXPECT_TRUE(unit_trie.Split("一二三 一二一", &ids));
+  EXPECT_EQ(ids, std::vector<int>({3, 4, 3, 1}));
+  ids.clear();
+  // "一二三四" is not a match of "一二三五", and 五 is oov
+  EXPECT_FALSE(unit_trie.Split("一二三五", &ids));
+  EXPECT_EQ(ids, std::vector<int>({3, 4}));
+}
+
+TEST(UnitTrieTest, BpeTest) {
+  fst::SymbolTable unit_table;
+  std::vector<std::string> units = {"<blank>", "<unk>", "▁", "▁HE", "LLO",
+                                    "▁WORLD", "W", "OR", "LD", "你"};
+  for (size_t i = 0; i < units.size(); ++i) {
+    unit_table.AddSymbol(units[i], i);
+  }
+  wenet::UnitTrie unit_trie(unit_table);
+  std::vector<int> ids;
+  // The units are upper case, so are the letters of the phrase
+  EXPECT_TRUE(unit_trie.Split("hello World", &ids));
+  EXPECT_EQ(ids, std::vector<int>({3, 4, 5}));
+  ids.clear();
+  // No '▁' in the middle of the words, and '▁' is separate if no unit
+  // starts with '▁' and the word
+  EXPECT_TRUE(unit_trie.Split("WORLD 你WORLD LLO", &ids));
+  EXPECT_EQ(ids, std::vector<int>({5, 9, 6, 7, 8, 2, 4}));
+}
+
+TEST(ContextGraphCacheTest, LruTest) {
+  wenet::UnitTrie unit_trie(*UnitTable());
+  wenet::ContextConfig config;
+  std::vector<std::string> a = {"一二"}, b = {"三四"}, c = {"二五"};
+  // Room for any two of the three graphs
+  size_t max_bytes = BuildGraph(a)->image_size() +
+                     BuildGraph(b)->image_size() +
+                     BuildGraph(c)->image_size() - 1;
+  wenet::ContextGraphCache cache(max_bytes);
+  std::string key_a, key_b;
+  auto graph_a = cache.Get(a, config, unit_trie, nullptr, &key_a);
+  EXPECT_EQ(cache.Get(a, config, unit_trie), graph_a);
+  EXPECT_EQ(cache.Find(key_a), graph_a);
+  cache.Get(b, config, unit_trie, nullptr, &key_b);
+  EXPECT_NE(key_a, key_b);
+  // a is used more recently than b, so b is evicted by c
+  cache.Find(key_a);
+  cache.Get(c, config, unit_trie);
+  EXPECT_EQ(cache.Size(), 2);
+  EXPECT_LE(cache.Bytes(), max_bytes);
+  EXPECT_EQ(cache.Find(key_b), nullptr);
+  EXPECT_EQ(cache.Find(key_a), graph_a);
+  // The scores are part of the key
+  config.context_score = 1.0;
+  EXPECT_NE(cache.Get(a, config, unit_trie), graph_a);
+}
+
+TEST(ContextGraphTest, ContextLimitsTest) {
+  wenet::ContextConfig config;
+  config.max_contexts = 2;
+  config.max_context_length = 3;
+  EXPECT_TRUE(wenet::CheckContextLimits({"一二三", "四五"}, config).empty());
+  EXPECT_FALSE(
+      wenet::CheckContextLimits({"一", "二", "三"}, config).empty());
+  // The length is in characters rather than bytes
+  EXPECT_FALSE(wenet::CheckContextLimits({"一二三四"}, config).empty());
+}
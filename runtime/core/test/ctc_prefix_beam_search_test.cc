@@ -14,12 +14,20 @@
 
 #include "decoder/ctc_prefix_beam_search.h"
 
+#include <algorithm>
 #include <cmath>
+#include <map>
+#include <memory>
+#include <random>
+#include <utility>
 #include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
+#include "decoder/batch_ctc_prefix_beam_search.h"
+#include "decoder/ctc_frame_summary.h"
+#include "utils/thread_pool.h"
 #include "utils/utils.h"
 
 TEST(CtcPrefixBeamSearchTest, CtcPrefixBeamSearchLogicTest) {
@@ -71,3 +79,267 @@ TEST(CtcPrefixBeamSearchTest, CtcPrefixBeamSearchLogicTest) {
   ASSERT_THAT(times[1], ElementsAre(0, 2));
   ASSERT_THAT(times[2], ElementsAre(2));
 }
+
+namespace {
+
+// The straightforward prefix beam search, which keys the hypotheses by the
+// whole prefix, it's the reference of the randomized test.
+struct NaiveScore {
+  float s = -wenet::kFloatMax;
+  float ns = -wenet::kFloatMax;
+  float v_s = -wenet::kFloatMax;
+  float v_ns = -wenet::kFloatMax;
+  float cur_token_prob = -wenet::kFloatMax;
+  std::vector<int> times_s;
+  std::vector<int> times_ns;
+
+  float score() const { return wenet::LogAdd(s, ns); }
+  float viterbi_score() const { return v_s > v_ns ? v_s : v_ns; }
+  const std::vector<int>& times() const {
+    return v_s > v_ns ? times_s : times_ns;
+  }
+};
+
+using NaiveHyp = std::pair<std::vector<int>, NaiveScore>;
+
+std::vector<NaiveHyp> NaiveSearch(
+    const std::vector<std::vector<float>>& logp,
+    const wenet::CtcPrefixBeamSearchOptions& opts) {
+  NaiveScore init;
+  init.s = 0.0;
+  init.v_s = 0.0;
+  init.v_ns = 0.0;
+  std::vector<NaiveHyp> cur_hyps = {{{}, init}};
+  for (int t = 0; t < logp.size(); ++t) {
+    std::vector<float> topk_score;
+    std::vector<int32_t> topk_index;
+    wenet::TopK(logp[t], opts.first_beam_size, &topk_score, &topk_index);
+    std::map<std::vector<int>, NaiveScore> next_hyps;
+    for (int i = 0; i < topk_index.size(); ++i) {
+      int id = topk_index[i];
+      float prob = topk_score[i];
+      for (const auto& it : cur_hyps) {
+        const std::vector<int>& prefix = it.first;
+        const NaiveScore& score = it.second;
+        if (id == opts.blank) {
+          NaiveScore& next = next_hyps[prefix];
+          next.s = wenet::LogAdd(next.s, score.score() + prob);
+          next.v_s = score.viterbi_score() + prob;
+          next.times_s = score.times();
+        } else if (!prefix.empty() && id == prefix.back()) {
+          NaiveScore& next1 = next_hyps[prefix];
+          next1.ns = wenet::LogAdd(next1.ns, score.ns + prob);
+          if (next1.v_ns < score.v_ns + prob) {
+            next1.v_ns = score.v_ns + prob;
+            if (next1.cur_token_prob < prob) {
+              next1.cur_token_prob = prob;
+              next1.times_ns = score.times_ns;
+              next1.times_ns.back() = t;
+            }
+          }
+          std::vector<int> new_prefix(prefix);
+          new_prefix.push_back(id);
+          NaiveScore& next2 = next_hyps[new_prefix];
+          next2.ns = wenet::LogAdd(next2.ns, score.s + prob);
+          if (next2.v_ns < score.v_s + prob) {
+            next2.v_ns = score.v_s + prob;
+            next2.cur_token_prob = prob;
+            next2.times_ns = score.times_s;
+            next2.times_ns.push_back(t);
+          }
+        } else {
+          std::vector<int> new_prefix(prefix);
+          new_prefix.push_back(id);
+          NaiveScore& next = next_hyps[new_prefix];
+          next.ns = wenet::LogAdd(next.ns, score.score() + prob);
+          if (next.v_ns < score.viterbi_score() + prob) {
+            next.v_ns = score.viterbi_score() + prob;
+            next.cur_token_prob = prob;
+            next.times_ns = score.times();
+            next.times_ns.push_back(t);
+          }
+        }
+      }
+    }
+    cur_hyps.assign(next_hyps.begin(), next_hyps.end());
+    std::sort(cur_hyps.begin(), cur_hyps.end(),
+              [](const NaiveHyp& a, const NaiveHyp& b) {
+                return a.second.score() > b.second.score();
+              });
+    if (cur_hyps.size() > opts.second_beam_size) {
+      cur_hyps.resize(opts.second_beam_size);
+    }
+  }
+  return cur_hyps;
+}
+
+}  // namespace
+
+TEST(CtcPrefixBeamSearchTest, RandomizedTest) {
+  using ::testing::ElementsAreArray;
+  const int vocab_size = 8;
+  const int num_frames = 3000;
+  std::default_random_engine generator(7);
+  std::uniform_real_distribution<float> distribution(0.0, 1.0);
+  std::vector<std::vector<float>> logp(num_frames,
+                                       std::vector<float>(vocab_size));
+  for (auto& frame : logp) {
+    // Peaky distributions like real CTC outputs
+    float sum = 0;
+    for (auto& p : frame) {
+      p = std::pow(distribution(generator), 4);
+      sum += p;
+    }
+    for (auto& p : frame) p = std::log(p / sum);
+  }
+
+  wenet::CtcPrefixBeamSearchOptions option;
+  option.first_beam_size = 4;
+  option.second_beam_size = 6;
+  wenet::CtcPrefixBeamSearch prefix_beam_search(option);
+  // Search chunk by chunk like the streaming decoding
+  const int chunk_size = 16;
+  std::vector<int> stable;
+  for (int t = 0; t < num_frames; t += chunk_size) {
+    std::vector<std::vector<float>> chunk(
+        logp.begin() + t, logp.begin() + std::min(t + chunk_size, num_frames));
+    prefix_beam_search.Search(chunk);
+    // The stable prefix only grows
+    const std::vector<int>& best = prefix_beam_search.Outputs()[0];
+    int num_stable = prefix_beam_search.NumStableOutputs();
+    ASSERT_GE(num_stable, static_cast<int>(stable.size()));
+    ASSERT_TRUE(std::equal(stable.begin(), stable.end(), best.begin()));
+    stable.assign(best.begin(), best.begin() + num_stable);
+  }
+  EXPECT_GT(stable.size(), 0);
+  for (const auto& output : prefix_beam_search.Outputs()) {
+    ASSERT_GE(output.size(), stable.size());
+    ASSERT_TRUE(std::equal(stable.begin(), stable.end(), output.begin()));
+  }
+
+  std::vector<NaiveHyp> expected = NaiveSearch(logp, option);
+  const auto& outputs = prefix_beam_search.Outputs();
+  const auto& likelihood = prefix_beam_search.Likelihood();
+  const auto& viterbi_likelihood = prefix_beam_search.viterbi_likelihood();
+  const auto& times = prefix_beam_search.Times();
+  ASSERT_EQ(outputs.size(), expected.size());
+  // The order of the hypotheses with the same score is undefined
+  std::map<std::vector<int>, NaiveScore> expected_scores(expected.begin(),
+                                                         expected.end());
+  for (int i = 0; i < outputs.size(); ++i) {
+    auto it = expected_scores.find(outputs[i]);
+    ASSERT_TRUE(it != expected_scores.end());
+    EXPECT_FLOAT_EQ(likelihood[i], it->second.score());
+    EXPECT_FLOAT_EQ(viterbi_likelihood[i], it->second.viterbi_score());
+    ASSERT_THAT(times[i], ElementsAreArray(it->second.times()));
+    if (i > 0) EXPECT_GE(likelihood[i - 1], likelihood[i]);
+  }
+}
+
+TEST(CtcPrefixBeamSearchTest, BatchSearchTest) {
+  const int batch_size = 5;
+  const int max_len = 200;
+  const int vocab_size = 10;
+  const std::vector<int> lengths = {200, 37, 0, 150, 1};
+  std::default_random_engine generator(11);
+  std::uniform_real_distribution<float> distribution(0.0, 1.0);
+  // Padded frames are garbage, they must be ignored
+  std::vector<float> logp(batch_size * max_len * vocab_size);
+  for (auto& p : logp) p = std::log(distribution(generator));
+
+  wenet::CtcPrefixBeamSearchOptions option;
+  option.first_beam_size = 4;
+  option.second_beam_size = 6;
+  ThreadPool pool(3);
+  wenet::BatchCtcPrefixBeamSearch batch_search(option, &pool);
+  // Search twice to check the searchers are reset between the batches
+  for (int i = 0; i < 2; ++i) {
+    batch_search.Search(logp.data(), batch_size, max_len, vocab_size,
+                        lengths);
+  }
+  ASSERT_EQ(batch_search.batch_size(), batch_size);
+
+  for (int b = 0; b < batch_size; ++b) {
+    std::vector<std::vector<float>> utt(lengths[b]);
+    for (int t = 0; t < lengths[b]; ++t) {
+      const float* row = logp.data() + (b * max_len + t) * vocab_size;
+      utt[t].assign(row, row + vocab_size);
+    }
+    wenet::CtcPrefixBeamSearch prefix_beam_search(option);
+    prefix_beam_search.Search(utt);
+    prefix_beam_search.FinalizeSearch();
+    const wenet::CtcPrefixBeamSearch& result = batch_search.Result(b);
+    EXPECT_EQ(result.Outputs(), prefix_beam_search.Outputs());
+    EXPECT_EQ(result.Likelihood(), prefix_beam_search.Likelihood());
+    EXPECT_EQ(result.Times(), prefix_beam_search.Times());
+  }
+}
+
+TEST(CtcPrefixBeamSearchTest, BatchSearchExternalSearchersTest) {
+  const int batch_size = 3;
+  const int max_len = 50;
+  const int vocab_size = 10;
+  const std::vector<int> lengths = {50, 20, 0};
+  std::default_random_engine generator(17);
+  std::uniform_real_distribution<float> distribution(0.0, 1.0);
+  std::vector<float> logp(batch_size * max_len * vocab_size);
+  for (auto& p : logp) p = std::log(distribution(generator));
+
+  wenet::CtcPrefixBeamSearchOptions option;
+  option.first_beam_size = 4;
+  option.second_beam_size = 6;
+  wenet::BatchCtcPrefixBeamSearch batch_search(option);
+  batch_search.Search(logp.data(), batch_size, max_len, vocab_size, lengths);
+  // The searchers of the decoders, they are finalized by their owners
+  std::vector<std::unique_ptr<wenet::CtcPrefixBeamSearch>> owned;
+  std::vector<wenet::CtcPrefixBeamSearch*> searchers;
+  for (int b = 0; b < batch_size; ++b) {
+    owned.emplace_back(new wenet::CtcPrefixBeamSearch(option));
+    searchers.push_back(owned.back().get());
+  }
+  batch_search.Search(logp.data(), batch_size, max_len, vocab_size, lengths,
+                      searchers);
+  for (int b = 0; b < batch_size; ++b) {
+    searchers[b]->FinalizeSearch();
+    EXPECT_EQ(searchers[b]->Outputs(), batch_search.Result(b).Outputs());
+    EXPECT_EQ(searchers[b]->Likelihood(),
+              batch_search.Result(b).Likelihood());
+  }
+}
+
+TEST(CtcPrefixBeamSearchTest, SummarySearchTest) {
+  const int num_frames = 300;
+  const int vocab_size = 10;
+  std::default_random_engine generator(13);
+  std::uniform_real_distribution<float> distribution(0.0, 1.0);
+  std::vector<std::vector<float>> logp(num_frames,
+                                       std::vector<float>(vocab_size));
+  for (auto& frame : logp) {
+    for (auto& p : frame) p = std::log(distribution(generator));
+  }
+
+  wenet::CtcPrefixBeamSearchOptions option;
+  option.first_beam_size = 4;
+  option.second_beam_size = 6;
+  wenet::CtcPrefixBeamSearch expected(option);
+  expected.Search(logp);
+  // The summaries may keep the same or more candidates than the search uses
+  for (int k : {option.first_beam_size, vocab_size}) {
+    std::vector<std::vector<float>> chunk(logp);
+    wenet::CtcFrameSummaries summaries;
+    wenet::SummarizeCtcFrames(0, 0, k, &chunk, &summaries);
+    ASSERT_EQ(summaries.num_frames, num_frames);
+    ASSERT_EQ(summaries.k, k);
+    for (int t = 0; t < num_frames; ++t) {
+      EXPECT_EQ(summaries.blank_score[t], logp[t][0]);
+      EXPECT_EQ(summaries.Argmax(t),
+                std::max_element(logp[t].begin(), logp[t].end()) -
+                    logp[t].begin());
+    }
+    wenet::CtcPrefixBeamSearch prefix_beam_search(option);
+    prefix_beam_search.Search(chunk, summaries);
+    EXPECT_EQ(prefix_beam_search.Outputs(), expected.Outputs());
+    EXPECT_EQ(prefix_beam_search.Likelihood(), expected.Likelihood());
+    EXPECT_EQ(prefix_beam_search.Times(), expected.Times());
+  }
+}
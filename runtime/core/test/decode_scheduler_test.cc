@@ -0,0 +1,124 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/decode_scheduler.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using StepState = wenet::DecodeScheduler::StepState;
+
+// A session of `num_chunks` chunks, the chunks are fed by Feed() and each
+// step decodes one of them
+struct FakeSession {
+  std::atomic<int> num_fed{0};
+  std::atomic<int> num_decoded{0};
+  std::atomic<bool> running{false};
+  std::atomic<bool> concurrent{false};
+  int num_chunks = 0;
+  std::shared_ptr<wenet::DecodeScheduler::Session> session;
+
+  StepState Step() {
+    if (running.exchange(true)) concurrent = true;
+    if (num_decoded < num_fed) ++num_decoded;
+    running = false;
+    if (num_decoded == num_chunks) return StepState::kDone;
+    return num_decoded < num_fed ? StepState::kMore : StepState::kWait;
+  }
+  bool Ready() const { return num_decoded < num_fed; }
+};
+
+TEST(DecodeSchedulerTest, ManySessionsTest) {
+  wenet::DecodeScheduler scheduler({4, false});
+  std::vector<std::unique_ptr<FakeSession>> sessions(200);
+  for (auto& s : sessions) {
+    s.reset(new FakeSession);
+    s->num_chunks = 50;
+    FakeSession* fake = s.get();
+    s->session = scheduler.AddSession([fake]() { return fake->Step(); },
+                                      [fake]() { return fake->Ready(); });
+  }
+  // Two feeding threads like the io threads, each session is fed by one
+  std::vector<std::thread> feeders;
+  for (int t = 0; t < 2; ++t) {
+    feeders.emplace_back([&sessions, &scheduler, t]() {
+      for (int chunk = 0; chunk < 50; ++chunk) {
+        for (size_t i = t; i < sessions.size(); i += 2) {
+          ++sessions[i]->num_fed;
+          scheduler.Notify(sessions[i]->session);
+        }
+      }
+    });
+  }
+  for (auto& feeder : feeders) feeder.join();
+  for (auto& s : sessions) {
+    for (int i = 0; i < 10000 && s->num_decoded < s->num_chunks; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(s->num_decoded, s->num_chunks);
+    ASSERT_FALSE(s->concurrent);
+  }
+}
+
+TEST(DecodeSchedulerTest, EarliestFirstTest) {
+  wenet::DecodeScheduler scheduler({1, false});
+  std::mutex mutex;
+  std::vector<int> order;
+  // Hold the only worker, so the others are queued meanwhile
+  std::atomic<bool> hold{true};
+  auto blocker = scheduler.AddSession(
+      [&hold]() {
+        while (hold) std::this_thread::yield();
+        return StepState::kDone;
+      },
+      []() { return true; });
+  scheduler.Notify(blocker);
+  std::vector<std::shared_ptr<wenet::DecodeScheduler::Session>> sessions;
+  for (int i = 0; i < 3; ++i) {
+    sessions.push_back(scheduler.AddSession(
+        [&mutex, &order, i]() {
+          std::lock_guard<std::mutex> lock(mutex);
+          order.push_back(i);
+          // The first step of session 0 leaves more to decode
+          return order.size() == 1 ? StepState::kMore : StepState::kDone;
+        },
+        []() { return true; }));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  for (int i = 0; i < 3; ++i) scheduler.Notify(sessions[i]);
+  // Not ready, never queued
+  scheduler.Notify(scheduler.AddSession([]() { return StepState::kDone; },
+                                        []() { return false; }));
+  hold = false;
+  for (int i = 0; i < 1000; ++i) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (order.size() == 4) break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  // Session 0 keeps its priority after its first step
+  ASSERT_EQ(order, std::vector<int>({0, 0, 1, 2}));
+}
+
+}  // namespace
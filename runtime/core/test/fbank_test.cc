@@ -0,0 +1,119 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "frontend/fbank.h"
+#include "frontend/fbank_kernels.h"
+#include "frontend/feature_pipeline.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+std::vector<float> RandomWave(int num_samples, float amplitude) {
+  std::default_random_engine generator(17);
+  std::uniform_real_distribution<float> distribution(-amplitude, amplitude);
+  std::vector<float> wave(num_samples);
+  for (auto& x : wave) x = distribution(generator);
+  return wave;
+}
+
+void ExpectSameFeatures(const wenet::FeaturePipelineConfig& config,
+                        const std::vector<float>& wave) {
+  wenet::Fbank reference(config.num_bins, config.sample_rate,
+                         config.frame_length, config.frame_shift,
+                         config.low_freq, config.pre_emphasis,
+                         config.scale_input_to_unit, config.log_floor,
+                         config.log_base, config.window_type, config.mel_type,
+                         config.norm_type);
+  wenet::Fbank optimized(config.num_bins, config.sample_rate,
+                         config.frame_length, config.frame_shift,
+                         config.low_freq, config.pre_emphasis,
+                         config.scale_input_to_unit, config.log_floor,
+                         config.log_base, config.window_type, config.mel_type,
+                         config.norm_type);
+  optimized.set_engine(wenet::FbankEngine::kOptimized);
+  std::vector<std::vector<float>> ref_feats, feats;
+  int num_frames = reference.Compute(wave, &ref_feats);
+  ASSERT_GT(num_frames, 0);
+  ASSERT_EQ(optimized.Compute(wave, &feats), num_frames);
+  for (int i = 0; i < num_frames; ++i) {
+    ASSERT_EQ(feats[i].size(), ref_feats[i].size());
+    for (size_t j = 0; j < feats[i].size(); ++j) {
+      ASSERT_NEAR(feats[i][j], ref_feats[i][j], 1e-3) << i << " " << j;
+    }
+  }
+}
+
+}  // namespace
+
+TEST(FbankTest, KaldiEngineTest) {
+  wenet::FeaturePipelineConfig config(80, 16000);
+  ExpectSameFeatures(config, RandomWave(16000, 10000));
+  // Small values are clamped by log_floor
+  ExpectSameFeatures(config, RandomWave(1600, 1e-3));
+}
+
+TEST(FbankTest, WhisperEngineTest) {
+  wenet::FeaturePipelineConfig config(80, 16000,
+                                      wenet::FeatureType::kWhisper);
+  ExpectSameFeatures(config, RandomWave(16000, 10000));
+}
+
+TEST(FbankTest, RealFftTest) {
+  const int n = 512;
+  std::vector<float> wave = RandomWave(n, 1.0);
+  std::vector<float> x(wave), y(n, 0);
+  std::vector<int> bitrev(n);
+  std::vector<float> sintbl(n + n / 4);
+  wenet::make_sintbl(n, sintbl.data());
+  wenet::make_bitrev(n, bitrev.data());
+  wenet::fft(bitrev.data(), sintbl.data(), x.data(), y.data(), n);
+
+  wenet::RealFft real_fft(n);
+  std::vector<float> re(n / 2), im(n / 2);
+  real_fft.Compute(wave.data(), re.data(), im.data());
+  for (int k = 0; k < n / 2; ++k) {
+    ASSERT_NEAR(re[k], x[k], 1e-4);
+    ASSERT_NEAR(im[k], y[k], 1e-4);
+  }
+}
+
+TEST(FbankTest, KernelsTest) {
+  const wenet::FbankKernels& scalar = wenet::GetScalarFbankKernels();
+  const wenet::FbankKernels& best = wenet::GetFbankKernels();
+  // Odd size to cover the scalar tails of the SIMD kernels
+  const int n = 403;
+  std::vector<float> wave = RandomWave(n, 100.0);
+  std::vector<float> a(wave), b(wave);
+  scalar.pre_emphasis(0.97, n, a.data());
+  best.pre_emphasis(0.97, n, b.data());
+  for (int i = 0; i < n; ++i) ASSERT_NEAR(a[i], b[i], 1e-4);
+
+  scalar.remove_dc_offset(n, a.data());
+  best.remove_dc_offset(n, b.data());
+  for (int i = 0; i < n; ++i) ASSERT_NEAR(a[i], b[i], 1e-3);
+
+  std::vector<float> c(wave), d(wave);
+  for (auto& x : c) x = std::abs(x) * 1e3;
+  for (auto& x : d) x = std::abs(x) * 1e3;
+  c[0] = d[0] = 0;
+  scalar.log(1e-10, 1.0, n, c.data());
+  best.log(1e-10, 1.0, n, d.data());
+  for (int i = 0; i < n; ++i) ASSERT_NEAR(c[i], d[i], 1e-5 * std::abs(c[i]));
+}
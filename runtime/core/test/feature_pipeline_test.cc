@@ -12,6 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <chrono>
 #include <thread>
 #include <vector>
 
@@ -89,3 +91,146 @@ TEST(FeaturePipelineTest, PipelineTest) {
   ASSERT_EQ(out_feats.size(), 0);
   ASSERT_EQ(feature_pipeline.NumQueuedFrames(), 0);
 }
+
+TEST(FeaturePipelineTest, FeatureQueueTest) {
+  const int dim = 3;
+  wenet::FeatureQueue queue(dim, 4);
+  std::vector<float> frames(dim * 16);
+  for (size_t i = 0; i < frames.size(); ++i) frames[i] = i;
+  std::vector<float> out(dim * 16);
+
+  // Wrap around the end of the ring buffer
+  queue.Push(frames.data(), 3);
+  ASSERT_EQ(queue.Pop(2, out.data()), 2);
+  queue.Push(frames.data() + 3 * dim, 3);
+  ASSERT_EQ(queue.Size(), 4);
+  ASSERT_EQ(queue.Pop(4, out.data()), 4);
+  for (int i = 0; i < 4 * dim; ++i) {
+    ASSERT_EQ(out[i], frames[2 * dim + i]);
+  }
+
+  // Grow when the queue is wrapped around
+  queue.Push(frames.data(), 3);
+  queue.Push(frames.data() + 3 * dim, 10);
+  ASSERT_EQ(queue.Size(), 13);
+  ASSERT_EQ(queue.Pop(16, out.data()), 13);
+  for (int i = 0; i < 13 * dim; ++i) {
+    ASSERT_EQ(out[i], frames[i]);
+  }
+  ASSERT_TRUE(queue.Empty());
+  ASSERT_EQ(queue.Pop(1, out.data()), 0);
+}
+
+TEST(FeaturePipelineTest, FeatureQueueSpscTest) {
+  // Many blocks are reused while the two threads run concurrently
+  const int dim = 2, num_frames = 100000;
+  wenet::FeatureQueue queue(dim, 16);
+  std::thread producer([&queue]() {
+    std::vector<float> frames;
+    for (int i = 0; i < num_frames;) {
+      int n = std::min(1 + i % 7, num_frames - i);
+      frames.clear();
+      for (int j = i; j < i + n; ++j) frames.insert(frames.end(), dim, j);
+      queue.Push(frames.data(), n);
+      i += n;
+    }
+  });
+  std::vector<float> out(dim * 32);
+  for (int i = 0; i < num_frames;) {
+    int n = queue.Pop(1 + i % 31, out.data());
+    for (int j = 0; j < n * dim; ++j) {
+      ASSERT_EQ(out[j], i + j / dim);
+    }
+    i += n;
+  }
+  producer.join();
+  ASSERT_TRUE(queue.Empty());
+}
+
+TEST(FeaturePipelineTest, BlockingReadTest) {
+  wenet::FeaturePipelineConfig config(80, 8000);
+  wenet::FeaturePipeline feature_pipeline(config);
+  ASSERT_FALSE(feature_pipeline.Ready(1));
+  std::thread producer([&feature_pipeline]() {
+    std::vector<float> pcm(8 * 10, 0);  // one frame shift each time
+    for (int i = 0; i < 50; ++i) {
+      feature_pipeline.AcceptWaveform(pcm.data(), pcm.size());
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    feature_pipeline.set_input_finished();
+  });
+  int num_frames = 0;
+  std::vector<float> feats;
+  while (feature_pipeline.Read(4, &feats)) num_frames += 4;
+  num_frames += feats.size() / 80;
+  producer.join();
+  ASSERT_TRUE(feature_pipeline.Ready(1));
+  ASSERT_EQ(num_frames, feature_pipeline.num_frames());
+}
+
+TEST(FeaturePipelineTest, ContiguousReadTest) {
+  wenet::FeaturePipelineConfig config(80, 8000);
+  wenet::FeaturePipeline feature_pipeline(config);
+  int audio_len = 8 * 75;  // audio len 75ms, 13 frames for two calls
+  std::vector<float> pcm(audio_len);
+  for (int i = 0; i < audio_len; ++i) pcm[i] = (i % 100) * 10;
+  feature_pipeline.AcceptWaveform(pcm.data(), audio_len);
+  feature_pipeline.AcceptWaveform(pcm.data(), audio_len);
+  ASSERT_EQ(feature_pipeline.NumQueuedFrames(), 13);
+
+  // Same features as the ones read by rows
+  wenet::FeaturePipeline ref_pipeline(config);
+  ref_pipeline.AcceptWaveform(pcm.data(), audio_len);
+  ref_pipeline.AcceptWaveform(pcm.data(), audio_len);
+  ref_pipeline.set_input_finished();
+  std::vector<std::vector<float>> ref_feats;
+  ASSERT_FALSE(ref_pipeline.Read(16, &ref_feats));
+  ASSERT_EQ(ref_feats.size(), 13);
+
+  std::vector<float> feats;
+  ASSERT_TRUE(feature_pipeline.Read(8, &feats));
+  ASSERT_EQ(feats.size(), 8 * 80);
+  for (int i = 0; i < 8; ++i) {
+    for (int j = 0; j < 80; ++j) {
+      ASSERT_EQ(feats[i * 80 + j], ref_feats[i][j]);
+    }
+  }
+  feature_pipeline.set_input_finished();
+  ASSERT_FALSE(feature_pipeline.Read(8, &feats));
+  ASSERT_EQ(feats.size(), 5 * 80);
+  for (int i = 0; i < 5; ++i) {
+    for (int j = 0; j < 80; ++j) {
+      ASSERT_EQ(feats[i * 80 + j], ref_feats[8 + i][j]);
+    }
+  }
+}
+
+TEST(FeaturePipelineTest, ReadAppendTest) {
+  wenet::FeaturePipelineConfig config(80, 8000);
+  wenet::FeaturePipeline feature_pipeline(config);
+  int audio_len = 8 * 75;  // audio len 75ms, 6 frames
+  std::vector<float> pcm(audio_len);
+  for (int i = 0; i < audio_len; ++i) pcm[i] = (i % 100) * 10;
+  feature_pipeline.AcceptWaveform(pcm.data(), audio_len);
+  feature_pipeline.set_input_finished();
+
+  wenet::FeaturePipeline ref_pipeline(config);
+  ref_pipeline.AcceptWaveform(pcm.data(), audio_len);
+  ref_pipeline.set_input_finished();
+  std::vector<std::vector<float>> ref_feats;
+  ASSERT_FALSE(ref_pipeline.Read(8, &ref_feats));
+  int num_frames = ref_feats.size();
+
+  // The frames go behind the 2 frames already in the buffer
+  std::vector<float> feats(2 * 80, -1.0f);
+  ASSERT_FALSE(feature_pipeline.ReadAppend(8, &feats));
+  ASSERT_EQ(feats.size(), (2 + num_frames) * 80);
+  for (int j = 0; j < 2 * 80; ++j) {
+    ASSERT_EQ(feats[j], -1.0f);
+  }
+  for (int i = 0; i < num_frames; ++i) {
+    for (int j = 0; j < 80; ++j) {
+      ASSERT_EQ(feats[(2 + i) * 80 + j], ref_feats[i][j]);
+    }
+  }
+}
@@ -0,0 +1,103 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/object-pool.h"
+
+#include <set>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+struct Item {
+  Item(int a, float b) : a(a), b(b) {}
+  int a;
+  float b;
+  Item* next = nullptr;
+};
+
+}  // namespace
+
+TEST(ObjectPoolTest, NewDeleteTest) {
+  kaldi::ObjectPool<Item> pool(4);
+  Item* x = pool.New(1, 2.0f);
+  EXPECT_EQ(x->a, 1);
+  EXPECT_EQ(x->b, 2.0f);
+  EXPECT_EQ(x->next, nullptr);
+  Item* y = pool.New(3, 4.0f);
+  EXPECT_NE(x, y);
+  // The deleted objects are reused first, the last deleted one first
+  pool.Delete(x);
+  pool.Delete(y);
+  EXPECT_EQ(pool.New(5, 6.0f), y);
+  Item* z = pool.New(7, 8.0f);
+  EXPECT_EQ(z, x);
+  EXPECT_EQ(z->a, 7);
+  EXPECT_EQ(z->b, 8.0f);
+  EXPECT_EQ(pool.Stats().num_slabs, 1);
+}
+
+TEST(ObjectPoolTest, StatsTest) {
+  kaldi::ObjectPool<Item> pool(4);
+  EXPECT_EQ(pool.Stats().num_slabs, 0);
+  EXPECT_EQ(pool.Stats().bytes, 0);
+  std::vector<Item*> items;
+  for (int i = 0; i < 6; ++i) items.push_back(pool.New(i, 0.0f));
+  for (int i = 0; i < 3; ++i) pool.Delete(items[i]);
+  pool.New(0, 0.0f);
+  const kaldi::ObjectPoolStats& stats = pool.Stats();
+  EXPECT_EQ(stats.num_live, 4);
+  EXPECT_EQ(stats.peak_live, 6);
+  EXPECT_EQ(stats.num_allocations, 7);
+  EXPECT_EQ(stats.num_slabs, 2);
+  EXPECT_GE(stats.bytes, 2 * 4 * sizeof(Item));
+
+  kaldi::ObjectPoolStats total;
+  total += stats;
+  total += stats;
+  EXPECT_EQ(total.num_live, 8);
+  EXPECT_EQ(total.num_allocations, 14);
+  EXPECT_EQ(total.num_slabs, 4);
+}
+
+TEST(ObjectPoolTest, ResetTest) {
+  kaldi::ObjectPool<Item> pool(4);
+  std::set<Item*> first;
+  for (int i = 0; i < 10; ++i) first.insert(pool.New(i, 0.0f));
+  EXPECT_EQ(pool.Stats().num_slabs, 3);
+  size_t bytes = pool.Stats().bytes;
+
+  // The slabs are kept, so the same objects come back without new slabs
+  pool.Reset();
+  EXPECT_EQ(pool.Stats().num_live, 0);
+  EXPECT_EQ(pool.Stats().peak_live, 10);
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(first.count(pool.New(i, 0.0f)), 1);
+  }
+  EXPECT_EQ(pool.Stats().num_slabs, 3);
+  EXPECT_EQ(pool.Stats().bytes, bytes);
+  EXPECT_EQ(pool.Stats().num_live, 10);
+  EXPECT_EQ(pool.Stats().num_allocations, 20);
+
+  // The free list is dropped by Reset too
+  Item* x = pool.New(0, 0.0f);
+  pool.Delete(x);
+  pool.Reset();
+  pool.New(0, 0.0f);
+  EXPECT_EQ(pool.Stats().num_live, 1);
+  // A reset pool grows again once its slabs are used up
+  for (int i = 0; i < 12; ++i) pool.New(i, 0.0f);
+  EXPECT_EQ(pool.Stats().num_slabs, 4);
+}
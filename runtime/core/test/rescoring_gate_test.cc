@@ -0,0 +1,60 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/rescoring_gate.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+#include "utils/metrics.h"
+
+TEST(RescoringGateTest, DefaultTest) {
+  wenet::RescoringGateOptions opts;
+  wenet::RescoringGate gate(opts);
+  EXPECT_EQ(gate.Decide({-1.0, -100.0}, 1, 1000),
+            wenet::RescoringDecision::kRescore);
+  EXPECT_EQ(gate.NumHypsToRescore(10), 10);
+}
+
+TEST(RescoringGateTest, SkipTest) {
+  wenet::RescoringGateOptions opts;
+  opts.score_margin = 5.0;
+  opts.skip_single_hyp = true;
+  opts.max_utterance_ms = 3000;
+  opts.max_hyps = 4;
+  wenet::RescoringGate gate(opts);
+  wenet::RescoringGateStats before = wenet::RescoringGate::GlobalStats();
+
+  EXPECT_EQ(gate.Decide({-10.0, -1.0, -9.0}, 3, 1000),
+            wenet::RescoringDecision::kSkipScoreMargin);
+  EXPECT_EQ(gate.Decide({-1.0, -5.0}, 2, 1000),
+            wenet::RescoringDecision::kRescore);
+  EXPECT_EQ(gate.Decide({-1.0, -2.0}, 1, 1000),
+            wenet::RescoringDecision::kSkipSingleHyp);
+  // Long utterances are always rescored
+  EXPECT_EQ(gate.Decide({-1.0, -100.0}, 1, 5000),
+            wenet::RescoringDecision::kRescore);
+  EXPECT_EQ(gate.NumHypsToRescore(10), 4);
+  EXPECT_EQ(gate.NumHypsToRescore(3), 3);
+
+  wenet::RescoringGateStats after = wenet::RescoringGate::GlobalStats();
+  EXPECT_EQ(after.num_requests - before.num_requests, 4);
+  EXPECT_EQ(after.num_skipped_score_margin - before.num_skipped_score_margin,
+            1);
+  EXPECT_EQ(after.num_skipped_single_hyp - before.num_skipped_single_hyp, 1);
+  EXPECT_EQ(after.num_shortened - before.num_shortened, 1);
+  std::string metrics = wenet::Metrics::Global().Export();
+  EXPECT_NE(metrics.find("wenet_rescoring_skipped_score_margin_total"),
+            std::string::npos);
+}
@@ -14,11 +14,19 @@
 
 #include "utils/utils.h"
 
+#include <algorithm>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
+#include "utils/metrics.h"
+#include "utils/trace.h"
+
 TEST(UtilsTest, TopKTest) {
   using ::testing::ElementsAre;
   using ::testing::FloatNear;
@@ -30,3 +38,100 @@ TEST(UtilsTest, TopKTest) {
   EXPECT_THAT(values, Pointwise(FloatNear(1e-8), {10, 9, 8}));
   ASSERT_THAT(indices, ElementsAre(9, 4, 8));
 }
+
+TEST(UtilsTest, BatchTopKTest) {
+  using ::testing::ElementsAre;
+  using ::testing::FloatNear;
+  using ::testing::Pointwise;
+  std::vector<float> data = {1, 3, 5, 7, 9, 2, 4, 6, 8, 10,
+                             10, 8, 6, 4, 2, 9, 7, 5, 3, 1};
+  std::vector<float> values(6);
+  std::vector<int32_t> indices(6);
+  wenet::BatchTopK(data.data(), 2, 10, 3, values.data(), indices.data());
+  EXPECT_THAT(values, Pointwise(FloatNear(1e-8), {10, 9, 8, 10, 9, 8}));
+  ASSERT_THAT(indices, ElementsAre(9, 4, 8, 0, 5, 1));
+}
+
+TEST(UtilsTest, BatchTopKLargeTest) {
+  const int num_rows = 8;
+  const int dim = 5003;
+  const int k = 10;
+  std::default_random_engine generator(3);
+  std::uniform_int_distribution<int> distribution(-2000, 0);
+  // Quantized scores, so there are many ties
+  std::vector<float> data(num_rows * dim);
+  for (auto& x : data) x = distribution(generator) / 100.0f;
+  std::vector<float> values(num_rows * k);
+  std::vector<int32_t> indices(num_rows * k);
+  wenet::BatchTopK(data.data(), num_rows, dim, k, values.data(),
+                   indices.data());
+  for (int r = 0; r < num_rows; ++r) {
+    const float* row = data.data() + r * dim;
+    std::vector<int32_t> order(dim);
+    for (int i = 0; i < dim; ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(),
+                     [row](int a, int b) { return row[a] > row[b]; });
+    for (int i = 0; i < k; ++i) {
+      EXPECT_EQ(indices[r * k + i], order[i]);
+      EXPECT_EQ(values[r * k + i], row[order[i]]);
+    }
+  }
+}
+
+TEST(UtilsTest, LatencyHistogramTest) {
+  using ::testing::HasSubstr;
+  wenet::LatencyHistogram histogram("test_seconds", "Test");
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&histogram]() {
+      for (int j = 0; j < 1000; ++j) histogram.Observe(j % 2 ? 80 : 20000);
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  EXPECT_EQ(histogram.Count(), 4000);
+  EXPECT_EQ(histogram.Sum(), 2000 * (80 + 20000));
+  std::string out;
+  histogram.Export(&out);
+  EXPECT_THAT(out, HasSubstr("# TYPE test_seconds histogram\n"));
+  EXPECT_THAT(out, HasSubstr("test_seconds_bucket{le=\"5e-05\"} 0\n"));
+  EXPECT_THAT(out, HasSubstr("test_seconds_bucket{le=\"0.0001\"} 2000\n"));
+  EXPECT_THAT(out, HasSubstr("test_seconds_bucket{le=\"0.025\"} 4000\n"));
+  EXPECT_THAT(out, HasSubstr("test_seconds_bucket{le=\"+Inf\"} 4000\n"));
+  EXPECT_THAT(out, HasSubstr("test_seconds_count 4000\n"));
+}
+
+TEST(UtilsTest, TraceTest) {
+  using ::testing::HasSubstr;
+  std::thread([]() {
+    for (int i = 0; i < wenet::kTraceBufferSize + 10; ++i) {
+      wenet::RecordTraceEvent("Overwritten", i, i + 1);
+    }
+    wenet::RecordTraceEvent("Test", 100, 150);
+  }).join();
+  std::string trace = wenet::ExportTrace();
+  EXPECT_THAT(trace, HasSubstr("{\"name\":\"Test\",\"ph\":\"X\""));
+  EXPECT_THAT(trace, HasSubstr("\"ts\":100,\"dur\":50}"));
+  // The first events of the thread are overwritten
+  EXPECT_THAT(trace, ::testing::Not(HasSubstr("\"ts\":5,")));
+}
+
+TEST(UtilsTest, TraceBufferReuseTest) {
+  using ::testing::HasSubstr;
+  // One thread at a time, so they all record to the same buffer
+  for (int i = 0; i < 8; ++i) {
+    std::thread([i]() {
+      wenet::RecordTraceEvent("Reused", 1000 + i, 1001 + i);
+    }).join();
+  }
+  std::string trace = wenet::ExportTrace();
+  std::set<std::string> tids;
+  const std::string tid_key = "\"tid\":";
+  for (int i = 0; i < 8; ++i) {
+    std::string ts = "\"ts\":" + std::to_string(1000 + i) + ",";
+    size_t pos = trace.find(ts);
+    ASSERT_NE(pos, std::string::npos);
+    size_t tid_pos = trace.rfind(tid_key, pos) + tid_key.size();
+    tids.insert(trace.substr(tid_pos, trace.find(',', tid_pos) - tid_pos));
+  }
+  EXPECT_EQ(tids.size(), 1);
+}
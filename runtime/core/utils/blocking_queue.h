@@ -22,6 +22,7 @@
 #include <utility>
 #include <vector>
 
+#include "utils/trace.h"
 #include "utils/utils.h"
 
 namespace wenet {
@@ -36,6 +37,7 @@ class BlockingQueue {
     {
       std::unique_lock<std::mutex> lock(mutex_);
       while (queue_.size() >= capacity_) {
+        WENET_TRACE_SCOPE("BlockingQueue::WaitNotFull");
         not_full_condition_.wait(lock);
       }
       queue_.push(value);
@@ -47,6 +49,7 @@ class BlockingQueue {
     {
       std::unique_lock<std::mutex> lock(mutex_);
       while (queue_.size() >= capacity_) {
+        WENET_TRACE_SCOPE("BlockingQueue::WaitNotFull");
         not_full_condition_.wait(lock);
       }
       queue_.push(std::move(value));
@@ -72,6 +75,7 @@ class BlockingQueue {
     std::unique_lock<std::mutex> lock(mutex_);
     for (auto& value : values) {
       while (queue_.size() >= capacity_) {
+        WENET_TRACE_SCOPE("BlockingQueue::WaitNotFull");
         not_empty_condition_.notify_one();
         not_full_condition_.wait(lock);
       }
@@ -83,6 +87,7 @@ class BlockingQueue {
   T Pop() {
     std::unique_lock<std::mutex> lock(mutex_);
     while (queue_.empty()) {
+      WENET_TRACE_SCOPE("BlockingQueue::WaitNotEmpty");
       not_empty_condition_.wait(lock);
     }
     T t(std::move(queue_.front()));
@@ -97,6 +102,7 @@ class BlockingQueue {
     std::vector<T> block_data;
     while (block_data.size() < num) {
       while (queue_.empty()) {
+        WENET_TRACE_SCOPE("BlockingQueue::WaitNotEmpty");
         not_full_condition_.notify_one();
         not_empty_condition_.wait(lock);
       }
@@ -0,0 +1,75 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/event_count.h"
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <climits>
+
+namespace wenet {
+
+#ifdef __linux__
+
+void EventCount::Wait(uint32_t key) {
+  // The futex returns at once if the epoch is not `key` anymore, so a
+  // notification between PrepareWait() and here is not lost
+  while (epoch_.load(std::memory_order_seq_cst) == key) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch_),
+            FUTEX_WAIT_PRIVATE, key, nullptr, nullptr, 0);
+  }
+  waiters_.fetch_sub(1, std::memory_order_seq_cst);
+}
+
+void EventCount::Notify(bool one) {
+  epoch_.fetch_add(1, std::memory_order_seq_cst);
+  if (waiters_.load(std::memory_order_seq_cst) > 0) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch_),
+            FUTEX_WAKE_PRIVATE, one ? 1 : INT_MAX, nullptr, nullptr, 0);
+  }
+}
+
+#else
+
+void EventCount::Wait(uint32_t key) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait(lock, [this, key] {
+      return epoch_.load(std::memory_order_seq_cst) != key;
+    });
+  }
+  waiters_.fetch_sub(1, std::memory_order_seq_cst);
+}
+
+void EventCount::Notify(bool one) {
+  epoch_.fetch_add(1, std::memory_order_seq_cst);
+  if (waiters_.load(std::memory_order_seq_cst) > 0) {
+    // The waiter checks the epoch under the lock, so taking the lock here
+    // makes sure it is either before the check or in wait()
+    { std::lock_guard<std::mutex> lock(mutex_); }
+    if (one) {
+      condition_.notify_one();
+    } else {
+      condition_.notify_all();
+    }
+  }
+}
+
+#endif
+
+}  // namespace wenet
@@ -0,0 +1,75 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTILS_EVENT_COUNT_H_
+#define UTILS_EVENT_COUNT_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// EventCount blocks a thread until a condition on lock free data becomes
+// true, without a lock on the notifying side. The waiter checks the
+// condition twice around PrepareWait():
+//
+//   while (!Ready()) {
+//     uint32_t key = event_count.PrepareWait();
+//     if (Ready()) {
+//       event_count.CancelWait();
+//       break;
+//     }
+//     event_count.Wait(key);
+//   }
+//
+// and the notifier calls NotifyAll() or NotifyOne() after making the
+// condition true. The notification is one atomic add and one load when
+// nobody is waiting, the waiter sleeps on a futex on Linux, or a condition
+// variable elsewhere.
+class EventCount {
+ public:
+  EventCount() = default;
+
+  uint32_t PrepareWait() {
+    waiters_.fetch_add(1, std::memory_order_seq_cst);
+    return epoch_.load(std::memory_order_seq_cst);
+  }
+  void CancelWait() { waiters_.fetch_sub(1, std::memory_order_seq_cst); }
+  // Block until there is a notification after the PrepareWait() of `key`
+  void Wait(uint32_t key);
+  void NotifyAll() { Notify(false); }
+  // Wake at most one of the threads sleeping in Wait()
+  void NotifyOne() { Notify(true); }
+
+ private:
+  void Notify(bool one);
+
+  std::atomic<uint32_t> epoch_{0};
+  std::atomic<int> waiters_{0};
+#ifndef __linux__
+  std::mutex mutex_;
+  std::condition_variable condition_;
+#endif
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(EventCount);
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_EVENT_COUNT_H_
@@ -0,0 +1,107 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTILS_FLAT_HASH_TABLE_H_
+#define UTILS_FLAT_HASH_TABLE_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace wenet {
+
+// Open addressing hash table from uint64_t keys to int values with linear
+// probing. Clear() is O(1) by bumping a generation stamp, so the table and
+// its memory can be reused per frame in the searches.
+class FlatHashTable {
+ public:
+  explicit FlatHashTable(int capacity = 64) { Rehash(capacity); }
+
+  int Size() const { return size_; }
+
+  void Clear() {
+    size_ = 0;
+    if (++generation_ == 0) {
+      // The stamp wraps around, reset all the slots once
+      for (auto& slot : slots_) slot.generation = 0;
+      generation_ = 1;
+    }
+  }
+
+  // Return the value of `key`, or -1 if it doesn't exist
+  int Find(uint64_t key) const {
+    for (size_t i = Hash(key);; i = (i + 1) & mask_) {
+      const Slot& slot = slots_[i];
+      if (slot.generation != generation_) return -1;
+      if (slot.key == key) return slot.value;
+    }
+  }
+
+  // Return the value of `key`, insert (key, value) if it doesn't exist
+  int FindOrInsert(uint64_t key, int value) {
+    if ((size_ + 1) * 2 > static_cast<int>(slots_.size())) {
+      Rehash(slots_.size() * 2);
+    }
+    for (size_t i = Hash(key);; i = (i + 1) & mask_) {
+      Slot& slot = slots_[i];
+      if (slot.generation != generation_) {
+        slot.key = key;
+        slot.value = value;
+        slot.generation = generation_;
+        ++size_;
+        return value;
+      }
+      if (slot.key == key) return slot.value;
+    }
+  }
+
+ private:
+  struct Slot {
+    uint64_t key = 0;
+    int value = 0;
+    uint32_t generation = 0;
+  };
+
+  size_t Hash(uint64_t key) const {
+    // Fibonacci hashing, the high bits are well mixed
+    return (key * 0x9E3779B97F4A7C15ull) >> shift_;
+  }
+
+  void Rehash(int capacity) {
+    int bits = 1;
+    while ((1 << bits) < capacity) ++bits;
+    std::vector<Slot> old_slots;
+    old_slots.swap(slots_);
+    uint32_t old_generation = generation_;
+    slots_.resize(1 << bits);
+    mask_ = slots_.size() - 1;
+    shift_ = 64 - bits;
+    generation_ = 1;
+    size_ = 0;
+    for (const auto& slot : old_slots) {
+      if (slot.generation == old_generation) {
+        FindOrInsert(slot.key, slot.value);
+      }
+    }
+  }
+
+  std::vector<Slot> slots_;
+  size_t mask_ = 0;
+  int shift_ = 0;
+  uint32_t generation_ = 1;
+  int size_ = 0;
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_FLAT_HASH_TABLE_H_
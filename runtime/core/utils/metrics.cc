@@ -0,0 +1,136 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/metrics.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace wenet {
+
+constexpr int LatencyHistogram::kNumBuckets;
+const int64_t LatencyHistogram::kBucketBounds[kNumBuckets] = {
+    50,     100,    250,     500,     1000,    2500,
+    5000,   10000,  25000,   50000,   100000,  250000,
+    500000, 750000, 1000000, 2500000, 5000000, 10000000};
+
+int LatencyHistogram::ShardIndex() {
+  static std::atomic<int> num_threads{0};
+  thread_local int index = num_threads.fetch_add(1) % kNumShards;
+  return index;
+}
+
+void LatencyHistogram::Observe(int64_t us) {
+  int bucket = std::lower_bound(kBucketBounds, kBucketBounds + kNumBuckets,
+                                us) -
+               kBucketBounds;
+  Shard& shard = shards_[ShardIndex()];
+  shard.counts[bucket].fetch_add(1, std::memory_order_relaxed);
+  shard.sum.fetch_add(us, std::memory_order_relaxed);
+}
+
+int64_t LatencyHistogram::Count() const {
+  int64_t count = 0;
+  for (const Shard& shard : shards_) {
+    for (const auto& c : shard.counts) {
+      count += c.load(std::memory_order_relaxed);
+    }
+  }
+  return count;
+}
+
+int64_t LatencyHistogram::Sum() const {
+  int64_t sum = 0;
+  for (const Shard& shard : shards_) {
+    sum += shard.sum.load(std::memory_order_relaxed);
+  }
+  return sum;
+}
+
+static std::string FormatSeconds(int64_t us) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%g", us / 1e6);
+  return buf;
+}
+
+void LatencyHistogram::Export(std::string* out) const {
+  int64_t counts[kNumBuckets + 1] = {0};
+  int64_t sum = 0;
+  for (const Shard& shard : shards_) {
+    for (int i = 0; i <= kNumBuckets; ++i) {
+      counts[i] += shard.counts[i].load(std::memory_order_relaxed);
+    }
+    sum += shard.sum.load(std::memory_order_relaxed);
+  }
+  std::string name(name_);
+  *out += "# HELP " + name + " " + help_ + "\n";
+  *out += "# TYPE " + name + " histogram\n";
+  // Prometheus buckets are cumulative
+  int64_t cumulative = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    cumulative += counts[i];
+    *out += name + "_bucket{le=\"" + FormatSeconds(kBucketBounds[i]) +
+            "\"} " + std::to_string(cumulative) + "\n";
+  }
+  cumulative += counts[kNumBuckets];
+  *out += name + "_bucket{le=\"+Inf\"} " + std::to_string(cumulative) + "\n";
+  *out += name + "_sum " + FormatSeconds(sum) + "\n";
+  *out += name + "_count " + std::to_string(cumulative) + "\n";
+}
+
+void Gauge::Export(std::string* out) const {
+  std::string name(name_);
+  *out += "# HELP " + name + " " + help_ + "\n";
+  *out += "# TYPE " + name + " gauge\n";
+  *out += name + " " + std::to_string(Value()) + "\n";
+}
+
+void Counter::Export(std::string* out) const {
+  std::string name(name_);
+  *out += "# HELP " + name + " " + help_ + "\n";
+  *out += "# TYPE " + name + " counter\n";
+  *out += name + " " + std::to_string(Value()) + "\n";
+}
+
+Metrics& Metrics::Global() {
+  static Metrics* metrics = new Metrics;
+  return *metrics;
+}
+
+std::string Metrics::Export() const {
+  std::string out;
+  for (const LatencyHistogram* histogram :
+       {&feature_extraction, &encoder_forward, &ctc_search, &endpointing,
+        &rescoring, &post_processing, &first_partial_latency,
+        &final_latency}) {
+    histogram->Export(&out);
+  }
+  for (const Gauge* gauge :
+       {&active_sessions, &session_memory_bytes, &decode_queue_depth,
+        &rescoring_queue_depth,
+        &context_graph_cache_bytes, &decode_load_percent,
+        &decode_backlog_ms}) {
+    gauge->Export(&out);
+  }
+  for (const Counter* counter :
+       {&context_graph_cache_hits, &context_graph_cache_misses,
+        &sessions_rejected, &sessions_degraded, &rescoring_requests,
+        &rescoring_skipped_score_margin, &rescoring_skipped_single_hyp,
+        &rescoring_shortened}) {
+    counter->Export(&out);
+  }
+  return out;
+}
+
+}  // namespace wenet
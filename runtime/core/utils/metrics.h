@@ -0,0 +1,186 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTILS_METRICS_H_
+#define UTILS_METRICS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "utils/timer.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// Latency histogram with microsecond resolution, exported in seconds as
+// Prometheus expects. Observe() is lock free: every thread adds to its own
+// shard by relaxed atomics, the shards are only summed by Export().
+class LatencyHistogram {
+ public:
+  // Upper bounds of the buckets in microseconds, from 50us to 10s
+  static constexpr int kNumBuckets = 18;
+  static const int64_t kBucketBounds[kNumBuckets];
+
+  LatencyHistogram(const char* name, const char* help)
+      : name_(name), help_(help) {}
+  void Observe(int64_t us);
+  // Total number of observations and their sum in microseconds
+  int64_t Count() const;
+  int64_t Sum() const;
+  // Append the histogram in the Prometheus text format to `out`
+  void Export(std::string* out) const;
+
+ private:
+  static constexpr int kNumShards = 16;
+  // The last count is the +Inf bucket, shards are cache line aligned so
+  // that the threads don't share lines
+  struct alignas(64) Shard {
+    std::atomic<int64_t> counts[kNumBuckets + 1] = {};
+    std::atomic<int64_t> sum{0};
+  };
+  static int ShardIndex();
+
+  const char* name_;
+  const char* help_;
+  Shard shards_[kNumShards];
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(LatencyHistogram);
+};
+
+class Gauge {
+ public:
+  Gauge(const char* name, const char* help) : name_(name), help_(help) {}
+  void Add(int64_t delta) {
+    value_.fetch_add(delta, std::memory_order_relaxed);
+  }
+  void Set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+  int64_t Value() const { return value_.load(std::memory_order_relaxed); }
+  void Export(std::string* out) const;
+
+ private:
+  const char* name_;
+  const char* help_;
+  std::atomic<int64_t> value_{0};
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(Gauge);
+};
+
+// Monotonic, e.g. the number of the cache hits
+class Counter {
+ public:
+  Counter(const char* name, const char* help) : name_(name), help_(help) {}
+  void Increment(int64_t delta = 1) {
+    value_.fetch_add(delta, std::memory_order_relaxed);
+  }
+  int64_t Value() const { return value_.load(std::memory_order_relaxed); }
+  void Export(std::string* out) const;
+
+ private:
+  const char* name_;
+  const char* help_;
+  std::atomic<int64_t> value_{0};
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(Counter);
+};
+
+// Observe the lifetime of the object in `histogram`
+class ScopedLatency {
+ public:
+  explicit ScopedLatency(LatencyHistogram* histogram)
+      : histogram_(histogram) {}
+  ~ScopedLatency() { histogram_->Observe(timer_.ElapsedUs()); }
+
+ private:
+  LatencyHistogram* histogram_;
+  Timer timer_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(ScopedLatency);
+};
+
+// All the metrics of the runtime in the process, the servers export them at
+// /metrics.
+struct Metrics {
+  static Metrics& Global();
+  // Prometheus text exposition format, version 0.0.4
+  std::string Export() const;
+
+  // Stages of the decoding
+  LatencyHistogram feature_extraction{"wenet_feature_extraction_seconds",
+                                      "Fbank of one piece of received audio"};
+  LatencyHistogram encoder_forward{"wenet_encoder_forward_seconds",
+                                   "Encoder forward of one chunk"};
+  LatencyHistogram ctc_search{"wenet_ctc_search_seconds",
+                              "CTC search of one chunk"};
+  LatencyHistogram endpointing{"wenet_endpointing_seconds",
+                               "Endpoint detection of one chunk"};
+  LatencyHistogram rescoring{"wenet_rescoring_seconds",
+                             "Attention rescoring of one segment"};
+  LatencyHistogram post_processing{"wenet_post_processing_seconds",
+                                   "Post processing of one result"};
+  // Sessions
+  LatencyHistogram first_partial_latency{
+      "wenet_first_partial_latency_seconds",
+      "From the start of a session to its first partial result"};
+  LatencyHistogram final_latency{
+      "wenet_final_latency_seconds",
+      "From the last chunk of a segment to its final result"};
+  Gauge active_sessions{"wenet_active_sessions", "Live decoding sessions"};
+  Gauge session_memory_bytes{
+      "wenet_session_memory_bytes",
+      "Memory of the decoding states of the live sessions, as of their last "
+      "chunks"};
+  // Queues
+  Gauge decode_queue_depth{"wenet_decode_queue_depth",
+                           "Sessions waiting for a decode worker"};
+  Gauge rescoring_queue_depth{"wenet_rescoring_queue_depth",
+                              "Segments waiting for asynchronous rescoring"};
+  // Context graphs of the session hotwords
+  Counter context_graph_cache_hits{"wenet_context_graph_cache_hits_total",
+                                   "Hotword lists found in the cache"};
+  Counter context_graph_cache_misses{
+      "wenet_context_graph_cache_misses_total",
+      "Hotword lists compiled, or cache keys not found"};
+  Gauge context_graph_cache_bytes{"wenet_context_graph_cache_bytes",
+                                  "Memory of the cached context graphs"};
+  // Admission control, see AdmissionController
+  Counter sessions_rejected{"wenet_sessions_rejected_total",
+                            "New sessions rejected by the admission control"};
+  Counter sessions_degraded{"wenet_sessions_degraded_total",
+                            "New sessions admitted in the degraded mode"};
+  Gauge decode_load_percent{"wenet_decode_load_percent",
+                            "Smoothed compute time of the chunks per thread"};
+  Gauge decode_backlog_ms{"wenet_decode_backlog_ms",
+                          "Smoothed audio waiting for decoding"};
+  // Rescoring gate, see RescoringGate
+  Counter rescoring_requests{"wenet_rescoring_requests_total",
+                             "Segments asked for attention rescoring"};
+  Counter rescoring_skipped_score_margin{
+      "wenet_rescoring_skipped_score_margin_total",
+      "Rescoring skipped by the CTC score margin of the 1-best"};
+  Counter rescoring_skipped_single_hyp{
+      "wenet_rescoring_skipped_single_hyp_total",
+      "Rescoring skipped with only one distinct hypothesis"};
+  Counter rescoring_shortened{
+      "wenet_rescoring_shortened_total",
+      "Rescoring of the top hypotheses only, by max_hyps"};
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_METRICS_H_
@@ -0,0 +1,193 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/trace.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <signal.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+namespace {
+
+// The fields are relaxed atomics, so reading an event being overwritten is
+// not a data race. `seq` is the index of the event in its buffer plus one,
+// it's 0 while the event is written, so ExportTrace detects and drops the
+// torn ones like a seqlock.
+struct TraceEvent {
+  std::atomic<int64_t> seq{0};
+  std::atomic<const char*> name{nullptr};
+  std::atomic<int64_t> begin{0};
+  std::atomic<int64_t> end{0};
+};
+
+struct TraceBuffer {
+  explicit TraceBuffer(int tid) : tid(tid), events(kTraceBufferSize) {}
+  const int tid;
+  std::vector<TraceEvent> events;
+  // Only written by the owner thread, the events before it are complete
+  std::atomic<int64_t> num_events{0};
+};
+
+// The buffers outlive their threads, so the events of the finished threads
+// are still exported. The buffer of a finished thread is reused by the next
+// new thread, so the memory is bounded by the number of live threads rather
+// than growing with the threads per connection of the servers.
+struct TraceRegistry {
+  std::mutex mutex;
+  std::vector<std::shared_ptr<TraceBuffer>> buffers;
+  std::vector<TraceBuffer*> free_buffers;
+};
+
+// Never destroyed, the threads may record at exit
+TraceRegistry& Registry() {
+  static TraceRegistry* registry = new TraceRegistry;
+  return *registry;
+}
+
+// Owns the buffer of a thread while it's alive
+class ThreadTraceBufferOwner {
+ public:
+  ThreadTraceBufferOwner() {
+    TraceRegistry& registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    if (!registry.free_buffers.empty()) {
+      buffer_ = registry.free_buffers.back();
+      registry.free_buffers.pop_back();
+    } else {
+      registry.buffers.push_back(
+          std::make_shared<TraceBuffer>(registry.buffers.size()));
+      buffer_ = registry.buffers.back().get();
+    }
+  }
+  ~ThreadTraceBufferOwner() {
+    TraceRegistry& registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.free_buffers.push_back(buffer_);
+  }
+  TraceBuffer* buffer() const { return buffer_; }
+
+ private:
+  TraceBuffer* buffer_ = nullptr;
+};
+
+TraceBuffer* ThreadTraceBuffer() {
+  thread_local ThreadTraceBufferOwner owner;
+  return owner.buffer();
+}
+
+}  // namespace
+
+int64_t TraceNowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void RecordTraceEvent(const char* name, int64_t begin_us, int64_t end_us) {
+  TraceBuffer* buffer = ThreadTraceBuffer();
+  int64_t n = buffer->num_events.load(std::memory_order_relaxed);
+  TraceEvent& event = buffer->events[n % kTraceBufferSize];
+  event.seq.store(0, std::memory_order_relaxed);
+  // The reader which sees any of the stores below sees the seq 0 above
+  std::atomic_thread_fence(std::memory_order_release);
+  event.name.store(name, std::memory_order_relaxed);
+  event.begin.store(begin_us, std::memory_order_relaxed);
+  event.end.store(end_us, std::memory_order_relaxed);
+  event.seq.store(n + 1, std::memory_order_release);
+  buffer->num_events.store(n + 1, std::memory_order_release);
+}
+
+std::string ExportTrace() {
+  std::vector<std::shared_ptr<TraceBuffer>> buffers;
+  {
+    TraceRegistry& registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    buffers = registry.buffers;
+  }
+  std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  for (const auto& buffer : buffers) {
+    int64_t n = buffer->num_events.load(std::memory_order_acquire);
+    // The slot of the event n - kTraceBufferSize is the one of the event n,
+    // which may be written now
+    int64_t start = std::max<int64_t>(0, n - kTraceBufferSize + 1);
+    for (int64_t i = start; i < n; ++i) {
+      const TraceEvent& event = buffer->events[i % kTraceBufferSize];
+      int64_t seq = event.seq.load(std::memory_order_acquire);
+      const char* name = event.name.load(std::memory_order_relaxed);
+      int64_t begin = event.begin.load(std::memory_order_relaxed);
+      int64_t end = event.end.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      // Overwritten while reading, it may be torn
+      if (seq != i + 1 || event.seq.load(std::memory_order_relaxed) != seq) {
+        continue;
+      }
+      if (!first) out += ",";
+      first = false;
+      out += "{\"name\":\"" + std::string(name) +
+             "\",\"ph\":\"X\",\"pid\":1,\"tid\":" +
+             std::to_string(buffer->tid) + ",\"ts\":" + std::to_string(begin) +
+             ",\"dur\":" + std::to_string(end - begin) + "}";
+    }
+  }
+  out += "]}";
+  return out;
+}
+
+bool DumpTrace(const std::string& path) {
+  std::ofstream os(path);
+  if (!os) {
+    LOG(ERROR) << "Failed to open " << path;
+    return false;
+  }
+  os << ExportTrace();
+  LOG(INFO) << "Dumped trace to " << path;
+  return static_cast<bool>(os);
+}
+
+void StartTraceDumper(const std::string& path) {
+  if (!TraceEnabled()) {
+    LOG(WARNING) << "Built without TRACE, the trace is empty";
+  }
+#ifndef _WIN32
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGUSR1);
+  // Inherited by the threads created after
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  std::thread([path, signals]() {
+    int signal = 0;
+    while (sigwait(&signals, &signal) == 0) {
+      DumpTrace(path);
+    }
+  }).detach();
+  LOG(INFO) << "Send SIGUSR1 to dump the trace to " << path;
+#endif
+}
+
+}  // namespace wenet
@@ -0,0 +1,89 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTILS_TRACE_H_
+#define UTILS_TRACE_H_
+
+#include <cstdint>
+#include <string>
+
+#include "utils/utils.h"
+
+// Timeline of the decoding in the Chrome trace format, which can be opened
+// by chrome://tracing or https://ui.perfetto.dev. It's compiled in by the
+// TRACE cmake option, otherwise WENET_TRACE_SCOPE is empty:
+//
+//   {
+//     WENET_TRACE_SCOPE("ForwardEncoder");
+//     model->ForwardEncoder(...);
+//   }
+//
+// Every thread records its events to its own ring buffer without locks, the
+// oldest events are overwritten when it's full. The buffer of a finished
+// thread is reused by the next new one, with the same tid in the trace. The
+// name must be a string literal, only the pointer is recorded.
+#ifdef WENET_TRACE
+#define WENET_TRACE_CONCAT_IMPL(a, b) a##b
+#define WENET_TRACE_CONCAT(a, b) WENET_TRACE_CONCAT_IMPL(a, b)
+#define WENET_TRACE_SCOPE(name) \
+  wenet::TraceScope WENET_TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#else
+#define WENET_TRACE_SCOPE(name)
+#endif
+
+namespace wenet {
+
+// Events per thread, about 1.5 MB per thread
+const int kTraceBufferSize = 1 << 16;
+
+constexpr bool TraceEnabled() {
+#ifdef WENET_TRACE
+  return true;
+#else
+  return false;
+#endif
+}
+
+// Microseconds of the steady clock
+int64_t TraceNowUs();
+
+// Record a complete event of the calling thread
+void RecordTraceEvent(const char* name, int64_t begin_us, int64_t end_us);
+
+// The events of all the threads in the Chrome trace JSON format. It can be
+// called while tracing, the events overwritten at the same time are dropped.
+std::string ExportTrace();
+bool DumpTrace(const std::string& path);
+
+// Dump the trace to `path` whenever the process gets SIGUSR1, for the
+// servers which never exit. It must be called before any other thread is
+// created, so that all the threads block the signal. No-op on Windows.
+void StartTraceDumper(const std::string& path);
+
+class TraceScope {
+ public:
+  explicit TraceScope(const char* name) : name_(name), begin_(TraceNowUs()) {}
+  ~TraceScope() { RecordTraceEvent(name_, begin_, TraceNowUs()); }
+
+ private:
+  const char* name_;
+  int64_t begin_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(TraceScope);
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_TRACE_H_
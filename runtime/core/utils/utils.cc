@@ -23,6 +23,14 @@
 
 #include "utils/log.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WENET_TOPK_AVX2
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define WENET_TOPK_NEON
+#include <arm_neon.h>
+#endif
+
 namespace wenet {
 
 float LogAdd(float x, float y) {
@@ -78,4 +86,98 @@ template void TopK<float>(const std::vector<float>& data, int32_t k,
                           std::vector<float>* values,
                           std::vector<int>* indices);
 
+namespace {
+
+// Insert (x, i) into the sorted top k v/idx which has n items
+inline void InsertTopK(float x, int32_t i, int k, int* n, float* v,
+                       int32_t* idx) {
+  if (*n == k && !(v[k - 1] < x)) return;
+  int j = *n < k ? (*n)++ : k - 1;
+  for (; j > 0 && v[j - 1] < x; --j) {
+    v[j] = v[j - 1];
+    idx[j] = idx[j - 1];
+  }
+  v[j] = x;
+  idx[j] = i;
+}
+
+// The top k of the first k items are the items themselves, then the rest are
+// compared with the k-th best, most of them are rejected by the comparison
+void TopKRowScalar(const float* row, int dim, int k, float* v, int32_t* idx) {
+  int n = 0;
+  for (int32_t i = 0; i < dim; ++i) InsertTopK(row[i], i, k, &n, v, idx);
+}
+
+#ifdef WENET_TOPK_AVX2
+
+// The comparison is done 8 items at a time, only the few items greater than
+// the k-th best take the scalar insertion
+__attribute__((target("avx2"))) void TopKRowAvx2(const float* row, int dim,
+                                                 int k, float* v,
+                                                 int32_t* idx) {
+  int n = 0;
+  int32_t i = 0;
+  for (; i < k; ++i) InsertTopK(row[i], i, k, &n, v, idx);
+  for (; i + 8 <= dim; i += 8) {
+    __m256 x = _mm256_loadu_ps(row + i);
+    int mask = _mm256_movemask_ps(
+        _mm256_cmp_ps(x, _mm256_set1_ps(v[k - 1]), _CMP_GT_OQ));
+    while (mask != 0) {
+      int lane = __builtin_ctz(mask);
+      mask &= mask - 1;
+      InsertTopK(row[i + lane], i + lane, k, &n, v, idx);
+    }
+  }
+  for (; i < dim; ++i) InsertTopK(row[i], i, k, &n, v, idx);
+}
+
+#endif  // WENET_TOPK_AVX2
+
+#ifdef WENET_TOPK_NEON
+
+void TopKRowNeon(const float* row, int dim, int k, float* v, int32_t* idx) {
+  int n = 0;
+  int32_t i = 0;
+  for (; i < k; ++i) InsertTopK(row[i], i, k, &n, v, idx);
+  for (; i + 4 <= dim; i += 4) {
+    uint32x4_t gt = vcgtq_f32(vld1q_f32(row + i), vdupq_n_f32(v[k - 1]));
+    uint32x2_t any = vorr_u32(vget_low_u32(gt), vget_high_u32(gt));
+    if (vget_lane_u32(vpmax_u32(any, any), 0) == 0) continue;
+    for (int32_t j = i; j < i + 4; ++j) {
+      InsertTopK(row[j], j, k, &n, v, idx);
+    }
+  }
+  for (; i < dim; ++i) InsertTopK(row[i], i, k, &n, v, idx);
+}
+
+#endif  // WENET_TOPK_NEON
+
+using TopKRowFunc = void (*)(const float* row, int dim, int k, float* v,
+                             int32_t* idx);
+
+TopKRowFunc SelectTopKRow() {
+#ifdef WENET_TOPK_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return TopKRowAvx2;
+#endif
+#ifdef WENET_TOPK_NEON
+  return TopKRowNeon;
+#endif
+  return TopKRowScalar;
+}
+
+}  // namespace
+
+void BatchTopK(const float* data, int num_rows, int dim, int k, float* values,
+               int32_t* indices) {
+  CHECK_LE(k, dim);
+  if (k <= 0) return;
+  static const TopKRowFunc top_k_row = SelectTopKRow();
+  for (int r = 0; r < num_rows; ++r) {
+    top_k_row(data + static_cast<size_t>(r) * dim, dim, k,
+              values + static_cast<size_t>(r) * k,
+              indices + static_cast<size_t>(r) * k);
+  }
+}
+
 }  // namespace wenet
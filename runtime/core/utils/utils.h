@@ -36,6 +36,15 @@ template <typename T>
 void TopK(const std::vector<T>& data, int32_t k, std::vector<T>* values,
           std::vector<int>* indices);
 
+// TopK of each row of the (num_rows x dim) row major `data` in one pass,
+// `values` and `indices` are (num_rows x k) row major and sorted in
+// descending order, k must be <= dim. The rows are scanned with SIMD
+// comparisons against the k-th best and there is no allocation, so it is
+// much cheaper than TopK for small k like the beam sizes. Among the equal
+// items, the one with the smaller index comes first.
+void BatchTopK(const float* data, int num_rows, int dim, int k, float* values,
+               int32_t* indices);
+
 }  // namespace wenet
 
 #endif  // UTILS_UTILS_H_
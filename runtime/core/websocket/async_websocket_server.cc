@@ -0,0 +1,477 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "websocket/async_websocket_server.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+#include "boost/asio/dispatch.hpp"
+#include "boost/asio/post.hpp"
+#include "boost/json.hpp"
+
+#include "utils/log.h"
+#include "utils/metrics.h"
+#include "utils/trace.h"
+#include "websocket/websocket_server.h"
+
+namespace wenet {
+
+namespace json = boost::json;
+
+AsyncConnectionHandler::AsyncConnectionHandler(tcp::socket&& socket,
+                                               AsyncWebSocketServer* server)
+    : ws_(std::move(socket)), server_(server) {}
+
+void AsyncConnectionHandler::Start() {
+  // Run on the strand of the connection, all the socket operations below
+  // are serialized by it
+  asio::dispatch(ws_.get_executor(), [self = shared_from_this()] {
+    self->ws_.next_layer().expires_after(std::chrono::seconds(30));
+    http::async_read(
+        self->ws_.next_layer(), self->buffer_, self->http_request_,
+        beast::bind_front_handler(&AsyncConnectionHandler::OnHttpRead, self));
+  });
+}
+
+void AsyncConnectionHandler::OnHttpRead(beast::error_code ec,
+                                        std::size_t bytes_transferred) {
+  if (ec) {
+    LOG(INFO) << "Read request failed: " << ec.message();
+    return;
+  }
+  buffer_.consume(buffer_.size());
+  if (websocket::is_upgrade(http_request_)) {
+    // The websocket stream has its own timeouts
+    ws_.next_layer().expires_never();
+    ws_.set_option(
+        websocket::stream_base::timeout::suggested(beast::role_type::server));
+    ws_.async_accept(http_request_, beast::bind_front_handler(
+                                        &AsyncConnectionHandler::OnAccept,
+                                        shared_from_this()));
+    return;
+  }
+  auto response = std::make_shared<http::response<http::string_body>>(
+      HandleHttpRequest(http_request_));
+  http::async_write(ws_.next_layer(), *response,
+                    [self = shared_from_this(), response](
+                        beast::error_code ec, std::size_t bytes_transferred) {
+                      self->ws_.next_layer().socket().shutdown(
+                          tcp::socket::shutdown_send, ec);
+                    });
+}
+
+void AsyncConnectionHandler::OnAccept(beast::error_code ec) {
+  if (ec) {
+    LOG(INFO) << "Accept failed: " << ec.message();
+    return;
+  }
+  ws_.text(true);
+  DoRead();
+}
+
+void AsyncConnectionHandler::DoRead() {
+  ws_.async_read(buffer_, beast::bind_front_handler(
+                              &AsyncConnectionHandler::OnRead,
+                              shared_from_this()));
+}
+
+void AsyncConnectionHandler::OnRead(beast::error_code ec,
+                                    std::size_t bytes_transferred) {
+  WENET_TRACE_SCOPE("AsyncWebSocket::OnRead");
+  if (ec) {
+    // This indicates that the session was closed
+    LOG(INFO) << ec.message();
+    OnSpeechEnd();
+    return;
+  }
+  if (ws_.got_text()) {
+    std::string message = beast::buffers_to_string(buffer_.data());
+    buffer_.consume(buffer_.size());
+    OnText(message);
+    if (got_end_tag_ || compiling_) {
+      return;
+    }
+  } else {
+    if (!got_start_tag_) {
+      OnError("Start signal is expected before binary data");
+    } else if (!stop_recognition_) {
+      OnSpeechData();
+    }
+    buffer_.consume(buffer_.size());
+  }
+  if (closed_ || stop_recognition_) {
+    return;
+  }
+  // Backpressure, do not read more data until the decoder catches up
+  if (feature_pipeline_ != nullptr &&
+      feature_pipeline_->NumQueuedFrames() >
+          server_->options().max_queued_frames) {
+    VLOG(1) << "Decoding is behind, pause reading";
+    read_paused_ = true;
+    return;
+  }
+  DoRead();
+}
+
+void AsyncConnectionHandler::OnText(const std::string& message) {
+  json::error_code ec;
+  json::value v = json::parse(message, ec);
+  if (ec || !v.is_object()) {
+    OnError("Wrong protocol");
+    return;
+  }
+  json::object obj = v.get_object();
+  if (obj.find("signal") == obj.end() || !obj["signal"].is_string()) {
+    OnError("Wrong message header");
+    return;
+  }
+  json::string signal = obj["signal"].as_string();
+  if (signal == "start") {
+    // The decoder of the session may be running in the decode threads
+    if (got_start_tag_ || compiling_) {
+      OnError("Session is already started");
+      return;
+    }
+    if (obj.find("nbest") != obj.end()) {
+      if (obj["nbest"].is_int64()) {
+        nbest_ = obj["nbest"].as_int64();
+      } else {
+        OnError("integer is expected for nbest option");
+      }
+    }
+    if (obj.find("continuous_decoding") != obj.end()) {
+      if (obj["continuous_decoding"].is_bool()) {
+        continuous_decoding_ = obj["continuous_decoding"].as_bool();
+      } else {
+        OnError(
+            "boolean true or false is expected for "
+            "continuous_decoding option");
+      }
+    }
+    std::string error = ParseHotwordOptions(obj, &hotwords_,
+                                            &hotwords_score_, &context_key_);
+    if (!error.empty()) {
+      OnError(error);
+      return;
+    }
+    OnSpeechStart();
+  } else if (signal == "end") {
+    OnSpeechEnd();
+  } else {
+    OnError("Unexpected signal type");
+  }
+}
+
+void AsyncConnectionHandler::OnSpeechStart() {
+  LOG(INFO) << "Received speech start signal, start reading speech";
+  if (hotwords_.empty()) {
+    std::string error;
+    auto resource = SessionResource(server_->decode_resource(), hotwords_,
+                                    hotwords_score_, &context_key_, &error);
+    StartSession(std::move(resource), error);
+    return;
+  }
+  // Compiling the hotwords may take long, do it off the io threads, and
+  // start the session back on the strand
+  compiling_ = true;
+  server_->context_pool()->enqueue(
+      [self = shared_from_this(), hotwords = hotwords_,
+       hotwords_score = hotwords_score_]() {
+        std::string context_key;
+        std::string error;
+        auto resource = SessionResource(self->server_->decode_resource(),
+                                        hotwords, hotwords_score,
+                                        &context_key, &error);
+        asio::post(self->ws_.get_executor(),
+                   [self, resource = std::move(resource),
+                    context_key = std::move(context_key),
+                    error = std::move(error)]() mutable {
+                     self->compiling_ = false;
+                     // The connection is gone during the compilation
+                     if (self->got_end_tag_ || self->closed_) return;
+                     self->context_key_ = std::move(context_key);
+                     self->StartSession(std::move(resource), error);
+                     if (!self->closed_ && !self->stop_recognition_) {
+                       self->DoRead();
+                     }
+                   });
+      });
+}
+
+void AsyncConnectionHandler::StartSession(
+    std::shared_ptr<DecodeResource> resource, const std::string& error) {
+  if (resource == nullptr) {
+    OnError(error);
+    return;
+  }
+  decode_config_ = server_->decode_config();
+  if (!AdmitSession(*resource, &admission_, &decode_config_)) {
+    OnError("Server is overloaded, please retry later");
+    return;
+  }
+  got_start_tag_ = true;
+  json::object rv = {{"status", "ok"}, {"type", "server_ready"}};
+  if (!context_key_.empty()) rv["context_key"] = context_key_;
+  Send(json::serialize(rv));
+  feature_pipeline_ =
+      std::make_shared<FeaturePipeline>(*server_->feature_config());
+  async_rescoring_ =
+      continuous_decoding_ && resource->rescoring_pool != nullptr;
+  decoder_ = std::make_shared<AsrDecoder>(feature_pipeline_, resource,
+                                          *decode_config_);
+  // The session holds the connection weakly, so a closed connection goes
+  // away even if its session is idle
+  std::weak_ptr<AsyncConnectionHandler> weak_self = shared_from_this();
+  decode_session_ = server_->decode_scheduler()->AddSession(
+      [weak_self]() {
+        auto self = weak_self.lock();
+        if (self == nullptr) return DecodeScheduler::StepState::kDone;
+        return self->DecodeStep();
+      },
+      [decoder = decoder_]() { return decoder->ReadyToDecode(); });
+}
+
+void AsyncConnectionHandler::OnSpeechEnd() {
+  if (got_end_tag_) return;
+  LOG(INFO) << "Received speech end signal";
+  got_end_tag_ = true;
+  if (feature_pipeline_ != nullptr) {
+    feature_pipeline_->set_input_finished();
+    NotifyDecode();
+  }
+}
+
+void AsyncConnectionHandler::OnSpeechData() {
+  // Read binary PCM data
+  int num_samples = buffer_.size() / sizeof(int16_t);
+  VLOG(2) << "Received " << num_samples << " samples";
+  const auto* pcm_data = static_cast<const int16_t*>(buffer_.data().data());
+  feature_pipeline_->AcceptWaveform(pcm_data, num_samples);
+  NotifyDecode();
+}
+
+void AsyncConnectionHandler::OnError(const std::string& message) {
+  json::value rv = {{"status", "failed"}, {"message", message}};
+  Send(json::serialize(rv), true);
+}
+
+void AsyncConnectionHandler::Send(std::string message, bool close) {
+  asio::post(ws_.get_executor(), [self = shared_from_this(),
+                                  message = std::move(message), close]() {
+    self->write_queue_.emplace_back(std::move(message), close);
+    // Only one async_write can be outstanding at a time
+    if (self->write_queue_.size() == 1) {
+      self->DoWrite();
+    }
+  });
+}
+
+void AsyncConnectionHandler::DoWrite() {
+  WENET_TRACE_SCOPE("AsyncWebSocket::Write");
+  if (closed_) {
+    write_queue_.clear();
+    return;
+  }
+  ws_.async_write(asio::buffer(write_queue_.front().first),
+                  beast::bind_front_handler(&AsyncConnectionHandler::OnWrite,
+                                            shared_from_this()));
+}
+
+void AsyncConnectionHandler::OnWrite(beast::error_code ec,
+                                     std::size_t bytes_transferred) {
+  if (ec) {
+    LOG(INFO) << "Write failed: " << ec.message();
+    closed_ = true;
+    write_queue_.clear();
+    return;
+  }
+  bool close = write_queue_.front().second;
+  write_queue_.pop_front();
+  if (close) {
+    closed_ = true;
+    write_queue_.clear();
+    ws_.async_close(websocket::close_code::normal,
+                    [self = shared_from_this()](beast::error_code ec) {});
+    return;
+  }
+  if (!write_queue_.empty()) {
+    DoWrite();
+  }
+}
+
+void AsyncConnectionHandler::NotifyDecode() {
+  if (decode_session_ == nullptr) return;
+  server_->decode_scheduler()->Notify(decode_session_);
+}
+
+DecodeScheduler::StepState AsyncConnectionHandler::DecodeStep() {
+  DecodeState state = DecodeState::kWaitFeats;
+  if (!stop_recognition_) {
+    try {
+      state = AdvanceDecoding();
+    } catch (std::exception const& e) {
+      LOG(ERROR) << e.what();
+      stop_recognition_ = true;
+      OnError(e.what());
+    }
+  }
+
+  // Resume reading if it is paused by backpressure
+  asio::post(ws_.get_executor(), [self = shared_from_this()]() {
+    if (self->read_paused_ && !self->closed_ && !self->stop_recognition_) {
+      self->read_paused_ = false;
+      self->DoRead();
+    }
+  });
+  if (stop_recognition_) return DecodeScheduler::StepState::kDone;
+  return state == DecodeState::kWaitFeats
+             ? DecodeScheduler::StepState::kWait
+             : DecodeScheduler::StepState::kMore;
+}
+
+DecodeState AsyncConnectionHandler::AdvanceDecoding() {
+  DecodeState state = decoder_->Decode(false);
+  if (state == DecodeState::kEndFeats) {
+    OnFinalResult();
+    OnFinish();
+    stop_recognition_ = true;
+  } else if (state == DecodeState::kEndpoint) {
+    OnFinalResult();
+    // If it's not continuous decoding, continue to do next recognition
+    // otherwise stop the recognition
+    if (continuous_decoding_) {
+      decoder_->ResetContinuousDecoding();
+    } else {
+      OnFinish();
+      stop_recognition_ = true;
+    }
+  } else if (state != DecodeState::kWaitFeats) {
+    if (decoder_->DecodedSomething()) {
+      json::value rv = {{"status", "ok"},
+                        {"type", "partial_result"},
+                        {"nbest", SerializeResult(false)}};
+      Send(json::serialize(rv));
+    }
+  }
+  return state;
+}
+
+void AsyncConnectionHandler::OnFinalResult() {
+  if (!async_rescoring_) {
+    decoder_->Rescoring();
+    json::value rv = {{"status", "ok"},
+                      {"type", "final_result"},
+                      {"nbest", SerializeResult(true)}};
+    Send(json::serialize(rv));
+    return;
+  }
+  // Send the CTC final result at once, and the rescored one when it's done,
+  // the decode thread goes on with the next segment
+  std::shared_ptr<RescoringTask> task = decoder_->DetachRescoring();
+  int segment = num_segments_++;
+  json::value rv = {{"status", "ok"},
+                    {"type", "final_result"},
+                    {"nbest", SerializeResult(true)},
+                    {"segment", segment}};
+  Send(json::serialize(rv));
+  Metrics::Global().rescoring_queue_depth.Add(1);
+  pending_rescoring_.fetch_add(1);
+  server_->decode_resource()->rescoring_pool->enqueue(
+      [self = shared_from_this(), task, segment]() {
+        Metrics::Global().rescoring_queue_depth.Add(-1);
+        try {
+          task->Run();
+          json::value rv = {
+              {"status", "ok"},
+              {"type", "rescored_final_result"},
+              {"nbest", SerializeDecodeResult(task->result(), self->nbest_,
+                                              true)},
+              {"segment", segment}};
+          self->Send(json::serialize(rv));
+        } catch (std::exception const& e) {
+          LOG(ERROR) << e.what();
+        }
+        self->OnFinish();
+      });
+}
+
+void AsyncConnectionHandler::OnFinish() {
+  // The last one of the session and its rescoring tasks sends it
+  if (pending_rescoring_.fetch_sub(1) != 1) return;
+  json::value end = {{"status", "ok"}, {"type", "speech_end"}};
+  Send(json::serialize(end), true);
+}
+
+std::string AsyncConnectionHandler::SerializeResult(bool finish) {
+  return SerializeDecodeResult(decoder_->result(), nbest_, finish);
+}
+
+AsyncWebSocketServer::AsyncWebSocketServer(
+    int port, const AsyncServerOptions& opts,
+    std::shared_ptr<FeaturePipelineConfig> feature_config,
+    std::shared_ptr<DecodeOptions> decode_config,
+    std::shared_ptr<DecodeResource> decode_resource)
+    : port_(port),
+      opts_(opts),
+      ioc_(opts.num_io_threads),
+      acceptor_(ioc_),
+      decode_scheduler_(new DecodeScheduler(
+          {opts.num_decode_threads, opts.pin_decode_threads})),
+      context_pool_(new ThreadPool(std::max(1, opts.num_context_threads))),
+      feature_config_(std::move(feature_config)),
+      decode_config_(std::move(decode_config)),
+      decode_resource_(std::move(decode_resource)) {}
+
+void AsyncWebSocketServer::Start() {
+  try {
+    auto const address = asio::ip::make_address("0.0.0.0");
+    tcp::endpoint endpoint{address, static_cast<uint16_t>(port_)};
+    acceptor_.open(endpoint.protocol());
+    acceptor_.set_option(asio::socket_base::reuse_address(true));
+    acceptor_.bind(endpoint);
+    acceptor_.listen(asio::socket_base::max_listen_connections);
+  } catch (const std::exception& e) {
+    LOG(FATAL) << e.what();
+  }
+  DoAccept();
+
+  std::vector<std::thread> threads;
+  for (int i = 1; i < opts_.num_io_threads; ++i) {
+    threads.emplace_back([this] { ioc_.run(); });
+  }
+  ioc_.run();
+  for (auto& t : threads) {
+    t.join();
+  }
+}
+
+void AsyncWebSocketServer::DoAccept() {
+  // Each connection gets its own strand
+  acceptor_.async_accept(
+      asio::make_strand(ioc_),
+      beast::bind_front_handler(&AsyncWebSocketServer::OnAccept, this));
+}
+
+void AsyncWebSocketServer::OnAccept(beast::error_code ec, tcp::socket socket) {
+  if (ec) {
+    LOG(WARNING) << "Accept failed: " << ec.message();
+  } else {
+    std::make_shared<AsyncConnectionHandler>(std::move(socket), this)->Start();
+  }
+  DoAccept();
+}
+
+}  // namespace wenet
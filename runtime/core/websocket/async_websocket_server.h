@@ -0,0 +1,199 @@
+// Copyright (c) 2023 Binbin Zhang (binbzha@qq.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef WEBSOCKET_ASYNC_WEBSOCKET_SERVER_H_
+#define WEBSOCKET_ASYNC_WEBSOCKET_SERVER_H_
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "boost/asio/ip/tcp.hpp"
+#include "boost/asio/strand.hpp"
+#include "boost/beast/core.hpp"
+#include "boost/beast/http.hpp"
+#include "boost/beast/websocket.hpp"
+
+#include "decoder/admission_controller.h"
+#include "decoder/asr_decoder.h"
+#include "decoder/decode_scheduler.h"
+#include "frontend/feature_pipeline.h"
+#include "utils/thread_pool.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+namespace beast = boost::beast;          // from <boost/beast.hpp>
+namespace http = beast::http;            // from <boost/beast/http.hpp>
+namespace websocket = beast::websocket;  // from <boost/beast/websocket.hpp>
+namespace asio = boost::asio;            // from <boost/asio.hpp>
+using tcp = boost::asio::ip::tcp;        // from <boost/asio/ip/tcp.hpp>
+
+struct AsyncServerOptions {
+  // Threads running the io_context, they only do network I/O
+  int num_io_threads = 1;
+  // Threads running the decoders of all the connections
+  int num_decode_threads = 4;
+  // Pin the decode threads to the cores, see DecodeScheduler
+  bool pin_decode_threads = false;
+  // Stop reading from a connection when it has more than this number of
+  // feature frames waiting for decoding, so a saturated decode pool pushes
+  // back on the clients by TCP flow control instead of buffering audio.
+  int max_queued_frames = 1000;
+  // Threads compiling the context graphs of the session hotwords, so a
+  // long hotword list doesn't block the io threads
+  int num_context_threads = 1;
+};
+
+class AsyncWebSocketServer;
+
+// One websocket connection. All the socket operations run on the strand of
+// the connection, and the decoding runs on the decode scheduler of the
+// server, one chunk at a time.
+class AsyncConnectionHandler
+    : public std::enable_shared_from_this<AsyncConnectionHandler> {
+ public:
+  AsyncConnectionHandler(tcp::socket&& socket, AsyncWebSocketServer* server);
+  void Start();
+
+ private:
+  // The HTTP request is the websocket handshake, or a plain request such as
+  // GET /metrics
+  void OnHttpRead(beast::error_code ec, std::size_t bytes_transferred);
+  void OnAccept(beast::error_code ec);
+  void DoRead();
+  void OnRead(beast::error_code ec, std::size_t bytes_transferred);
+  void OnText(const std::string& message);
+  void OnSpeechStart();
+  // Start the session of `resource` once its hotwords are compiled, it's
+  // rejected with `error` if `resource` is nullptr
+  void StartSession(std::shared_ptr<DecodeResource> resource,
+                    const std::string& error);
+  void OnSpeechEnd();
+  void OnSpeechData();
+  void OnError(const std::string& message);
+
+  // Queue a message to send, it can be called from any thread
+  void Send(std::string message, bool close = false);
+  void DoWrite();
+  void OnWrite(beast::error_code ec, std::size_t bytes_transferred);
+
+  // Tell the decode scheduler the input of this connection is updated, it
+  // can be called from any thread, see DecodeScheduler::Notify
+  void NotifyDecode();
+  // One step of the session on a decode thread, it decodes one chunk and
+  // asks to be run again while there are more
+  DecodeScheduler::StepState DecodeStep();
+  // Decode one chunk of the queued features, and send the result
+  DecodeState AdvanceDecoding();
+  // Send the final result of the segment, it's rescored in the rescoring
+  // pool of the resource if the session is decoded continuously, then the
+  // rescored final result is sent from there
+  void OnFinalResult();
+  // Called when the session or one of its rescoring tasks finishes, the
+  // last one sends speech_end and closes
+  void OnFinish();
+  std::string SerializeResult(bool finish);
+
+  websocket::stream<beast::tcp_stream> ws_;
+  AsyncWebSocketServer* server_;
+  beast::flat_buffer buffer_;
+  http::request<http::string_body> http_request_;
+  // Messages waiting to be written, only touched on the strand
+  std::deque<std::pair<std::string, bool>> write_queue_;
+  bool closed_ = false;
+  // Reading is paused by backpressure, only touched on the strand
+  bool read_paused_ = false;
+
+  bool continuous_decoding_ = false;
+  int nbest_ = 1;
+  // Hotwords of the session, or the cache key of the hotwords of a previous
+  // session, see SessionResource
+  std::vector<std::string> hotwords_;
+  float hotwords_score_ = 0;
+  std::string context_key_;
+  bool got_start_tag_ = false;
+  bool got_end_tag_ = false;
+  // The hotwords are being compiled in the context pool, reading is paused
+  // until the session starts, only touched on the strand
+  bool compiling_ = false;
+  std::atomic<bool> stop_recognition_{false};
+  // The decode options of the session, they may be degraded under load
+  std::shared_ptr<DecodeOptions> decode_config_ = nullptr;
+  // Counts the session in the admission control until it is destroyed,
+  // after the decoder
+  std::unique_ptr<AdmissionController::Ticket> admission_;
+  std::shared_ptr<FeaturePipeline> feature_pipeline_ = nullptr;
+  std::shared_ptr<AsrDecoder> decoder_ = nullptr;
+  std::shared_ptr<DecodeScheduler::Session> decode_session_ = nullptr;
+  bool async_rescoring_ = false;
+  int num_segments_ = 0;
+  // The rescoring tasks in flight, plus one until the session finishes,
+  // whoever brings it to 0 closes the connection
+  std::atomic<int> pending_rescoring_{1};
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(AsyncConnectionHandler);
+};
+
+// Event driven websocket server, the number of threads is fixed no matter
+// how many connections there are. The protocol is the same as WebSocketServer.
+class AsyncWebSocketServer {
+ public:
+  AsyncWebSocketServer(int port, const AsyncServerOptions& opts,
+                       std::shared_ptr<FeaturePipelineConfig> feature_config,
+                       std::shared_ptr<DecodeOptions> decode_config,
+                       std::shared_ptr<DecodeResource> decode_resource);
+
+  // Run the server, it blocks the calling thread
+  void Start();
+
+  const AsyncServerOptions& options() const { return opts_; }
+  std::shared_ptr<FeaturePipelineConfig> feature_config() const {
+    return feature_config_;
+  }
+  std::shared_ptr<DecodeOptions> decode_config() const {
+    return decode_config_;
+  }
+  std::shared_ptr<DecodeResource> decode_resource() const {
+    return decode_resource_;
+  }
+  DecodeScheduler* decode_scheduler() { return decode_scheduler_.get(); }
+  ThreadPool* context_pool() { return context_pool_.get(); }
+
+ private:
+  void DoAccept();
+  void OnAccept(beast::error_code ec, tcp::socket socket);
+
+  int port_;
+  AsyncServerOptions opts_;
+  asio::io_context ioc_;
+  tcp::acceptor acceptor_;
+  std::unique_ptr<DecodeScheduler> decode_scheduler_;
+  std::unique_ptr<ThreadPool> context_pool_;
+  std::shared_ptr<FeaturePipelineConfig> feature_config_;
+  std::shared_ptr<DecodeOptions> decode_config_;
+  std::shared_ptr<DecodeResource> decode_resource_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(AsyncWebSocketServer);
+};
+
+}  // namespace wenet
+
+#endif  // WEBSOCKET_ASYNC_WEBSOCKET_SERVER_H_
@@ -14,6 +14,8 @@
 
 #include "websocket/websocket_client.h"
 
+#include <utility>
+
 #include "boost/json/src.hpp"
 
 #include "utils/log.h"
@@ -27,8 +29,9 @@ namespace asio = boost::asio;            // from <boost/asio.hpp>
 using tcp = boost::asio::ip::tcp;        // from <boost/asio/ip/tcp.hpp>
 namespace json = boost::json;
 
-WebSocketClient::WebSocketClient(const std::string& hostname, int port)
-    : hostname_(hostname), port_(port) {
+WebSocketClient::WebSocketClient(const std::string& hostname, int port,
+                                 MessageCallback on_message)
+    : hostname_(hostname), port_(port), on_message_(std::move(on_message)) {
   Connect();
   t_.reset(new std::thread(&WebSocketClient::ReadLoopFunc, this));
 }
@@ -64,12 +67,18 @@ void WebSocketClient::ReadLoopFunc() {
       beast::flat_buffer buffer;
       ws_.read(buffer);
       std::string message = beast::buffers_to_string(buffer.data());
-      LOG(INFO) << message;
+      if (on_message_ == nullptr) {
+        LOG(INFO) << message;
+      }
       CHECK(ws_.got_text());
       json::object obj = json::parse(message).as_object();
       if (obj["status"] != "ok") {
+        if (on_message_ != nullptr) on_message_("error");
         break;
       }
+      if (on_message_ != nullptr) {
+        on_message_(std::string(obj["type"].as_string().c_str()));
+      }
       if (obj["type"] == "speech_end") {
         done_ = true;
         break;
@@ -79,9 +88,11 @@ void WebSocketClient::ReadLoopFunc() {
     // This indicates that the session was closed
     if (se.code() != websocket::error::closed) {
       LOG(ERROR) << se.code().message();
+      if (on_message_ != nullptr) on_message_("error");
     }
   } catch (std::exception const& e) {
     LOG(ERROR) << e.what();
+    if (on_message_ != nullptr) on_message_("error");
   }
 }
 
@@ -92,6 +103,16 @@ void WebSocketClient::SendStartSignal() {
   json::value start_tag = {{"signal", "start"},
                            {"nbest", nbest_},
                            {"continuous_decoding", continuous_decoding_}};
+  if (!hotwords_.empty()) {
+    json::array hotwords;
+    for (const auto& hotword : hotwords_) hotwords.emplace_back(hotword);
+    start_tag.as_object()["hotwords"] = hotwords;
+    if (hotwords_score_ > 0) {
+      start_tag.as_object()["hotwords_score"] = hotwords_score_;
+    }
+  } else if (!context_key_.empty()) {
+    start_tag.as_object()["context_key"] = context_key_;
+  }
   std::string start_message = json::serialize(start_tag);
   this->SendTextData(start_message);
 }
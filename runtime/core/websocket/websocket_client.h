@@ -15,10 +15,12 @@
 #ifndef WEBSOCKET_WEBSOCKET_CLIENT_H_
 #define WEBSOCKET_WEBSOCKET_CLIENT_H_
 
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "boost/asio/connect.hpp"
 #include "boost/asio/ip/tcp.hpp"
@@ -37,7 +39,13 @@ using tcp = boost::asio::ip::tcp;        // from <boost/asio/ip/tcp.hpp>
 
 class WebSocketClient {
  public:
-  WebSocketClient(const std::string& host, int port);
+  // Called from the read thread with the type of every message received,
+  // e.g. "partial_result", or "error" for a failure
+  using MessageCallback = std::function<void(const std::string& type)>;
+  // If `on_message` is set, the messages are passed to it instead of being
+  // logged
+  WebSocketClient(const std::string& host, int port,
+                  MessageCallback on_message = nullptr);
   int sample_rate_;
   void SendTextData(const std::string& data);
   void SendBinaryData(const void* data, size_t size);
@@ -51,6 +59,16 @@ class WebSocketClient {
   void set_continuous_decoding(bool continuous_decoding) {
     continuous_decoding_ = continuous_decoding;
   }
+  // Phrases to bias the session to, or the key of the compiled ones from
+  // the server_ready message of a previous session
+  void set_hotwords(const std::vector<std::string>& hotwords,
+                    float hotwords_score = 0) {
+    hotwords_ = hotwords;
+    hotwords_score_ = hotwords_score;
+  }
+  void set_context_key(const std::string& context_key) {
+    context_key_ = context_key;
+  }
   bool done() const { return done_; }
 
  private:
@@ -59,7 +77,11 @@ class WebSocketClient {
   int port_;
   int nbest_ = 1;
   bool continuous_decoding_ = false;
+  std::vector<std::string> hotwords_;
+  float hotwords_score_ = 0;
+  std::string context_key_;
   bool done_ = false;
+  MessageCallback on_message_;
   asio::io_context ioc_;
   websocket::stream<tcp::socket> ws_{ioc_};
   std::unique_ptr<std::thread> t_{nullptr};
@@ -14,12 +14,15 @@
 
 #include "websocket/websocket_server.h"
 
+#include <chrono>
 #include <thread>
 #include <utility>
 #include <vector>
 
 #include "boost/json/src.hpp"
 #include "utils/log.h"
+#include "utils/metrics.h"
+#include "utils/trace.h"
 
 namespace wenet {
 
@@ -37,16 +40,74 @@ ConnectionHandler::ConnectionHandler(
     : ws_(std::move(socket)),
       feature_config_(std::move(feature_config)),
       decode_config_(std::move(decode_config)),
-      decode_resource_(std::move(decode_resource)) {}
+      decode_resource_(std::move(decode_resource)),
+      write_mutex_(new std::mutex) {}
+
+std::string ParseHotwordOptions(const json::object& obj,
+                                std::vector<std::string>* hotwords,
+                                float* hotwords_score,
+                                std::string* context_key) {
+  auto it = obj.find("hotwords");
+  if (it != obj.end()) {
+    if (!it->value().is_array()) {
+      return "string array is expected for hotwords option";
+    }
+    for (const auto& hotword : it->value().get_array()) {
+      if (!hotword.is_string()) {
+        return "string array is expected for hotwords option";
+      }
+      hotwords->emplace_back(hotword.get_string().c_str());
+    }
+  }
+  it = obj.find("hotwords_score");
+  if (it != obj.end()) {
+    if (it->value().is_double()) {
+      *hotwords_score = it->value().get_double();
+    } else if (it->value().is_int64()) {
+      *hotwords_score = it->value().get_int64();
+    } else {
+      return "number is expected for hotwords_score option";
+    }
+  }
+  it = obj.find("context_key");
+  if (it != obj.end()) {
+    if (!it->value().is_string()) {
+      return "string is expected for context_key option";
+    }
+    *context_key = it->value().get_string().c_str();
+  }
+  return "";
+}
+
+void ConnectionHandler::WriteText(const std::string& message) {
+  // The decoding thread and the rescoring pool may write at the same time
+  std::lock_guard<std::mutex> lock(*write_mutex_);
+  WENET_TRACE_SCOPE("WebSocket::Write");
+  ws_.text(true);
+  ws_.write(asio::buffer(message));
+}
 
 void ConnectionHandler::OnSpeechStart() {
   LOG(INFO) << "Received speech start signal, start reading speech";
+  std::string error;
+  auto resource = SessionResource(decode_resource_, hotwords_,
+                                  hotwords_score_, &context_key_, &error);
+  if (resource == nullptr) {
+    OnError(error);
+    return;
+  }
+  if (!AdmitSession(*resource, &admission_, &decode_config_)) {
+    OnError("Server is overloaded, please retry later");
+    return;
+  }
   got_start_tag_ = true;
-  json::value rv = {{"status", "ok"}, {"type", "server_ready"}};
-  ws_.text(true);
-  ws_.write(asio::buffer(json::serialize(rv)));
+  json::object rv = {{"status", "ok"}, {"type", "server_ready"}};
+  if (!context_key_.empty()) rv["context_key"] = context_key_;
+  WriteText(json::serialize(rv));
+  async_rescoring_ =
+      continuous_decoding_ && resource->rescoring_pool != nullptr;
   feature_pipeline_ = std::make_shared<FeaturePipeline>(*feature_config_);
-  decoder_ = std::make_shared<AsrDecoder>(feature_pipeline_, decode_resource_,
+  decoder_ = std::make_shared<AsrDecoder>(feature_pipeline_, resource,
                                           *decode_config_);
   // Start decoder thread
   decode_thread_ =
@@ -65,23 +126,69 @@ void ConnectionHandler::OnPartialResult(const std::string& result) {
   LOG(INFO) << "Partial result: " << result;
   json::value rv = {
       {"status", "ok"}, {"type", "partial_result"}, {"nbest", result}};
-  ws_.text(true);
-  ws_.write(asio::buffer(json::serialize(rv)));
+  WriteText(json::serialize(rv));
 }
 
-void ConnectionHandler::OnFinalResult(const std::string& result) {
+void ConnectionHandler::OnFinalResult(const std::string& result,
+                                      int segment) {
   LOG(INFO) << "Final result: " << result;
-  json::value rv = {
+  VLOG(1) << "Session memory usage: " << decoder_->MemoryUsage() << " bytes";
+  json::object rv = {
       {"status", "ok"}, {"type", "final_result"}, {"nbest", result}};
-  ws_.text(true);
-  ws_.write(asio::buffer(json::serialize(rv)));
+  if (segment >= 0) rv.emplace("segment", segment);
+  WriteText(json::serialize(rv));
+}
+
+void ConnectionHandler::OnRescoredFinalResult(const std::string& result,
+                                              int segment) {
+  LOG(INFO) << "Rescored final result of segment " << segment << ": "
+            << result;
+  json::value rv = {{"status", "ok"},
+                    {"type", "rescored_final_result"},
+                    {"nbest", result},
+                    {"segment", segment}};
+  WriteText(json::serialize(rv));
 }
 
 void ConnectionHandler::OnFinish() {
   // Send finish tag
   json::value rv = {{"status", "ok"}, {"type", "speech_end"}};
-  ws_.text(true);
-  ws_.write(asio::buffer(json::serialize(rv)));
+  WriteText(json::serialize(rv));
+}
+
+void ConnectionHandler::RescoreAsync() {
+  // Send the CTC final result at once, and the rescored one when it's done
+  std::shared_ptr<RescoringTask> task = decoder_->DetachRescoring();
+  int segment = num_segments_++;
+  // A long stream has many segments, drop the finished ones
+  WaitRescoring(false);
+  Metrics::Global().rescoring_queue_depth.Add(1);
+  OnFinalResult(SerializeResult(true), segment);
+  pending_rescoring_.push_back(decode_resource_->rescoring_pool->enqueue(
+      [this, task, segment]() {
+        Metrics::Global().rescoring_queue_depth.Add(-1);
+        task->Run();
+        OnRescoredFinalResult(SerializeDecodeResult(task->result(), nbest_,
+                                                    true),
+                              segment);
+      }));
+}
+
+void ConnectionHandler::WaitRescoring(bool block) {
+  for (auto it = pending_rescoring_.begin();
+       it != pending_rescoring_.end();) {
+    if (!block &&
+        it->wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+      ++it;
+      continue;
+    }
+    try {
+      it->get();
+    } catch (std::exception const& e) {
+      LOG(ERROR) << e.what();
+    }
+    it = pending_rescoring_.erase(it);
+  }
 }
 
 void ConnectionHandler::OnSpeechData(const beast::flat_buffer& buffer) {
@@ -94,11 +201,14 @@ void ConnectionHandler::OnSpeechData(const beast::flat_buffer& buffer) {
   feature_pipeline_->AcceptWaveform(pcm_data, num_samples);
 }
 
-std::string ConnectionHandler::SerializeResult(bool finish) {
-  json::array nbest;
-  for (const DecodeResult& path : decoder_->result()) {
+std::string SerializeDecodeResult(const std::vector<DecodeResult>& results,
+                                  int nbest, bool finish) {
+  json::array jnbest;
+  for (const DecodeResult& path : results) {
     json::object jpath({{"sentence", path.sentence}});
-    if (finish) {
+    if (!finish) {
+      jpath.emplace("stable_sentence", path.stable_sentence);
+    } else {
       json::array word_pieces;
       for (const WordPiece& word_piece : path.word_pieces) {
         json::object jword_piece({{"word", word_piece.word},
@@ -108,13 +218,40 @@ std::string ConnectionHandler::SerializeResult(bool finish) {
       }
       jpath.emplace("word_pieces", word_pieces);
     }
-    nbest.emplace_back(jpath);
+    jnbest.emplace_back(jpath);
 
-    if (nbest.size() == nbest_) {
+    if (jnbest.size() == nbest) {
       break;
     }
   }
-  return json::serialize(nbest);
+  return json::serialize(jnbest);
+}
+
+http::response<http::string_body> HandleHttpRequest(
+    const http::request<http::string_body>& request) {
+  http::response<http::string_body> response;
+  response.version(request.version());
+  response.keep_alive(false);
+  if (request.method() == http::verb::get && request.target() == "/metrics") {
+    response.result(http::status::ok);
+    response.set(http::field::content_type, "text/plain; version=0.0.4");
+    response.body() = Metrics::Global().Export();
+  } else if (request.method() == http::verb::get &&
+             request.target() == "/trace") {
+    response.result(http::status::ok);
+    response.set(http::field::content_type, "application/json");
+    response.body() = ExportTrace();
+  } else {
+    response.result(http::status::not_found);
+    response.set(http::field::content_type, "text/plain");
+    response.body() = "Not found\n";
+  }
+  response.prepare_payload();
+  return response;
+}
+
+std::string ConnectionHandler::SerializeResult(bool finish) {
+  return SerializeDecodeResult(decoder_->result(), nbest_, finish);
 }
 
 void ConnectionHandler::DecodeThreadFunc() {
@@ -122,16 +259,25 @@ void ConnectionHandler::DecodeThreadFunc() {
     while (true) {
       DecodeState state = decoder_->Decode();
       if (state == DecodeState::kEndFeats) {
-        decoder_->Rescoring();
-        std::string result = SerializeResult(true);
-        OnFinalResult(result);
+        if (async_rescoring_) {
+          RescoreAsync();
+          WaitRescoring();
+        } else {
+          decoder_->Rescoring();
+          std::string result = SerializeResult(true);
+          OnFinalResult(result);
+        }
         OnFinish();
         stop_recognition_ = true;
         break;
       } else if (state == DecodeState::kEndpoint) {
-        decoder_->Rescoring();
-        std::string result = SerializeResult(true);
-        OnFinalResult(result);
+        if (async_rescoring_) {
+          RescoreAsync();
+        } else {
+          decoder_->Rescoring();
+          std::string result = SerializeResult(true);
+          OnFinalResult(result);
+        }
         // If it's not continuous decoding, continue to do next recognition
         // otherwise stop the recognition
         if (continuous_decoding_) {
@@ -151,12 +297,13 @@ void ConnectionHandler::DecodeThreadFunc() {
   } catch (std::exception const& e) {
     LOG(ERROR) << e.what();
   }
+  // The pending rescoring tasks refer to this handler
+  WaitRescoring();
 }
 
 void ConnectionHandler::OnError(const std::string& message) {
   json::value rv = {{"status", "failed"}, {"message", message}};
-  ws_.text(true);
-  ws_.write(asio::buffer(json::serialize(rv)));
+  WriteText(json::serialize(rv));
   // Close websocket
   ws_.close(websocket::close_code::normal);
 }
@@ -184,6 +331,13 @@ void ConnectionHandler::OnText(const std::string& message) {
                 "continuous_decoding option");
           }
         }
+        std::string error = ParseHotwordOptions(obj, &hotwords_,
+                                                &hotwords_score_,
+                                                &context_key_);
+        if (!error.empty()) {
+          OnError(error);
+          return;
+        }
         OnSpeechStart();
       } else if (signal == "end") {
         OnSpeechEnd();
@@ -200,13 +354,26 @@ void ConnectionHandler::OnText(const std::string& message) {
 
 void ConnectionHandler::operator()() {
   try {
+    // Read the HTTP request, it's the websocket handshake, or a plain
+    // request such as GET /metrics
+    beast::flat_buffer http_buffer;
+    http::request<http::string_body> request;
+    http::read(ws_.next_layer(), http_buffer, request);
+    if (!websocket::is_upgrade(request)) {
+      http::write(ws_.next_layer(), HandleHttpRequest(request));
+      ws_.next_layer().shutdown(tcp::socket::shutdown_send);
+      return;
+    }
     // Accept the websocket handshake
-    ws_.accept();
+    ws_.accept(request);
     for (;;) {
       // This buffer will hold the incoming message
       beast::flat_buffer buffer;
       // Read a message
-      ws_.read(buffer);
+      {
+        WENET_TRACE_SCOPE("WebSocket::Read");
+        ws_.read(buffer);
+      }
       if (ws_.got_text()) {
         std::string message = beast::buffers_to_string(buffer.data());
         LOG(INFO) << message;
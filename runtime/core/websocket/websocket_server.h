@@ -15,17 +15,23 @@
 #ifndef WEBSOCKET_WEBSOCKET_SERVER_H_
 #define WEBSOCKET_WEBSOCKET_SERVER_H_
 
+#include <future>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #include "boost/asio/connect.hpp"
 #include "boost/asio/ip/tcp.hpp"
 #include "boost/beast/core.hpp"
+#include "boost/beast/http.hpp"
 #include "boost/beast/websocket.hpp"
+#include "boost/json.hpp"
 
+#include "decoder/admission_controller.h"
 #include "decoder/asr_decoder.h"
 #include "frontend/feature_pipeline.h"
 #include "utils/log.h"
@@ -38,6 +44,25 @@ namespace websocket = beast::websocket;  // from <boost/beast/websocket.hpp>
 namespace asio = boost::asio;            // from <boost/asio.hpp>
 using tcp = boost::asio::ip::tcp;        // from <boost/asio/ip/tcp.hpp>
 
+// Serialize the top `nbest` results to the json string of the protocol,
+// word pieces are only included in final results.
+std::string SerializeDecodeResult(const std::vector<DecodeResult>& results,
+                                  int nbest, bool finish);
+
+// Read the hotword options of the start signal: "hotwords" (string array),
+// "hotwords_score" (number) and "context_key" (string), see SessionResource.
+// Return the error message, or an empty string if they are valid.
+std::string ParseHotwordOptions(const boost::json::object& obj,
+                                std::vector<std::string>* hotwords,
+                                float* hotwords_score,
+                                std::string* context_key);
+
+// Response to a plain HTTP request to the websocket port, GET /metrics gets
+// the metrics of the process in the Prometheus text format, and GET /trace
+// gets the Chrome trace of it, see utils/trace.h.
+http::response<http::string_body> HandleHttpRequest(
+    const http::request<http::string_body>& request);
+
 class ConnectionHandler {
  public:
   ConnectionHandler(tcp::socket&& socket,
@@ -54,12 +79,27 @@ class ConnectionHandler {
   void OnSpeechData(const beast::flat_buffer& buffer);
   void OnError(const std::string& message);
   void OnPartialResult(const std::string& result);
-  void OnFinalResult(const std::string& result);
+  // `segment` is the index of the segment in the asynchronous rescoring
+  // mode, or -1
+  void OnFinalResult(const std::string& result, int segment = -1);
+  void OnRescoredFinalResult(const std::string& result, int segment);
   void DecodeThreadFunc();
   std::string SerializeResult(bool finish);
+  void WriteText(const std::string& message);
+  // Send the CTC final result of the segment, and its rescoring runs in the
+  // rescoring pool of the resource, which sends the rescored final result
+  void RescoreAsync();
+  // Wait for the pending rescoring tasks, or only collect the finished ones
+  // if `block` is false
+  void WaitRescoring(bool block = true);
 
   bool continuous_decoding_ = false;
   int nbest_ = 1;
+  // Hotwords of the session, or the cache key of the hotwords of a previous
+  // session, see SessionResource
+  std::vector<std::string> hotwords_;
+  float hotwords_score_ = 0;
+  std::string context_key_;
   websocket::stream<tcp::socket> ws_;
   std::shared_ptr<FeaturePipelineConfig> feature_config_;
   std::shared_ptr<DecodeOptions> decode_config_;
@@ -69,9 +109,17 @@ class ConnectionHandler {
   bool got_end_tag_ = false;
   // When endpoint is detected, stop recognition, and stop receiving data.
   bool stop_recognition_ = false;
+  // Counts the session in the admission control until it is destroyed,
+  // after the decoder
+  std::unique_ptr<AdmissionController::Ticket> admission_;
   std::shared_ptr<FeaturePipeline> feature_pipeline_ = nullptr;
   std::shared_ptr<AsrDecoder> decoder_ = nullptr;
   std::shared_ptr<std::thread> decode_thread_ = nullptr;
+  // The handler is moved into its thread, so the mutex is held by pointer
+  std::unique_ptr<std::mutex> write_mutex_;
+  bool async_rescoring_ = false;
+  int num_segments_ = 0;
+  std::vector<std::future<void>> pending_rescoring_;
 };
 
 class WebSocketServer {